@@ -143,4 +143,5 @@ init_commands(void)
 	timelimit_init();
 	iunlink_init();
 	bmapinflate_init();
+	quotacheck_init();
 }
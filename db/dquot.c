@@ -17,6 +17,7 @@
 #include "init.h"
 #include "output.h"
 #include "dquot.h"
+#include "libfrog/idnames.h"
 
 static int	dquot_f(int argc, char **argv);
 static void	dquot_help(void);
@@ -169,8 +170,427 @@ xfs_dquot_set_crc(
 			 XFS_DQUOT_CRC_OFF);
 }
 
+/*
+ * Offline quota report.
+ *
+ * Read the quota files of an unmounted filesystem a whole extent at a time
+ * (up to QREPORT_READ_BYTES) instead of one dquot per quotactl, and print
+ * the used dquots in the same format as the xfs_quota report command.
+ * Names are looked up in a cache of the passwd, group and projid databases
+ * that is filled once.
+ */
+
+#define QREPORT_READ_BYTES	(1U << 20)
+
+#define QREPORT_BLOCKS		(1U << 0)
+#define QREPORT_INODES		(1U << 1)
+#define QREPORT_RTBLOCKS	(1U << 2)
+
+static int	quota_report_f(int argc, char **argv);
+static void	quota_report_help(void);
+
+static const cmdinfo_t	quota_report_cmd = {
+	"quota", NULL, quota_report_f, 0, -1, 0,
+	N_("[-bir] [-gpu] [-nN]"),
+	N_("report quota usage and limits from the quota files"),
+	quota_report_help,
+};
+
+static void
+quota_report_help(void)
+{
+	dbprintf(_(
+"\n"
+" Report used space and inodes, and quota limits, from the quota files of\n"
+" the filesystem.  The output is the same as for the xfs_quota report command,\n"
+" but the filesystem doesn't have to be mounted.\n"
+"\n"
+" -b -- report blocks-used information (default)\n"
+" -i -- report inodes-used information\n"
+" -r -- report realtime-blocks-used information\n"
+" -g -- report group quotas\n"
+" -p -- report project quotas\n"
+" -u -- report user quotas\n"
+"       (all quota types that are present by default)\n"
+" -n -- skip identifier-to-name translations, just report IDs\n"
+" -N -- suppress the header from the output\n"
+"\n"));
+}
+
+static const char *
+quota_report_grace(
+	time64_t		timer,
+	bool			over_hard)
+{
+	static char		buf[32];
+	time64_t		left;
+	unsigned int		days;
+
+	if (over_hard)
+		return _("[--none--]");
+	if (timer == 0)
+		return _("[--------]");
+
+	/* same rounding as the xfs_quota report */
+	left = timer - time(NULL);
+	if (left < 0)
+		left = 0;
+	if (left > 24 * 60 * 60)
+		left += 30;
+	days = left / (24 * 60 * 60);
+	left %= 24 * 60 * 60;
+	if (days || left == 0)
+		snprintf(buf, sizeof(buf), "[%u %s]", days,
+				days == 1 ? _("day") : _("days"));
+	else
+		snprintf(buf, sizeof(buf), "[%02u:%02u:%02u]",
+				(unsigned int)(left / 3600),
+				(unsigned int)(left / 60 % 60),
+				(unsigned int)(left % 60));
+	return buf;
+}
+
+static void
+quota_report_counts(
+	struct xfs_disk_dquot	*ddq,
+	uint64_t		count,
+	uint64_t		soft,
+	uint64_t		hard,
+	unsigned int		warns,
+	__be32			timer)
+{
+	dbprintf(" %10llu %10llu %10llu     %02d %9s",
+			(unsigned long long)count,
+			(unsigned long long)soft,
+			(unsigned long long)hard,
+			warns,
+			quota_report_grace(
+				libxfs_dquot_from_disk_ts(ddq, timer),
+				hard && count > hard));
+}
+
+/* Print one dquot, unless it has no usage and no limits. */
+static void
+quota_report_dquot(
+	struct xfs_disk_dquot	*ddq,
+	xfs_dqtype_t		type,
+	unsigned int		form,
+	bool			lookup)
+{
+	const char		*name = NULL;
+	uint32_t		id = be32_to_cpu(ddq->d_id);
+
+	if (!ddq->d_blk_hardlimit && !ddq->d_blk_softlimit &&
+	    !ddq->d_ino_hardlimit && !ddq->d_ino_softlimit &&
+	    !ddq->d_rtb_hardlimit && !ddq->d_rtb_softlimit &&
+	    !ddq->d_bcount && !ddq->d_icount && !ddq->d_rtbcount)
+		return;
+
+	if (lookup) {
+		if (type == XFS_DQTYPE_USER)
+			name = idnames_lookup(IDNAMES_USER, id);
+		else if (type == XFS_DQTYPE_GROUP)
+			name = idnames_lookup(IDNAMES_GROUP, id);
+		else
+			name = idnames_lookup(IDNAMES_PROJ, id);
+	}
+	if (name)
+		dbprintf("%-10s", name);
+	else
+		dbprintf("#%-9u", id);
+
+	/* block counts are reported in KiB */
+	if (form & QREPORT_BLOCKS)
+		quota_report_counts(ddq,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_bcount)) >> 1,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_blk_softlimit)) >> 1,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_blk_hardlimit)) >> 1,
+			be16_to_cpu(ddq->d_bwarns), ddq->d_btimer);
+	if (form & QREPORT_INODES)
+		quota_report_counts(ddq,
+			be64_to_cpu(ddq->d_icount),
+			be64_to_cpu(ddq->d_ino_softlimit),
+			be64_to_cpu(ddq->d_ino_hardlimit),
+			be16_to_cpu(ddq->d_iwarns), ddq->d_itimer);
+	if (form & QREPORT_RTBLOCKS)
+		quota_report_counts(ddq,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_rtbcount)) >> 1,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_rtb_softlimit)) >> 1,
+			XFS_FSB_TO_BB(mp, be64_to_cpu(ddq->d_rtb_hardlimit)) >> 1,
+			be16_to_cpu(ddq->d_rtbwarns), ddq->d_rtbtimer);
+	dbprintf("\n");
+}
+
+static void
+quota_report_header(
+	const char		*typename,
+	unsigned int		form)
+{
+	char			scratch[64];
+	int			i;
+
+	dbprintf(_("%s quota on %s (offline)\n"), typename, x.data.name);
+
+	dbprintf("%10s", "");
+	if (form & QREPORT_BLOCKS)
+		dbprintf("%20c %s %20c", ' ', _("Blocks"), ' ');
+	if (form & QREPORT_INODES)
+		dbprintf("%20c %s %20c", ' ', _("Inodes"), ' ');
+	if (form & QREPORT_RTBLOCKS)
+		dbprintf("%15c %s %15c", ' ', _("Realtime Blocks"), ' ');
+	dbprintf("\n");
+
+	snprintf(scratch, sizeof(scratch), "%s ID", typename);
+	dbprintf("%-10s ", scratch);
+	if (form & QREPORT_BLOCKS)
+		dbprintf(
+		_("      Used       Soft       Hard    Warn/Grace     "));
+	if (form & QREPORT_INODES)
+		dbprintf(
+		_("      Used       Soft       Hard    Warn/ Grace     "));
+	if (form & QREPORT_RTBLOCKS)
+		dbprintf(
+		_("      Used       Soft       Hard    Warn/Grace     "));
+	dbprintf("\n");
+
+	dbprintf("---------- ");
+	for (i = 0; i < 3; i++) {
+		if (!(form & (1U << i)))
+			continue;
+		dbprintf("%s ",
+		"--------------------------------------------------");
+	}
+	dbprintf("\n");
+}
+
+/*
+ * Report the dquots in @len quota file blocks with one read.  Each block is
+ * checked on its own, as the buffer verifier only copes with a single dquot
+ * cluster.  The read bypasses the buffer cache, so that the multi-block
+ * buffer does not shadow the single cluster buffers the dquot command reads.
+ */
+static int
+quota_report_extent(
+	xfs_dqtype_t		type,
+	unsigned int		form,
+	bool			lookup,
+	xfs_fileoff_t		startoff,
+	xfs_fsblock_t		startblock,
+	xfs_filblks_t		len,
+	unsigned long long	*bad)
+{
+	struct xfs_buf		*bp;
+	unsigned int		perblock;
+	xfs_filblks_t		b;
+	int			error;
+
+	error = -libxfs_buf_read_uncached(mp->m_ddev_targp,
+			XFS_FSB_TO_DADDR(mp, startblock),
+			XFS_FSB_TO_BB(mp, len), 0, &bp, NULL);
+	if (error)
+		return error;
+
+	perblock = libxfs_calc_dquots_per_chunk(XFS_FSB_TO_BB(mp, 1));
+	for (b = 0; b < len; b++) {
+		struct xfs_dqblk	*dqb;
+		xfs_dqid_t		id;
+		unsigned int		i;
+
+		dqb = bp->b_addr + XFS_FSB_TO_B(mp, b);
+		id = (startoff + b) * perblock;
+		for (i = 0; i < perblock; i++, dqb++, id++) {
+			/* never initialised */
+			if (!dqb->dd_diskdq.d_magic)
+				continue;
+			if ((xfs_has_crc(mp) &&
+			     !libxfs_verify_cksum((char *)dqb, sizeof(*dqb),
+						XFS_DQUOT_CRC_OFF)) ||
+			    libxfs_dquot_verify(mp, &dqb->dd_diskdq, id) ||
+			    (dqb->dd_diskdq.d_type & XFS_DQTYPE_REC_MASK) !=
+						type) {
+				(*bad)++;
+				continue;
+			}
+			quota_report_dquot(&dqb->dd_diskdq, type, form,
+					lookup);
+		}
+	}
+	libxfs_buf_relse(bp);
+	return 0;
+}
+
+static void
+quota_report_type(
+	xfs_dqtype_t		type,
+	unsigned int		form,
+	bool			lookup,
+	bool			header)
+{
+	struct xfs_iext_cursor	icur;
+	struct xfs_bmbt_irec	got;
+	struct xfs_inode	*ip;
+	struct xfs_ifork	*ifp;
+	const char		*typename;
+	xfs_filblks_t		max_len;
+	unsigned long long	bad = 0;
+	xfs_ino_t		ino;
+	uint16_t		chkd;
+	int			error;
+
+	switch (type) {
+	case XFS_DQTYPE_USER:
+		ino = mp->m_sb.sb_uquotino;
+		chkd = XFS_UQUOTA_CHKD;
+		typename = _("User");
+		break;
+	case XFS_DQTYPE_GROUP:
+		ino = mp->m_sb.sb_gquotino;
+		chkd = XFS_GQUOTA_CHKD;
+		typename = _("Group");
+		break;
+	default:
+		ino = mp->m_sb.sb_pquotino;
+		chkd = XFS_PQUOTA_CHKD;
+		typename = _("Project");
+		break;
+	}
+	if (ino == 0 || ino == NULLFSINO)
+		return;
+
+	if (!(mp->m_sb.sb_qflags & chkd))
+		dbprintf(
+_("%s quota counts have not been checked and may not be accurate\n"),
+				typename);
+
+	error = -libxfs_iget(mp, NULL, ino, 0, &ip);
+	if (!error)
+		error = -libxfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+	if (error) {
+		dbprintf(_("could not read %s quota inode %llu: %s\n"),
+				typename, (unsigned long long)ino,
+				strerror(error));
+		exitcode = 1;
+		return;
+	}
+
+	if (header)
+		quota_report_header(typename, form);
+
+	/* every dquot gets a name, so read the whole database up front */
+	if (lookup) {
+		if (type == XFS_DQTYPE_USER)
+			idnames_preload(IDNAMES_USER);
+		else if (type == XFS_DQTYPE_GROUP)
+			idnames_preload(IDNAMES_GROUP);
+		else
+			idnames_preload(IDNAMES_PROJ);
+	}
+
+	max_len = XFS_B_TO_FSBT(mp, QREPORT_READ_BYTES);
+	if (max_len == 0)
+		max_len = 1;
+	ifp = xfs_ifork_ptr(ip, XFS_DATA_FORK);
+	for_each_xfs_iext(ifp, &icur, &got) {
+		xfs_filblks_t	done, len;
+
+		if (isnullstartblock(got.br_startblock))
+			continue;
+
+		for (done = 0; done < got.br_blockcount; done += len) {
+			len = got.br_blockcount - done;
+			if (len > max_len)
+				len = max_len;
+			error = quota_report_extent(type, form, lookup,
+					got.br_startoff + done,
+					got.br_startblock + done, len, &bad);
+			if (error) {
+				dbprintf(
+_("could not read %s quota block %llu: %s\n"),
+					typename,
+					(unsigned long long)(got.br_startoff +
+							     done),
+					strerror(error));
+				exitcode = 1;
+			}
+		}
+	}
+	if (bad)
+		dbprintf(_("%llu %s dquots failed verification\n"),
+				(unsigned long long)bad, typename);
+	if (header)
+		dbprintf("\n");
+	libxfs_irele(ip);
+}
+
+static int
+quota_report_f(
+	int			argc,
+	char			**argv)
+{
+	unsigned int		form = 0;
+	unsigned int		types = 0;
+	bool			lookup = true;
+	bool			header = true;
+	int			c;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "bignNpru")) != EOF) {
+		switch (c) {
+		case 'b':
+			form |= QREPORT_BLOCKS;
+			break;
+		case 'i':
+			form |= QREPORT_INODES;
+			break;
+		case 'r':
+			form |= QREPORT_RTBLOCKS;
+			break;
+		case 'u':
+			types |= XFS_DQTYPE_USER;
+			break;
+		case 'g':
+			types |= XFS_DQTYPE_GROUP;
+			break;
+		case 'p':
+			types |= XFS_DQTYPE_PROJ;
+			break;
+		case 'n':
+			lookup = false;
+			break;
+		case 'N':
+			header = false;
+			break;
+		default:
+			quota_report_help();
+			return 0;
+		}
+	}
+	if (optind != argc) {
+		quota_report_help();
+		return 0;
+	}
+
+	if (!xfs_has_quota(mp)) {
+		dbprintf(_("quotas are not enabled on this filesystem\n"));
+		return 0;
+	}
+	if (!form)
+		form = QREPORT_BLOCKS;
+	if (!types)
+		types = XFS_DQTYPE_USER | XFS_DQTYPE_GROUP | XFS_DQTYPE_PROJ;
+
+	if (types & XFS_DQTYPE_USER)
+		quota_report_type(XFS_DQTYPE_USER, form, lookup, header);
+	if (types & XFS_DQTYPE_GROUP)
+		quota_report_type(XFS_DQTYPE_GROUP, form, lookup, header);
+	if (types & XFS_DQTYPE_PROJ)
+		quota_report_type(XFS_DQTYPE_PROJ, form, lookup, header);
+	return 0;
+}
+
 void
 dquot_init(void)
 {
 	add_command(&dquot_cmd);
+	add_command(&quota_report_cmd);
 }
@@ -28,16 +28,61 @@ struct xfs_mount	*mp;
 static struct xlog	xlog;
 xfs_agnumber_t		cur_agno = NULLAGNUMBER;
 struct libxfs_init	x;
+static bool		buf_stats;
+static unsigned int	buf_stats_interval;
+
+/* -o: options that aren't about the filesystem */
+enum {
+	O_BUF_STATS = 0,
+	O_BUF_STATS_INTERVAL,
+	O_MAX_OPTS,
+};
+
+static char		*o_opts[] = {
+	[O_BUF_STATS]		= "stats",
+	[O_BUF_STATS_INTERVAL]	= "stats_interval",
+	[O_MAX_OPTS]		= NULL,
+};
 
 static void
 usage(void)
 {
 	fprintf(stderr, _(
-		"Usage: %s [-ifFrxV] [-p prog] [-l logdev] [-c cmd]... device\n"
+		"Usage: %s [-ifFrxV] [-p prog] [-l logdev] [-o subopts] [-c cmd]... device\n"
 		), progname);
 	exit(1);
 }
 
+static void
+parse_o_opts(
+	char		*p)
+{
+	char		*val;
+
+	while (*p) {
+		switch (getsubopt(&p, o_opts, &val)) {
+		case O_BUF_STATS:
+			if (val)
+				usage();
+			buf_stats = true;
+			break;
+		case O_BUF_STATS_INTERVAL:
+			if (!val)
+				usage();
+			errno = 0;
+			buf_stats_interval = strtoul(val, NULL, 0);
+			if (errno || !buf_stats_interval) {
+				fprintf(stderr,
+	_("%s: invalid stats_interval %s\n"), progname, val);
+				exit(1);
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+}
+
 static void
 init(
 	int		argc,
@@ -54,7 +99,7 @@ init(
 	textdomain(PACKAGE);
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "c:fFip:rxVl:")) != EOF) {
+	while ((c = getopt(argc, argv, "c:fFip:rxVl:o:")) != EOF) {
 		switch (c) {
 		case 'c':
 			cmdline = xrealloc(cmdline, (ncmdline+1)*sizeof(char*));
@@ -78,6 +123,9 @@ init(
 		case 'l':
 			x.log.name = optarg;
 			break;
+		case 'o':
+			parse_o_opts(optarg);
+			break;
 		case 'x':
 			expert_mode = 1;
 			break;
@@ -94,6 +142,16 @@ init(
 	x.data.name = argv[optind];
 	x.flags |= LIBXFS_DIRECT;
 
+	if (buf_stats || buf_stats_interval) {
+		error = libxfs_buf_stats_enable(buf_stats_interval, stderr);
+		if (error) {
+			fprintf(stderr,
+	_("%s: cannot start buffer cache statistics: %s\n"),
+				progname, strerror(error));
+			exit(1);
+		}
+	}
+
 	x.bcache_flags = CACHE_MISCOMPARE_PURGE;
 	if (!libxfs_init(&x)) {
 		fputs(_("\nfatal error -- couldn't initialize XFS library\n"),
@@ -211,5 +269,11 @@ close_devices:
 	libxfs_umount(mp);
 	libxfs_destroy(&x);
 
+	if (buf_stats || buf_stats_interval) {
+		libxfs_buf_stats_disable();
+		if (buf_stats)
+			libxfs_buf_stats_report(stdout);
+	}
+
 	return exitcode;
 }
@@ -128,6 +128,205 @@ static const struct cmdinfo logformat_cmd = {
 	.help =		logformat_help,
 };
 
+/*
+ * Sum the per-AG counters into the superblock.  With lazy superblock
+ * counters the kernel only does this after it has recovered the log itself,
+ * so it has to be done here before the log is marked clean.  Returns 1 if
+ * an AGI still has unlinked inodes, which only the kernel can clean up.
+ */
+static int
+logreplay_sum_counters(
+	struct xfs_sb		*sb)
+{
+	struct xfs_buf		*bp;
+	struct xfs_agi		*agi;
+	struct xfs_agf		*agf;
+	uint64_t		icount = 0;
+	uint64_t		ifree = 0;
+	uint64_t		fdblocks = 0;
+	xfs_agnumber_t		agno;
+	int			i;
+	int			error;
+
+	for (agno = 0; agno < sb->sb_agcount; agno++) {
+		error = -libxfs_buf_read(mp->m_ddev_targp,
+				XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+				XFS_FSS_TO_BB(mp, 1), 0, &bp, &xfs_agi_buf_ops);
+		if (error)
+			return error;
+		agi = bp->b_addr;
+		for (i = 0; i < XFS_AGI_UNLINKED_BUCKETS; i++) {
+			if (agi->agi_unlinked[i] != cpu_to_be32(NULLAGINO)) {
+				libxfs_buf_relse(bp);
+				return 1;
+			}
+		}
+		icount += be32_to_cpu(agi->agi_count);
+		ifree += be32_to_cpu(agi->agi_freecount);
+		libxfs_buf_relse(bp);
+
+		error = -libxfs_buf_read(mp->m_ddev_targp,
+				XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+				XFS_FSS_TO_BB(mp, 1), 0, &bp, &xfs_agf_buf_ops);
+		if (error)
+			return error;
+		agf = bp->b_addr;
+		fdblocks += be32_to_cpu(agf->agf_freeblks) +
+			    be32_to_cpu(agf->agf_flcount) +
+			    be32_to_cpu(agf->agf_btreeblks);
+		libxfs_buf_relse(bp);
+	}
+
+	if (xfs_has_lazysbcount(mp)) {
+		sb->sb_icount = icount;
+		sb->sb_ifree = ifree;
+		sb->sb_fdblocks = fdblocks;
+	}
+	return 0;
+}
+
+static int
+logreplay_f(int argc, char **argv)
+{
+	struct xlog_replay_stats stats;
+	struct xfs_sb		sb;
+	struct xfs_buf		*bp;
+	xfs_daddr_t		head_blk;
+	xfs_daddr_t		tail_blk;
+	int			error;
+
+	if (x.flags & LIBXFS_ISREADONLY) {
+		dbprintf(_("%s started in read only mode, log replay disabled\n"),
+			progname);
+		return 0;
+	}
+
+	xlog_init(mp, mp->m_log);
+	error = xlog_find_tail(mp->m_log, &head_blk, &tail_blk);
+	if (error) {
+		dbprintf(_("could not find log head/tail\n"));
+		return 0;
+	}
+	if (head_blk == tail_blk) {
+		dbprintf(_("The log is clean, nothing to replay.\n"));
+		return 0;
+	}
+
+	error = xlog_replay_scan(mp->m_log, head_blk, tail_blk, &stats);
+	if (error) {
+		dbprintf(_("log replay failed - %d\n"), error);
+		return 0;
+	}
+	if (stats.nr_unfinished) {
+		xlog_replay_free();
+		dbprintf(_(
+"The log holds %llu unfinished intent items that only the kernel can\n"
+"complete; nothing was replayed.  Mount the filesystem to recover the log.\n"),
+			(unsigned long long)stats.nr_unfinished);
+		return 0;
+	}
+
+	error = xlog_replay(mp->m_log, head_blk, tail_blk);
+	if (error) {
+		dbprintf(_("log replay failed - %d\n"), error);
+		return 0;
+	}
+	dbprintf(_("replayed %llu transactions: %llu buffers, %llu inodes, "
+		   "%llu dquots, %llu inode chunks, %llu cancelled, "
+		   "%llu already on disk\n"),
+		(unsigned long long)stats.nr_trans,
+		(unsigned long long)stats.nr_buffers,
+		(unsigned long long)stats.nr_inodes,
+		(unsigned long long)stats.nr_dquots,
+		(unsigned long long)stats.nr_icreates,
+		(unsigned long long)stats.nr_cancelled,
+		(unsigned long long)stats.nr_skipped);
+
+	/*
+	 * Unfinished frees, reverse mapping updates and unlinked inodes need
+	 * the kernel (or repair) to finish recovery.  Replaying the log again
+	 * is harmless, so leave it dirty for them.
+	 */
+	if (stats.nr_intents) {
+		dbprintf(_(
+"%llu intent items were left unfinished; the log has been left dirty.\n"
+"Mount the filesystem or run xfs_repair to complete recovery.\n"),
+			(unsigned long long)stats.nr_intents);
+		return 0;
+	}
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, XFS_SB_DADDR,
+			XFS_FSS_TO_BB(mp, 1), 0, &bp, &xfs_sb_buf_ops);
+	if (error) {
+		dbprintf(_("cannot read superblock - %d\n"), error);
+		return 0;
+	}
+	libxfs_sb_from_disk(&sb, bp->b_addr);
+
+	error = logreplay_sum_counters(&sb);
+	if (error) {
+		libxfs_buf_relse(bp);
+		if (error > 0)
+			dbprintf(_(
+"Unlinked inodes remain after replay; the log has been left dirty.\n"
+"Mount the filesystem or run xfs_repair to complete recovery.\n"));
+		else
+			dbprintf(_("cannot read AG headers - %d\n"), -error);
+		return 0;
+	}
+	libxfs_sb_to_disk(bp->b_addr, &sb);
+	libxfs_buf_mark_dirty(bp);
+	libxfs_buf_relse(bp);
+	libxfs_bcache_flush(mp);
+
+	/* move the log cycle past every LSN the replay could have stamped */
+	error = -libxfs_log_clear(mp->m_logdev_targp, NULL,
+				 mp->m_log->l_logBBstart,
+				 mp->m_log->l_logBBsize,
+				 &sb.sb_uuid, xfs_has_logv2(mp) ? 2 : 1,
+				 sb.sb_logsunit, XLOG_FMT,
+				 mp->m_log->l_curr_cycle + 1, false);
+	if (error) {
+		dbprintf(_("error formatting log - %d\n"), error);
+		return 0;
+	}
+
+	if (sb.sb_dblocks != mp->m_sb.sb_dblocks ||
+	    sb.sb_agcount != mp->m_sb.sb_agcount ||
+	    sb.sb_rblocks != mp->m_sb.sb_rblocks)
+		dbprintf(_(
+"The log replay changed the filesystem geometry; restart xfs_db.\n"));
+	else
+		mp->m_sb = sb;
+	return 0;
+}
+
+static void
+logreplay_help(void)
+{
+	dbprintf(_(
+"\n"
+" The 'logreplay' command replays a dirty log into the filesystem and then\n"
+" clears the log, so that the filesystem can be examined or repaired without\n"
+" mounting it first.  If the log contains intents whose operations were not\n"
+" finished, or unlinked inodes remain afterwards, the log is left dirty so\n"
+" that a mount or xfs_repair can complete recovery.\n"
+"\n"
+	));
+}
+
+static const struct cmdinfo logreplay_cmd = {
+	.name =		"logreplay",
+	.altname =	NULL,
+	.cfunc =	logreplay_f,
+	.argmin =	0,
+	.argmax =	0,
+	.canpush =	0,
+	.args =		NULL,
+	.oneline =	N_("replay a dirty log"),
+	.help =		logreplay_help,
+};
+
 void
 logformat_init(void)
 {
@@ -135,6 +334,7 @@ logformat_init(void)
 		return;
 
 	add_command(&logformat_cmd);
+	add_command(&logreplay_cmd);
 }
 
 static void
@@ -0,0 +1,705 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs.h"
+#include "libfrog/platform.h"
+#include "libfrog/workqueue.h"
+#include "libfrog/qcount.h"
+#include "command.h"
+#include "io.h"
+#include "type.h"
+#include "fprint.h"
+#include "faddr.h"
+#include "field.h"
+#include "output.h"
+#include "init.h"
+#include "sb.h"
+
+/*
+ * Offline quotacheck.
+ *
+ * Recompute the block, realtime block and inode usage of every quota id on
+ * an unmounted filesystem and compare it with the dquots, optionally
+ * rewriting the dquot counters so that the next quota mount doesn't have to
+ * run quotacheck.  This is the same check that xfs_repair does in phase 7,
+ * without having to run the rest of repair.
+ *
+ * The inode btree of each AG is walked by a separate work item that reads
+ * whole inode clusters and charges each inode to its own partial usage
+ * table, so the scan needs no locking.  The partial tables are merged once
+ * all the AGs are done.
+ */
+
+/* Default grace period if the root dquot doesn't set one, as in the kernel. */
+#define QCHK_GRACE_DEFAULT	(7 * 24 * 60 * 60)
+
+/* This id has a dquot on disk. */
+#define QCHK_REC_ONDISK		(1U << 31)
+
+struct qchk_type {
+	xfs_dqtype_t		type;
+	const char		*name;
+	xfs_ino_t		ino;
+	uint16_t		chkd;
+	bool			active;
+
+	struct qcount		counts;
+
+	/* grace periods from the root dquot */
+	time64_t		btimelimit;
+	time64_t		itimelimit;
+	time64_t		rtbtimelimit;
+
+	uint64_t		mismatched;
+	uint64_t		missing;
+	bool			failed;
+};
+
+struct qchk_ctx {
+	struct qchk_type	types[3];
+	bool			repair;
+	bool			verbose;
+
+	pthread_mutex_t		lock;
+	int			error;
+};
+
+static void
+qchk_set_error(
+	struct qchk_ctx		*ctx,
+	int			error)
+{
+	pthread_mutex_lock(&ctx->lock);
+	if (!ctx->error)
+		ctx->error = error;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+/* Count the realtime blocks allocated to a file. */
+static int
+qchk_count_rtblocks(
+	xfs_ino_t		ino,
+	xfs_filblks_t		*count)
+{
+	struct xfs_iext_cursor	icur;
+	struct xfs_bmbt_irec	got;
+	struct xfs_inode	*ip;
+	int			error;
+
+	error = -libxfs_iget(mp, NULL, ino, 0, &ip);
+	if (error)
+		return error;
+
+	error = -libxfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+	if (!error) {
+		*count = 0;
+		for_each_xfs_iext(xfs_ifork_ptr(ip, XFS_DATA_FORK), &icur, &got)
+			if (!isnullstartblock(got.br_startblock))
+				*count += got.br_blockcount;
+	}
+	libxfs_irele(ip);
+	return error;
+}
+
+/* Charge an inode's blocks to its owners. */
+static int
+qchk_count_inode(
+	struct qchk_ctx		*ctx,
+	xfs_agnumber_t		agno,
+	xfs_ino_t		ino,
+	struct xfs_dinode	*dip)
+{
+	xfs_filblks_t		blocks, rtblks = 0;
+	uint32_t		ids[3];
+	int			i;
+	int			error;
+
+	/* Quota files are not included in quota counts. */
+	if (ino == mp->m_sb.sb_uquotino ||
+	    ino == mp->m_sb.sb_gquotino ||
+	    ino == mp->m_sb.sb_pquotino)
+		return 0;
+
+	if (!dip->di_mode) {
+		dbprintf(_("inode %llu is allocated but has no mode\n"),
+				(unsigned long long)ino);
+		return -EFSCORRUPTED;
+	}
+
+	blocks = be64_to_cpu(dip->di_nblocks);
+	if (dip->di_flags & cpu_to_be16(XFS_DIFLAG_REALTIME)) {
+		error = qchk_count_rtblocks(ino, &rtblks);
+		if (error) {
+			dbprintf(_("could not read inode %llu extents: %s\n"),
+					(unsigned long long)ino,
+					strerror(error));
+			return -error;
+		}
+		blocks -= rtblks;
+	}
+
+	ids[0] = be32_to_cpu(dip->di_uid);
+	ids[1] = be32_to_cpu(dip->di_gid);
+	ids[2] = 0;
+	if (dip->di_version > 1)
+		ids[2] = be16_to_cpu(dip->di_projid_lo) |
+			 ((uint32_t)be16_to_cpu(dip->di_projid_hi) << 16);
+
+	for (i = 0; i < 3; i++) {
+		if (!ctx->types[i].active)
+			continue;
+		error = qcount_add(&ctx->types[i].counts, agno, ids[i], blocks,
+				rtblks);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+struct qchk_ag {
+	struct qchk_ctx		*ctx;
+	xfs_agnumber_t		agno;
+};
+
+/* Read the clusters of an inode chunk and count the inodes in use. */
+static int
+qchk_inobt_rec(
+	struct xfs_btree_cur		*cur,
+	const union xfs_btree_rec	*rec,
+	void				*priv)
+{
+	struct qchk_ag			*ag = priv;
+	struct xfs_ino_geometry		*igeo = M_IGEO(mp);
+	struct xfs_inobt_rec_incore	irec;
+	unsigned int			ipc;
+	unsigned int			c, i;
+	int				error;
+
+	libxfs_inobt_btrec_to_irec(mp, rec, &irec);
+
+	ipc = min(igeo->inodes_per_cluster,
+			(unsigned int)XFS_INODES_PER_CHUNK);
+	for (c = 0; c < XFS_INODES_PER_CHUNK; c += ipc) {
+		struct xfs_buf	*bp;
+		xfs_agino_t	agino = irec.ir_startino + c;
+		xfs_agblock_t	agbno = XFS_AGINO_TO_AGBNO(mp, agino);
+		uint64_t	mask;
+
+		/* also skips the clusters in the holes of sparse chunks */
+		mask = ((ipc == 64 ? 0ULL : 1ULL << ipc) - 1) << c;
+		if (!(~irec.ir_free & mask))
+			continue;
+
+		error = -libxfs_buf_read(mp->m_ddev_targp,
+				XFS_AGB_TO_DADDR(mp, ag->agno, agbno),
+				XFS_FSB_TO_BB(mp, igeo->blocks_per_cluster), 0,
+				&bp, &xfs_inode_buf_ops);
+		if (error) {
+			dbprintf(_("could not read AG %u inode cluster %u: %s\n"),
+					ag->agno, agbno, strerror(error));
+			return -error;
+		}
+
+		for (i = c; i < c + ipc; i++, agino++) {
+			struct xfs_dinode	*dip;
+			unsigned int		off;
+
+			if (irec.ir_free & XFS_INOBT_MASK(i))
+				continue;
+
+			off = ((XFS_AGINO_TO_AGBNO(mp, agino) - agbno) <<
+					mp->m_sb.sb_blocklog) +
+			      (XFS_AGINO_TO_OFFSET(mp, agino) <<
+					mp->m_sb.sb_inodelog);
+			dip = xfs_buf_offset(bp, off);
+			error = qchk_count_inode(ag->ctx, ag->agno,
+					XFS_AGINO_TO_INO(mp, ag->agno, agino),
+					dip);
+			if (error)
+				break;
+		}
+		libxfs_buf_relse(bp);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+static void
+qchk_scan_ag(
+	struct workqueue	*wq,
+	uint32_t		agno,
+	void			*arg)
+{
+	struct qchk_ctx		*ctx = arg;
+	struct qchk_ag		ag = {
+		.ctx		= ctx,
+		.agno		= agno,
+	};
+	struct xfs_perag	*pag;
+	struct xfs_btree_cur	*cur;
+	struct xfs_buf		*agi_bp;
+	int			error;
+
+	pag = libxfs_perag_get(mp, agno);
+	error = -libxfs_ialloc_read_agi(pag, NULL, 0, &agi_bp);
+	if (error) {
+		dbprintf(_("could not read AGI %u: %s\n"), agno,
+				strerror(error));
+		goto out_pag;
+	}
+
+	cur = libxfs_inobt_init_cursor(pag, NULL, agi_bp);
+	error = -libxfs_btree_query_all(cur, qchk_inobt_rec, &ag);
+	libxfs_btree_del_cursor(cur, error);
+	libxfs_buf_relse(agi_bp);
+out_pag:
+	libxfs_perag_put(pag);
+	if (error)
+		qchk_set_error(ctx, error);
+}
+
+/* Work out when a soft limit grace period started now would expire. */
+static __be32
+qchk_timer(
+	struct xfs_disk_dquot	*ddq,
+	__be32			timer,
+	uint64_t		count,
+	__be64			softlimit,
+	__be64			hardlimit,
+	time64_t		timelimit)
+{
+	uint64_t		soft = be64_to_cpu(softlimit);
+	uint64_t		hard = be64_to_cpu(hardlimit);
+	time64_t		expiry;
+
+	if (!((soft && count > soft) || (hard && count > hard)))
+		return 0;
+	if (timer)
+		return timer;
+
+	expiry = time(NULL) + timelimit;
+	if (ddq->d_type & XFS_DQTYPE_BIGTIME)
+		return cpu_to_be32(xfs_dq_unix_to_bigtime(expiry));
+	return cpu_to_be32(min(expiry, XFS_DQ_LEGACY_EXPIRY_MAX));
+}
+
+/* Compare a dquot with the usage we counted, and fix it if asked to. */
+static bool
+qchk_check_dquot(
+	struct qchk_ctx		*ctx,
+	struct qchk_type	*t,
+	struct xfs_disk_dquot	*ddq,
+	xfs_dqid_t		id)
+{
+	struct qcount_rec	*rec;
+	struct qcount_rec	empty = { .id = id };
+
+	rec = qcount_lookup(&t->counts, id);
+	if (!rec)
+		rec = &empty;
+	rec->flags |= QCHK_REC_ONDISK;
+
+	if (be64_to_cpu(ddq->d_bcount) == rec->bcount &&
+	    be64_to_cpu(ddq->d_rtbcount) == rec->rtbcount &&
+	    be64_to_cpu(ddq->d_icount) == rec->icount)
+		return false;
+
+	t->mismatched++;
+	if (!ctx->repair || ctx->verbose)
+		dbprintf(
+_("%s quota id %u has bcount %llu rtbcount %llu icount %llu, expected %llu %llu %llu\n"),
+			t->name, id,
+			(unsigned long long)be64_to_cpu(ddq->d_bcount),
+			(unsigned long long)be64_to_cpu(ddq->d_rtbcount),
+			(unsigned long long)be64_to_cpu(ddq->d_icount),
+			(unsigned long long)rec->bcount,
+			(unsigned long long)rec->rtbcount,
+			(unsigned long long)rec->icount);
+	if (!ctx->repair)
+		return false;
+
+	ddq->d_bcount = cpu_to_be64(rec->bcount);
+	ddq->d_rtbcount = cpu_to_be64(rec->rtbcount);
+	ddq->d_icount = cpu_to_be64(rec->icount);
+
+	/* the root dquot's timers are the grace periods */
+	if (id == 0)
+		return true;
+	ddq->d_btimer = qchk_timer(ddq, ddq->d_btimer, rec->bcount,
+			ddq->d_blk_softlimit, ddq->d_blk_hardlimit,
+			t->btimelimit);
+	ddq->d_itimer = qchk_timer(ddq, ddq->d_itimer, rec->icount,
+			ddq->d_ino_softlimit, ddq->d_ino_hardlimit,
+			t->itimelimit);
+	ddq->d_rtbtimer = qchk_timer(ddq, ddq->d_rtbtimer, rec->rtbcount,
+			ddq->d_rtb_softlimit, ddq->d_rtb_hardlimit,
+			t->rtbtimelimit);
+	return true;
+}
+
+/* Check every dquot in one cluster of the quota file. */
+static int
+qchk_check_cluster(
+	struct qchk_ctx		*ctx,
+	struct qchk_type	*t,
+	xfs_fileoff_t		off,
+	xfs_fsblock_t		fsbno)
+{
+	struct xfs_buf		*bp;
+	struct xfs_dqblk	*dqb;
+	xfs_dqid_t		id;
+	unsigned int		perchunk;
+	unsigned int		i;
+	bool			dirty = false;
+	int			error;
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, XFS_FSB_TO_DADDR(mp, fsbno),
+			XFS_FSB_TO_BB(mp, XFS_DQUOT_CLUSTER_SIZE_FSB), 0, &bp,
+			&xfs_dquot_buf_ops);
+	if (error) {
+		dbprintf(_("could not read %s quota block %llu: %s\n"),
+				t->name, (unsigned long long)off,
+				strerror(error));
+		return error;
+	}
+
+	perchunk = libxfs_calc_dquots_per_chunk(
+			XFS_FSB_TO_BB(mp, XFS_DQUOT_CLUSTER_SIZE_FSB));
+	dqb = bp->b_addr;
+	id = off * perchunk;
+	for (i = 0; i < perchunk && id <= XFS_DQ_ID_MAX; i++, dqb++, id++) {
+		if (!qchk_check_dquot(ctx, t, &dqb->dd_diskdq, id))
+			continue;
+		if (xfs_has_crc(mp))
+			xfs_update_cksum((char *)dqb, sizeof(struct xfs_dqblk),
+					XFS_DQUOT_CRC_OFF);
+		dirty = true;
+	}
+
+	if (dirty) {
+		error = -libxfs_bwrite(bp);
+		if (error)
+			dbprintf(_("could not write %s quota block %llu: %s\n"),
+					t->name, (unsigned long long)off,
+					strerror(error));
+	}
+	libxfs_buf_relse(bp);
+	return error;
+}
+
+/* Read the grace periods from the root dquot. */
+static void
+qchk_load_timelimits(
+	struct qchk_type	*t,
+	struct xfs_inode	*ip)
+{
+	struct xfs_bmbt_irec	map;
+	struct xfs_buf		*bp;
+	struct xfs_disk_dquot	*ddq;
+	int			nmaps = 1;
+
+	t->btimelimit = QCHK_GRACE_DEFAULT;
+	t->itimelimit = QCHK_GRACE_DEFAULT;
+	t->rtbtimelimit = QCHK_GRACE_DEFAULT;
+
+	if (libxfs_bmapi_read(ip, 0, 1, &map, &nmaps, 0) ||
+	    map.br_startblock == HOLESTARTBLOCK)
+		return;
+	if (libxfs_buf_read(mp->m_ddev_targp,
+			XFS_FSB_TO_DADDR(mp, map.br_startblock),
+			XFS_FSB_TO_BB(mp, XFS_DQUOT_CLUSTER_SIZE_FSB), 0, &bp,
+			&xfs_dquot_buf_ops))
+		return;
+
+	ddq = bp->b_addr;
+	if (ddq->d_btimer)
+		t->btimelimit = be32_to_cpu(ddq->d_btimer);
+	if (ddq->d_itimer)
+		t->itimelimit = be32_to_cpu(ddq->d_itimer);
+	if (ddq->d_rtbtimer)
+		t->rtbtimelimit = be32_to_cpu(ddq->d_rtbtimer);
+	libxfs_buf_relse(bp);
+}
+
+/* Compare the counted usage with the dquots of one quota type. */
+static void
+qchk_check_type(
+	struct qchk_ctx		*ctx,
+	struct qchk_type	*t)
+{
+	struct xfs_iext_cursor	icur;
+	struct xfs_bmbt_irec	map;
+	struct xfs_inode	*ip;
+	xfs_fileoff_t		off;
+	uint64_t		i;
+	int			error;
+
+	error = -qcount_merge(&t->counts);
+	if (error) {
+		dbprintf(_("could not merge %s quota counts: %s\n"), t->name,
+				strerror(error));
+		t->failed = true;
+		return;
+	}
+
+	error = -libxfs_iget(mp, NULL, t->ino, 0, &ip);
+	if (!error)
+		error = -libxfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+	if (error) {
+		dbprintf(_("could not read %s quota inode %llu: %s\n"),
+				t->name, (unsigned long long)t->ino,
+				strerror(error));
+		t->failed = true;
+		return;
+	}
+
+	if (ctx->repair)
+		qchk_load_timelimits(t, ip);
+
+	for_each_xfs_iext(xfs_ifork_ptr(ip, XFS_DATA_FORK), &icur, &map) {
+		if (isnullstartblock(map.br_startblock))
+			continue;
+		for (off = 0; off < map.br_blockcount;
+		     off += XFS_DQUOT_CLUSTER_SIZE_FSB) {
+			if (qchk_check_cluster(ctx, t, map.br_startoff + off,
+					map.br_startblock + off))
+				t->failed = true;
+		}
+	}
+	libxfs_irele(ip);
+
+	/* Usage charged to ids that have no dquot on disk. */
+	for (i = 0; i < t->counts.nr_recs; i++) {
+		struct qcount_rec	*rec = &t->counts.recs[i];
+
+		if (rec->flags & QCHK_REC_ONDISK)
+			continue;
+		t->missing++;
+		dbprintf(
+_("%s quota id %u has no dquot (bcount %llu rtbcount %llu icount %llu)\n"),
+			t->name, rec->id,
+			(unsigned long long)rec->bcount,
+			(unsigned long long)rec->rtbcount,
+			(unsigned long long)rec->icount);
+	}
+}
+
+static int		quotacheck_f(int argc, char **argv);
+static void		quotacheck_help(void);
+
+static const cmdinfo_t	quotacheck_cmd = {
+	"quotacheck", NULL, quotacheck_f, 0, -1, 0,
+	N_("[-gpu] [-r] [-v]"),
+	N_("recompute quota usage and check it against the dquots"),
+	quotacheck_help,
+};
+
+static void
+quotacheck_help(void)
+{
+	dbprintf(_(
+"\n"
+" Recompute the space and inodes used by each quota id from the inodes of\n"
+" the filesystem, and check the counters in the dquots against it.\n"
+"\n"
+" -g -- check group quotas\n"
+" -p -- check project quotas\n"
+" -u -- check user quotas\n"
+"       (all quota types that are present by default)\n"
+" -r -- rewrite the counters that are wrong, and mark the quota types as\n"
+"       checked so that the kernel doesn't need to run quotacheck\n"
+" -v -- list the dquots that are rewritten\n"
+"\n"));
+}
+
+static int
+quotacheck_f(
+	int			argc,
+	char			**argv)
+{
+	struct qchk_ctx		ctx = {
+		.types = {
+			{ XFS_DQTYPE_USER, _("user"),
+			  mp->m_sb.sb_uquotino, XFS_UQUOTA_CHKD },
+			{ XFS_DQTYPE_GROUP, _("group"),
+			  mp->m_sb.sb_gquotino, XFS_GQUOTA_CHKD },
+			{ XFS_DQTYPE_PROJ, _("project"),
+			  mp->m_sb.sb_pquotino, XFS_PQUOTA_CHKD },
+		},
+	};
+	struct workqueue	wq;
+	unsigned int		types = 0;
+	unsigned int		nr_threads;
+	uint16_t		qflags;
+	xfs_agnumber_t		agno;
+	int			c, i;
+	int			error;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "gpruv")) != EOF) {
+		switch (c) {
+		case 'g':
+			types |= XFS_DQTYPE_GROUP;
+			break;
+		case 'p':
+			types |= XFS_DQTYPE_PROJ;
+			break;
+		case 'u':
+			types |= XFS_DQTYPE_USER;
+			break;
+		case 'r':
+			ctx.repair = true;
+			break;
+		case 'v':
+			ctx.verbose = true;
+			break;
+		default:
+			quotacheck_help();
+			return 0;
+		}
+	}
+	if (optind != argc) {
+		quotacheck_help();
+		return 0;
+	}
+	if (!types)
+		types = XFS_DQTYPE_USER | XFS_DQTYPE_GROUP | XFS_DQTYPE_PROJ;
+
+	if (!xfs_has_quota(mp)) {
+		dbprintf(_("quotas are not enabled on this filesystem\n"));
+		return 0;
+	}
+	if (ctx.repair) {
+		if (!expert_mode || (x.flags & LIBXFS_ISREADONLY)) {
+			dbprintf(
+_("%s: must be in expert mode and not read-only to rewrite dquots\n"),
+				progname);
+			exitcode = 1;
+			return 0;
+		}
+		if (!sb_logcheck()) {
+			exitcode = 1;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		struct qchk_type	*t = &ctx.types[i];
+
+		if (!(types & t->type) || t->ino == 0 || t->ino == NULLFSINO)
+			continue;
+		error = -qcount_init(&t->counts, mp->m_sb.sb_agcount);
+		if (error) {
+			dbprintf(_("could not set up quotacheck: %s\n"),
+					strerror(error));
+			exitcode = 1;
+			goto out_free;
+		}
+		t->active = true;
+	}
+	if (!ctx.types[0].active && !ctx.types[1].active &&
+	    !ctx.types[2].active) {
+		dbprintf(_("no quota files to check\n"));
+		return 0;
+	}
+
+	/* Count the usage of every AG, each into its own partial tables. */
+	pthread_mutex_init(&ctx.lock, NULL);
+	nr_threads = min((unsigned int)platform_nproc(),
+			(unsigned int)mp->m_sb.sb_agcount);
+	error = -workqueue_create(&wq, &ctx, nr_threads);
+	if (error) {
+		dbprintf(_("could not start quotacheck threads: %s\n"),
+				strerror(error));
+		exitcode = 1;
+		goto out_lock;
+	}
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		error = -workqueue_add(&wq, qchk_scan_ag, agno, &ctx);
+		if (error) {
+			qchk_set_error(&ctx, error);
+			break;
+		}
+	}
+	error = -workqueue_terminate(&wq);
+	if (error)
+		qchk_set_error(&ctx, error);
+	workqueue_destroy(&wq);
+
+	if (ctx.error) {
+		dbprintf(_("could not count quota usage: %s\n"),
+				strerror(ctx.error));
+		exitcode = 1;
+		goto out_lock;
+	}
+
+	qflags = mp->m_sb.sb_qflags;
+	for (i = 0; i < 3; i++) {
+		struct qchk_type	*t = &ctx.types[i];
+
+		if (!t->active)
+			continue;
+		qchk_check_type(&ctx, t);
+
+		if (t->failed || t->missing) {
+			/* let the kernel sort it out at the next mount */
+			qflags &= ~t->chkd;
+			exitcode = 1;
+		} else if (ctx.repair) {
+			qflags |= t->chkd;
+		} else if (t->mismatched) {
+			exitcode = 1;
+		}
+
+		if (ctx.repair)
+			dbprintf(_("%s quota: %llu ids in use, %llu dquots rewritten\n"),
+					t->name,
+					(unsigned long long)t->counts.nr_recs,
+					(unsigned long long)t->mismatched);
+		else
+			dbprintf(_("%s quota: %llu ids in use, %llu dquots wrong\n"),
+					t->name,
+					(unsigned long long)t->counts.nr_recs,
+					(unsigned long long)t->mismatched);
+	}
+
+	if (ctx.repair && qflags != mp->m_sb.sb_qflags) {
+		struct xfs_buf	*bp = libxfs_getsb(mp);
+
+		if (!bp) {
+			dbprintf(_("could not read superblock\n"));
+			exitcode = 1;
+			goto out_lock;
+		}
+		if (qflags & ~mp->m_sb.sb_qflags & XFS_ALL_QUOTA_CHKD)
+			dbprintf(_("marking quota types as checked\n"));
+		else
+			dbprintf(
+_("quota usage will be recomputed at the next quota mount\n"));
+		mp->m_sb.sb_qflags = qflags;
+		libxfs_sb_to_disk(bp->b_addr, &mp->m_sb);
+		error = -libxfs_bwrite(bp);
+		if (error) {
+			dbprintf(_("could not write superblock: %s\n"),
+					strerror(error));
+			exitcode = 1;
+		}
+		libxfs_buf_relse(bp);
+	}
+
+out_lock:
+	pthread_mutex_destroy(&ctx.lock);
+out_free:
+	for (i = 0; i < 3; i++)
+		qcount_free(&ctx.types[i].counts);
+	return 0;
+}
+
+void
+quotacheck_init(void)
+{
+	add_command(&quotacheck_cmd);
+}
@@ -208,10 +208,10 @@ get_sb(xfs_agnumber_t agno, xfs_sb_t *sb)
 	return 1;
 }
 
-/* workaround craziness in the xlog routines */
+/* the logreplay command drives replay through the xlog routines */
 int xlog_recover_do_trans(struct xlog *log, struct xlog_recover *t, int p)
 {
-	return 0;
+	return xlog_replay_trans(log, t, p);
 }
 
 int
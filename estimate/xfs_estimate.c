@@ -11,7 +11,15 @@
  */
 #include "libxfs.h"
 #include <sys/stat.h>
-#include <ftw.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#ifndef STATX_TYPE
+# include <linux/stat.h>
+#endif
+#include "libfrog/fsgeom.h"
+#include "libfrog/bulkstat.h"
+#include "libfrog/workqueue.h"
+#include "libfrog/ptvar.h"
 
 static unsigned long long
 cvtnum(char *s)
@@ -33,8 +41,6 @@ cvtnum(char *s)
 	return 0LL;
 }
 
-int ffn(const char *, const struct stat *, int, struct FTW *);
-
 #define BLOCKSIZE	4096
 #define INODESIZE	256
 #define PERDIRENTRY	\
@@ -43,20 +49,61 @@ int ffn(const char *, const struct stat *, int, struct FTW *);
 
 #define FBLOCKS(n)	((n)/blocksize)
 
-static unsigned long long dirsize=0;		/* bytes */
+char *progname;
+
 static unsigned long long logsize=LOGSIZE*BLOCKSIZE;	/* bytes */
-static unsigned long long fullblocks=0;	/* FS blocks */
-static unsigned long long isize=0;		/* inodes bytes */
 static unsigned long long blocksize=BLOCKSIZE;
-static unsigned long long nslinks=0;		/* number of symbolic links */
-static unsigned long long nfiles=0;		/* number of regular files */
-static unsigned long long ndirs=0;		/* number of directories */
-static unsigned long long nspecial=0;		/* number of special files */
 static unsigned long long verbose=0;		/* verbose mode TRUE/FALSE */
 
 static int __debug = 0;
 static int ilog = 0;
 static  int elog = 0;
+static int dirclassflag = 0;
+static int walkflag = 0;
+static unsigned int nr_threads;
+
+/*
+ * Directories on the new filesystem, by the format their entries would need.
+ */
+enum dirclass {
+	DIRCLASS_SHORTFORM,	/* entries fit in the inode */
+	DIRCLASS_BLOCK,		/* one directory block */
+	DIRCLASS_LEAF,		/* data blocks and one leaf block */
+	DIRCLASS_NODE,		/* data, leaf, node and freespace blocks */
+	DIRCLASS_NR,
+};
+
+static const char *dirclass_names[DIRCLASS_NR] = {
+	[DIRCLASS_SHORTFORM]	= "shortform",
+	[DIRCLASS_BLOCK]	= "block",
+	[DIRCLASS_LEAF]		= "leaf",
+	[DIRCLASS_NODE]		= "node",
+};
+
+struct dirclass_count {
+	unsigned long long	dirs;
+	unsigned long long	entries;
+	unsigned long long	blocks;		/* FS blocks */
+};
+
+struct estimate {
+	unsigned long long	dirsize;	/* bytes */
+	unsigned long long	fullblocks;	/* FS blocks */
+	unsigned long long	isize;		/* inodes bytes */
+	unsigned long long	nslinks;	/* number of symbolic links */
+	unsigned long long	nfiles;		/* number of regular files */
+	unsigned long long	ndirs;		/* number of directories */
+	unsigned long long	nspecial;	/* number of special files */
+	struct dirclass_count	dirclass[DIRCLASS_NR];
+};
+
+/* v5 directory geometry, for the directory size classes */
+#define DIR3_HDR_SIZE		64	/* data, leaf and node block headers */
+#define DIR_DOT_ENTRIES		2
+#define DIR_DATA_ENTSIZE(n)	roundup((n) + 12, 8)	/* ino, len, ftype, tag */
+#define DIR_SF_ENTSIZE(n)	((n) + 8)	/* len, offset, ftype, ino */
+#define DIR_LEAF_ENTSIZE	8
+#define DIR_AVG_NAMELEN		12	/* guess when we only know the size */
 
 static void
 usage(char *progname)
@@ -66,6 +113,9 @@ usage(char *progname)
 		"\t-b blocksize (fundamental filesystem blocksize)\n"
 		"\t-i logsize (internal log size)\n"
 		"\t-e logsize (external log size)\n"
+		"\t-j threads (walk this many directories at once)\n"
+		"\t-s prints the directory overhead by size class\n"
+		"\t-w always walk the tree, even from the root of an XFS filesystem\n"
 		"\t-v prints more verbose messages\n"
 		"\t-V prints version and exits\n"
 		"\t-h prints this usage message\n\n"
@@ -75,20 +125,509 @@ usage(char *progname)
 	exit(1);
 }
 
+/*
+ * Work out which format a directory with this many entries would take on
+ * the new filesystem and how many blocks it would need beyond its inode.
+ */
+static void
+add_dirclass(
+	struct estimate		*est,
+	unsigned long long	entries,
+	unsigned long long	namebytes)
+{
+	unsigned long long	sfsize, datasize, blocks;
+	unsigned long long	leaves, dblocks, nodes;
+	unsigned long long	bsize = blocksize - DIR3_HDR_SIZE;
+	enum dirclass		class;
+
+	sfsize = 6 + entries * DIR_SF_ENTSIZE(0) + namebytes;
+	datasize = DIR_DOT_ENTRIES * DIR_DATA_ENTSIZE(2);
+	if (entries)
+		datasize += entries *
+				DIR_DATA_ENTSIZE((namebytes + entries - 1) /
+						 entries);
+	leaves = (entries + DIR_DOT_ENTRIES) * DIR_LEAF_ENTSIZE;
+	dblocks = howmany(datasize, bsize);
+
+	if (sfsize <= INODESIZE - sizeof(struct xfs_dinode)) {
+		class = DIRCLASS_SHORTFORM;
+		blocks = 0;
+	} else if (datasize + leaves + 8 <= bsize) {
+		class = DIRCLASS_BLOCK;
+		blocks = 1;
+	} else if (leaves + dblocks * 2 + 4 <= bsize) {
+		class = DIRCLASS_LEAF;
+		blocks = dblocks + 1;
+	} else {
+		class = DIRCLASS_NODE;
+		nodes = howmany(leaves, bsize);
+		blocks = dblocks + nodes +
+			 howmany(nodes * 8, bsize) +	/* da btree nodes */
+			 howmany(dblocks * 2, bsize);	/* freespace blocks */
+	}
+
+	est->dirclass[class].dirs++;
+	est->dirclass[class].entries += entries;
+	est->dirclass[class].blocks += blocks;
+}
+
+/*
+ * Account for one inode and the directory entry pointing to it.  The entry
+ * is charged for its name only, whether the name is known or guessed; used
+ * is the number of bytes the source filesystem has allocated to the file.
+ */
+static void
+add_entry(
+	struct estimate		*est,
+	size_t			namelen,
+	mode_t			mode,
+	unsigned long long	size,
+	unsigned long long	used)
+{
+	/* cases are in most-encountered to least-encountered order */
+	est->dirsize+=PERDIRENTRY+namelen;
+	est->isize+=INODESIZE;
+	switch (S_IFMT & mode) {
+	case S_IFREG:			/* regular files */
+		est->fullblocks+=FBLOCKS(used + blocksize-1);
+		if (used < size)
+			est->fullblocks++;	/* add one bmap block here */
+		est->nfiles++;
+		break;
+	case S_IFLNK:			/* symbolic links */
+		if (size >= (INODESIZE - (sizeof(struct xfs_dinode)+4)))
+			est->fullblocks+=FBLOCKS(size + blocksize-1);
+		est->nslinks++;
+		break;
+	case S_IFDIR:			/* directories */
+		est->dirsize+=blocksize;	/* fudge upwards */
+		if (size >= blocksize)
+			est->dirsize+=blocksize;
+		est->ndirs++;
+		break;
+	case S_IFIFO:			/* named pipes */
+	case S_IFCHR:			/* Character Special device */
+	case S_IFBLK:			/* Block Special device */
+	case S_IFSOCK:			/* socket */
+		est->nspecial++;
+		break;
+	}
+}
+
+static void
+sum_estimate(
+	struct estimate		*dest,
+	const struct estimate	*src)
+{
+	int			i;
+
+	dest->dirsize += src->dirsize;
+	dest->fullblocks += src->fullblocks;
+	dest->isize += src->isize;
+	dest->nslinks += src->nslinks;
+	dest->nfiles += src->nfiles;
+	dest->ndirs += src->ndirs;
+	dest->nspecial += src->nspecial;
+	for (i = 0; i < DIRCLASS_NR; i++) {
+		dest->dirclass[i].dirs += src->dirclass[i].dirs;
+		dest->dirclass[i].entries += src->dirclass[i].entries;
+		dest->dirclass[i].blocks += src->dirclass[i].blocks;
+	}
+}
+
+/*
+ * Parallel directory tree walk.  Each directory is a work item; the worker
+ * reads it with big getdents64 calls, statx()es its entries for only the
+ * fields we need, and queues its subdirectories.  Counters are per-thread
+ * and added up at the end.
+ */
+#define DIRBUF_SIZE	(1024 * 1024)
+#define STATX_MASK	(STATX_TYPE | STATX_SIZE | STATX_BLOCKS)
+#define STATX_FLAGS	(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | \
+			 AT_STATX_DONT_SYNC)
+
+struct est_dirent64 {
+	uint64_t		d_ino;
+	int64_t			d_off;
+	unsigned short		d_reclen;
+	unsigned char		d_type;
+	char			d_name[];
+};
+
+struct walk_thread {
+	struct estimate		est;
+	char			*dirbuf;
+};
+
+struct walk_tree {
+	struct ptvar		*threads;
+	unsigned int		nr_dirs;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	uint32_t		dev_major;
+	uint32_t		dev_minor;
+	bool			aborted;
+};
+
+struct walk_dir {
+	struct walk_tree	*wt;
+	char			*path;
+};
+
+static void walk_dir(struct workqueue *wq, uint32_t index, void *arg);
+
+static int
+queue_dir(
+	struct walk_tree	*wt,
+	struct workqueue	*wq,
+	const char		*path)
+{
+	struct walk_dir		*wd;
+
+	wd = malloc(sizeof(struct walk_dir));
+	if (!wd)
+		return errno;
+	wd->path = strdup(path);
+	if (!wd->path) {
+		free(wd);
+		return errno;
+	}
+	wd->wt = wt;
+
+	pthread_mutex_lock(&wt->lock);
+	wt->nr_dirs++;
+	pthread_mutex_unlock(&wt->lock);
+	if (workqueue_add(wq, walk_dir, 0, wd))
+		walk_dir(wq, 0, wd);
+	return 0;
+}
+
+static inline int
+est_statx(
+	int			dirfd,
+	const char		*path,
+	struct statx		*stx)
+{
+	return syscall(__NR_statx, dirfd, path, STATX_FLAGS, STATX_MASK, stx);
+}
+
+static mode_t
+dtype_to_mode(
+	unsigned char		d_type)
+{
+	switch (d_type) {
+	case DT_FIFO:	return S_IFIFO;
+	case DT_CHR:	return S_IFCHR;
+	case DT_BLK:	return S_IFBLK;
+	case DT_SOCK:	return S_IFSOCK;
+	}
+	return 0;
+}
+
+static void
+walk_dir(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct walk_dir		*wd = arg;
+	struct walk_tree	*wt = wd->wt;
+	struct walk_thread	*wth;
+	struct est_dirent64	*de;
+	struct statx		stx;
+	char			newpath[PATH_MAX];
+	unsigned long long	entries = 0;
+	unsigned long long	namebytes = 0;
+	size_t			pathlen = strlen(wd->path);
+	size_t			namelen;
+	mode_t			mode;
+	long			nr = 0, off;
+	int			fd;
+	int			error;
+
+	wth = ptvar_get(wt->threads, &error);
+	if (error) {
+		errno = error;
+		perror("ptvar_get");
+		wt->aborted = true;
+		goto out;
+	}
+	if (!wth->dirbuf) {
+		wth->dirbuf = malloc(DIRBUF_SIZE);
+		if (!wth->dirbuf) {
+			perror(wd->path);
+			wt->aborted = true;
+			goto out;
+		}
+	}
+
+	fd = open(wd->path, O_RDONLY | O_DIRECTORY | O_NOATIME | O_NOFOLLOW);
+	if (fd < 0 && errno == EPERM)
+		fd = open(wd->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (fd < 0) {
+		perror(wd->path);
+		goto out;
+	}
+
+	while (!wt->aborted &&
+	       (nr = syscall(SYS_getdents64, fd, wth->dirbuf,
+				DIRBUF_SIZE)) > 0) {
+		for (off = 0; off < nr; off += de->d_reclen) {
+			de = (struct est_dirent64 *)(wth->dirbuf + off);
+			if (!strcmp(de->d_name, ".") ||
+			    !strcmp(de->d_name, ".."))
+				continue;
+
+			namelen = strlen(de->d_name);
+			entries++;
+			namebytes += namelen;
+			if (pathlen + namelen + 2 > PATH_MAX) {
+				fprintf(stderr, _("%s/%s: %s\n"), wd->path,
+						de->d_name,
+						strerror(ENAMETOOLONG));
+				continue;
+			}
+
+			/* Special files have no size; skip the statx. */
+			mode = dtype_to_mode(de->d_type);
+			if (mode) {
+				add_entry(&wth->est, namelen, mode, 0, 0);
+				continue;
+			}
+
+			if (est_statx(fd, de->d_name, &stx)) {
+				fprintf(stderr, "%s/%s: %s\n", wd->path,
+						de->d_name, strerror(errno));
+				continue;
+			}
+
+			/* Don't cross mount points. */
+			if (stx.stx_dev_major != wt->dev_major ||
+			    stx.stx_dev_minor != wt->dev_minor)
+				continue;
+
+			add_entry(&wth->est, namelen, stx.stx_mode,
+					stx.stx_size, stx.stx_blocks * 512);
+			if (!S_ISDIR(stx.stx_mode))
+				continue;
+
+			snprintf(newpath, PATH_MAX, "%s/%s", wd->path,
+					de->d_name);
+			error = queue_dir(wt, wq, newpath);
+			if (error) {
+				fprintf(stderr, "%s: %s\n", newpath,
+						strerror(error));
+				wt->aborted = true;
+				break;
+			}
+		}
+	}
+	if (nr < 0)
+		perror(wd->path);
+	close(fd);
+
+	add_dirclass(&wth->est, entries, namebytes);
+out:
+	pthread_mutex_lock(&wt->lock);
+	if (--wt->nr_dirs == 0)
+		pthread_cond_signal(&wt->wakeup);
+	pthread_mutex_unlock(&wt->lock);
+	free(wd->path);
+	free(wd);
+}
+
+static int
+collect_thread(
+	struct ptvar		*ptv,
+	void			*data,
+	void			*foreach_arg)
+{
+	struct walk_thread	*wth = data;
+
+	sum_estimate(foreach_arg, &wth->est);
+	free(wth->dirbuf);
+	return 0;
+}
+
+static int
+walk_tree(
+	const char		*path,
+	struct estimate		*est)
+{
+	struct workqueue	wq;
+	struct walk_tree	wt = { };
+	struct walk_thread	root = { };
+	struct statx		stx;
+	const char		*name;
+	int			error;
+
+	if (est_statx(AT_FDCWD, path, &stx)) {
+		perror(path);
+		return errno;
+	}
+	name = strrchr(path, '/');
+	add_entry(est, strlen(name ? name + 1 : path), stx.stx_mode,
+			stx.stx_size, stx.stx_blocks * 512);
+	if (!S_ISDIR(stx.stx_mode))
+		return 0;
+
+	wt.dev_major = stx.stx_dev_major;
+	wt.dev_minor = stx.stx_dev_minor;
+	pthread_mutex_init(&wt.lock, NULL);
+	pthread_cond_init(&wt.wakeup, NULL);
+
+	/* one more for the main thread, if it has to do the work itself */
+	error = -ptvar_alloc(nr_threads + 1, sizeof(struct walk_thread), NULL,
+			&wt.threads);
+	if (error)
+		goto out_lock;
+	error = -workqueue_create(&wq, NULL, nr_threads);
+	if (error)
+		goto out_ptvar;
+
+	error = queue_dir(&wt, &wq, path);
+	if (!error) {
+		pthread_mutex_lock(&wt.lock);
+		while (wt.nr_dirs > 0)
+			pthread_cond_wait(&wt.wakeup, &wt.lock);
+		pthread_mutex_unlock(&wt.lock);
+	}
+
+	if (!error)
+		error = -workqueue_terminate(&wq);
+	workqueue_destroy(&wq);
+	ptvar_foreach(wt.threads, collect_thread, &root.est);
+	sum_estimate(est, &root.est);
+	if (!error && wt.aborted)
+		error = ECANCELED;
+out_ptvar:
+	ptvar_free(wt.threads);
+out_lock:
+	pthread_cond_destroy(&wt.wakeup);
+	pthread_mutex_destroy(&wt.lock);
+	if (error)
+		fprintf(stderr, "%s: %s\n", path, strerror(error));
+	return error;
+}
+
+/*
+ * If we've been pointed at the root of an XFS filesystem, we can bulkstat
+ * every inode instead of walking the paths to them.  We don't get the names,
+ * so guess the directory entries from the link counts and directory sizes.
+ * Returns EOPNOTSUPP if the caller should walk the tree instead.
+ */
+static int
+scan_bulkstat(
+	const char		*path,
+	struct estimate		*est)
+{
+	struct xfs_fd		xfd = XFS_FD_INIT_EMPTY;
+	struct xfs_bulkstat_req	*breq;
+	struct xfs_bulkstat	*bs;
+	struct stat		sb, psb;
+	unsigned long long	entries, dirbytes;
+	char			parent[PATH_MAX];
+	uint32_t		i;
+	int			error;
+
+	snprintf(parent, PATH_MAX, "%s/..", path);
+	if (stat(path, &sb) || stat(parent, &psb) || !S_ISDIR(sb.st_mode))
+		return EOPNOTSUPP;
+	if (sb.st_dev == psb.st_dev && sb.st_ino != psb.st_ino)
+		return EOPNOTSUPP;	/* not a mount point */
+
+	xfd.fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (xfd.fd < 0)
+		return EOPNOTSUPP;
+	if (!platform_test_xfs_fd(xfd.fd) || xfd_prepare_geometry(&xfd)) {
+		error = EOPNOTSUPP;
+		goto out_close;
+	}
+
+	error = -xfrog_bulkstat_alloc_req(4096, 0, &breq);
+	if (error)
+		goto out_close;
+
+	while ((error = -xfrog_bulkstat(&xfd, breq)) == 0 &&
+	       breq->hdr.ocount > 0) {
+		for (i = 0, bs = breq->bulkstat; i < breq->hdr.ocount;
+		     i++, bs++) {
+			/* Every link is a directory entry somewhere. */
+			add_entry(est, DIR_AVG_NAMELEN, bs->bs_mode,
+					bs->bs_size,
+					bs->bs_blocks * bs->bs_blksize);
+			if (!S_ISDIR(bs->bs_mode)) {
+				if (bs->bs_nlink > 1)
+					est->dirsize += (bs->bs_nlink - 1) *
+						(PERDIRENTRY + DIR_AVG_NAMELEN);
+				continue;
+			}
+
+			/*
+			 * The directory's size on the source is the size of
+			 * its inline entries or of its data blocks; turn
+			 * that back into a number of entries.  A single
+			 * block directory always reports one block, so guess
+			 * that it's half full.
+			 */
+			dirbytes = bs->bs_size;
+			if (dirbytes < xfd.fsgeom.blocksize)
+				entries = dirbytes > 6 ? (dirbytes - 6) /
+					DIR_SF_ENTSIZE(DIR_AVG_NAMELEN) : 0;
+			else if (dirbytes == xfd.fsgeom.blocksize)
+				entries = (dirbytes - DIR3_HDR_SIZE) / 2 /
+					(DIR_DATA_ENTSIZE(DIR_AVG_NAMELEN) +
+					 DIR_LEAF_ENTSIZE);
+			else
+				entries = dirbytes /
+					DIR_DATA_ENTSIZE(DIR_AVG_NAMELEN);
+			add_dirclass(est, entries, entries * DIR_AVG_NAMELEN);
+		}
+	}
+	free(breq);
+	/* Not allowed to bulkstat?  Walk the tree then. */
+	if (error == EPERM)
+		error = EOPNOTSUPP;
+	else if (error)
+		fprintf(stderr, _("%s: bulkstat: %s\n"), path,
+				strerror(error));
+out_close:
+	xfd_close(&xfd);
+	return error;
+}
+
+static void
+print_dirclasses(
+	const struct estimate	*est)
+{
+	int			i;
+
+	printf(_("dir class        dirs    entries     blocks    megabytes\n"));
+	for (i = 0; i < DIRCLASS_NR; i++)
+		printf("%-9s  %10llu %10llu %10llu %10.1fMB\n",
+			dirclass_names[i], est->dirclass[i].dirs,
+			est->dirclass[i].entries, est->dirclass[i].blocks,
+			(double)est->dirclass[i].blocks * blocksize /
+				(1024.0 * 1024.0));
+}
+
 int
 main(int argc, char **argv)
 {
+	struct estimate estimate;
 	unsigned long long est;
 	extern int optind;
 	extern char *optarg;
 	char dname[40];
 	int c;
 
+	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 
-	while ((c = getopt (argc, argv, "b:hdve:i:V")) != EOF) {
+	nr_threads = platform_nproc();
+	while ((c = getopt (argc, argv, "b:hde:i:j:svwV")) != EOF) {
 		switch (c) {
 		case 'b':
 			blocksize=cvtnum(optarg);
@@ -121,9 +660,23 @@ main(int argc, char **argv)
 			logsize=cvtnum(optarg);
 			elog++;
 			break;
+		case 'j':
+			nr_threads=cvtnum(optarg);
+			if (nr_threads == 0) {
+				fprintf(stderr, _("bad thread count %s\n"),
+					optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 's':
+			dirclassflag = 1;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
+		case 'w':
+			walkflag = 1;
+			break;
 		case 'd':
 			__debug++;
 			break;
@@ -147,32 +700,30 @@ main(int argc, char **argv)
 		printf(_("directory                               bsize   blocks    megabytes    logsize\n"));
 
 	for ( ; optind < argc; optind++) {
-		dirsize=0LL;		/* bytes */
-		fullblocks=0LL;		/* FS blocks */
-		isize=0LL;		/* inodes bytes */
-		nslinks=0LL;		/* number of symbolic links */
-		nfiles=0LL;		/* number of regular files */
-		ndirs=0LL;		/* number of directories */
-		nspecial=0LL;		/* number of special files */
+		memset(&estimate, 0, sizeof(estimate));
 
-		nftw(argv[optind], ffn, 40, FTW_PHYS | FTW_MOUNT);
+		if (walkflag ||
+		    scan_bulkstat(argv[optind], &estimate) == EOPNOTSUPP) {
+			memset(&estimate, 0, sizeof(estimate));
+			walk_tree(argv[optind], &estimate);
+		}
 
 		if (__debug) {
-			printf(_("dirsize=%llu\n"), dirsize);
-			printf(_("fullblocks=%llu\n"), fullblocks);
-			printf(_("isize=%llu\n"), isize);
-
-			printf(_("%llu regular files\n"), nfiles);
-			printf(_("%llu symbolic links\n"), nslinks);
-			printf(_("%llu directories\n"), ndirs);
-			printf(_("%llu special files\n"), nspecial);
+			printf(_("dirsize=%llu\n"), estimate.dirsize);
+			printf(_("fullblocks=%llu\n"), estimate.fullblocks);
+			printf(_("isize=%llu\n"), estimate.isize);
+
+			printf(_("%llu regular files\n"), estimate.nfiles);
+			printf(_("%llu symbolic links\n"), estimate.nslinks);
+			printf(_("%llu directories\n"), estimate.ndirs);
+			printf(_("%llu special files\n"), estimate.nspecial);
 		}
 
-		est = FBLOCKS(isize) + 8	/* blocks for inodes */
-			+ FBLOCKS(dirsize) + 1	/* blocks for directories */
-			+ fullblocks  		/* blocks for file contents */
+		est = FBLOCKS(estimate.isize) + 8	/* blocks for inodes */
+			+ FBLOCKS(estimate.dirsize) + 1	/* blocks for directories */
+			+ estimate.fullblocks	/* blocks for file contents */
 			+ (8 * 16)	/* fudge for overhead blks (per ag) */
-			+ FBLOCKS(isize / INODESIZE); /* 1 byte/inode for map */
+			+ FBLOCKS(estimate.isize / INODESIZE); /* 1 byte/inode for map */
 
 		if (ilog)
 			est += (logsize / blocksize);
@@ -196,40 +747,9 @@ main(int argc, char **argv)
 			printf(_("or about %.1f megabytes\n"),
 			(double)logsize/(1024.0*1024.0));
 		}
-	}
-	return 0;
-}
 
-int
-ffn(const char *path, const struct stat *stb, int flags, struct FTW *f)
-{
-	/* cases are in most-encountered to least-encountered order */
-	dirsize+=PERDIRENTRY+strlen(path);
-	isize+=INODESIZE;
-	switch (S_IFMT & stb->st_mode) {
-	case S_IFREG:			/* regular files */
-		fullblocks+=FBLOCKS(stb->st_blocks * 512 + blocksize-1);
-		if (stb->st_blocks * 512 < stb->st_size)
-			fullblocks++;	/* add one bmap block here */
-		nfiles++;
-		break;
-	case S_IFLNK:			/* symbolic links */
-		if (stb->st_size >= (INODESIZE - (sizeof(struct xfs_dinode)+4)))
-			fullblocks+=FBLOCKS(stb->st_size + blocksize-1);
-		nslinks++;
-		break;
-	case S_IFDIR:			/* directories */
-		dirsize+=blocksize;	/* fudge upwards */
-		if (stb->st_size >= blocksize)
-			dirsize+=blocksize;
-		ndirs++;
-		break;
-	case S_IFIFO:			/* named pipes */
-	case S_IFCHR:			/* Character Special device */
-	case S_IFBLK:			/* Block Special device */
-	case S_IFSOCK:			/* socket */
-		nspecial++;
-		break;
+		if (dirclassflag)
+			print_dirclasses(&estimate);
 	}
 	return 0;
 }
@@ -13,16 +13,22 @@
 #include "libfrog/paths.h"
 #include "libfrog/fsgeom.h"
 #include "libfrog/bulkstat.h"
+#include "libfrog/workqueue.h"
+#include "libfrog/convert.h"
+#include "libfrog/file_exchange.h"
 
 #include <fcntl.h>
 #include <errno.h>
+#include <linux/fsmap.h>
 #include <syslog.h>
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/statvfs.h>
 #include <sys/xattr.h>
+#include <sys/syscall.h>
 #include <paths.h>
+#include <pthread.h>
 
 #define _PATH_FSRLAST		"/var/tmp/.fsrlast_xfs"
 #define _PATH_PROC_MOUNTS	"/proc/mounts"
@@ -40,9 +46,8 @@ static int argv_blksz_dio;
 extern int max_ext_size;
 static int npasses = 10;
 static int startpass = 0;
+static unsigned int nr_workers = 0;	/* parallel AG workers, 0 = serial */
 
-static struct getbmap  *outmap = NULL;
-static int		outmap_size = 0;
 static int		RealUid;
 static int		tmp_agi;
 static int64_t		minimumfree = 2048;
@@ -63,26 +68,117 @@ static time_t starttime;
 static xfs_ino_t	leftoffino = 0;
 static int	pagesize;
 
+/*
+ * Per-AG checkpoints for parallel mode.  leftoff_aginos is indexed by AG and
+ * records the last inode examined in each AG during this run; the ckpt array
+ * holds the checkpoints read back in from the leftoff file.
+ */
+struct fsr_agckpt {
+	xfs_agnumber_t	agno;
+	xfs_ino_t	ino;
+};
+static xfs_ino_t		*leftoff_aginos;
+static xfs_agnumber_t		leftoff_agcount;
+static struct fsr_agckpt	*startckpts;
+static unsigned int		nr_startckpts;
+
+/*
+ * Shared I/O budget for all defrag threads.  Each I/O reserves a slice of
+ * time on a virtual clock and waits until its slice comes up.
+ */
+static uint64_t		bw_limit;	/* bytes per second, 0 = unlimited */
+static uint64_t		iops_limit;	/* I/Os per second, 0 = unlimited */
+static uint64_t		throttle_next;	/* ns, CLOCK_MONOTONIC */
+static pthread_mutex_t	throttle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Defragment files larger than this one window at a time; 0 = whole files */
+static uint64_t		window_size;
+
+/*
+ * Free space index built from GETFSMAP.  For each AG we keep the number of
+ * free blocks and the lengths of the longest free extents, which is enough to
+ * guess how few extents a file could be laid out in and which AG to put it
+ * in.  Space handed out to tmp files is subtracted as we go, and an AG is
+ * rescanned when a file is about to be put there and its entry has got old.
+ */
+#define FREESP_NR_LONGEST	16
+#define FREESP_NR_RECS		128
+#define FREESP_MAX_AGE		30	/* seconds */
+
+struct fsr_agfree {
+	time_t		stamp;		/* when we last tried to scan this AG */
+	uint64_t	freeblks;
+	unsigned int	nr;
+	xfs_extlen_t	longest[FREESP_NR_LONGEST];	/* descending */
+};
+static struct fsr_agfree	*freesp;
+static struct xfs_fd		*freesp_xfd;
+static dev_t			freesp_dev;
+static pthread_mutex_t		freesp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Scratch space for defragmenting one file at a time. */
+struct fsr_scratch {
+	struct getbmap	*outmap;	/* coalesced extent map */
+	int		outmap_size;
+
+	/* free space to take out of the index once we commit to the file */
+	xfs_agnumber_t	resv_agno;
+	uint64_t	resv_blocks;
+};
+
+/* State for walking a filesystem, or one AG of it, with bulkstat. */
+struct fsr_scan {
+	char			*mntdir;
+	jdm_fshandle_t		*fshandlep;
+	struct xfs_fd		*fsxfd;
+	struct fsr_scratch	scratch;
+
+	/* where to record the last inode that we looked at */
+	xfs_ino_t		*leftoffp;
+
+	xfs_ino_t		startino;
+	int			targetrange;
+
+	/* AG that we're walking, or NULLAGNUMBER for the whole fs */
+	xfs_agnumber_t		agno;
+	char			tname[SMBUFSZ];
+
+	unsigned long long	nr_examined;
+	bool			timed_out;
+	bool			done;		/* walked to the end */
+};
+
 void usage(int ret);
 static int  fsrfile(char *fname, xfs_ino_t ino);
-static int  fsrfile_common(char *fname, char *tname, char *mnt,
-			   struct xfs_fd *file_fd, struct xfs_bulkstat *statp);
-static int  packfile(char *fname, char *tname, struct xfs_fd *file_fd,
-                     struct xfs_bulkstat *statp, struct fsxattr *fsxp);
+static int  fsrfile_common(struct fsr_scratch *scr, char *fname,
+			   char *tname, char *mnt, struct xfs_fd *file_fd,
+			   struct xfs_bulkstat *statp);
+static int  packfile(struct fsr_scratch *scr, char *fname, char *tname,
+		     struct xfs_fd *file_fd, struct xfs_bulkstat *statp,
+		     struct fsxattr *fsxp);
+static inline bool fsr_use_windows(struct xfs_bulkstat *statp);
+static int  packfile_windows(struct fsr_scratch *scr, char *fname,
+		     char *tname, struct xfs_fd *file_fd,
+		     struct xfs_bulkstat *statp, struct fsxattr *fsxp);
 static void fsrdir(char *dirname);
 static int  fsrfs(char *mntdir, xfs_ino_t ino, int targetrange);
 static void initallfs(char *mtab);
 static void fsrallfs(char *mtab, time_t howlong, char *leftofffile);
 static void fsrall_cleanup(int timeout);
 static int  getnextents(int);
+static int  read_fd_bmap_range(struct fsr_scratch *scr, int fd, off_t start,
+			       off_t len);
 int xfsrtextsize(int fd);
 int xfs_getrt(int fd, struct statvfs *sfbp);
 char * gettmpname(char *fname);
 char * getparent(char *fname);
 int fsrprintf(const char *fmt, ...);
-int read_fd_bmap(int, struct xfs_bulkstat *, int *);
+int read_fd_bmap(struct fsr_scratch *, int, struct xfs_bulkstat *, int *);
 static void tmp_init(char *mnt);
+static void tmp_map_ags(struct xfs_fd *xfd, char *mnt);
 static char * tmp_next(char *mnt);
+static char * tmp_next_ag(char *buf, char *mnt, xfs_agnumber_t agno,
+			  unsigned int id);
 static void tmp_close(char *mnt);
 
 static struct xfs_fsop_geom fsgeom;	/* geometry of active mounted system */
@@ -159,7 +255,7 @@ main(int argc, char **argv)
 
 	gflag = ! isatty(0);
 
-	while ((c = getopt(argc, argv, "C:p:e:MgsdnvTt:f:m:b:N:FV")) != -1) {
+	while ((c = getopt(argc, argv, "B:C:I:j:p:e:MgsdnvTt:f:m:b:N:Fw:V")) != -1) {
 		switch (c) {
 		case 'M':
 			Mflag = 1;
@@ -224,6 +320,44 @@ main(int argc, char **argv)
 				exit(1);
 			}
 			break;
+		case 'j':
+			errno = 0;
+			nr_workers = strtoul(optarg, NULL, 10);
+			if (errno) {
+				fprintf(stderr,
+					_("%s: invalid number of workers: %s\n"),
+					optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 'B':
+			bw_limit = cvtnum(0, 0, optarg);
+			if ((long long)bw_limit < 0) {
+				fprintf(stderr,
+					_("%s: invalid bandwidth limit\n"),
+					optarg);
+				exit(1);
+			}
+			break;
+		case 'I':
+			errno = 0;
+			iops_limit = strtoull(optarg, NULL, 10);
+			if (errno) {
+				fprintf(stderr,
+					_("%s: invalid IOPS limit: %s\n"),
+					optarg, strerror(errno));
+				exit(1);
+			}
+			break;
+		case 'w':
+			window_size = cvtnum(0, 0, optarg);
+			if ((long long)window_size <= 0) {
+				fprintf(stderr,
+					_("%s: invalid window size\n"),
+					optarg);
+				exit(1);
+			}
+			break;
 		case 'C':
 			/* Testing opt: coerses frag count in result */
 			if (getenv("FSRXFSTEST") != NULL) {
@@ -256,6 +390,10 @@ main(int argc, char **argv)
 	if (vflag)
 		setbuf(stdout, NULL);
 
+	/* The frag count coercion test option is not thread safe. */
+	if (nfrags)
+		nr_workers = 0;
+
 	starttime = time(NULL);
 
 	/* Save the caller's real uid */
@@ -322,7 +460,9 @@ usage(int ret)
 {
 	fprintf(stderr, _(
 "Usage: %s [-d] [-v] [-g] [-t time] [-p passes] [-f leftf] [-m mtab]\n"
-"       %s [-d] [-v] [-g] xfsdev | dir | file ...\n"
+"          [-j workers] [-B bandwidth] [-I iops] [-w window]\n"
+"       %s [-d] [-v] [-g] [-j workers] [-B bandwidth] [-I iops]\n"
+"          [-w window] xfsdev | dir | file ...\n"
 "       %s -V\n\n"
 "Options:\n"
 "       -g              Print to syslog (default if stdout not a tty).\n"
@@ -330,6 +470,10 @@ usage(int ret)
 "       -p passes       Number of passes before terminating global re-org.\n"
 "       -f leftoff      Use this instead of %s.\n"
 "       -m mtab         Use something other than /etc/mtab.\n"
+"       -j workers      Reorganize this many AGs in parallel.\n"
+"       -B bandwidth    Limit defrag I/O to this many bytes per second.\n"
+"       -I iops         Limit defrag I/O to this many I/Os per second.\n"
+"       -w window       Defragment large files one window of this size at a time.\n"
 "       -d              Debug, print even more.\n"
 "       -v              Verbose, more -v's more verbose.\n"
 "       -V              Print version number and exit.\n"
@@ -432,9 +576,49 @@ initallfs(char *mtab)
 	}
 }
 
+/* Forget where the last filesystem that we worked on left off. */
+static void
+leftoff_reset(void)
+{
+	free(leftoff_aginos);
+	leftoff_aginos = NULL;
+	leftoff_agcount = 0;
+	leftoffino = 0;
+}
+
+/*
+ * Read the per-AG checkpoints that follow the first line of the leftoff file.
+ * Each line is an AG number and the last inode examined in that AG.
+ */
+static void
+read_agckpts(FILE *fp)
+{
+	char			buf[SMBUFSZ];
+	struct fsr_agckpt	*p;
+	unsigned int		agno;
+	unsigned long long	ino;
+
+	while (fgets(buf, SMBUFSZ, fp) != NULL) {
+		if (sscanf(buf, "%u %llu", &agno, &ino) != 2)
+			continue;
+
+		p = realloc(startckpts,
+				(nr_startckpts + 1) * sizeof(struct fsr_agckpt));
+		if (!p) {
+			fsrprintf(_("out of memory: %s\n"), strerror(errno));
+			break;
+		}
+		startckpts = p;
+		startckpts[nr_startckpts].agno = agno;
+		startckpts[nr_startckpts].ino = ino;
+		nr_startckpts++;
+	}
+}
+
 static void
 fsrallfs(char *mtab, time_t howlong, char *leftofffile)
 {
+	FILE *fp = NULL;
 	int fd;
 	int error;
 	int found = 0;
@@ -488,13 +672,12 @@ fsrallfs(char *mtab, time_t howlong, char *leftofffile)
 	}
 
 	if (fd != NULLFD) {
-		if (read(fd, buf, SMBUFSZ) == -1) {
+		fp = fdopen(fd, "r");
+		if (!fp || fgets(buf, SMBUFSZ, fp) == NULL) {
 			fs = fsbase;
 			fsrprintf(_("could not read %s, starting with %s\n"),
 				leftofffile, *fs->dev);
 		} else {
-			/* Ensure the buffer we read is null terminated */
-			buf[SMBUFSZ-1] = '\0';
 			for (fs = fsbase; fs < fsend; fs++) {
 				fsname = fs->dev;
 				if ((strncmp(buf,fsname,strlen(fsname)) == 0)
@@ -528,6 +711,10 @@ fsrallfs(char *mtab, time_t howlong, char *leftofffile)
 			if (startpass < 0)
 				startpass = 0;
 
+			/* Per-AG checkpoints from a parallel run */
+			if (found)
+				read_agckpts(fp);
+
 			/* Init pass counts */
 			for (fsp = fsbase; fsp < fs; fsp++) {
 				fsp->npass = startpass + 1;
@@ -536,7 +723,10 @@ fsrallfs(char *mtab, time_t howlong, char *leftofffile)
 				fsp->npass = startpass;
 			}
 		}
-		close(fd);
+		if (fp)
+			fclose(fp);
+		else
+			close(fd);
 	}
 
 	if (vflag) {
@@ -578,6 +768,9 @@ fsrallfs(char *mtab, time_t howlong, char *leftofffile)
 			break;
 		}
 		startino = 0;  /* reset after the first time through */
+		free(startckpts);
+		startckpts = NULL;
+		nr_startckpts = 0;
 		fs->npass++;
 		fs++;
 		if (fs == fsend)
@@ -613,11 +806,26 @@ fsrall_cleanup(int timeout)
 			fsrprintf(_("open(%s) failed: %s\n"),
 			          leftofffile, strerror(errno));
 		} else {
+			xfs_agnumber_t	agno;
+
 			ret = sprintf(buf, "%s %d %llu\n", fs->dev,
 			        fs->npass, (unsigned long long)leftoffino);
 			if (write(fd, buf, ret) < strlen(buf))
 				fsrprintf(_("write(%s) failed: %s\n"),
 					leftofffile, strerror(errno));
+
+			/* Record how far each AG got in parallel mode */
+			for (agno = 0; agno < leftoff_agcount; agno++) {
+				if (!leftoff_aginos[agno])
+					continue;
+				ret = sprintf(buf, "%u %llu\n", agno,
+					(unsigned long long)leftoff_aginos[agno]);
+				if (write(fd, buf, ret) < strlen(buf)) {
+					fsrprintf(_("write(%s) failed: %s\n"),
+						leftofffile, strerror(errno));
+					break;
+				}
+			}
 			close(fd);
 		}
 	}
@@ -641,49 +849,338 @@ cmp(const void *s1, const void *s2)
 }
 
 /*
- * fsrfs -- reorganize a file system
+ * Wait for our turn to issue this many I/Os totalling this many bytes so that
+ * all the defrag threads together stay under the bandwidth and IOPS limits.
  */
-static int
-fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
+static void
+fsr_throttle(
+	size_t			bytes,
+	unsigned int		nr_ios)
 {
-	struct xfs_fd	fsxfd = XFS_FD_INIT_EMPTY;
-	int	count = 0;
-	int	ret;
-	char	fname[64];
-	char	*tname;
-	jdm_fshandle_t	*fshandlep;
-	struct xfs_bulkstat_req	*breq;
+	struct timespec		now;
+	uint64_t		now_ns;
+	uint64_t		start_ns;
+	uint64_t		cost_ns = 0;
+
+	if (!bw_limit && !iops_limit)
+		return;
+
+	if (bw_limit)
+		cost_ns = bytes * NSEC_PER_SEC / bw_limit;
+	if (iops_limit)
+		cost_ns = max(cost_ns, nr_ios * NSEC_PER_SEC / iops_limit);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+
+	pthread_mutex_lock(&throttle_lock);
+	if (throttle_next < now_ns)
+		throttle_next = now_ns;
+	start_ns = throttle_next;
+	throttle_next += cost_ns;
+	pthread_mutex_unlock(&throttle_lock);
+
+	if (start_ns > now_ns) {
+		struct timespec	delay = {
+			.tv_sec		= (start_ns - now_ns) / NSEC_PER_SEC,
+			.tv_nsec	= (start_ns - now_ns) % NSEC_PER_SEC,
+		};
+
+		nanosleep(&delay, NULL);
+	}
+}
 
-	fsrprintf(_("%s start inode=%llu\n"), mntdir,
-		(unsigned long long)startino);
+/* Remember a free extent if it's one of the longest in the AG. */
+static void
+freesp_add(
+	struct fsr_agfree	*ag,
+	xfs_extlen_t		len)
+{
+	unsigned int		i;
+
+	ag->freeblks += len;
+	if (ag->nr == FREESP_NR_LONGEST &&
+	    len <= ag->longest[FREESP_NR_LONGEST - 1])
+		return;
+
+	i = min(ag->nr, FREESP_NR_LONGEST - 1);
+	for (; i > 0 && ag->longest[i - 1] < len; i--)
+		ag->longest[i] = ag->longest[i - 1];
+	ag->longest[i] = len;
+	if (ag->nr < FREESP_NR_LONGEST)
+		ag->nr++;
+}
 
-	fshandlep = jdm_getfshandle( mntdir );
-	if ( ! fshandlep ) {
-		fsrprintf(_("unable to get handle: %s: %s\n"),
-		          mntdir, strerror( errno ));
+/*
+ * Summarize the free extents of one AG with GETFSMAP.  The results go in @ag,
+ * which is private to the caller, so that nobody has to wait for the scan.
+ */
+static int
+freesp_scan_ag(
+	xfs_agnumber_t		agno,
+	struct fsr_agfree	*ag)
+{
+	struct fsmap_head	*fsmap;
+	struct fsmap		*extent;
+	struct fsmap		*l, *h;
+	struct fsmap		*p;
+	int			i;
+
+	fsmap = calloc(1, fsmap_sizeof(FREESP_NR_RECS));
+	if (!fsmap)
 		return -1;
+
+	fsmap->fmh_count = FREESP_NR_RECS;
+	l = fsmap->fmh_keys;
+	h = fsmap->fmh_keys + 1;
+	l->fmr_physical = cvt_agbno_to_b(freesp_xfd, agno, 0);
+	h->fmr_physical = cvt_agbno_to_b(freesp_xfd, agno + 1, 0);
+	l->fmr_device = h->fmr_device = freesp_dev;
+	h->fmr_owner = ULLONG_MAX;
+	h->fmr_flags = UINT_MAX;
+	h->fmr_offset = ULLONG_MAX;
+
+	memset(ag, 0, sizeof(*ag));
+	while (true) {
+		if (ioctl(freesp_xfd->fd, FS_IOC_GETFSMAP, fsmap) < 0) {
+			if (dflag)
+				fsrprintf(_("FS_IOC_GETFSMAP failed: AG %u: %s\n"),
+					  agno, strerror(errno));
+			free(fsmap);
+			return -1;
+		}
+
+		/* No more extents to map, exit */
+		if (!fsmap->fmh_entries)
+			break;
+
+		for (i = 0, extent = fsmap->fmh_recs;
+		     i < fsmap->fmh_entries;
+		     i++, extent++) {
+			if (!(extent->fmr_flags & FMR_OF_SPECIAL_OWNER) ||
+			    extent->fmr_owner != XFS_FMR_OWN_FREE)
+				continue;
+			freesp_add(ag, cvt_b_to_off_fsbt(freesp_xfd,
+						extent->fmr_length));
+		}
+
+		p = &fsmap->fmh_recs[fsmap->fmh_entries - 1];
+		if (p->fmr_flags & FMR_OF_LAST)
+			break;
+		fsmap_advance(fsmap);
 	}
 
-	ret = -xfd_open(&fsxfd, mntdir, O_RDONLY);
-	if (ret) {
-		fsrprintf(_("unable to open XFS file: %s: %s\n"),
-		          mntdir, strerror(ret));
-		free(fshandlep);
-		return -1;
+	free(fsmap);
+	return 0;
+}
+
+static void
+freesp_free(void)
+{
+	free(freesp);
+	freesp = NULL;
+	freesp_xfd = NULL;
+}
+
+/*
+ * Build the free space index for this filesystem.  If GETFSMAP doesn't work
+ * here we go without, and tmp files are spread around the AGs like before.
+ */
+static void
+freesp_load(
+	struct xfs_fd		*xfd)
+{
+	struct stat		sb;
+	xfs_agnumber_t		agno;
+
+	freesp_free();
+	if (fstat(xfd->fd, &sb) < 0)
+		return;
+
+	freesp = calloc(xfd->fsgeom.agcount, sizeof(struct fsr_agfree));
+	if (!freesp)
+		return;
+	freesp_xfd = xfd;
+	freesp_dev = sb.st_dev;
+
+	for (agno = 0; agno < xfd->fsgeom.agcount; agno++) {
+		if (freesp_scan_ag(agno, &freesp[agno])) {
+			freesp_free();
+			return;
+		}
+		freesp[agno].stamp = time(NULL);
 	}
-	memcpy(&fsgeom, &fsxfd.fsgeom, sizeof(fsgeom));
+}
 
-	tmp_init(mntdir);
+/*
+ * Guess the fewest extents that this many blocks could be written in if the
+ * allocator gave us the longest free extents in the AG.  Anything that
+ * doesn't fit in the extents we remember has to go in extents no longer than
+ * the shortest of them.
+ */
+static uint64_t
+freesp_extents_needed(
+	struct fsr_agfree	*ag,
+	uint64_t		blocks)
+{
+	uint64_t		longest_sum = 0;
+	unsigned int		i;
+
+	for (i = 0; i < ag->nr; i++) {
+		if (ag->longest[i] >= blocks)
+			return i + 1;
+		blocks -= ag->longest[i];
+		longest_sum += ag->longest[i];
+	}
 
-	ret = -xfrog_bulkstat_alloc_req(GRABSZ, startino, &breq);
-	if (ret) {
-		fsrprintf(_("Skipping %s: %s\n"), mntdir, strerror(ret));
-		xfd_close(&fsxfd);
-		free(fshandlep);
-		return -1;
+	if (ag->nr == 0 || blocks > ag->freeblks - longest_sum)
+		return UINT64_MAX;
+	return ag->nr + howmany(blocks, ag->longest[ag->nr - 1]);
+}
+
+/* Take this many blocks out of the longest free extents of the AG. */
+static void
+freesp_consume(
+	struct fsr_agfree	*ag,
+	uint64_t		blocks)
+{
+	xfs_extlen_t		longest[FREESP_NR_LONGEST];
+	uint64_t		freeblks;
+	unsigned int		i, nr = ag->nr;
+
+	freeblks = ag->freeblks - min(blocks, ag->freeblks);
+	memcpy(longest, ag->longest, sizeof(longest));
+	ag->nr = 0;
+	for (i = 0; i < nr; i++) {
+		xfs_extlen_t	len = min((uint64_t)longest[i], blocks);
+
+		blocks -= len;
+		if (longest[i] > len)
+			freesp_add(ag, longest[i] - len);
+	}
+	ag->freeblks = freeblks;
+}
+
+/*
+ * Find the AG that could hold this many blocks of the file in the fewest
+ * extents, preferring the AG that the file lives in.  The caller must hold
+ * freesp_lock.
+ */
+static xfs_agnumber_t
+freesp_best_ag(
+	xfs_agnumber_t		home,
+	uint64_t		blocks,
+	uint64_t		max_extents)
+{
+	xfs_agnumber_t		agcount = freesp_xfd->fsgeom.agcount;
+	xfs_agnumber_t		agno;
+	xfs_agnumber_t		best = NULLAGNUMBER;
+	uint64_t		best_need = max_extents;
+	uint64_t		need;
+
+	for (agno = 0; agno < agcount; agno++) {
+		xfs_agnumber_t	a = (home + agno) % agcount;
+
+		need = freesp_extents_needed(&freesp[a], blocks);
+		if (need < best_need) {
+			best = a;
+			best_need = need;
+		}
+	}
+	return best;
+}
+
+/*
+ * Pick an AG for the tmp file.  If the index entry for the AG that we pick
+ * has got old, rescan just that AG, without holding the lock, and pick again.
+ * The entry is marked as fresh before the scan starts, so that other threads
+ * don't scan it too and a failed scan isn't retried for every file.  Nothing
+ * is reserved here; see freesp_reserve.  Returns false if no AG could hold
+ * the file in fewer than max_extents extents.
+ */
+static bool
+freesp_place(
+	struct xfs_bulkstat	*p,
+	uint64_t		blocks,
+	uint64_t		max_extents,
+	xfs_agnumber_t		*agnop)
+{
+	xfs_agnumber_t		home = cvt_ino_to_agno(freesp_xfd, p->bs_ino);
+	xfs_agnumber_t		best;
+	struct fsr_agfree	fresh;
+	time_t			now = time(NULL);
+
+	pthread_mutex_lock(&freesp_lock);
+	while ((best = freesp_best_ag(home, blocks, max_extents)) !=
+			NULLAGNUMBER &&
+	       now - freesp[best].stamp > FREESP_MAX_AGE) {
+		freesp[best].stamp = now;
+		pthread_mutex_unlock(&freesp_lock);
+
+		memset(&fresh, 0, sizeof(fresh));
+		if (freesp_scan_ag(best, &fresh) == 0) {
+			fresh.stamp = now;
+			pthread_mutex_lock(&freesp_lock);
+			freesp[best] = fresh;
+		} else {
+			/* keep the old numbers until the entry ages again */
+			pthread_mutex_lock(&freesp_lock);
+		}
+	}
+	pthread_mutex_unlock(&freesp_lock);
+
+	if (best == NULLAGNUMBER)
+		return false;
+	*agnop = best;
+	return true;
+}
+
+/* Take the space for a file that we're going to defragment out of the index. */
+static void
+freesp_reserve(
+	struct fsr_scratch	*scr)
+{
+	if (!freesp || !scr->resv_blocks)
+		return;
+
+	pthread_mutex_lock(&freesp_lock);
+	freesp_consume(&freesp[scr->resv_agno], scr->resv_blocks);
+	pthread_mutex_unlock(&freesp_lock);
+	scr->resv_blocks = 0;
+}
+
+/*
+ * Walk the inodes of a filesystem (or one AG of it) and defragment the most
+ * fragmented files in each bulkstat batch.  Returns zero or a positive errno;
+ * if we run out of time, scan->timed_out is set.
+ */
+static int
+fsrfs_walk(
+	struct fsr_scan		*scan)
+{
+	struct xfs_bulkstat_req	*breq;
+	char			fname[64];
+	char			*tname;
+	xfs_agnumber_t		tmp_agno = 0;
+	unsigned int		scan_id;
+	int			count = 0;
+	int			ret;
+
+	/* Keep the tmp file names of parallel workers apart. */
+	scan_id = scan->agno == NULLAGNUMBER ? 0 : scan->agno;
+
+	if (endtime && endtime < time(NULL)) {
+		scan->timed_out = true;
+		return 0;
 	}
 
-	while ((ret = -xfrog_bulkstat(&fsxfd, breq) == 0)) {
+	ret = -xfrog_bulkstat_alloc_req(GRABSZ, scan->startino, &breq);
+	if (ret)
+		return ret;
+	if (scan->agno != NULLAGNUMBER)
+		xfrog_bulkstat_set_ag(breq, scan->agno);
+
+	while ((ret = -xfrog_bulkstat(scan->fsxfd, breq)) == 0) {
 		struct xfs_bulkstat	*buf = breq->bulkstat;
 		struct xfs_bulkstat	*p;
 		struct xfs_bulkstat	*endp;
@@ -691,10 +1188,10 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 		uint32_t		buflenout = breq->hdr.ocount;
 
 		if (buflenout == 0)
-			goto out0;
+			break;
 
 		/* Each loop through, defrag targetrange percent of the files */
-		count = (buflenout * targetrange) / 100;
+		count = (buflenout * scan->targetrange) / 100;
 
 		qsort((char *)buf, buflenout, sizeof(struct xfs_bulkstat), cmp);
 
@@ -704,8 +1201,37 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 			     (p->bs_extents64 < 2))
 				continue;
 
-			ret = open_handle(&file_fd, fshandlep, p,
-					&fsxfd.fsgeom, O_RDWR | O_DIRECT);
+			/*
+			 * Find an AG with enough long free extents to hold
+			 * the file (or one window of it) in fewer extents
+			 * than it has now, or skip the file.
+			 */
+			if (freesp) {
+				uint64_t	blocks = p->bs_blocks;
+				uint64_t	max_extents = p->bs_extents64;
+
+				if (fsr_use_windows(p)) {
+					blocks = min(blocks, howmany(window_size,
+							fsgeom.blocksize));
+					max_extents = UINT64_MAX;
+				}
+				if (!freesp_place(p, blocks, max_extents,
+							&tmp_agno)) {
+					if (vflag)
+						fsrprintf(
+	_("ino=%lld: not enough contiguous free space, skipping\n"),
+							(long long)p->bs_ino);
+					*scan->leftoffp = p->bs_ino;
+					scan->nr_examined++;
+					continue;
+				}
+				scan->scratch.resv_agno = tmp_agno;
+				scan->scratch.resv_blocks = blocks;
+			}
+
+			ret = open_handle(&file_fd, scan->fshandlep, p,
+					&scan->fsxfd->fsgeom,
+					O_RDWR | O_DIRECT);
 			if (ret) {
 				/* This probably means the file was
 				 * removed while in progress of handling
@@ -714,6 +1240,7 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 				if (dflag)
 					fsrprintf(_("could not open: "
 						"inode %llu\n"), p->bs_ino);
+				scan->scratch.resv_blocks = 0;
 				continue;
 			}
 
@@ -721,12 +1248,21 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 			sprintf(fname, "ino=%lld", (long long)p->bs_ino);
 
 			/* Get a tmp file name */
-			tname = tmp_next(mntdir);
-
-			ret = fsrfile_common(fname, tname, mntdir, &file_fd,
-					p);
-
-			leftoffino = p->bs_ino;
+			if (freesp)
+				tname = tmp_next_ag(scan->tname, scan->mntdir,
+						tmp_agno, scan_id);
+			else if (scan->agno == NULLAGNUMBER)
+				tname = tmp_next(scan->mntdir);
+			else
+				tname = tmp_next_ag(scan->tname, scan->mntdir,
+						scan->agno, scan_id);
+
+			ret = fsrfile_common(&scan->scratch, fname, tname,
+					scan->mntdir, &file_fd, p);
+			scan->scratch.resv_blocks = 0;
+
+			*scan->leftoffp = p->bs_ino;
+			scan->nr_examined++;
 
 			xfd_close(&file_fd);
 
@@ -736,101 +1272,348 @@ fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
 			}
 		}
 		if (endtime && endtime < time(NULL)) {
-			free(breq);
-			tmp_close(mntdir);
-			xfd_close(&fsxfd);
-			fsrall_cleanup(1);
-			exit(1);
+			scan->timed_out = true;
+			ret = 0;
+			break;
 		}
 	}
-	if (ret)
-		fsrprintf(_("%s: bulkstat: %s\n"), progname, strerror(ret));
-out0:
+
 	free(breq);
-	tmp_close(mntdir);
-	xfd_close(&fsxfd);
-	free(fshandlep);
-	return 0;
+	return ret;
 }
 
-/*
- * reorganize by directory hierarchy.
- * Stay in dev (a restriction based on structure of this program -- either
- * call efs_{n,u}mount() around each file, something smarter or this)
- */
+/* Defragment one AG in parallel mode. */
 static void
-fsrdir(char *dirname)
+fsrfs_ag_worker(
+	struct workqueue	*wq,
+	xfs_agnumber_t		agno,
+	void			*arg)
 {
-	fsrprintf(_("%s: Directory defragmentation not supported\n"), dirname);
+	struct fsr_scan		*scan = arg;
+	int			ret;
+
+	ret = fsrfs_walk(scan);
+	if (ret)
+		fsrprintf(_("%s: AG %u: bulkstat: %s\n"), progname, agno,
+				strerror(ret));
+	else if (!scan->timed_out)
+		scan->done = true;
+	if (vflag)
+		fsrprintf(_("%s AG %u: %llu files examined\n"),
+				scan->mntdir, agno, scan->nr_examined);
+
+	free(scan->scratch.outmap);
+	scan->scratch.outmap = NULL;
 }
 
 /*
- * Sets up the defragmentation of a file based on the
- * filepath.  It collects the bstat information, does
- * an open on the file and passes this all to fsrfile_common.
+ * Figure out where this AG's walk should start.  A serial checkpoint means
+ * that all the AGs below it were finished; a per-AG checkpoint is the last
+ * inode examined in that AG.  Returns false if there's nothing left to do in
+ * this AG, in which case the start inode is set to the first inode past it.
  */
-static int
-fsrfile(
-	char			*fname,
-	xfs_ino_t		ino)
+static bool
+fsrfs_ag_startino(
+	struct xfs_fd		*xfd,
+	xfs_agnumber_t		agno,
+	xfs_ino_t		startino,
+	xfs_ino_t		*agstartino)
 {
-	struct xfs_fd		fsxfd = XFS_FD_INIT_EMPTY;
-	struct xfs_bulkstat	bulkstat;
-	struct xfs_fd		file_fd = XFS_FD_INIT_EMPTY;
-	jdm_fshandle_t		*fshandlep;
-	int			error = -1;
-	char			*tname;
+	unsigned int		i;
+
+	*agstartino = 0;
+	if (startino) {
+		if (cvt_ino_to_agno(xfd, startino) > agno)
+			goto done;
+		if (cvt_ino_to_agno(xfd, startino) == agno)
+			*agstartino = startino;
+	}
 
-	fshandlep = jdm_getfshandle(getparent (fname) );
-	if (!fshandlep) {
-		fsrprintf(_("unable to construct sys handle for %s: %s\n"),
-			fname, strerror(errno));
-		goto out;
+	for (i = 0; i < nr_startckpts; i++) {
+		if (startckpts[i].agno != agno)
+			continue;
+		*agstartino = startckpts[i].ino + 1;
+		if (cvt_ino_to_agno(xfd, *agstartino) != agno)
+			goto done;
 	}
 
-	/*
-	 * Need to open something on the same filesystem as the
-	 * file.  Open the parent.
-	 */
-	error = -xfd_open(&fsxfd, getparent(fname), O_RDONLY);
-	if (error) {
-		fsrprintf(_("unable to open sys handle for XFS file %s: %s\n"),
-			fname, strerror(error));
-		goto out;
+	return true;
+done:
+	/* Point past the end of the AG. */
+	*agstartino = cvt_agino_to_ino(xfd, agno + 1, 0);
+	return false;
+}
+
+/*
+ * Reorganize a filesystem with one bulkstat cursor per AG, running up to
+ * nr_workers AGs at the same time.
+ */
+static int
+fsrfs_parallel(
+	char			*mntdir,
+	jdm_fshandle_t		*fshandlep,
+	struct xfs_fd		*fsxfd,
+	xfs_ino_t		startino,
+	int			targetrange)
+{
+	struct workqueue	wq;
+	struct fsr_scan		*scans;
+	xfs_agnumber_t		agcount = fsxfd->fsgeom.agcount;
+	xfs_agnumber_t		agno;
+	bool			timed_out = false;
+	int			ret;
+
+	scans = calloc(agcount, sizeof(struct fsr_scan));
+	leftoff_aginos = calloc(agcount, sizeof(xfs_ino_t));
+	if (!scans || !leftoff_aginos) {
+		fsrprintf(_("out of memory: %s\n"), strerror(errno));
+		leftoff_reset();
+		free(scans);
+		return -1;
 	}
+	leftoff_agcount = agcount;
 
-	error = -xfrog_bulkstat_single(&fsxfd, ino, 0, &bulkstat);
-	if (error) {
-		fsrprintf(_("unable to get bstat on %s: %s\n"),
-			fname, strerror(error));
-		goto out;
+	ret = -workqueue_create(&wq, NULL, min(nr_workers, agcount));
+	if (ret) {
+		fsrprintf(_("%s: could not create workqueue: %s\n"),
+				mntdir, strerror(ret));
+		free(scans);
+		return -1;
 	}
 
-	error = open_handle(&file_fd, fshandlep, &bulkstat, &fsxfd.fsgeom,
-			O_RDWR | O_DIRECT);
-	if (error) {
-		fsrprintf(_("unable to open handle %s: %s\n"),
-			fname, strerror(error));
-		goto out;
+	for (agno = 0; agno < agcount; agno++) {
+		struct fsr_scan	*scan = &scans[agno];
+
+		scan->mntdir = mntdir;
+		scan->fshandlep = fshandlep;
+		scan->fsxfd = fsxfd;
+		scan->leftoffp = &leftoff_aginos[agno];
+		scan->targetrange = targetrange;
+		scan->agno = agno;
+		if (!fsrfs_ag_startino(fsxfd, agno, startino,
+					&scan->startino)) {
+			/* Keep the checkpoint for the next run. */
+			leftoff_aginos[agno] = scan->startino - 1;
+			scan->done = true;
+			continue;
+		}
+
+		ret = -workqueue_add(&wq, fsrfs_ag_worker, agno, scan);
+		if (ret) {
+			fsrprintf(_("%s: could not queue AG %u: %s\n"),
+					mntdir, agno, strerror(ret));
+			break;
+		}
 	}
 
-	/* Stash the fs geometry for general use. */
-	memcpy(&fsgeom, &fsxfd.fsgeom, sizeof(fsgeom));
+	ret = -workqueue_terminate(&wq);
+	if (ret)
+		fsrprintf(_("%s: could not finish workqueue: %s\n"),
+				mntdir, strerror(ret));
+	workqueue_destroy(&wq);
+
+	for (agno = 0; agno < agcount; agno++)
+		if (scans[agno].timed_out)
+			timed_out = true;
+
+	/*
+	 * Point the serial checkpoint at the first AG that didn't finish, so
+	 * that everything below it is skipped next time, even without -j.
+	 */
+	if (timed_out) {
+		for (agno = 0; agno < agcount; agno++)
+			if (!scans[agno].done)
+				break;
+		if (agno < agcount && leftoff_aginos[agno])
+			leftoffino = leftoff_aginos[agno];
+		else if (agno > 0 && agno < agcount)
+			leftoffino = cvt_agino_to_ino(fsxfd, agno, 0) - 1;
+	}
+	free(scans);
+
+	return timed_out ? 1 : 0;
+}
+
+/*
+ * fsrfs -- reorganize a file system
+ */
+static int
+fsrfs(char *mntdir, xfs_ino_t startino, int targetrange)
+{
+	struct xfs_fd	fsxfd = XFS_FD_INIT_EMPTY;
+	struct fsr_scan	scan = {
+		.mntdir		= mntdir,
+		.fsxfd		= &fsxfd,
+		.leftoffp	= &leftoffino,
+		.startino	= startino,
+		.targetrange	= targetrange,
+		.agno		= NULLAGNUMBER,
+	};
+	int	ret;
+	jdm_fshandle_t	*fshandlep;
+
+	fsrprintf(_("%s start inode=%llu\n"), mntdir,
+		(unsigned long long)startino);
+
+	fshandlep = jdm_getfshandle( mntdir );
+	if ( ! fshandlep ) {
+		fsrprintf(_("unable to get handle: %s: %s\n"),
+		          mntdir, strerror( errno ));
+		return -1;
+	}
+	scan.fshandlep = fshandlep;
+
+	ret = -xfd_open(&fsxfd, mntdir, O_RDONLY);
+	if (ret) {
+		fsrprintf(_("unable to open XFS file: %s: %s\n"),
+		          mntdir, strerror(ret));
+		free(fshandlep);
+		return -1;
+	}
+	memcpy(&fsgeom, &fsxfd.fsgeom, sizeof(fsgeom));
+
+	/* Don't let checkpoints from another filesystem leak into this one. */
+	leftoff_reset();
+	tmp_init(mntdir);
+	tmp_map_ags(&fsxfd, mntdir);
+	freesp_load(&fsxfd);
+
+	if (nr_workers > 1) {
+		ret = fsrfs_parallel(mntdir, fshandlep, &fsxfd, startino,
+				targetrange);
+		if (ret > 0) {
+			scan.timed_out = true;
+			ret = 0;
+		}
+	} else {
+		ret = fsrfs_walk(&scan);
+		free(scan.scratch.outmap);
+	}
+
+	freesp_free();
+	if (scan.timed_out) {
+		tmp_close(mntdir);
+		xfd_close(&fsxfd);
+		fsrall_cleanup(1);
+		exit(1);
+	}
+	if (ret > 0)
+		fsrprintf(_("%s: bulkstat: %s\n"), progname, strerror(ret));
+
+	tmp_close(mntdir);
+	xfd_close(&fsxfd);
+	free(fshandlep);
+	leftoff_reset();
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * reorganize by directory hierarchy.
+ * Stay in dev (a restriction based on structure of this program -- either
+ * call efs_{n,u}mount() around each file, something smarter or this)
+ */
+static void
+fsrdir(char *dirname)
+{
+	fsrprintf(_("%s: Directory defragmentation not supported\n"), dirname);
+}
+
+/*
+ * Sets up the defragmentation of a file based on the
+ * filepath.  It collects the bstat information, does
+ * an open on the file and passes this all to fsrfile_common.
+ */
+static int
+fsrfile(
+	char			*fname,
+	xfs_ino_t		ino)
+{
+	struct xfs_fd		fsxfd = XFS_FD_INIT_EMPTY;
+	struct xfs_bulkstat	bulkstat;
+	struct xfs_fd		file_fd = XFS_FD_INIT_EMPTY;
+	struct fsr_scratch	scratch = { };
+	jdm_fshandle_t		*fshandlep;
+	int			error = -1;
+	char			*tname;
+
+	fshandlep = jdm_getfshandle(getparent (fname) );
+	if (!fshandlep) {
+		fsrprintf(_("unable to construct sys handle for %s: %s\n"),
+			fname, strerror(errno));
+		goto out;
+	}
+
+	/*
+	 * Need to open something on the same filesystem as the
+	 * file.  Open the parent.
+	 */
+	error = -xfd_open(&fsxfd, getparent(fname), O_RDONLY);
+	if (error) {
+		fsrprintf(_("unable to open sys handle for XFS file %s: %s\n"),
+			fname, strerror(error));
+		goto out;
+	}
+
+	error = -xfrog_bulkstat_single(&fsxfd, ino, 0, &bulkstat);
+	if (error) {
+		fsrprintf(_("unable to get bstat on %s: %s\n"),
+			fname, strerror(error));
+		goto out;
+	}
+
+	error = open_handle(&file_fd, fshandlep, &bulkstat, &fsxfd.fsgeom,
+			O_RDWR | O_DIRECT);
+	if (error) {
+		fsrprintf(_("unable to open handle %s: %s\n"),
+			fname, strerror(error));
+		goto out;
+	}
+
+	/* Stash the fs geometry for general use. */
+	memcpy(&fsgeom, &fsxfd.fsgeom, sizeof(fsgeom));
 
 	tname = gettmpname(fname);
 	if (tname)
-		error = fsrfile_common(fname, tname, NULL, &file_fd,
+		error = fsrfile_common(&scratch, fname, tname, NULL, &file_fd,
 				&bulkstat);
 
 out:
 	xfd_close(&fsxfd);
 	xfd_close(&file_fd);
+	free(scratch.outmap);
 	free(fshandlep);
 
 	return error;
 }
 
 
+/*
+ * Exchanges must cover whole allocation units, which for a realtime file are
+ * realtime extents.
+ */
+static inline unsigned int
+fsr_alloc_unit(
+	struct xfs_bulkstat	*statp)
+{
+	if ((statp->bs_xflags & FS_XFLAG_REALTIME) && fsgeom.rtextsize > 1)
+		return fsgeom.rtextsize * fsgeom.blocksize;
+	return fsgeom.blocksize;
+}
+
+/*
+ * Should we defragment this file one window at a time?  Windows are swapped
+ * in with the commit-range ioctl, so the filesystem has to support exchanging
+ * file contents.
+ */
+static inline bool
+fsr_use_windows(
+	struct xfs_bulkstat	*statp)
+{
+	return window_size && !nfrags && S_ISREG(statp->bs_mode) &&
+	       statp->bs_size > window_size &&
+	       (fsgeom.flags & XFS_FSOP_GEOM_FLAGS_EXCHANGE_RANGE);
+}
+
 /*
  * This is the common defrag code for either a full fs
  * defragmentation or a single file.  Check as much as
@@ -847,6 +1630,7 @@ out:
  */
 static int
 fsrfile_common(
+	struct fsr_scratch *scr,
 	char		*fname,
 	char		*tname,
 	char		*fsname,
@@ -857,6 +1641,7 @@ fsrfile_common(
 	struct statvfs  vfss;
 	struct fsxattr	fsx;
 	unsigned long	bsize;
+	long long	need;
 
 	if (vflag)
 		fsrprintf("%s\n", fname);
@@ -912,11 +1697,12 @@ fsrfile_common(
 		return -1;
 	}
 	bsize = vfss.f_frsize ? vfss.f_frsize : vfss.f_bsize;
-	if (statp->bs_blksize * statp->bs_blocks >
-	    vfss.f_bfree * bsize - minimumfree) {
+	need = statp->bs_blksize * statp->bs_blocks;
+	if (fsr_use_windows(statp))
+		need = min(need, window_size);
+	if (need > vfss.f_bfree * bsize - minimumfree) {
 		fsrprintf(_("insufficient freespace for: %s: "
-			    "size=%lld: ignoring\n"), fname,
-			    statp->bs_blksize * statp->bs_blocks);
+			    "size=%lld: ignoring\n"), fname, need);
 		return 1;
 	}
 
@@ -962,7 +1748,15 @@ fsrfile_common(
 	 * file we're defragging, in packfile().
 	 */
 
-	if ((error = packfile(fname, tname, file_fd, statp, &fsx)))
+	/* The file passed all the checks, so its tmp space is spoken for. */
+	freesp_reserve(scr);
+
+	if (fsr_use_windows(statp))
+		error = packfile_windows(scr, fname, tname, file_fd, statp,
+				&fsx);
+	else
+		error = packfile(scr, fname, tname, file_fd, statp, &fsx);
+	if (error)
 		return error;
 	return -1; /* no error */
 }
@@ -1169,6 +1963,164 @@ out:
 	return 0;
 }
 
+#ifdef HAVE_COPY_FILE_RANGE
+/*
+ * Copy the written parts of the file into the tmp file with copy_file_range
+ * so that the data never has to bounce through a userspace buffer.  This only
+ * makes sense if the kernel will actually copy the data; on a reflink
+ * filesystem it would share the old fragmented blocks with the tmp file
+ * instead, so we don't try there.
+ *
+ * copy_file_range goes through the page cache, so turn off O_DIRECT for the
+ * duration of the copy.  Returns 0 if the whole file was copied, or -1 if the
+ * caller should fall back to copying with read and write.
+ */
+static int
+packfile_copy_range(
+	char			*fname,
+	struct getbmap		*outmap,
+	int			nextents,
+	int			fd,
+	int			tfd)
+{
+	int			fd_flags, tfd_flags;
+	int			extent;
+	int			retval = -1;
+
+	if (nfrags || (fsgeom.flags & XFS_FSOP_GEOM_FLAGS_REFLINK))
+		return -1;
+
+	fd_flags = fcntl(fd, F_GETFL);
+	tfd_flags = fcntl(tfd, F_GETFL);
+	if (fd_flags < 0 || tfd_flags < 0)
+		return -1;
+	if (fcntl(fd, F_SETFL, fd_flags & ~O_DIRECT) < 0)
+		return -1;
+	if (fcntl(tfd, F_SETFL, tfd_flags & ~O_DIRECT) < 0)
+		goto out_fd;
+
+	for (extent = 0; extent < nextents; extent++) {
+		loff_t		pos = outmap[extent].bmv_offset;
+		loff_t		tpos = pos;
+		off_t		cnt = outmap[extent].bmv_length;
+		ssize_t		ct;
+
+		/* Holes were already punched in the tmp file. */
+		if (outmap[extent].bmv_block == -1 || cnt == 0)
+			continue;
+
+		while (cnt > 0) {
+			ct = min(cnt, BUFFER_MAX);
+			fsr_throttle(2 * ct, 2);
+			ct = syscall(__NR_copy_file_range, fd, &pos, tfd,
+					&tpos, ct, 0);
+			if (ct < 0) {
+				if (dflag)
+					fsrprintf(
+	_("copy_file_range failed, falling back to read/write: %s: %s\n"),
+						fname, strerror(errno));
+				goto out_tfd;
+			}
+			if (ct == 0)
+				break;	/* EOF */
+			cnt -= ct;
+		}
+	}
+	retval = 0;
+
+out_tfd:
+	fcntl(tfd, F_SETFL, tfd_flags);
+out_fd:
+	fcntl(fd, F_SETFL, fd_flags);
+	return retval;
+}
+#else
+# define packfile_copy_range(n, o, e, fd, tfd)	(-1)
+#endif
+
+/*
+ * Swap the extents of the file and the tmp file with the old swapext ioctl,
+ * which checks that the file hasn't changed since we bulkstat'd it.
+ */
+static int
+packfile_swapext(
+	char			*fname,
+	struct xfs_fd		*file_fd,
+	int			tfd,
+	struct xfs_bulkstat	*statp)
+{
+	xfs_swapext_t		sx;
+	int			error;
+
+	error = -xfrog_bulkstat_v5_to_v1(file_fd, &sx.sx_stat, statp);
+	if (error) {
+		fsrprintf(_("bstat conversion error on %s: %s\n"),
+				fname, strerror(error));
+		return -1;
+	}
+
+	sx.sx_version  = XFS_SX_VERSION;
+	sx.sx_fdtarget = file_fd->fd;
+	sx.sx_fdtmp    = tfd;
+	sx.sx_offset   = 0;
+	sx.sx_length   = statp->bs_size;
+
+	if (xfs_swapext(file_fd->fd, &sx) < 0) {
+		if (errno == ENOTSUP) {
+			if (vflag || dflag)
+			   fsrprintf(_("%s: file type not supported\n"), fname);
+		} else if (errno == EFAULT) {
+			/* The file has changed since we started the copy */
+			if (vflag || dflag)
+			   fsrprintf(_("%s: file modified defrag aborted\n"),
+				     fname);
+		} else if (errno == EBUSY) {
+			/* Timestamp has changed or mmap'ed file */
+			if (vflag || dflag)
+			   fsrprintf(_("%s: file busy\n"), fname);
+		} else {
+			fsrprintf(_("XFS_IOC_SWAPEXT failed: %s: %s\n"),
+				  fname, strerror(errno));
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Exchange the contents of the file and the tmp file with the commit-range
+ * ioctl, which fails with EBUSY if the file changed after the commit was
+ * prepared.
+ */
+static int
+packfile_commit(
+	char			*fname,
+	struct xfs_fd		*file_fd,
+	struct xfs_commit_range	*xcr)
+{
+	int			error;
+
+	error = -xfrog_commitrange(file_fd->fd, xcr,
+			XFS_EXCHANGE_RANGE_TO_EOF);
+	if (!error)
+		return 0;
+
+	if (error == EBUSY) {
+		/* The file has changed since we started the copy */
+		if (vflag || dflag)
+			fsrprintf(_("%s: file modified defrag aborted\n"),
+				  fname);
+	} else if (error == EOPNOTSUPP) {
+		if (vflag || dflag)
+			fsrprintf(_("%s: file type not supported\n"), fname);
+	} else {
+		fsrprintf(_("XFS_IOC_COMMIT_RANGE failed: %s: %s\n"),
+			  fname, strerror(error));
+	}
+	return -1;
+}
+
 /*
  * Do the defragmentation of a single file.
  * We already are pretty sure we can and want to
@@ -1183,6 +2135,7 @@ out:
  */
 static int
 packfile(
+	struct fsr_scratch	*scr,
 	char			*fname,
 	char			*tname,
 	struct xfs_fd		*file_fd,
@@ -1196,7 +2149,8 @@ packfile(
 	unsigned		blksz_dio;
 	unsigned		dio_min;
 	struct dioattr		dio;
-	static xfs_swapext_t	sx;
+	struct xfs_commit_range	xcr;
+	bool			use_commit = false;
 	struct xfs_flock64	space;
 	off_t			cnt, pos;
 	void			*fbuf = NULL;
@@ -1204,6 +2158,23 @@ packfile(
 	char			ffname[SMBUFSZ];
 	int			ffd = -1;
 	int			error;
+	struct getbmap		*outmap;
+
+	/*
+	 * If the kernel can exchange file contents, sample the file's
+	 * freshness before we look at the extent map so that the commit will
+	 * fail if anyone changes the file while we're copying it.  We don't
+	 * have a tmp file yet, so that gets filled in later.
+	 */
+	if (fsgeom.flags & XFS_FSOP_GEOM_FLAGS_EXCHANGE_RANGE) {
+		error = -xfrog_commitrange_prep(&xcr, file_fd->fd, 0, -1, 0,
+				statp->bs_size);
+		if (!error)
+			use_commit = true;
+		else if (dflag)
+			fsrprintf(_("XFS_IOC_START_COMMIT failed: %s: %s\n"),
+				  fname, strerror(error));
+	}
 
 	/*
 	 * Work out the extent map - nextents will be set to the
@@ -1211,7 +2182,8 @@ packfile(
 	 * into account holes), cur_nextents is the current number
 	 * of extents.
 	 */
-	nextents = read_fd_bmap(file_fd->fd, statp, &cur_nextents);
+	nextents = read_fd_bmap(scr, file_fd->fd, statp, &cur_nextents);
+	outmap = scr->outmap;
 
 	if (cur_nextents == 1 || cur_nextents <= nextents) {
 		if (vflag)
@@ -1346,7 +2318,14 @@ packfile(
 		goto out;
 	}
 
-	/* Loop through block map copying the file. */
+	/*
+	 * Let the kernel copy the data if it can; otherwise loop through the
+	 * block map copying the file.
+	 */
+	if (packfile_copy_range(fname, outmap, nextents, file_fd->fd,
+				tfd) == 0)
+		goto copied;
+
 	for (extent = 0; extent < nextents; extent++) {
 		pos = outmap[extent].bmv_offset;
 		if (outmap[extent].bmv_block == -1) {
@@ -1375,6 +2354,7 @@ packfile(
 				ct = min(cnt + dio_min - (cnt % dio_min),
 					blksz_dio);
 			}
+			fsr_throttle(ct, 1);
 			ct = read(file_fd->fd, fbuf, ct);
 			if (ct == 0) {
 				/* EOF, stop trying to read */
@@ -1390,6 +2370,8 @@ packfile(
 				wc = ct;
 			}
 			wc_b4 = wc;
+			if (ct >= 0)
+				fsr_throttle(wc, 1);
 			if (ct < 0 || ((wc = write(tfd, fbuf, wc)) != wc_b4)) {
 				if (ct < 0)
 					fsrprintf(_("bad read of %d bytes "
@@ -1435,6 +2417,7 @@ packfile(
 			}
 		}
 	}
+copied:
 	if (ftruncate(tfd, statp->bs_size) < 0) {
 		fsrprintf(_("could not truncate tmpfile: %s : %s\n"),
 				fname, strerror(errno));
@@ -1446,19 +2429,6 @@ packfile(
 		goto out;
 	}
 
-	error = -xfrog_bulkstat_v5_to_v1(file_fd, &sx.sx_stat, statp);
-	if (error) {
-		fsrprintf(_("bstat conversion error on %s: %s\n"),
-				fname, strerror(error));
-		goto out;
-	}
-
-	sx.sx_version  = XFS_SX_VERSION;
-	sx.sx_fdtarget = file_fd->fd;
-	sx.sx_fdtmp    = tfd;
-	sx.sx_offset   = 0;
-	sx.sx_length   = statp->bs_size;
-
 	/* switch to the owner's id, to keep quota in line */
         if (fchown(tfd, statp->bs_uid, statp->bs_gid) < 0) {
                 if (vflag)
@@ -1468,26 +2438,14 @@ packfile(
         }
 
 	/* Swap the extents */
-	srval = xfs_swapext(file_fd->fd, &sx);
-	if (srval < 0) {
-		if (errno == ENOTSUP) {
-			if (vflag || dflag)
-			   fsrprintf(_("%s: file type not supported\n"), fname);
-		} else if (errno == EFAULT) {
-			/* The file has changed since we started the copy */
-			if (vflag || dflag)
-			   fsrprintf(_("%s: file modified defrag aborted\n"),
-				     fname);
-		} else if (errno == EBUSY) {
-			/* Timestamp has changed or mmap'ed file */
-			if (vflag || dflag)
-			   fsrprintf(_("%s: file busy\n"), fname);
-		} else {
-			fsrprintf(_("XFS_IOC_SWAPEXT failed: %s: %s\n"),
-				  fname, strerror(errno));
-		}
-		goto out;
+	if (use_commit) {
+		xcr.file1_fd = tfd;
+		srval = packfile_commit(fname, file_fd, &xcr);
+	} else {
+		srval = packfile_swapext(fname, file_fd, tfd, statp);
 	}
+	if (srval < 0)
+		goto out;
 
 	/* Report progress */
 	if (vflag)
@@ -1506,6 +2464,385 @@ out:
 	return retval;
 }
 
+/* Fragmentation of one window of a file. */
+struct fsr_window {
+	off_t			offset;
+	unsigned int		nextents;
+};
+
+static int
+window_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct fsr_window	*wa = a;
+	const struct fsr_window	*wb = b;
+
+	/* Most fragmented windows first, then in file offset order. */
+	if (wa->nextents != wb->nextents)
+		return wa->nextents > wb->nextents ? -1 : 1;
+	if (wa->offset != wb->offset)
+		return wa->offset < wb->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Count the extents in each window of the file and return an array of the
+ * windows that could be improved, worst first.
+ */
+static struct fsr_window *
+rank_windows(
+	struct fsr_scratch	*scr,
+	int			fd,
+	off_t			size,
+	off_t			win,
+	unsigned int		*nr_windowsp,
+	int			*cur_nextentsp)
+{
+	struct fsr_window	*windows;
+	unsigned int		nr_windows = howmany(size, win);
+	unsigned int		i, nr = 0;
+	int			nextents;
+
+	nextents = read_fd_bmap_range(scr, fd, 0, size);
+	if (nextents < 0)
+		return NULL;
+
+	windows = calloc(nr_windows, sizeof(struct fsr_window));
+	if (!windows) {
+		fsrprintf(_("malloc failed: %s\n"), strerror(errno));
+		return NULL;
+	}
+
+	/* An extent that crosses a window boundary counts in both windows. */
+	for (i = 0; i < nextents; i++) {
+		off_t		start = scr->outmap[i].bmv_offset;
+		off_t		end = start + scr->outmap[i].bmv_length - 1;
+		unsigned int	w;
+
+		for (w = start / win; w <= end / win && w < nr_windows; w++)
+			windows[w].nextents++;
+	}
+
+	for (i = 0; i < nr_windows; i++) {
+		if (windows[i].nextents <= 1)
+			continue;
+		windows[nr].offset = (off_t)i * win;
+		windows[nr].nextents = windows[i].nextents;
+		nr++;
+	}
+	qsort(windows, nr, sizeof(struct fsr_window), window_cmp);
+
+	*nr_windowsp = nr;
+	*cur_nextentsp = nextents;
+	return windows;
+}
+
+/*
+ * Copy the written extents in the extent map from the file to the same
+ * offsets in the tmp file with direct I/O.
+ */
+static int
+copy_extents(
+	char			*fname,
+	char			*tname,
+	struct getbmap		*map,
+	int			nextents,
+	int			fd,
+	int			tfd,
+	void			*fbuf,
+	unsigned int		blksz_dio,
+	unsigned int		dio_min)
+{
+	int			extent;
+
+	for (extent = 0; extent < nextents; extent++) {
+		off_t		pos = map[extent].bmv_offset;
+		off_t		cnt = map[extent].bmv_length;
+		ssize_t		ct, wc;
+
+		while (cnt > 0) {
+			ct = min(cnt, blksz_dio);
+			fsr_throttle(ct, 1);
+			ct = pread(fd, fbuf, ct, pos);
+			if (ct < 0) {
+				fsrprintf(_("bad read of %lld bytes from %s: %s\n"),
+					(long long)min(cnt, blksz_dio), fname,
+					strerror(errno));
+				return -1;
+			}
+			if (ct == 0)
+				break;	/* EOF */
+
+			/* Ensure we do direct I/O to correct block boundaries */
+			wc = roundup(ct, dio_min);
+			fsr_throttle(wc, 1);
+			if (pwrite(tfd, fbuf, wc, pos) != wc) {
+				fsrprintf(_("bad write of %lld bytes to %s: %s\n"),
+					(long long)wc, tname, strerror(errno));
+				return -1;
+			}
+			pos += ct;
+			cnt -= ct;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Defragment one window of the file.  The window's blocks are reserved and
+ * copied into the same range of the tmp file and then swapped into the file
+ * with the commit-range ioctl, which fails if the file changed since we read
+ * its block map.  Afterwards the old blocks are freed from the tmp file so
+ * that we never need more than one window's worth of free space.
+ *
+ * Returns 0 if the window was defragmented, 1 if there was nothing to gain,
+ * or -1 for errors.
+ */
+static int
+packwindow(
+	struct fsr_scratch	*scr,
+	char			*fname,
+	char			*tname,
+	struct xfs_fd		*file_fd,
+	int			tfd,
+	off_t			offset,
+	off_t			win,
+	unsigned int		unit,
+	void			*fbuf,
+	unsigned int		blksz_dio,
+	unsigned int		dio_min)
+{
+	struct xfs_commit_range	xcr;
+	struct xfs_flock64	space;
+	struct stat		st;
+	uint64_t		flags = 0;
+	off_t			len = win;
+	int			nextents, new_nextents;
+	int			extent;
+	int			retval = -1;
+	int			error;
+
+	/* Sample the file's freshness before we look at the block map. */
+	error = -xfrog_commitrange_prep(&xcr, file_fd->fd, offset, tfd, offset,
+			win);
+	if (error) {
+		fsrprintf(_("XFS_IOC_START_COMMIT failed: %s: %s\n"),
+			  fname, strerror(error));
+		return -1;
+	}
+
+	if (fstat(file_fd->fd, &st) < 0) {
+		fsrprintf(_("unable to stat %s: %s\n"), fname, strerror(errno));
+		return -1;
+	}
+	if (offset >= st.st_size)
+		return 1;
+	if (offset + win >= st.st_size) {
+		/*
+		 * Stay aligned to the allocation unit for direct I/O and the
+		 * exchange; the commit goes to EOF.
+		 */
+		len = roundup_64(st.st_size, unit) - offset;
+		flags |= XFS_EXCHANGE_RANGE_TO_EOF;
+	}
+
+	nextents = read_fd_bmap_range(scr, file_fd->fd, offset, len);
+	if (nextents <= 1)
+		return nextents < 0 ? -1 : 1;
+
+	for (extent = 0; extent < nextents; extent++) {
+		space.l_whence = SEEK_SET;
+		space.l_start = scr->outmap[extent].bmv_offset;
+		space.l_len = scr->outmap[extent].bmv_length;
+		if (ioctl(tfd, XFS_IOC_RESVSP64, &space) < 0) {
+			fsrprintf(_("could not pre-allocate tmp space: %s\n"),
+				  tname);
+			goto out_free;
+		}
+	}
+
+	new_nextents = read_fd_bmap_range(NULL, tfd, offset, len);
+	if (dflag)
+		fsrprintf(_("window at %lld: %d extents in tmp file (%d in original)\n"),
+			  (long long)offset, new_nextents, nextents);
+	if (new_nextents < 0)
+		goto out_free;
+	if (new_nextents >= nextents) {
+		retval = 1;
+		goto out_free;
+	}
+
+	if (packfile_copy_range(fname, scr->outmap, nextents, file_fd->fd,
+				tfd) != 0 &&
+	    copy_extents(fname, tname, scr->outmap, nextents, file_fd->fd,
+				tfd, fbuf, blksz_dio, dio_min) != 0)
+		goto out_free;
+
+	/* The tmp file has to be as large as the file for the exchange. */
+	if (ftruncate(tfd, st.st_size) < 0) {
+		fsrprintf(_("could not truncate tmpfile: %s : %s\n"),
+				fname, strerror(errno));
+		goto out_free;
+	}
+	if (fsync(tfd) < 0) {
+		fsrprintf(_("could not fsync tmpfile: %s : %s\n"),
+				fname, strerror(errno));
+		goto out_free;
+	}
+
+	xcr.length = len;
+	error = -xfrog_commitrange(file_fd->fd, &xcr, flags);
+	if (error == EBUSY) {
+		/* The file has changed since we started the copy */
+		if (vflag || dflag)
+			fsrprintf(_("%s: file modified defrag aborted\n"),
+				  fname);
+		goto out_free;
+	} else if (error) {
+		fsrprintf(_("XFS_IOC_COMMIT_RANGE failed: %s: %s\n"),
+			  fname, strerror(error));
+		goto out_free;
+	}
+
+	if (vflag > 1)
+		fsrprintf(_("%s: window at %lld: extents before:%d after:%d\n"),
+			  fname, (long long)offset, nextents, new_nextents);
+	retval = 0;
+
+out_free:
+	/* Give back whatever blocks the tmp file now holds in this window. */
+	space.l_whence = SEEK_SET;
+	space.l_start = offset;
+	space.l_len = win;
+	if (ioctl(tfd, XFS_IOC_UNRESVSP64, &space) < 0) {
+		fsrprintf(_("could not trunc tmp %s\n"), tname);
+		retval = -1;
+	}
+	return retval;
+}
+
+/*
+ * Defragment a large file one window at a time, starting with the most
+ * fragmented windows, so that we neither copy the parts of the file that are
+ * already in good shape nor need enough free space to hold the whole file.
+ *
+ * Return values:
+ * -1: Some error was encountered
+ *  0: Successfully defragmented at least one window of the file
+ *  1: No change / No Error
+ */
+static int
+packfile_windows(
+	struct fsr_scratch	*scr,
+	char			*fname,
+	char			*tname,
+	struct xfs_fd		*file_fd,
+	struct xfs_bulkstat	*statp,
+	struct fsxattr		*fsxp)
+{
+	struct fsr_window	*windows = NULL;
+	struct dioattr		dio;
+	unsigned int		nr_windows = 0;
+	unsigned int		i;
+	unsigned int		blksz_dio;
+	unsigned int		unit = fsr_alloc_unit(statp);
+	off_t			win;
+	void			*fbuf = NULL;
+	int			cur_nextents, new_nextents;
+	int			nr_done = 0;
+	int			tfd = -1;
+	int			retval = -1;
+	int			ret;
+
+	win = roundup_64(window_size, unit);
+	windows = rank_windows(scr, file_fd->fd, statp->bs_size, win,
+			&nr_windows, &cur_nextents);
+	if (!windows)
+		goto out;
+	if (nr_windows == 0) {
+		if (vflag)
+			fsrprintf(_("%s already fully defragmented.\n"), fname);
+		retval = 1; /* indicates no change/no error */
+		goto out;
+	}
+
+	if (dflag)
+		fsrprintf(_("%s extents=%d windows=%u window=%lld tmp=%s\n"),
+			  fname, cur_nextents, nr_windows, (long long)win,
+			  tname);
+
+	if ((tfd = open(tname, openopts, 0666)) < 0) {
+		if (vflag)
+			fsrprintf(_("could not open tmp file: %s: %s\n"),
+				   tname, strerror(errno));
+		goto out;
+	}
+	unlink(tname);
+
+	/* Setup extended inode flags, project identifier, etc */
+	if (fsxp->fsx_xflags || fsxp->fsx_projid) {
+		if (ioctl(tfd, FS_IOC_FSSETXATTR, fsxp) < 0) {
+			fsrprintf(_("could not set inode attrs on tmp: %s\n"),
+				tname);
+			goto out;
+		}
+	}
+
+	/* switch to the owner's id, to keep quota in line */
+	if (fchown(tfd, statp->bs_uid, statp->bs_gid) < 0) {
+		if (vflag)
+			fsrprintf(_("failed to fchown tmpfile %s: %s\n"),
+				   tname, strerror(errno));
+		goto out;
+	}
+
+	if ((ioctl(tfd, XFS_IOC_DIOINFO, &dio)) < 0 ) {
+		fsrprintf(_("could not get DirectIO info on tmp: %s\n"), tname);
+		goto out;
+	}
+
+	blksz_dio = min(dio.d_maxiosz, BUFFER_MAX - pagesize);
+	if (argv_blksz_dio != 0)
+		blksz_dio = min(argv_blksz_dio, blksz_dio);
+	blksz_dio = (min(win, blksz_dio) / dio.d_miniosz) * dio.d_miniosz;
+
+	if (!(fbuf = memalign(dio.d_mem, blksz_dio))) {
+		fsrprintf(_("could not allocate buf: %s\n"), tname);
+		goto out;
+	}
+
+	for (i = 0; i < nr_windows; i++) {
+		if (endtime && endtime < time(NULL))
+			break;
+
+		ret = packwindow(scr, fname, tname, file_fd, tfd,
+				windows[i].offset, win, unit, fbuf, blksz_dio,
+				dio.d_miniosz);
+		if (ret < 0)
+			goto out;
+		if (ret == 0)
+			nr_done++;
+	}
+
+	/* Report progress */
+	if (vflag) {
+		new_nextents = getnextents(file_fd->fd);
+		fsrprintf(_("extents before:%d after:%d windows:%d/%u %s\n"),
+			  cur_nextents, new_nextents, nr_done, nr_windows,
+			  fname);
+	}
+	retval = nr_done ? 0 : 1;
+
+out:
+	free(fbuf);
+	free(windows);
+	if (tfd != -1)
+		close(tfd);
+	return retval;
+}
+
 char *
 gettmpname(char *fname)
 {
@@ -1564,17 +2901,18 @@ getparent(char *fname)
 #define MAPSIZE	128
 #define	OUTMAP_SIZE_INCREMENT	MAPSIZE
 
-int read_fd_bmap(int fd, struct xfs_bulkstat *sin, int *cur_nextents)
+int read_fd_bmap(struct fsr_scratch *scr, int fd, struct xfs_bulkstat *sin,
+		 int *cur_nextents)
 {
 	int		i, cnt;
 	struct getbmap	map[MAPSIZE];
 
 #define	BUMP_CNT	\
-	if (++cnt >= outmap_size) { \
-		outmap_size += OUTMAP_SIZE_INCREMENT; \
-		outmap = (struct getbmap *)realloc(outmap, \
-		                           outmap_size*sizeof(*outmap)); \
-		if (outmap == NULL) { \
+	if (++cnt >= scr->outmap_size) { \
+		scr->outmap_size += OUTMAP_SIZE_INCREMENT; \
+		scr->outmap = (struct getbmap *)realloc(scr->outmap, \
+		                           scr->outmap_size*sizeof(*scr->outmap)); \
+		if (scr->outmap == NULL) { \
 			fsrprintf(_("realloc failed: %s\n"), \
 				strerror(errno)); \
 			exit(1); \
@@ -1584,19 +2922,20 @@ int read_fd_bmap(int fd, struct xfs_bulkstat *sin, int *cur_nextents)
 	/*	Initialize the outmap array.  It always grows - never shrinks.
 	 *	Left-over memory allocation is saved for the next files.
 	 */
-	if (outmap_size == 0) {
-		outmap_size = OUTMAP_SIZE_INCREMENT; /* Initial size */
-		outmap = (struct getbmap *)malloc(outmap_size*sizeof(*outmap));
-		if (!outmap) {
+	if (scr->outmap_size == 0) {
+		scr->outmap_size = OUTMAP_SIZE_INCREMENT; /* Initial size */
+		scr->outmap = (struct getbmap *)malloc(
+				scr->outmap_size * sizeof(*scr->outmap));
+		if (!scr->outmap) {
 			fsrprintf(_("malloc failed: %s\n"),
 				strerror(errno));
 			exit(1);
 		}
 	}
 
-	outmap[0].bmv_block = 0;
-	outmap[0].bmv_offset = 0;
-	outmap[0].bmv_length = sin->bs_size;
+	scr->outmap[0].bmv_block = 0;
+	scr->outmap[0].bmv_offset = 0;
+	scr->outmap[0].bmv_length = sin->bs_size;
 
 	/*
 	 * If a non regular file is involved then forget holes
@@ -1605,7 +2944,7 @@ int read_fd_bmap(int fd, struct xfs_bulkstat *sin, int *cur_nextents)
 	if (!S_ISREG(sin->bs_mode))
 		return(1);
 
-	outmap[0].bmv_length = 0;
+	scr->outmap[0].bmv_length = 0;
 
 	map[0].bmv_offset = 0;
 	map[0].bmv_block = 0;
@@ -1630,21 +2969,21 @@ int read_fd_bmap(int fd, struct xfs_bulkstat *sin, int *cur_nextents)
 		for (i = 0; i < map[0].bmv_entries; i++) {
 			if (map[i + 1].bmv_block == -1) {
 				BUMP_CNT;
-				outmap[cnt] = map[i+1];
-			} else if (outmap[cnt].bmv_block == -1) {
+				scr->outmap[cnt] = map[i+1];
+			} else if (scr->outmap[cnt].bmv_block == -1) {
 				BUMP_CNT;
-				outmap[cnt] = map[i+1];
+				scr->outmap[cnt] = map[i+1];
 			} else {
-				outmap[cnt].bmv_length += map[i + 1].bmv_length;
+				scr->outmap[cnt].bmv_length += map[i + 1].bmv_length;
 			}
 		}
 	} while (map[0].bmv_entries == (MAPSIZE-1));
 	for (i = 0; i <= cnt; i++) {
-		outmap[i].bmv_offset = BBTOB(outmap[i].bmv_offset);
-		outmap[i].bmv_length = BBTOB(outmap[i].bmv_length);
+		scr->outmap[i].bmv_offset = BBTOB(scr->outmap[i].bmv_offset);
+		scr->outmap[i].bmv_length = BBTOB(scr->outmap[i].bmv_length);
 	}
 
-	outmap[cnt].bmv_length = sin->bs_size - outmap[cnt].bmv_offset;
+	scr->outmap[cnt].bmv_length = sin->bs_size - scr->outmap[cnt].bmv_offset;
 
 	return(cnt+1);
 }
@@ -1678,6 +3017,74 @@ getnextents(int fd)
 	return(nextents);
 }
 
+/*
+ * Read in the written extents of the file that overlap the given byte range,
+ * trimmed to the range and converted to bytes.  Unlike read_fd_bmap, nothing
+ * is coalesced and holes are left out.  If scr is NULL we only count the
+ * extents.  Returns the number of extents or -1 for errors.
+ */
+static int
+read_fd_bmap_range(
+	struct fsr_scratch	*scr,
+	int			fd,
+	off_t			start,
+	off_t			len)
+{
+	struct getbmap		map[MAPSIZE];
+	off_t			end = start + len;
+	int			i, cnt = 0;
+
+	map[0].bmv_offset = BTOBBT(start);
+	map[0].bmv_block = 0;
+	map[0].bmv_entries = 0;
+	map[0].bmv_count = MAPSIZE;
+	map[0].bmv_length = BTOBB(end) - BTOBBT(start);
+
+	do {
+		if (ioctl(fd, XFS_IOC_GETBMAP, map) < 0) {
+			fsrprintf(_("failed reading extents: %s\n"),
+				  strerror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < map[0].bmv_entries; i++) {
+			off_t	off, next;
+
+			if (map[i + 1].bmv_block == -1)
+				continue;
+			off = max(BBTOB(map[i + 1].bmv_offset), start);
+			next = min(BBTOB(map[i + 1].bmv_offset +
+					 map[i + 1].bmv_length), end);
+			if (next <= off)
+				continue;
+
+			if (scr) {
+				if (cnt >= scr->outmap_size) {
+					struct getbmap	*p;
+
+					p = realloc(scr->outmap,
+						(scr->outmap_size +
+						 OUTMAP_SIZE_INCREMENT) *
+						sizeof(*scr->outmap));
+					if (!p) {
+						fsrprintf(_("realloc failed: %s\n"),
+							strerror(errno));
+						return -1;
+					}
+					scr->outmap = p;
+					scr->outmap_size += OUTMAP_SIZE_INCREMENT;
+				}
+				scr->outmap[cnt] = map[i + 1];
+				scr->outmap[cnt].bmv_offset = off;
+				scr->outmap[cnt].bmv_length = next - off;
+			}
+			cnt++;
+		}
+	} while (map[0].bmv_entries == (MAPSIZE-1));
+
+	return cnt;
+}
+
 /*
  * Get xfs realtime space information
  */
@@ -1770,6 +3177,60 @@ tmp_init(char *mnt)
 	return;
 }
 
+/*
+ * Figure out which AG each tmp directory actually landed in.  Files are
+ * allocated in the same AG as their parent directory, so this lets us put a
+ * tmp file (and hence the new extents) in whichever AG we want.
+ */
+static int	*tmp_agdirs;
+
+static void
+tmp_map_ags(struct xfs_fd *xfd, char *mnt)
+{
+	static char	buf[SMBUFSZ];
+	struct stat	sb;
+	xfs_agnumber_t	agno;
+	int		i;
+
+	free(tmp_agdirs);
+	tmp_agdirs = malloc(fsgeom.agcount * sizeof(int));
+	if (!tmp_agdirs)
+		return;
+
+	for (i = 0; i < fsgeom.agcount; i++)
+		tmp_agdirs[i] = -1;
+
+	for (i = 0; i < fsgeom.agcount; i++) {
+		sprintf(buf, "%s/.fsr/ag%d", mnt, i);
+		if (stat(buf, &sb) < 0)
+			continue;
+		agno = cvt_ino_to_agno(xfd, sb.st_ino);
+		if (agno < fsgeom.agcount && tmp_agdirs[agno] < 0)
+			tmp_agdirs[agno] = i;
+	}
+}
+
+/*
+ * Get a tmp file name in this AG for the caller's buffer.  The id keeps the
+ * names used by concurrent callers apart.
+ */
+static char *
+tmp_next_ag(char *buf, char *mnt, xfs_agnumber_t agno, unsigned int id)
+{
+	int		dir = agno;
+
+	if (tmp_agdirs && tmp_agdirs[agno] >= 0)
+		dir = tmp_agdirs[agno];
+
+	sprintf(buf, "%s/.fsr/ag%d/tmp%d.%u",
+	        ( (strcmp(mnt, "/") == 0) ? "" : mnt),
+	        dir,
+	        getpid(),
+	        id);
+
+	return(buf);
+}
+
 static char *
 tmp_next(char *mnt)
 {
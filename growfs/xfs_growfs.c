@@ -5,8 +5,11 @@
  */
 
 #include "libxfs.h"
+#include <linux/fs.h>
 #include "libfrog/paths.h"
 #include "libfrog/fsgeom.h"
+#include "libfrog/platform.h"
+#include "libfrog/workqueue.h"
 
 static void
 usage(void)
@@ -18,6 +21,8 @@ Options:\n\
 	-l          grow log section\n\
 	-r          grow realtime section\n\
 	-n          don't change anything, just show geometry\n\
+	-P          don't change anything, show what growing would write\n\
+	-Z          zero the new part of the data or rt section before growing\n\
 	-i          convert log from external to internal format\n\
 	-t          alternate location for mount table (/etc/mtab)\n\
 	-x          convert log from internal to external format\n\
@@ -31,6 +36,256 @@ Options:\n\
 	exit(2);
 }
 
+/*
+ * Read the superblock and set up enough of an xfs_mount to work out the
+ * geometry and log reservations of the grown filesystem.  The filesystem is
+ * mounted, so nothing but the geometry can be trusted, and the caller must
+ * unmount this again before it touches the filesystem.
+ */
+static struct xfs_mount *
+plan_mount(
+	struct libxfs_init	*xi)
+{
+	static struct xfs_mount	xmount;
+	struct xfs_buf		*bp;
+	struct xfs_sb		sb;
+	int			error;
+
+	libxfs_buftarg_init(&xmount, xi);
+	error = -libxfs_buf_read_uncached(xmount.m_ddev_targp, XFS_SB_DADDR,
+			1 << (XFS_MAX_SECTORSIZE_LOG - BBSHIFT), 0, &bp, NULL);
+	if (error) {
+		fprintf(stderr, _("%s: cannot read superblock: %s\n"),
+			progname, strerror(error));
+		return NULL;
+	}
+	libxfs_sb_from_disk(&sb, bp->b_addr);
+	libxfs_buf_relse(bp);
+
+	return libxfs_mount(&xmount, &sb, xi, LIBXFS_MOUNT_DEBUGGER);
+}
+
+/*
+ * Work out the AG count the kernel will end up with, and trim the new size
+ * the same way it does if the last AG would be too small to be used.
+ */
+static xfs_agnumber_t
+plan_agcount(
+	struct xfs_fsop_geom	*geo,
+	long long		*dsize)
+{
+	long long		nagcount = *dsize / geo->agblocks;
+	long long		mod = *dsize % geo->agblocks;
+
+	if (mod && mod >= XFS_MIN_AG_BLOCKS)
+		nagcount++;
+	else if (mod)
+		*dsize = nagcount * geo->agblocks;
+	if (nagcount > (long long)XFS_MAX_AGNUMBER + 1) {
+		nagcount = (long long)XFS_MAX_AGNUMBER + 1;
+		*dsize = nagcount * geo->agblocks;
+	}
+	return nagcount;
+}
+
+static void
+plan_data(
+	struct xfs_mount	*mp,
+	struct xfs_fsop_geom	*geo,
+	long long		dsize,
+	bool			zero)
+{
+	xfs_agnumber_t		nagcount = plan_agcount(geo, &dsize);
+	xfs_agnumber_t		newags;
+	long long		lastag, nlastag;
+	unsigned long long	agbytes, sbbytes;
+	unsigned int		roots = 3;	/* bnobt, cntbt, inobt */
+
+	if (dsize <= geo->datablocks) {
+		printf(_("data: no new space to plan for\n"));
+		return;
+	}
+
+	if (geo->flags & XFS_FSOP_GEOM_FLAGS_FINOBT)
+		roots++;
+	if (geo->flags & XFS_FSOP_GEOM_FLAGS_RMAPBT)
+		roots++;
+	if (geo->flags & XFS_FSOP_GEOM_FLAGS_REFLINK)
+		roots++;
+
+	newags = nagcount - geo->agcount;
+	lastag = geo->datablocks - (long long)(geo->agcount - 1) * geo->agblocks;
+	nlastag = newags ? geo->agblocks :
+			dsize - (long long)(geo->agcount - 1) * geo->agblocks;
+
+	/*
+	 * Each new AG gets a superblock, AGF, AGFL and AGI sector and an empty
+	 * root block for each of its btrees.  Once the new AGs are in, every
+	 * secondary superblock is rewritten with the new geometry.
+	 */
+	agbytes = 4ULL * geo->sectsize + (unsigned long long)roots *
+			geo->blocksize;
+	sbbytes = (unsigned long long)(nagcount - 1) * geo->sectsize;
+
+	printf(_("data: %lld -> %lld blocks, %u -> %u AGs (%u new)\n"),
+		(long long)geo->datablocks, dsize, geo->agcount, nagcount,
+		newags);
+	if (nlastag != lastag)
+		printf(_("      last AG grows from %lld to %lld blocks\n"),
+			lastag, nlastag);
+	printf(_("      new AG headers: %u x %llu bytes = %llu bytes\n"),
+		newags, agbytes, newags * agbytes);
+	printf(_("      secondary superblocks: %u x %u bytes = %llu bytes\n"),
+		nagcount - 1, geo->sectsize, sbbytes);
+	printf(_("      metadata written: %llu bytes\n"),
+		newags * agbytes + sbbytes);
+	if (mp)
+		printf(
+	_("      log: 1 transaction, reservation %u bytes\n"),
+			M_RES(mp)->tr_growdata.tr_logres);
+	printf(_("      new space: %llu bytes%s\n"),
+		(unsigned long long)(dsize - geo->datablocks) * geo->blocksize,
+		zero ? _(", zeroed before growing") : "");
+}
+
+static void
+plan_rt(
+	struct xfs_mount	*mp,
+	struct xfs_fsop_geom	*geo,
+	long long		rsize,
+	long			esize)
+{
+	xfs_rtbxlen_t		orext, nrext;
+	xfs_filblks_t		orbm, nrbm, orsum, nrsum;
+	unsigned long long	blocks, allocs, steps;
+
+	if (!mp) {
+		printf(_("realtime: cannot plan without the superblock\n"));
+		return;
+	}
+
+	orext = geo->rtblocks / geo->rtextsize;
+	nrext = rsize / esize;
+	orbm = mp->m_sb.sb_rbmblocks;
+	nrbm = libxfs_rtbitmap_blockcount(mp, nrext);
+	orsum = libxfs_rtsummary_blockcount(mp, mp->m_rsumlevels, orbm);
+	nrsum = libxfs_rtsummary_blockcount(mp,
+			libxfs_compute_rextslog(nrext) + 1, nrbm);
+
+	/*
+	 * The kernel allocates the new bitmap and summary blocks, with at
+	 * least one transaction for each of the two files that grows, and
+	 * zeroes them with one transaction per block.  It then frees the new
+	 * extents one bitmap block at a time, starting with the old last
+	 * bitmap block if that was only partly used, with one transaction per
+	 * bitmap block.
+	 */
+	blocks = (nrbm - orbm) + (nrsum > orsum ? nrsum - orsum : 0);
+	allocs = (nrbm > orbm) + (nrsum > orsum);
+	steps = (nrbm - orbm) +
+		(orext % ((xfs_rtbxlen_t)geo->blocksize * NBBY) != 0);
+
+	printf(_("realtime: %lld -> %lld extents\n"), (long long)orext,
+		(long long)nrext);
+	printf(_("      bitmap blocks: %llu -> %llu, summary blocks: %llu -> %llu\n"),
+		(unsigned long long)orbm, (unsigned long long)nrbm,
+		(unsigned long long)orsum, (unsigned long long)nrsum);
+	printf(_("      metadata written: about %llu bytes\n"),
+		(unsigned long long)(nrbm + nrsum) * geo->blocksize);
+	printf(_("      log: about %llu transactions, up to %u bytes each\n"),
+		allocs + blocks + steps,
+		max(M_RES(mp)->tr_growrtfree.tr_logres,
+		    max(M_RES(mp)->tr_growrtalloc.tr_logres,
+			M_RES(mp)->tr_growrtzero.tr_logres)));
+}
+
+#define ZERO_STEP	(1ULL << 30)	/* bytes zeroed per work item */
+
+struct zero_ctx {
+	int			fd;
+	unsigned long long	start;
+	unsigned long long	end;
+	pthread_mutex_t		lock;
+	int			error;
+};
+
+static void
+zero_worker(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct zero_ctx		*zc = arg;
+	uint64_t		range[2];
+
+	range[0] = zc->start + (unsigned long long)index * ZERO_STEP;
+	range[1] = min(ZERO_STEP, zc->end - range[0]);
+	if (ioctl(zc->fd, BLKZEROOUT, &range) < 0) {
+		pthread_mutex_lock(&zc->lock);
+		if (!zc->error)
+			zc->error = errno;
+		pthread_mutex_unlock(&zc->lock);
+	}
+}
+
+/*
+ * Zero the part of a device that the grow will add, in parallel, so that
+ * thinly provisioned storage is allocated and any I/O errors show up before
+ * the filesystem depends on the new space.  The device belongs to a mounted
+ * filesystem, and kernels built without CONFIG_BLK_DEV_WRITE_MOUNTED will
+ * not let us open it for writing.  Zeroing is only a precaution, so in that
+ * case we say so and grow anyway.
+ */
+static int
+zero_range(
+	const char		*dev,
+	unsigned long long	start,
+	unsigned long long	end)
+{
+	struct zero_ctx		zc = { 0 };
+	struct workqueue	wq;
+	unsigned long long	nr, i;
+	int			error;
+
+	zc.start = start;
+	zc.end = end;
+	if (zc.end <= zc.start)
+		return 0;
+
+	zc.fd = open(dev, O_RDWR);
+	if (zc.fd < 0) {
+		fprintf(stderr,
+	_("%s: cannot open %s to zero the new space: %s; growing without it\n"),
+			progname, dev, strerror(errno));
+		return 0;
+	}
+	pthread_mutex_init(&zc.lock, NULL);
+
+	nr = (zc.end - zc.start + ZERO_STEP - 1) / ZERO_STEP;
+	error = -workqueue_create(&wq, NULL,
+			min((unsigned long long)platform_nproc(), nr));
+	if (!error) {
+		for (i = 0; i < nr && !error; i++)
+			error = -workqueue_add(&wq, zero_worker, i, &zc);
+		if (!error)
+			error = -workqueue_terminate(&wq);
+		else
+			workqueue_terminate(&wq);
+		workqueue_destroy(&wq);
+	}
+	if (!error)
+		error = zc.error;
+	if (!error)
+		error = fsync(zc.fd) ? errno : 0;
+	if (error)
+		fprintf(stderr, _("%s: cannot zero new space on %s: %s\n"),
+			progname, dev, strerror(error));
+
+	pthread_mutex_destroy(&zc.lock);
+	close(zc.fd);
+	return error ? 1 : 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -52,6 +307,9 @@ main(int argc, char **argv)
 	int			maxpct;	/* -m flag value */
 	int			mflag;	/* -m flag */
 	int			nflag;	/* -n flag */
+	int			pflag;	/* -P flag */
+	int			zflag;	/* -Z flag */
+	struct xfs_mount	*mp = NULL; /* for planning */
 	struct xfs_fsop_geom	ngeo;	/* new fs geometry */
 	int			rflag;	/* -r flag */
 	long long		rsize;	/* new rt size in fs blocks */
@@ -73,8 +331,9 @@ main(int argc, char **argv)
 	maxpct = esize = 0;
 	dsize = lsize = rsize = 0LL;
 	aflag = dflag = iflag = lflag = mflag = nflag = rflag = xflag = 0;
+	pflag = zflag = 0;
 
-	while ((c = getopt(argc, argv, "dD:e:ilL:m:np:rR:t:xV")) != EOF) {
+	while ((c = getopt(argc, argv, "dD:e:ilL:m:nPp:rR:t:xVZ")) != EOF) {
 		switch (c) {
 		case 'D':
 			dsize = strtoll(optarg, NULL, 10);
@@ -102,6 +361,9 @@ main(int argc, char **argv)
 		case 'n':
 			nflag = 1;
 			break;
+		case 'P':
+			nflag = pflag = 1;
+			break;
 		case 'p':
 			progname = optarg;
 			break;
@@ -117,6 +379,9 @@ main(int argc, char **argv)
 		case 'x':
 			lflag = xflag = 1;
 			break;
+		case 'Z':
+			zflag = 1;
+			break;
 		case 'V':
 			printf(_("%s version %s\n"), progname, VERSION);
 			exit(0);
@@ -211,6 +476,14 @@ main(int argc, char **argv)
 
 	xfs_report_geom(&geo, datadev, logdev, rtdev);
 
+	if (pflag) {
+		mp = plan_mount(&xi);
+		if (!mp)
+			fprintf(stderr,
+	_("%s: cannot estimate log reservations for %s\n"),
+				progname, fname);
+	}
+
 	ddsize = xi.data.size;
 	dlsize = (xi.log.size ? xi.log.size :
 			geo.logblocks * (geo.blocksize / BBSIZE) );
@@ -258,6 +531,13 @@ _("[EXPERIMENTAL] try to shrink unused space %lld, old size is %lld\n"),
 			if (mflag)
 				fprintf(stderr, _(
 					"inode max pct unchanged, skipping\n"));
+		} else if (!error && pflag) {
+			plan_data(mp, &geo, dsize, zflag);
+		} else if (!error && !nflag && zflag &&
+			   zero_range(datadev,
+				(unsigned long long)geo.datablocks * geo.blocksize,
+				(unsigned long long)dsize * geo.blocksize)) {
+			error = 1;
 		} else if (!error && !nflag) {
 			in.newblocks = (__u64)dsize;
 			in.imaxpct = (__u32)maxpct;
@@ -297,6 +577,13 @@ _("[EXPERIMENTAL] try to shrink unused space %lld, old size is %lld\n"),
 			if (rflag)
 				fprintf(stderr, _(
 					"realtime size unchanged, skipping\n"));
+		} else if (!error && pflag) {
+			plan_rt(mp, &geo, rsize, esize);
+		} else if (!error && !nflag && zflag &&
+			   zero_range(rtdev,
+				(unsigned long long)geo.rtblocks * geo.blocksize,
+				(unsigned long long)rsize * geo.blocksize)) {
+			error = 1;
 		} else if (!error && !nflag) {
 			in.newblocks = (__u64)rsize;
 			in.extsize = (__u32)esize;
@@ -353,6 +640,9 @@ _("[EXPERIMENTAL] try to shrink unused space %lld, old size is %lld\n"),
 		}
 	}
 
+	if (mp)
+		libxfs_umount(mp);
+
 	ret = -xfrog_geometry(ffd, &ngeo);
 	if (ret) {
 		fprintf(stderr, _("%s: XFS_IOC_FSGEOMETRY xfsctl failed: %s\n"),
@@ -90,6 +90,7 @@ struct iomap;
 #include "xfs_symlink_remote.h"
 #include "libxfs/xfile.h"
 #include "libxfs/buf_mem.h"
+#include "libxfs/buf_stats.h"
 #include "xfs_btree_mem.h"
 #include "xfs_parent.h"
 #include "xfs_ag_resv.h"
@@ -67,6 +67,7 @@ extern void xlog_panic(char *fmt,...);
 extern int	print_exit;
 extern int	print_skip_uuid;
 extern int	print_record_header;
+extern int	print_crc_warn;
 
 void xlog_init(struct xfs_mount *mp, struct xlog *log);
 int xlog_is_dirty(struct xfs_mount *mp, struct xlog *log);
@@ -96,8 +97,42 @@ extern void	xlog_recover_print_trans(struct xlog_recover *trans,
 				struct list_head *itemq, int print);
 extern int	xlog_do_recovery_pass(struct xlog *log, xfs_daddr_t head_blk,
 				xfs_daddr_t tail_blk, int pass);
+extern int	xlog_do_recovery_pass_parallel(struct xlog *log,
+				xfs_daddr_t head_blk, xfs_daddr_t tail_blk,
+				int pass, unsigned int nr_threads);
+extern int	xlog_valid_rec_header(struct xlog *log,
+				struct xlog_rec_header *rhead,
+				xfs_daddr_t blkno);
+extern int	xlog_unpack_data(struct xlog_rec_header *rhead, char *dp,
+				struct xlog *log);
+extern int	xlog_recover_process_data(struct xlog *log,
+				struct hlist_head rhash[],
+				struct xlog_rec_header *rhead, char *dp,
+				int pass);
 extern int	xlog_recover_do_trans(struct xlog *log, struct xlog_recover *trans,
 				int pass);
+/* userspace log replay */
+struct xlog_replay_stats {
+	uint64_t	nr_trans;	/* transactions replayed */
+	uint64_t	nr_buffers;	/* buffer items written */
+	uint64_t	nr_inodes;	/* inode items written */
+	uint64_t	nr_dquots;	/* dquot items written */
+	uint64_t	nr_icreates;	/* inode chunks initialised */
+	uint64_t	nr_cancelled;	/* items for cancelled buffers */
+	uint64_t	nr_skipped;	/* items already on disk */
+	uint64_t	nr_intents;	/* EFIs and RUIs without a done item */
+	uint64_t	nr_unfinished;	/* other intents without a done item */
+};
+
+extern int	xlog_replay_scan(struct xlog *log, xfs_daddr_t head_blk,
+				xfs_daddr_t tail_blk,
+				struct xlog_replay_stats *stats);
+extern int	xlog_replay(struct xlog *log, xfs_daddr_t head_blk,
+				xfs_daddr_t tail_blk);
+extern void	xlog_replay_free(void);
+extern int	xlog_replay_trans(struct xlog *log, struct xlog_recover *trans,
+				int pass);
+
 extern int	xlog_header_check_recover(xfs_mount_t *mp,
 				xlog_rec_header_t *head);
 extern int	xlog_header_check_mount(xfs_mount_t *mp,
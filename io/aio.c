@@ -0,0 +1,828 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include "command.h"
+#include "input.h"
+#include "init.h"
+#include "io.h"
+#include "latency.h"
+
+static cmdinfo_t aio_cmd;
+
+static void
+aio_help(void)
+{
+	printf(_(
+"\n"
+" runs an asynchronous I/O benchmark against the open file(s)\n"
+"\n"
+" Example:\n"
+" 'aio -j 4 -d 32 -M 70 -R 0 1g' - four jobs, each keeping 32 I/Os in flight,\n"
+"                                  issue 70%% reads and 30%% writes at random\n"
+"                                  offsets in the first gigabyte of the file\n"
+"\n"
+" Each job submits I/O through its own io_uring and keeps up to the queue\n"
+" depth of requests in flight.  By default every job covers its own share of\n"
+" the range once, in sequential blocks; the -n and -T options run for a fixed\n"
+" number of operations or a fixed time instead, wrapping around the range.\n"
+" The latency of every operation is measured from submission to completion,\n"
+" and the distribution is reported separately for reads and writes.\n"
+" If the file was opened for direct I/O, the block size, offset and buffer\n"
+" alignment are checked against the XFS_IOC_DIOINFO constraints.\n"
+" -a   -- spread the jobs over all the open files, not just the current one\n"
+" -b N -- block size of each I/O (default is the filesystem block size)\n"
+" -d N -- number of I/Os each job keeps in flight (default 1)\n"
+" -j N -- number of concurrent jobs (default 1)\n"
+" -M N -- percentage of I/Os that are reads, the rest are writes (default 100)\n"
+" -n N -- number of I/Os each job issues\n"
+" -T N -- run for N seconds\n"
+" -R   -- use random offsets within the range instead of sequential ones\n"
+" -Z N -- zeed the random number generator\n"
+" -S N -- use an alternate seed number for filling the write buffer\n"
+" -A   -- submit writes with RWF_ATOMIC\n"
+" -D   -- submit writes with RWF_DSYNC\n"
+" -N   -- submit all I/O with RWF_NOWAIT; EAGAIN completions are counted\n"
+" -C   -- print the results in compact form\n"
+" -q   -- quiet mode, do not write anything to standard output\n"
+"\n"));
+}
+
+struct aio_ring {
+	int			fd;
+	unsigned int		entries;
+
+	void			*sq_ptr;
+	size_t			sq_len;
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_len;
+
+	void			*cq_ptr;
+	size_t			cq_len;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+/* One in-flight I/O. */
+struct aio_slot {
+	struct timespec		start;
+	void			*buf;
+	int			write;
+};
+
+struct aio_stats {
+	struct iolat_stats	lat;
+	long long		ops;
+	long long		bytes;
+};
+
+struct aio_job {
+	pthread_t		thread;
+	struct aio_ring		ring;
+
+	/* what to do */
+	fileio_t		*file;
+	long long		start;
+	long long		len;
+	long long		nr_ops;
+	size_t			bsize;
+	unsigned int		depth;
+	unsigned int		readpct;
+	int			random;
+	uint64_t		rng;
+	int			rw_flags;
+	int			wr_flags;
+	void			*wbuf;
+
+	/* runtime state */
+	struct aio_slot		*slots;
+	unsigned int		*free_slots;
+	unsigned int		nr_free;
+	long long		cursor;
+	long long		submitted;
+
+	/* results */
+	struct aio_stats	rd;
+	struct aio_stats	wr;
+	long long		eagain;
+	int			error;
+	const char		*errop;
+	bool			stuck;		/* I/O may still be in flight */
+};
+
+static struct timespec	aio_deadline;
+static int		aio_timed;
+
+static inline int
+aio_ring_setup(
+	unsigned int		entries,
+	struct io_uring_params	*p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+aio_ring_enter(
+	int			fd,
+	unsigned int		to_submit,
+	unsigned int		min_complete,
+	unsigned int		flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+			NULL, 0);
+}
+
+static void
+aio_ring_free(
+	struct aio_ring		*ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr)
+		munmap(ring->sq_ptr, ring->sq_len);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+/* Set up an io_uring and map its queues.  Returns 0 or an errno. */
+static int
+aio_ring_init(
+	struct aio_ring		*ring,
+	unsigned int		entries)
+{
+	struct io_uring_params	p = { .flags = IORING_SETUP_CLAMP };
+	int			error;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = aio_ring_setup(entries, &p);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return errno;
+	}
+	ring->entries = p.sq_entries;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries *
+			sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_len = ring->cq_len = max(ring->sq_len, ring->cq_len);
+
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		ring->sq_ptr = NULL;
+		goto out_errno;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd,
+				IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			ring->cq_ptr = NULL;
+			goto out_errno;
+		}
+	}
+
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto out_errno;
+	}
+
+	ring->sq_head = ring->sq_ptr + p.sq_off.head;
+	ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+	ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ptr + p.sq_off.array;
+	ring->cq_head = ring->cq_ptr + p.cq_off.head;
+	ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+	ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+	ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+	return 0;
+
+out_errno:
+	error = errno;
+	aio_ring_free(ring);
+	return error;
+}
+
+static void
+aio_stats_add(
+	struct aio_stats	*st,
+	long long		ns,
+	long long		bytes)
+{
+	iolat_stats_add(&st->lat, ns);
+	st->ops++;
+	st->bytes += bytes;
+}
+
+static void
+aio_stats_import(
+	struct aio_stats	*dest,
+	const struct aio_stats	*src)
+{
+	iolat_stats_import(&dest->lat, &src->lat);
+	dest->ops += src->ops;
+	dest->bytes += src->bytes;
+}
+
+/* xorshift64*, so that each job has its own random stream */
+static inline uint64_t
+aio_random(
+	struct aio_job		*job)
+{
+	job->rng ^= job->rng >> 12;
+	job->rng ^= job->rng << 25;
+	job->rng ^= job->rng >> 27;
+	return job->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static long long
+aio_next_offset(
+	struct aio_job		*job)
+{
+	long long		nblocks = job->len / job->bsize;
+	long long		off;
+
+	if (job->random)
+		return job->start + (aio_random(job) % nblocks) * job->bsize;
+
+	off = job->start + job->cursor;
+	job->cursor += job->bsize;
+	if (job->cursor + job->bsize > job->len)
+		job->cursor = 0;
+	return off;
+}
+
+static bool
+aio_job_more(
+	struct aio_job		*job,
+	const struct timespec	*now)
+{
+	if (job->error)
+		return false;
+	if (aio_timed)
+		return iolat_nsec(now, &aio_deadline) > 0;
+	return job->submitted < job->nr_ops;
+}
+
+/* Fill the submission queue with as many I/Os as we're allowed. */
+static unsigned int
+aio_job_fill(
+	struct aio_job		*job)
+{
+	struct aio_ring		*ring = &job->ring;
+	unsigned int		tail = *ring->sq_tail;
+	unsigned int		queued = 0;
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (job->nr_free > 0 && aio_job_more(job, &now)) {
+		unsigned int		idx = job->free_slots[--job->nr_free];
+		struct aio_slot		*slot = &job->slots[idx];
+		struct io_uring_sqe	*sqe;
+
+		slot->write = (aio_random(job) % 100) >= job->readpct;
+		slot->start = now;
+
+		sqe = &ring->sqes[tail & *ring->sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = slot->write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = job->file->fd;
+		sqe->off = aio_next_offset(job);
+		sqe->addr = (unsigned long)(slot->write ? job->wbuf : slot->buf);
+		sqe->len = job->bsize;
+		sqe->rw_flags = job->rw_flags |
+				(slot->write ? job->wr_flags : 0);
+		sqe->user_data = idx;
+		ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+		tail++;
+		queued++;
+		job->submitted++;
+	}
+
+	/* make the sqes visible before the kernel can see the new tail */
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+	return queued;
+}
+
+/* Collect all the completions that have arrived. */
+static void
+aio_job_reap(
+	struct aio_job		*job)
+{
+	struct aio_ring		*ring = &job->ring;
+	unsigned int		head = *ring->cq_head;
+	unsigned int		tail;
+	struct timespec		now;
+
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (; head != tail; head++) {
+		struct io_uring_cqe	*cqe = &ring->cqes[head & *ring->cq_mask];
+		unsigned int		idx = cqe->user_data;
+		struct aio_slot		*slot = &job->slots[idx];
+		long long		ns = iolat_nsec(&slot->start, &now);
+
+		job->free_slots[job->nr_free++] = idx;
+		if (cqe->res == -EAGAIN && (job->rw_flags & RWF_NOWAIT)) {
+			job->eagain++;
+			continue;
+		}
+		if (cqe->res < 0) {
+			if (!job->error) {
+				job->error = -cqe->res;
+				job->errop = slot->write ? "write" : "read";
+			}
+			continue;
+		}
+		aio_stats_add(slot->write ? &job->wr : &job->rd, ns,
+				cqe->res);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait for every I/O the kernel has taken off the submission queue to
+ * complete, so that nothing can still be writing into our buffers when they
+ * are freed.  SQEs the kernel never consumed are thrown away with the ring.
+ * Returns false if the ring stops working before the I/O has drained.
+ */
+static bool
+aio_job_drain(
+	struct aio_job		*job)
+{
+	struct aio_ring		*ring = &job->ring;
+	unsigned int		unsubmitted;
+
+	for (;;) {
+		aio_job_reap(job);
+		unsubmitted = *ring->sq_tail -
+			      __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if (job->nr_free + unsubmitted == job->depth)
+			return true;
+
+		if (aio_ring_enter(ring->fd, 0, 1,
+				IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			return false;
+	}
+}
+
+static void *
+aio_job_run(
+	void			*arg)
+{
+	struct aio_job		*job = arg;
+	unsigned int		pending = 0;
+	int			ret;
+
+	for (;;) {
+		pending += aio_job_fill(job);
+		if (pending == 0 && job->nr_free == job->depth)
+			break;
+
+		ret = aio_ring_enter(job->ring.fd, pending, 1,
+				IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EBUSY) {
+				aio_job_reap(job);
+				continue;
+			}
+			job->error = errno;
+			job->errop = "io_uring_enter";
+			job->stuck = !aio_job_drain(job);
+			break;
+		}
+		pending -= ret;
+		aio_job_reap(job);
+	}
+	return NULL;
+}
+
+static void
+aio_job_free(
+	struct aio_job		*job)
+{
+	unsigned int		i;
+
+	/*
+	 * If we couldn't wait for the I/O to finish, the kernel may still
+	 * write into the buffers, so leak them rather than hand them back.
+	 */
+	if (job->slots && !job->stuck) {
+		for (i = 0; i < job->depth; i++)
+			free(job->slots[i].buf);
+	}
+	free(job->slots);
+	free(job->free_slots);
+	if (!job->stuck)
+		free(job->wbuf);
+	iolat_stats_free(&job->rd.lat);
+	iolat_stats_free(&job->wr.lat);
+	aio_ring_free(&job->ring);
+}
+
+/*
+ * Work out the buffer alignment for a file.  Direct I/O to an XFS file must
+ * also obey the size and offset constraints reported by XFS_IOC_DIOINFO.
+ */
+static int
+aio_file_align(
+	fileio_t		*f,
+	long long		offset,
+	size_t			bsize,
+	size_t			*align)
+{
+	struct dioattr		dio;
+
+	*align = pagesize;
+	if (!(f->flags & IO_DIRECT) || (f->flags & IO_FOREIGN))
+		return 0;
+
+	if (xfsctl(f->name, f->fd, XFS_IOC_DIOINFO, &dio) < 0) {
+		perror("XFS_IOC_DIOINFO");
+		return -1;
+	}
+	if (bsize % dio.d_miniosz || bsize > dio.d_maxiosz) {
+		printf(
+_("%s: block size %zu must be a multiple of %u and no more than %u for direct I/O\n"),
+			f->name, bsize, dio.d_miniosz, dio.d_maxiosz);
+		return -1;
+	}
+	if (offset % dio.d_miniosz) {
+		printf(
+_("%s: offset %lld must be a multiple of %u for direct I/O\n"),
+			f->name, offset, dio.d_miniosz);
+		return -1;
+	}
+	*align = max(*align, (size_t)dio.d_mem);
+	return 0;
+}
+
+static int
+aio_job_init(
+	struct aio_job		*job,
+	unsigned int		depth,
+	size_t			align,
+	unsigned int		seed)
+{
+	unsigned int		i;
+	int			error;
+
+	job->ring.fd = -1;
+	error = aio_ring_init(&job->ring, depth);
+	if (error) {
+		errno = error;
+		perror("io_uring_setup");
+		return -1;
+	}
+	job->depth = min(depth, job->ring.entries);
+
+	error = iolat_stats_init(&job->rd.lat);
+	if (!error)
+		error = iolat_stats_init(&job->wr.lat);
+	if (error) {
+		errno = error;
+		perror("histogram");
+		return -1;
+	}
+
+	job->slots = calloc(job->depth, sizeof(struct aio_slot));
+	job->free_slots = calloc(job->depth, sizeof(unsigned int));
+	if (!job->slots || !job->free_slots) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < job->depth; i++) {
+		job->slots[i].buf = memalign(align, job->bsize);
+		if (!job->slots[i].buf) {
+			perror("memalign");
+			return -1;
+		}
+		job->free_slots[i] = i;
+	}
+	job->nr_free = job->depth;
+
+	job->wbuf = memalign(align, job->bsize);
+	if (!job->wbuf) {
+		perror("memalign");
+		return -1;
+	}
+	memset(job->wbuf, seed, job->bsize);
+	return 0;
+}
+
+static void
+aio_report(
+	const char		*verb,
+	struct aio_stats	*st,
+	struct timeval		*t,
+	long long		offset,
+	int			Cflag)
+{
+	if (!st->ops)
+		return;
+
+	report_io_times(verb, t, offset, st->bytes, st->bytes,
+			min(st->ops, (long long)INT_MAX), Cflag);
+	iolat_stats_print(verb, &st->lat, Cflag ? IOLAT_CSV : 0);
+}
+
+static int
+aio_f(
+	int			argc,
+	char			**argv)
+{
+	struct aio_job		*jobs;
+	struct aio_stats	rd = { }, wr = { };
+	struct timeval		t1, t2;
+	size_t			fsblocksize, fssectsize;
+	size_t			bsize, align;
+	long long		offset, count, nr_ops = 0, tmp;
+	long long		eagain = 0;
+	unsigned int		nr_jobs = 1, depth = 1, readpct = 100;
+	unsigned int		nr_files, seconds = 0;
+	unsigned int		zeed = 0, seed = 0xcdcdcdcd;
+	unsigned int		i, started;
+	int			rw_flags = 0, wr_flags = 0;
+	int			aflag = 0, Cflag = 0, qflag = 0, Rflag = 0;
+	int			c, error;
+	char			*sp;
+
+	init_cvtnum(&fsblocksize, &fssectsize);
+	bsize = fsblocksize;
+
+	while ((c = getopt(argc, argv, "Aab:Cd:Dj:M:n:NqRS:T:Z:")) != EOF) {
+		switch (c) {
+		case 'a':
+			aflag = 1;
+			break;
+		case 'A':
+			wr_flags |= RWF_ATOMIC;
+			break;
+		case 'b':
+			tmp = cvtnum(fsblocksize, fssectsize, optarg);
+			if (tmp <= 0) {
+				printf(_("non-numeric bsize -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			bsize = tmp;
+			break;
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'd':
+			depth = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || *sp || depth == 0) {
+				printf(_("bad queue depth -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'D':
+			wr_flags |= RWF_DSYNC;
+			break;
+		case 'j':
+			nr_jobs = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || *sp || nr_jobs == 0) {
+				printf(_("bad job count -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'M':
+			readpct = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || *sp || readpct > 100) {
+				printf(_("bad read percentage -- %s\n"),
+						optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'n':
+			nr_ops = cvtnum(fsblocksize, fssectsize, optarg);
+			if (nr_ops <= 0) {
+				printf(_("bad operation count -- %s\n"),
+						optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'N':
+			rw_flags |= RWF_NOWAIT;
+			break;
+		case 'q':
+			qflag = 1;
+			break;
+		case 'R':
+			Rflag = 1;
+			break;
+		case 'S':
+			seed = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric seed -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'T':
+			seconds = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg || *sp || seconds == 0) {
+				printf(_("bad run time -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		case 'Z':
+			zeed = strtoul(optarg, &sp, 0);
+			if (!sp || sp == optarg) {
+				printf(_("non-numeric seed -- %s\n"), optarg);
+				exitcode = 1;
+				return 0;
+			}
+			break;
+		default:
+			exitcode = 1;
+			return command_usage(&aio_cmd);
+		}
+	}
+	if (optind != argc - 2 || (nr_ops && seconds)) {
+		exitcode = 1;
+		return command_usage(&aio_cmd);
+	}
+
+	offset = cvtnum(fsblocksize, fssectsize, argv[optind]);
+	if (offset < 0) {
+		printf(_("non-numeric offset argument -- %s\n"), argv[optind]);
+		exitcode = 1;
+		return 0;
+	}
+	optind++;
+	count = cvtnum(fsblocksize, fssectsize, argv[optind]);
+	if (count < 0) {
+		printf(_("non-numeric length argument -- %s\n"), argv[optind]);
+		exitcode = 1;
+		return 0;
+	}
+
+	nr_files = aflag ? filecount : 1;
+	for (i = 0; i < nr_files; i++) {
+		fileio_t	*f = aflag ? &filetable[i] : file;
+
+		if (readpct < 100 && (f->flags & IO_READONLY)) {
+			printf(_("%s: file is open read-only\n"), f->name);
+			exitcode = 1;
+			return 0;
+		}
+	}
+
+	/*
+	 * Jobs are dealt out to the files in turn.  Each job gets an equal
+	 * share of the range in its file, which must hold at least one block.
+	 */
+	if (count / bsize < (nr_jobs + nr_files - 1) / nr_files) {
+		printf(_("range too small for %u jobs of %zu byte blocks\n"),
+				nr_jobs, bsize);
+		exitcode = 1;
+		return 0;
+	}
+
+	jobs = calloc(nr_jobs, sizeof(struct aio_job));
+	if (!jobs) {
+		perror("calloc");
+		exitcode = 1;
+		return 0;
+	}
+
+	for (i = 0; i < nr_jobs; i++)
+		jobs[i].ring.fd = -1;
+
+	if (!zeed)
+		zeed = time(NULL);
+	for (i = 0; i < nr_jobs; i++) {
+		struct aio_job	*job = &jobs[i];
+		unsigned int	sharers;
+		long long	slice;
+
+		job->file = aflag ? &filetable[i % nr_files] : file;
+		sharers = (nr_jobs - (i % nr_files) + nr_files - 1) / nr_files;
+		slice = (count / sharers / bsize) * bsize;
+		job->start = offset + (i / nr_files) * slice;
+		job->len = slice;
+		job->bsize = bsize;
+		job->readpct = readpct;
+		job->random = Rflag;
+		job->rng = ((uint64_t)zeed << 32) + i + 1;
+		job->rw_flags = rw_flags;
+		job->wr_flags = wr_flags;
+		job->nr_ops = nr_ops ? nr_ops : slice / bsize;
+
+		if (aio_file_align(job->file, job->start, bsize, &align) ||
+		    aio_job_init(job, depth, align, seed)) {
+			exitcode = 1;
+			goto out_free;
+		}
+	}
+
+	gettimeofday(&t1, NULL);
+	aio_timed = seconds > 0;
+	if (aio_timed) {
+		clock_gettime(CLOCK_MONOTONIC, &aio_deadline);
+		aio_deadline.tv_sec += seconds;
+	}
+	for (started = 0; started < nr_jobs; started++) {
+		error = pthread_create(&jobs[started].thread, NULL,
+				aio_job_run, &jobs[started]);
+		if (error) {
+			/* let the running jobs finish what they're doing */
+			errno = error;
+			perror("pthread_create");
+			exitcode = 1;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(jobs[i].thread, NULL);
+	gettimeofday(&t2, NULL);
+	t2 = tsub(t2, t1);
+
+	if (iolat_stats_init(&rd.lat) || iolat_stats_init(&wr.lat)) {
+		perror("histogram");
+		exitcode = 1;
+		goto out_hist;
+	}
+	for (i = 0; i < nr_jobs; i++) {
+		struct aio_job	*job = &jobs[i];
+
+		if (job->error) {
+			errno = job->error;
+			fprintf(stderr, "%s: ", job->file->name);
+			perror(job->errop);
+			exitcode = 1;
+		}
+		aio_stats_import(&rd, &job->rd);
+		aio_stats_import(&wr, &job->wr);
+		eagain += job->eagain;
+	}
+
+	if (qflag)
+		goto out_hist;
+	aio_report("read", &rd, &t2, offset, Cflag);
+	aio_report("wrote", &wr, &t2, offset, Cflag);
+	if (eagain)
+		printf(_("%lld I/Os returned EAGAIN\n"), eagain);
+
+out_hist:
+	iolat_stats_free(&rd.lat);
+	iolat_stats_free(&wr.lat);
+out_free:
+	for (i = 0; i < nr_jobs; i++)
+		aio_job_free(&jobs[i]);
+	free(jobs);
+	return 0;
+}
+
+void
+aio_init(void)
+{
+	aio_cmd.name = "aio";
+	aio_cmd.cfunc = aio_f;
+	aio_cmd.argmin = 2;
+	aio_cmd.argmax = -1;
+	aio_cmd.flags = CMD_NOMAP_OK | CMD_FOREIGN_OK;
+	aio_cmd.args =
+_("[-aqACDNR] [-b bs] [-d depth] [-j jobs] [-M read%] [-n ops|-T secs] [-S seed] [-Z N] off len");
+	aio_cmd.oneline =
+		_("asynchronous I/O benchmark with latency percentiles");
+	aio_cmd.help = aio_help;
+
+	add_command(&aio_cmd);
+}
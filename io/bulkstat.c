@@ -11,9 +11,33 @@
 #include "libfrog/fsgeom.h"
 #include "libfrog/bulkstat.h"
 #include "libfrog/paths.h"
+#include "libfrog/workqueue.h"
 #include "io.h"
 #include "input.h"
 
+/* Per-AG results of a parallel scan. */
+struct scan_ag {
+	uint64_t		nr;
+	uint64_t		nsec;
+};
+
+/* A bulkstat or inumbers scan, possibly split up by AG. */
+struct scan_ctl {
+	struct xfs_fd		*xfd;
+	uint64_t		endino;
+	uint32_t		batch_size;
+	bool			inumbers;
+	bool			quiet;
+
+	/* write records here as raw v5 structures instead of printing them */
+	int			outfd;
+
+	/* serializes output and error reporting between threads */
+	pthread_mutex_t		lock;
+	struct scan_ag		*ags;
+	int			error;
+};
+
 static void
 dump_bulkstat_time(
 	const char		*tag,
@@ -60,6 +84,16 @@ dump_bulkstat(
 	printf("\tbs_extents64 = %"PRIu64"\n", bstat->bs_extents64);
 };
 
+static void
+dump_inumbers(
+	struct xfs_inumbers	*inumbers)
+{
+	printf("xi_startino = %"PRIu64"\n", inumbers->xi_startino);
+	printf("\txi_allocmask = 0x%"PRIx64"\n", inumbers->xi_allocmask);
+	printf("\txi_alloccount = %"PRIu8"\n", inumbers->xi_alloccount);
+	printf("\txi_version = %"PRIu8"\n", inumbers->xi_version);
+}
+
 static void
 bulkstat_help(void)
 {
@@ -70,7 +104,10 @@ bulkstat_help(void)
 "   -d         Print debugging output.\n"
 "   -q         Be quiet, no output.\n"
 "   -e <ino>   Stop after this inode.\n"
+"   -j <nr>    Run no more than this many AGs at once with -p.\n"
 "   -n <nr>    Ask for this many results at once.\n"
+"   -o <file>  Write the raw v5 records to this file instead of printing.\n"
+"   -p         Walk every AG in parallel and report inodes/sec.\n"
 "   -s <ino>   Inode to start with.\n"
 "   -v <ver>   Use this version of the ioctl (1 or 5).\n"));
 }
@@ -92,6 +129,230 @@ set_xfd_flags(
 	}
 }
 
+static int
+scan_write(
+	int			fd,
+	const void		*buf,
+	size_t			len)
+{
+	ssize_t			ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Print or write out a batch of records, stopping after endino.  Returns the
+ * number of records consumed, or a negative errno.
+ */
+static int
+scan_emit(
+	struct scan_ctl		*sc,
+	void			*recs,
+	uint32_t		ocount)
+{
+	struct xfs_bulkstat	*bs = recs;
+	struct xfs_inumbers	*inums = recs;
+	size_t			recsize;
+	uint32_t		i;
+	int			ret = 0;
+
+	for (i = 0; i < ocount; i++) {
+		if (sc->inumbers ? inums[i].xi_startino > sc->endino :
+				   bs[i].bs_ino > sc->endino)
+			break;
+	}
+	ocount = i;
+
+	if (sc->outfd >= 0) {
+		recsize = sc->inumbers ? sizeof(struct xfs_inumbers) :
+					 sizeof(struct xfs_bulkstat);
+		ret = scan_write(sc->outfd, recs, ocount * recsize);
+	} else if (!sc->quiet) {
+		for (i = 0; i < ocount; i++) {
+			if (sc->inumbers)
+				dump_inumbers(&inums[i]);
+			else
+				dump_bulkstat(&bs[i]);
+		}
+	}
+	return ret ? -ret : ocount;
+}
+
+/* Run one cursor over the inodes of one AG. */
+static void
+scan_ag_worker(
+	struct workqueue	*wq,
+	uint32_t		agno,
+	void			*arg)
+{
+	struct scan_ctl		*sc = arg;
+	struct xfs_fd		xfd = *sc->xfd;
+	struct xfs_bulkstat_req	*breq = NULL;
+	struct xfs_inumbers_req	*ireq = NULL;
+	struct timespec		t1, t2;
+	uint64_t		nr = 0;
+	uint32_t		ocount;
+	void			*recs;
+	int			ret;
+
+	if (sc->inumbers)
+		ret = -xfrog_inumbers_alloc_req(sc->batch_size, 0, &ireq);
+	else
+		ret = -xfrog_bulkstat_alloc_req(sc->batch_size, 0, &breq);
+	if (ret)
+		goto out;
+	if (sc->inumbers)
+		xfrog_inumbers_set_ag(ireq, agno);
+	else
+		xfrog_bulkstat_set_ag(breq, agno);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (;;) {
+		if (sc->inumbers) {
+			ret = -xfrog_inumbers(&xfd, ireq);
+			ocount = ireq->hdr.ocount;
+			recs = ireq->inumbers;
+		} else {
+			ret = -xfrog_bulkstat(&xfd, breq);
+			ocount = breq->hdr.ocount;
+			recs = breq->bulkstat;
+		}
+		if (ret || ocount == 0)
+			break;
+
+		pthread_mutex_lock(&sc->lock);
+		ret = scan_emit(sc, recs, ocount);
+		pthread_mutex_unlock(&sc->lock);
+		if (ret < 0) {
+			ret = -ret;
+			break;
+		}
+		nr += ret;
+		if (ret < ocount) {
+			ret = 0;
+			break;
+		}
+		ret = 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	sc->ags[agno].nr = nr;
+	sc->ags[agno].nsec = (t2.tv_sec - t1.tv_sec) * 1000000000ULL +
+			     (t2.tv_nsec - t1.tv_nsec);
+out:
+	if (ret) {
+		pthread_mutex_lock(&sc->lock);
+		if (!sc->error)
+			sc->error = ret;
+		pthread_mutex_unlock(&sc->lock);
+	}
+	free(breq);
+	free(ireq);
+}
+
+static void
+scan_report_rate(
+	const char		*what,
+	const char		*units,
+	uint64_t		nr,
+	uint64_t		nsec)
+{
+	double			secs = nsec / 1000000000.0;
+
+	printf(_("%s: %"PRIu64" %s in %.3f sec, %.0f %s/sec\n"), what, nr,
+			units, secs, secs > 0 ? nr / secs : 0.0, units);
+}
+
+/*
+ * Walk every AG with its own cursor, running the AGs in parallel, and report
+ * how fast each AG went and how fast the whole scan went.
+ */
+static int
+scan_all_ags(
+	struct scan_ctl		*sc,
+	unsigned int		nr_threads)
+{
+	struct workqueue	wq;
+	struct timespec		t1, t2;
+	const char		*units;
+	uint32_t		agcount = sc->xfd->fsgeom.agcount;
+	uint64_t		total = 0;
+	uint32_t		agno;
+	char			what[32];
+	int			ret;
+
+	sc->ags = calloc(agcount, sizeof(struct scan_ag));
+	if (!sc->ags)
+		return ENOMEM;
+	if (!nr_threads)
+		nr_threads = agcount;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	ret = -workqueue_create(&wq, NULL, min(nr_threads, agcount));
+	if (ret) {
+		xfrog_perror(ret, "workqueue_create");
+		goto out;
+	}
+	for (agno = 0; agno < agcount; agno++) {
+		if (workqueue_add(&wq, scan_ag_worker, agno, sc))
+			scan_ag_worker(&wq, agno, sc);
+	}
+	ret = -workqueue_terminate(&wq);
+	workqueue_destroy(&wq);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	if (ret) {
+		xfrog_perror(ret, "workqueue_terminate");
+		goto out;
+	}
+	ret = sc->error;
+	if (ret) {
+		xfrog_perror(ret, sc->inumbers ? "xfrog_inumbers" :
+						 "xfrog_bulkstat");
+		goto out;
+	}
+
+	units = sc->inumbers ? _("inode groups") : _("inodes");
+	for (agno = 0; agno < agcount; agno++) {
+		snprintf(what, sizeof(what), _("AG %u"), agno);
+		scan_report_rate(what, units, sc->ags[agno].nr,
+				sc->ags[agno].nsec);
+		total += sc->ags[agno].nr;
+	}
+	scan_report_rate(_("total"), units, total,
+			(t2.tv_sec - t1.tv_sec) * 1000000000ULL +
+			(t2.tv_nsec - t1.tv_nsec));
+out:
+	free(sc->ags);
+	sc->ags = NULL;
+	return ret;
+}
+
+static int
+scan_open_output(
+	struct scan_ctl		*sc,
+	const char		*path)
+{
+	sc->outfd = -1;
+	if (!path)
+		return 0;
+	sc->outfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (sc->outfd < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
 static int
 bulkstat_f(
 	int			argc,
@@ -99,19 +360,20 @@ bulkstat_f(
 {
 	struct xfs_fd		xfd = XFS_FD_INIT(file->fd);
 	struct xfs_bulkstat_req	*breq;
+	struct scan_ctl		sc = { .endino = -1ULL };
 	uint64_t		startino = 0;
-	uint64_t		endino = -1ULL;
 	uint32_t		batch_size = 4096;
 	uint32_t		agno = 0;
 	uint32_t		ver = 0;
+	uint32_t		nr_threads = 0;
+	char			*outfile = NULL;
 	bool			has_agno = false;
 	bool			debug = false;
-	bool			quiet = false;
-	unsigned int		i;
+	bool			parallel = false;
 	int			c;
 	int			ret;
 
-	while ((c = getopt(argc, argv, "a:de:n:qs:v:")) != -1) {
+	while ((c = getopt(argc, argv, "a:de:j:n:o:pqs:v:")) != -1) {
 		switch (c) {
 		case 'a':
 			agno = cvt_u32(optarg, 10);
@@ -125,7 +387,14 @@ bulkstat_f(
 			debug = true;
 			break;
 		case 'e':
-			endino = cvt_u64(optarg, 10);
+			sc.endino = cvt_u64(optarg, 10);
+			if (errno) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'j':
+			nr_threads = cvt_u32(optarg, 10);
 			if (errno) {
 				perror(optarg);
 				return 1;
@@ -138,8 +407,14 @@ bulkstat_f(
 				return 1;
 			}
 			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'p':
+			parallel = true;
+			break;
 		case 'q':
-			quiet = true;
+			sc.quiet = true;
 			break;
 		case 's':
 			startino = cvt_u64(optarg, 10);
@@ -164,7 +439,7 @@ bulkstat_f(
 			return 0;
 		}
 	}
-	if (optind != argc) {
+	if (optind != argc || (parallel && (has_agno || startino))) {
 		bulkstat_help();
 		return 0;
 	}
@@ -176,18 +451,32 @@ bulkstat_f(
 		return 0;
 	}
 
+	set_xfd_flags(&xfd, ver);
+	if (scan_open_output(&sc, outfile)) {
+		exitcode = 1;
+		return 0;
+	}
+
+	if (parallel) {
+		sc.xfd = &xfd;
+		sc.batch_size = batch_size;
+		pthread_mutex_init(&sc.lock, NULL);
+		if (scan_all_ags(&sc, nr_threads))
+			exitcode = 1;
+		pthread_mutex_destroy(&sc.lock);
+		goto out_close;
+	}
+
 	ret = -xfrog_bulkstat_alloc_req(batch_size, startino, &breq);
 	if (ret) {
 		xfrog_perror(ret, "alloc bulkreq");
 		exitcode = 1;
-		return 0;
+		goto out_close;
 	}
 
 	if (has_agno)
 		xfrog_bulkstat_set_ag(breq, agno);
 
-	set_xfd_flags(&xfd, ver);
-
 	while ((ret = -xfrog_bulkstat(&xfd, breq)) == 0) {
 		if (debug)
 			printf(
@@ -201,13 +490,14 @@ _("bulkstat: startino=%lld flags=0x%x agno=%u ret=%d icount=%u ocount=%u\n"),
 		if (breq->hdr.ocount == 0)
 			break;
 
-		for (i = 0; i < breq->hdr.ocount; i++) {
-			if (breq->bulkstat[i].bs_ino > endino)
-				break;
-			if (quiet)
-				continue;
-			dump_bulkstat(&breq->bulkstat[i]);
+		c = scan_emit(&sc, breq->bulkstat, breq->hdr.ocount);
+		if (c < 0) {
+			xfrog_perror(-c, outfile);
+			exitcode = 1;
+			break;
 		}
+		if (c < breq->hdr.ocount)
+			break;
 	}
 	if (ret) {
 		xfrog_perror(ret, "xfrog_bulkstat");
@@ -215,6 +505,9 @@ _("bulkstat: startino=%lld flags=0x%x agno=%u ret=%d icount=%u ocount=%u\n"),
 	}
 
 	free(breq);
+out_close:
+	if (sc.outfd >= 0)
+		close(sc.outfd);
 	return 0;
 }
 
@@ -330,16 +623,6 @@ _("bulkstat_single: startino=%"PRIu64" flags=0x%"PRIx32" ret=%d\n"),
 	return 0;
 }
 
-static void
-dump_inumbers(
-	struct xfs_inumbers	*inumbers)
-{
-	printf("xi_startino = %"PRIu64"\n", inumbers->xi_startino);
-	printf("\txi_allocmask = 0x%"PRIx64"\n", inumbers->xi_allocmask);
-	printf("\txi_alloccount = %"PRIu8"\n", inumbers->xi_alloccount);
-	printf("\txi_version = %"PRIu8"\n", inumbers->xi_version);
-}
-
 static void
 inumbers_help(void)
 {
@@ -349,7 +632,11 @@ inumbers_help(void)
 "   -a <agno>  Only iterate this AG.\n"
 "   -d         Print debugging output.\n"
 "   -e <ino>   Stop after this inode.\n"
+"   -j <nr>    Run no more than this many AGs at once with -p.\n"
 "   -n <nr>    Ask for this many results at once.\n"
+"   -o <file>  Write the raw v5 records to this file instead of printing.\n"
+"   -p         Walk every AG in parallel and report groups/sec.\n"
+"   -q         Be quiet, no output.\n"
 "   -s <ino>   Inode to start with.\n"
 "   -v <ver>   Use this version of the ioctl (1 or 5).\n"));
 }
@@ -361,18 +648,20 @@ inumbers_f(
 {
 	struct xfs_fd		xfd = XFS_FD_INIT(file->fd);
 	struct xfs_inumbers_req	*ireq;
+	struct scan_ctl		sc = { .endino = -1ULL, .inumbers = true };
 	uint64_t		startino = 0;
-	uint64_t		endino = -1ULL;
 	uint32_t		batch_size = 4096;
 	uint32_t		agno = 0;
 	uint32_t		ver = 0;
+	uint32_t		nr_threads = 0;
+	char			*outfile = NULL;
 	bool			has_agno = false;
 	bool			debug = false;
-	unsigned int		i;
+	bool			parallel = false;
 	int			c;
 	int			ret;
 
-	while ((c = getopt(argc, argv, "a:de:n:s:v:")) != -1) {
+	while ((c = getopt(argc, argv, "a:de:j:n:o:pqs:v:")) != -1) {
 		switch (c) {
 		case 'a':
 			agno = cvt_u32(optarg, 10);
@@ -386,7 +675,14 @@ inumbers_f(
 			debug = true;
 			break;
 		case 'e':
-			endino = cvt_u64(optarg, 10);
+			sc.endino = cvt_u64(optarg, 10);
+			if (errno) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'j':
+			nr_threads = cvt_u32(optarg, 10);
 			if (errno) {
 				perror(optarg);
 				return 1;
@@ -399,6 +695,15 @@ inumbers_f(
 				return 1;
 			}
 			break;
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'p':
+			parallel = true;
+			break;
+		case 'q':
+			sc.quiet = true;
+			break;
 		case 's':
 			startino = cvt_u64(optarg, 10);
 			if (errno) {
@@ -418,12 +723,12 @@ inumbers_f(
 			}
 			break;
 		default:
-			bulkstat_help();
+			inumbers_help();
 			return 0;
 		}
 	}
-	if (optind != argc) {
-		bulkstat_help();
+	if (optind != argc || (parallel && (has_agno || startino))) {
+		inumbers_help();
 		return 0;
 	}
 
@@ -434,18 +739,32 @@ inumbers_f(
 		return 0;
 	}
 
+	set_xfd_flags(&xfd, ver);
+	if (scan_open_output(&sc, outfile)) {
+		exitcode = 1;
+		return 0;
+	}
+
+	if (parallel) {
+		sc.xfd = &xfd;
+		sc.batch_size = batch_size;
+		pthread_mutex_init(&sc.lock, NULL);
+		if (scan_all_ags(&sc, nr_threads))
+			exitcode = 1;
+		pthread_mutex_destroy(&sc.lock);
+		goto out_close;
+	}
+
 	ret = -xfrog_inumbers_alloc_req(batch_size, startino, &ireq);
 	if (ret) {
 		xfrog_perror(ret, "alloc inumbersreq");
 		exitcode = 1;
-		return 0;
+		goto out_close;
 	}
 
 	if (has_agno)
 		xfrog_inumbers_set_ag(ireq, agno);
 
-	set_xfd_flags(&xfd, ver);
-
 	while ((ret = -xfrog_inumbers(&xfd, ireq)) == 0) {
 		if (debug)
 			printf(
@@ -459,11 +778,14 @@ _("bulkstat: startino=%"PRIu64" flags=0x%"PRIx32" agno=%"PRIu32" ret=%d icount=%
 		if (ireq->hdr.ocount == 0)
 			break;
 
-		for (i = 0; i < ireq->hdr.ocount; i++) {
-			if (ireq->inumbers[i].xi_startino > endino)
-				break;
-			dump_inumbers(&ireq->inumbers[i]);
+		c = scan_emit(&sc, ireq->inumbers, ireq->hdr.ocount);
+		if (c < 0) {
+			xfrog_perror(-c, outfile);
+			exitcode = 1;
+			break;
 		}
+		if (c < ireq->hdr.ocount)
+			break;
 	}
 	if (ret) {
 		xfrog_perror(ret, "xfrog_inumbers");
@@ -471,6 +793,9 @@ _("bulkstat: startino=%"PRIu64" flags=0x%"PRIx32" agno=%"PRIu32" ret=%d icount=%
 	}
 
 	free(ireq);
+out_close:
+	if (sc.outfd >= 0)
+		close(sc.outfd);
 	return 0;
 }
 
@@ -505,14 +830,14 @@ void
 bulkstat_init(void)
 {
 	bulkstat_cmd.args =
-_("[-a agno] [-d] [-e endino] [-n batchsize] [-s startino] [-v version]");
+_("[-a agno|-p [-j threads]] [-dq] [-e endino] [-n batchsize] [-o file] [-s startino] [-v version]");
 	bulkstat_cmd.oneline = _("Bulk stat of inodes in a filesystem");
 
 	bulkstat_single_cmd.args = _("[-d] [-v version] inum...");
 	bulkstat_single_cmd.oneline = _("Stat one inode in a filesystem");
 
 	inumbers_cmd.args =
-_("[-a agno] [-d] [-e endino] [-n batchsize] [-s startino] [-v version]");
+_("[-a agno|-p [-j threads]] [-dq] [-e endino] [-n batchsize] [-o file] [-s startino] [-v version]");
 	inumbers_cmd.oneline = _("Query inode groups in a filesystem");
 
 	add_command(&bulkstat_cmd);
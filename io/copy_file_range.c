@@ -10,6 +10,7 @@
 #include "input.h"
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t copy_range_cmd;
 
@@ -38,11 +39,14 @@ copy_range_help(void)
 static loff_t
 copy_file_range_cmd(int fd, long long *src_off, long long *dst_off, size_t len)
 {
+	struct timespec start;
 	loff_t ret;
 
 	do {
+		iolat_start(&start);
 		ret = syscall(__NR_copy_file_range, fd, src_off,
 				file->fd, dst_off, len, 0);
+		iolat_stop(IOLAT_COPY_RANGE, &start);
 		if (ret == -1) {
 			perror("copy_range");
 			return errno;
@@ -166,6 +170,7 @@ copy_range_f(int argc, char **argv)
 	}
 
 	ret = copy_file_range_cmd(fd, &src_off, &dst_off, len);
+	iolat_report();
 out:
 	close(fd);
 	if (ret < 0)
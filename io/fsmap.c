@@ -11,6 +11,8 @@
 #include "io.h"
 #include "input.h"
 #include "libfrog/fsgeom.h"
+#include "libfrog/logging.h"
+#include "libfrog/workqueue.h"
 
 static cmdinfo_t	fsmap_cmd;
 static dev_t		xfs_data_dev;
@@ -35,6 +37,12 @@ fsmap_help(void)
 " -r -- query only the realtime device.\n"
 " -n -- query n extents at a time.\n"
 " -m -- output machine-readable format.\n"
+" -s -- instead of listing extents, add up the space used by each owner.\n"
+"       Inode owners are split into data, attr and extent map (bmbt) usage.\n"
+" -J -- print the -s summary as JSON.\n"
+" -o -- write the raw fsmap records to this file, in host byte order.\n"
+" -p -- query each AG of the data device in parallel (needs -s or -o).\n"
+"       The log and realtime devices are queried alongside unless -d is given.\n"
 " -v -- Verbose information, show AG and offsets.  Show flags legend on 2nd -v\n"
 "\n"
 "The optional start and end arguments require one of -d, -l, or -r to be set.\n"
@@ -367,6 +375,505 @@ dump_verbose_key(void)
 		NFLG+1, NFLG+1, FLG_ESW);
 }
 
+/*
+ * Space map export.  Instead of printing each extent as it comes back, the
+ * export mode adds up the space used by each owner and/or writes the raw
+ * records out to a file.  The data device can be queried one AG at a time on
+ * separate threads, and the query buffers grow while the kernel keeps
+ * filling them, so that huge filesystems don't take forever to walk.
+ */
+#define FSMAP_BATCH_MIN		1024
+#define FSMAP_BATCH_MAX		65536
+
+/* What an owner uses space for. */
+enum fsmap_kind {
+	FSMAP_KIND_DATA,
+	FSMAP_KIND_ATTR,
+	FSMAP_KIND_DATA_BMBT,
+	FSMAP_KIND_ATTR_BMBT,
+	FSMAP_KIND_SPECIAL,
+};
+
+static const char *fsmap_kind_names[] = {
+	[FSMAP_KIND_DATA]	= "data",
+	[FSMAP_KIND_ATTR]	= "attr",
+	[FSMAP_KIND_DATA_BMBT]	= "data_bmbt",
+	[FSMAP_KIND_ATTR_BMBT]	= "attr_bmbt",
+	[FSMAP_KIND_SPECIAL]	= "special",
+};
+
+/* Space used by one owner on one device; a zero extent count is a free slot. */
+struct fsmap_sum {
+	uint64_t		owner;
+	uint32_t		device;
+	uint32_t		kind;
+	uint64_t		extents;
+	uint64_t		bytes;
+};
+
+/* Open addressing hash table of owners. */
+struct fsmap_sumtab {
+	struct fsmap_sum	*recs;
+	size_t			size;
+	size_t			nr;
+};
+
+/* One GETFSMAP query, and what it found. */
+struct fsmap_query {
+	struct fsmap		keys[2];
+	struct fsmap_sumtab	sums;
+	unsigned long long	nr;
+	int			error;
+};
+
+struct fsmap_export {
+	struct fsmap_query	*queries;
+	unsigned int		nr_queries;
+	int			fd;
+	int			nflag;
+	bool			summarize;
+
+	/* write records here */
+	int			outfd;
+	pthread_mutex_t		outlock;
+};
+
+static inline size_t
+fsmap_sum_hash(
+	const struct fsmap_sum	*key,
+	size_t			size)
+{
+	uint64_t		h = key->owner ^ ((uint64_t)key->device << 32) ^
+				    key->kind;
+
+	return (h * 0x9e3779b97f4a7c15ULL) >> 32 & (size - 1);
+}
+
+static struct fsmap_sum *
+fsmap_sum_slot(
+	struct fsmap_sum	*recs,
+	size_t			size,
+	const struct fsmap_sum	*key)
+{
+	size_t			i = fsmap_sum_hash(key, size);
+
+	while (recs[i].extents &&
+	       (recs[i].owner != key->owner ||
+		recs[i].device != key->device ||
+		recs[i].kind != key->kind))
+		i = (i + 1) & (size - 1);
+	return &recs[i];
+}
+
+static int
+fsmap_sum_add(
+	struct fsmap_sumtab	*tab,
+	const struct fsmap	*p)
+{
+	struct fsmap_sum	key = {
+		.owner		= p->fmr_owner,
+		.device		= p->fmr_device,
+	};
+	struct fsmap_sum	*rec;
+
+	if (p->fmr_flags & FMR_OF_SPECIAL_OWNER)
+		key.kind = FSMAP_KIND_SPECIAL;
+	else if (p->fmr_flags & FMR_OF_EXTENT_MAP)
+		key.kind = (p->fmr_flags & FMR_OF_ATTR_FORK) ?
+				FSMAP_KIND_ATTR_BMBT : FSMAP_KIND_DATA_BMBT;
+	else
+		key.kind = (p->fmr_flags & FMR_OF_ATTR_FORK) ?
+				FSMAP_KIND_ATTR : FSMAP_KIND_DATA;
+
+	if (tab->nr >= tab->size / 2) {
+		struct fsmap_sum	*recs;
+		size_t			size, i;
+
+		size = tab->size ? tab->size * 2 : 256;
+		recs = calloc(size, sizeof(struct fsmap_sum));
+		if (!recs)
+			return ENOMEM;
+		for (i = 0; i < tab->size; i++) {
+			if (tab->recs[i].extents)
+				*fsmap_sum_slot(recs, size, &tab->recs[i]) =
+						tab->recs[i];
+		}
+		free(tab->recs);
+		tab->recs = recs;
+		tab->size = size;
+	}
+
+	rec = fsmap_sum_slot(tab->recs, tab->size, &key);
+	if (!rec->extents) {
+		*rec = key;
+		tab->nr++;
+	}
+	rec->extents++;
+	rec->bytes += p->fmr_length;
+	return 0;
+}
+
+static int
+fsmap_sum_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct fsmap_sum	*sa = a;
+	const struct fsmap_sum	*sb = b;
+
+	if (sa->device != sb->device)
+		return sa->device < sb->device ? -1 : 1;
+	if (sa->owner != sb->owner)
+		return sa->owner < sb->owner ? -1 : 1;
+	if (sa->kind != sb->kind)
+		return sa->kind < sb->kind ? -1 : 1;
+	return 0;
+}
+
+/* Run one query to completion, growing the buffer while the kernel fills it. */
+static void
+fsmap_export_query(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct fsmap_export	*fx = arg;
+	struct fsmap_query	*q = &fx->queries[index];
+	struct fsmap_head	*head, *new_head;
+	struct fsmap		*p;
+	unsigned int		count;
+	unsigned int		i;
+	int			error = 0;
+
+	count = fx->nflag ? fx->nflag : FSMAP_BATCH_MIN;
+	head = calloc(1, fsmap_sizeof(count));
+	if (!head) {
+		q->error = ENOMEM;
+		return;
+	}
+	memcpy(head->fmh_keys, q->keys, sizeof(q->keys));
+
+	for (;;) {
+		head->fmh_count = count;
+		if (ioctl(fx->fd, FS_IOC_GETFSMAP, head) < 0) {
+			error = errno;
+			break;
+		}
+		if (head->fmh_entries == 0)
+			break;
+
+		if (fx->outfd >= 0) {
+			size_t		len = head->fmh_entries *
+					      sizeof(struct fsmap);
+			char		*buf = (char *)head->fmh_recs;
+			ssize_t		ret;
+
+			pthread_mutex_lock(&fx->outlock);
+			while (len > 0) {
+				ret = write(fx->outfd, buf, len);
+				if (ret < 0 && errno == EINTR)
+					continue;
+				if (ret < 0) {
+					error = errno;
+					break;
+				}
+				buf += ret;
+				len -= ret;
+			}
+			pthread_mutex_unlock(&fx->outlock);
+			if (error)
+				break;
+		}
+
+		if (fx->summarize) {
+			for (i = 0, p = head->fmh_recs;
+			     i < head->fmh_entries;
+			     i++, p++) {
+				error = fsmap_sum_add(&q->sums, p);
+				if (error)
+					break;
+			}
+			if (error)
+				break;
+		}
+		q->nr += head->fmh_entries;
+
+		p = &head->fmh_recs[head->fmh_entries - 1];
+		if (p->fmr_flags & FMR_OF_LAST)
+			break;
+		fsmap_advance(head);
+
+		/* the buffer filled up, so ask for more next time */
+		if (!fx->nflag && head->fmh_entries == count &&
+		    count < FSMAP_BATCH_MAX) {
+			new_head = realloc(head, fsmap_sizeof(count * 2));
+			if (new_head) {
+				head = new_head;
+				count *= 2;
+			}
+		}
+	}
+
+	q->error = error;
+	free(head);
+}
+
+static void
+fsmap_query_init(
+	struct fsmap_query	*q,
+	uint32_t		low_dev,
+	uint32_t		high_dev,
+	uint64_t		start,
+	uint64_t		end)
+{
+	struct fsmap		*l = &q->keys[0];
+	struct fsmap		*h = &q->keys[1];
+
+	memset(q, 0, sizeof(*q));
+	l->fmr_device = low_dev;
+	h->fmr_device = high_dev;
+	l->fmr_physical = start;
+	h->fmr_physical = end;
+	h->fmr_owner = ULLONG_MAX;
+	h->fmr_flags = UINT_MAX;
+	h->fmr_offset = ULLONG_MAX;
+}
+
+/* Print the space usage of each owner, in 512-byte blocks. */
+static void
+fsmap_export_summary(
+	struct fsmap_sum	*sums,
+	size_t			nr,
+	int			mflag,
+	bool			json)
+{
+	char			owner[OWNER_BUF_SZ];
+	struct fsmap_sum	*s;
+	size_t			i;
+
+	if (mflag)
+		printf(_("MAJOR,MINOR,OWNER,KIND,EXTENTS,LENGTH\n"));
+	else if (json)
+		printf("[");
+
+	for (i = 0, s = sums; i < nr; i++, s++) {
+		if (s->kind == FSMAP_KIND_SPECIAL)
+			snprintf(owner, sizeof(owner), "special_%u:%u",
+					FMR_OWNER_TYPE(s->owner),
+					FMR_OWNER_CODE(s->owner));
+		else
+			snprintf(owner, sizeof(owner), "%llu",
+					(unsigned long long)s->owner);
+
+		if (mflag) {
+			printf("%u,%u,%s,%s,%llu,%lld\n",
+				major(s->device), minor(s->device), owner,
+				fsmap_kind_names[s->kind],
+				(unsigned long long)s->extents,
+				(long long)BTOBBT(s->bytes));
+		} else if (json) {
+			printf(
+"%s\n  {\"major\": %u, \"minor\": %u, \"owner\": %s%s%s, \"kind\": \"%s\", \"extents\": %llu, \"blocks\": %lld}",
+				i ? "," : "",
+				major(s->device), minor(s->device),
+				s->kind == FSMAP_KIND_SPECIAL ? "\"" : "",
+				owner,
+				s->kind == FSMAP_KIND_SPECIAL ? "\"" : "",
+				fsmap_kind_names[s->kind],
+				(unsigned long long)s->extents,
+				(long long)BTOBBT(s->bytes));
+		} else {
+			printf("\t%u:%u ", major(s->device), minor(s->device));
+			if (s->kind == FSMAP_KIND_SPECIAL)
+				printf("%s", special_owner(s->owner, owner));
+			else
+				printf(_("inode %llu %s"),
+					(unsigned long long)s->owner,
+					fsmap_kind_names[s->kind]);
+			printf(_(": %llu extents, %lld blocks\n"),
+				(unsigned long long)s->extents,
+				(long long)BTOBBT(s->bytes));
+		}
+	}
+
+	if (json)
+		printf("\n]\n");
+}
+
+/*
+ * Run the queries, in parallel if there's more than one, then merge and
+ * print the per-owner sums.
+ */
+static int
+fsmap_export(
+	struct fsmap_export	*fx,
+	unsigned int		nr_threads,
+	int			mflag,
+	bool			json)
+{
+	struct workqueue	wq;
+	struct fsmap_sum	*sums = NULL;
+	unsigned long long	nr = 0;
+	size_t			nr_sums = 0;
+	size_t			i, j;
+	unsigned int		q;
+	int			error;
+
+	pthread_mutex_init(&fx->outlock, NULL);
+	error = -workqueue_create(&wq, NULL,
+			min(nr_threads, fx->nr_queries));
+	if (error) {
+		xfrog_perror(error, "workqueue_create");
+		goto out;
+	}
+	for (q = 0; q < fx->nr_queries; q++) {
+		if (workqueue_add(&wq, fsmap_export_query, q, fx))
+			fsmap_export_query(&wq, q, fx);
+	}
+	error = -workqueue_terminate(&wq);
+	workqueue_destroy(&wq);
+	if (error) {
+		xfrog_perror(error, "workqueue_terminate");
+		goto out;
+	}
+
+	for (q = 0; q < fx->nr_queries; q++) {
+		if (fx->queries[q].error) {
+			error = fx->queries[q].error;
+			fprintf(stderr, _("%s: xfsctl(XFS_IOC_GETFSMAP) [\"%s\"]: %s\n"),
+				progname, file->name, strerror(error));
+			goto out;
+		}
+		nr += fx->queries[q].nr;
+		nr_sums += fx->queries[q].sums.nr;
+	}
+
+	if (!fx->summarize) {
+		printf(_("exported %llu extents\n"), nr);
+		goto out;
+	}
+
+	/* concatenate the sums, sort them, and fold the duplicates */
+	sums = malloc((nr_sums ? nr_sums : 1) * sizeof(struct fsmap_sum));
+	if (!sums) {
+		error = ENOMEM;
+		perror("malloc");
+		goto out;
+	}
+	nr_sums = 0;
+	for (q = 0; q < fx->nr_queries; q++) {
+		struct fsmap_sumtab	*tab = &fx->queries[q].sums;
+
+		for (i = 0; i < tab->size; i++) {
+			if (tab->recs[i].extents)
+				sums[nr_sums++] = tab->recs[i];
+		}
+	}
+	qsort(sums, nr_sums, sizeof(struct fsmap_sum), fsmap_sum_cmp);
+	for (i = 0, j = 0; i < nr_sums; i++) {
+		if (j > 0 && !fsmap_sum_cmp(&sums[j - 1], &sums[i])) {
+			sums[j - 1].extents += sums[i].extents;
+			sums[j - 1].bytes += sums[i].bytes;
+		} else {
+			sums[j++] = sums[i];
+		}
+	}
+
+	fsmap_export_summary(sums, j, mflag, json);
+out:
+	for (q = 0; q < fx->nr_queries; q++)
+		free(fx->queries[q].sums.recs);
+	free(sums);
+	pthread_mutex_destroy(&fx->outlock);
+	return error;
+}
+
+/*
+ * Set up the export queries: either the one the user asked for, or one per
+ * AG of the data device plus one each for the external log and realtime
+ * devices, unless only the data device was asked for.
+ */
+static int
+fsmap_export_run(
+	const struct fsmap	*keys,
+	bool			parallel,
+	bool			data_only,
+	bool			summarize,
+	const char		*outfile,
+	int			nflag,
+	int			mflag,
+	bool			json)
+{
+	struct fsmap_export	fx = {
+		.fd		= file->fd,
+		.nflag		= nflag,
+		.summarize	= summarize,
+		.outfd		= -1,
+	};
+	struct xfs_fsop_geom	fsgeo;
+	uint32_t		datadev = file->fs_path.fs_datadev;
+	uint32_t		logdev = file->fs_path.fs_logdev;
+	uint32_t		rtdev = file->fs_path.fs_rtdev;
+	uint64_t		agbytes;
+	unsigned int		nr_threads = 1;
+	unsigned int		agno;
+	long			ncpus;
+	int			error;
+
+	if (!parallel) {
+		fx.queries = calloc(1, sizeof(struct fsmap_query));
+		if (!fx.queries)
+			return ENOMEM;
+		memcpy(fx.queries[0].keys, keys, sizeof(fx.queries[0].keys));
+		fx.nr_queries = 1;
+	} else {
+		error = -xfrog_geometry(file->fd, &fsgeo);
+		if (error) {
+			fprintf(stderr,
+				_("%s: can't get geometry [\"%s\"]: %s\n"),
+				progname, file->name, strerror(error));
+			return error;
+		}
+		fx.queries = calloc(fsgeo.agcount + 2,
+				sizeof(struct fsmap_query));
+		if (!fx.queries)
+			return ENOMEM;
+
+		agbytes = (uint64_t)fsgeo.agblocks * fsgeo.blocksize;
+		for (agno = 0; agno < fsgeo.agcount; agno++)
+			fsmap_query_init(&fx.queries[fx.nr_queries++],
+					datadev, datadev, agno * agbytes,
+					(agno + 1) * agbytes - 1);
+		if (!data_only && logdev && logdev != datadev)
+			fsmap_query_init(&fx.queries[fx.nr_queries++],
+					logdev, logdev, 0, ULLONG_MAX);
+		if (!data_only && rtdev)
+			fsmap_query_init(&fx.queries[fx.nr_queries++],
+					rtdev, rtdev, 0, ULLONG_MAX);
+
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nr_threads = max(ncpus, 1);
+	}
+
+	if (outfile) {
+		fx.outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fx.outfd < 0) {
+			error = errno;
+			perror(outfile);
+			goto out;
+		}
+	}
+
+	error = fsmap_export(&fx, nr_threads, mflag, json);
+	if (fx.outfd >= 0 && close(fx.outfd)) {
+		perror(outfile);
+		error = errno;
+	}
+out:
+	free(fx.queries);
+	return error;
+}
+
 static int
 fsmap_f(
 	int			argc,
@@ -389,16 +896,30 @@ fsmap_f(
 	struct fs_path		*fs;
 	static bool		tab_init;
 	bool			dumped_flags = false;
+	bool			pflag = false, sflag = false, Jflag = false;
+	char			*outfile = NULL;
 	int			dflag, lflag, rflag;
 
 	init_cvtnum(&fsblocksize, &fssectsize);
 
 	dflag = lflag = rflag = 0;
-	while ((c = getopt(argc, argv, "dlmn:rv")) != EOF) {
+	while ((c = getopt(argc, argv, "dJlmn:o:prsv")) != EOF) {
 		switch (c) {
 		case 'd':	/* data device */
 			dflag = 1;
 			break;
+		case 'J':	/* JSON summary */
+			Jflag = true;
+			break;
+		case 'o':	/* export records to a file */
+			outfile = optarg;
+			break;
+		case 'p':	/* query AGs in parallel */
+			pflag = true;
+			break;
+		case 's':	/* summarize by owner */
+			sflag = true;
+			break;
 		case 'l':	/* log device */
 			lflag = 1;
 			break;
@@ -428,6 +949,17 @@ fsmap_f(
 		return command_usage(&fsmap_cmd);
 	}
 
+	/* the export modes only summarize or dump raw records */
+	if ((pflag || sflag || outfile) && vflag) {
+		exitcode = 1;
+		return command_usage(&fsmap_cmd);
+	}
+	if ((Jflag && (!sflag || mflag)) || (pflag && !sflag && !outfile) ||
+	    (pflag && (lflag || rflag || argc > optind))) {
+		exitcode = 1;
+		return command_usage(&fsmap_cmd);
+	}
+
 	if (argc > optind) {
 		start = cvtnum(fsblocksize, fssectsize, argv[optind]);
 		if (start < 0) {
@@ -502,6 +1034,14 @@ fsmap_f(
 	fs = fs_table_lookup(file->name, FS_MOUNT_POINT);
 	xfs_data_dev = fs ? fs->fs_datadev : 0;
 
+	if (pflag || sflag || outfile) {
+		if (fsmap_export_run(head->fmh_keys, pflag, dflag, sflag,
+					outfile, nflag, mflag, Jflag))
+			exitcode = 1;
+		free(head);
+		return 0;
+	}
+
 	head->fmh_count = map_size;
 	do {
 		/* Get some extents */
@@ -547,7 +1087,8 @@ fsmap_init(void)
 	fsmap_cmd.argmin = 0;
 	fsmap_cmd.argmax = -1;
 	fsmap_cmd.flags = CMD_NOMAP_OK | CMD_FLAG_FOREIGN_OK;
-	fsmap_cmd.args = _("[-d|-l|-r] [-m|-v] [-n nx] [start] [end]");
+	fsmap_cmd.args =
+_("[-d|-l|-r] [-m|-v] [-n nx] [-s [-J]] [-o file] [-p] [start] [end]");
 	fsmap_cmd.oneline = _("print filesystem mapping for a range of blocks");
 	fsmap_cmd.help = fsmap_help;
 
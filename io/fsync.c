@@ -8,6 +8,7 @@
 #include "command.h"
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t fsync_cmd;
 static cmdinfo_t fdatasync_cmd;
@@ -17,7 +18,14 @@ fsync_f(
 	int			argc,
 	char			**argv)
 {
-	if (fsync(file->fd) < 0) {
+	struct timespec		start;
+	int			ret;
+
+	iolat_start(&start);
+	ret = fsync(file->fd);
+	iolat_stop(IOLAT_FSYNC, &start);
+	iolat_report();
+	if (ret < 0) {
 		perror("fsync");
 		exitcode = 1;
 		return 0;
@@ -30,7 +38,14 @@ fdatasync_f(
 	int			argc,
 	char			**argv)
 {
-	if (fdatasync(file->fd) < 0) {
+	struct timespec		start;
+	int			ret;
+
+	iolat_start(&start);
+	ret = fdatasync(file->fd);
+	iolat_stop(IOLAT_FDATASYNC, &start);
+	iolat_report();
+	if (ret < 0) {
 		perror("fdatasync");
 		exitcode = 1;
 		return 0;
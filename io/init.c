@@ -44,6 +44,7 @@ init_cvtnum(
 static void
 init_commands(void)
 {
+	aio_init();
 	attr_init();
 	bmap_init();
 	bulkstat_init();
@@ -63,6 +64,7 @@ init_commands(void)
 	imap_init();
 	inject_init();
 	label_init();
+	latency_init();
 	log_writes_init();
 	madvise_init();
 	mincore_init();
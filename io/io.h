@@ -101,6 +101,7 @@ extern void		help_init(void);
 extern void		imap_init(void);
 extern void		inject_init(void);
 extern void		label_init(void);
+extern void		latency_init(void);
 extern void		mmap_init(void);
 extern void		open_init(void);
 extern void		parent_init(void);
@@ -139,6 +140,12 @@ extern void		fsmap_init(void);
 # define fsmap_init()	do { } while (0)
 #endif
 
+#ifdef HAVE_IO_URING
+extern void		aio_init(void);
+#else
+#define aio_init()	do { } while (0)
+#endif
+
 #ifdef HAVE_DEVMAPPER
 extern void		log_writes_init(void);
 #else
@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+
+#include "command.h"
+#include "input.h"
+#include "init.h"
+#include "io.h"
+#include "latency.h"
+
+static cmdinfo_t latency_cmd;
+
+/*
+ * Latencies are recorded in nanoseconds.  The buckets start out one
+ * nanosecond wide and then come eight to each power of two, so that every
+ * percentile is accurate to within about 12%.
+ */
+#define IOLAT_SUBBUCKETS	8
+#define IOLAT_MAXSHIFT		40
+
+/* percentiles to report */
+#define IOLAT_NR_PCTS		4
+static const double	iolat_pcts[IOLAT_NR_PCTS] = { 50, 90, 99, 99.9 };
+
+static const char	*iolat_names[IOLAT_NR] = {
+	[IOLAT_PREAD]		= "pread",
+	[IOLAT_PWRITE]		= "pwrite",
+	[IOLAT_MREAD]		= "mread",
+	[IOLAT_MWRITE]		= "mwrite",
+	[IOLAT_SENDFILE]	= "sendfile",
+	[IOLAT_COPY_RANGE]	= "copy_range",
+	[IOLAT_FSYNC]		= "fsync",
+	[IOLAT_FDATASYNC]	= "fdatasync",
+	[IOLAT_FALLOCATE]	= "fallocate",
+};
+
+bool			iolat_enabled;
+static bool		iolat_cumulative;
+static unsigned int	iolat_flags;
+static struct iolat_stats iolat[IOLAT_NR];
+
+int
+iolat_stats_init(
+	struct iolat_stats	*st)
+{
+	long long		base;
+	unsigned int		shift, i;
+	int			error;
+
+	memset(st, 0, sizeof(*st));
+	hist_init(&st->hist);
+	for (i = 0; i < IOLAT_SUBBUCKETS; i++) {
+		error = hist_add_bucket(&st->hist, i);
+		if (error)
+			goto out_free;
+	}
+	for (shift = 3; shift < IOLAT_MAXSHIFT; shift++) {
+		base = 1LL << shift;
+		for (i = 0; i < IOLAT_SUBBUCKETS; i++) {
+			error = hist_add_bucket(&st->hist,
+					base + i * (base / IOLAT_SUBBUCKETS));
+			if (error)
+				goto out_free;
+		}
+	}
+	hist_prepare(&st->hist, LLONG_MAX);
+	return 0;
+out_free:
+	hist_free(&st->hist);
+	return error;
+}
+
+void
+iolat_stats_add(
+	struct iolat_stats	*st,
+	long long		ns)
+{
+	if (st->hist.tot_obs == 0 || ns < st->min_ns)
+		st->min_ns = ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	hist_add(&st->hist, ns);
+}
+
+void
+iolat_stats_import(
+	struct iolat_stats	*dest,
+	const struct iolat_stats *src)
+{
+	if (!src->hist.tot_obs)
+		return;
+	if (dest->hist.tot_obs == 0 || src->min_ns < dest->min_ns)
+		dest->min_ns = src->min_ns;
+	dest->max_ns = max(dest->max_ns, src->max_ns);
+	hist_import(&dest->hist, &src->hist);
+}
+
+/* Forget the observations, but keep the buckets. */
+void
+iolat_stats_reset(
+	struct iolat_stats	*st)
+{
+	unsigned int		i;
+
+	for (i = 0; i < st->hist.nr_buckets; i++) {
+		st->hist.buckets[i].nr_obs = 0;
+		st->hist.buckets[i].sum = 0;
+	}
+	st->hist.tot_obs = 0;
+	st->hist.tot_sum = 0;
+	st->min_ns = st->max_ns = 0;
+}
+
+void
+iolat_stats_free(
+	struct iolat_stats	*st)
+{
+	hist_free(&st->hist);
+}
+
+void
+iolat_stats_print(
+	const char		*name,
+	const struct iolat_stats *st,
+	unsigned int		flags)
+{
+	const struct histogram	*hs = &st->hist;
+	long long		p[IOLAT_NR_PCTS];
+	unsigned int		i;
+
+	if (!hs->tot_obs)
+		return;
+
+	for (i = 0; i < IOLAT_NR_PCTS; i++)
+		p[i] = min(hist_percentile(hs, iolat_pcts[i]), st->max_ns);
+
+	if (!(flags & (IOLAT_CSV | IOLAT_DUMP))) {
+		printf(_("%s latency (usec): %lld ops, min %.1f, avg %.1f"),
+				name, hs->tot_obs, st->min_ns / 1000.0,
+				(double)hs->tot_sum / hs->tot_obs / 1000.0);
+		for (i = 0; i < IOLAT_NR_PCTS; i++)
+			printf(", p%g %.1f", iolat_pcts[i], p[i] / 1000.0);
+		printf(_(", max %.1f\n"), st->max_ns / 1000.0);
+		return;
+	}
+
+	/* op,ops,min,avg,p50,p90,p99,p99.9,max in nanoseconds */
+	printf("%s,%lld,%lld,%lld", name, hs->tot_obs, st->min_ns,
+			hs->tot_sum / hs->tot_obs);
+	for (i = 0; i < IOLAT_NR_PCTS; i++)
+		printf(",%lld", p[i]);
+	printf(",%lld\n", st->max_ns);
+
+	if (!(flags & IOLAT_DUMP))
+		return;
+
+	/* op,bucket low,bucket high,ops for every bucket in use */
+	for (i = 0; i < hs->nr_buckets; i++) {
+		if (!hs->buckets[i].nr_obs)
+			continue;
+		printf("%s,%lld,%lld,%lld\n", name, hs->buckets[i].low,
+				min(hs->buckets[i].high, st->max_ns),
+				hs->buckets[i].nr_obs);
+	}
+}
+
+void
+__iolat_record(
+	enum iolat_op		op,
+	const struct timespec	*start)
+{
+	struct timespec		now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	iolat_stats_add(&iolat[op], iolat_nsec(start, &now));
+}
+
+static void
+iolat_print_all(void)
+{
+	unsigned int		i;
+
+	for (i = 0; i < IOLAT_NR; i++) {
+		iolat_stats_print(iolat_names[i], &iolat[i], iolat_flags);
+		iolat_stats_reset(&iolat[i]);
+	}
+}
+
+/*
+ * Called by the data commands when they finish.  Print and forget the
+ * latencies they recorded, unless we're accumulating across commands.
+ */
+void
+iolat_report(void)
+{
+	if (iolat_enabled && !iolat_cumulative)
+		iolat_print_all();
+}
+
+static void
+latency_help(void)
+{
+	printf(_(
+"\n"
+" records the latency of each system call made by the data commands\n"
+"\n"
+" Example:\n"
+" 'latency on' - print latency percentiles after each pwrite, fsync, etc.\n"
+"\n"
+" While recording is on, pread, pwrite, mread, mwrite, sendfile, copy_range,\n"
+" fsync, fdatasync and the fallocate family of commands time every system\n"
+" call they make (every page touched, for mread and mwrite).  When each\n"
+" command finishes, the minimum, average, 50th, 90th, 99th and 99.9th\n"
+" percentile and maximum latencies are printed for each kind of call, even\n"
+" if the command itself was told to be quiet.\n"
+" -c   -- accumulate latencies across commands, and only print them when\n"
+"         'latency report' or 'latency off' is run\n"
+" -m   -- print machine-readable comma separated values, in nanoseconds:\n"
+"         op,ops,min,avg,p50,p90,p99,p99.9,max\n"
+" -d   -- as -m, and also dump each histogram bucket in use as op,low,high,ops\n"
+" With no arguments, show whether recording is on.\n"
+"\n"));
+}
+
+static int
+latency_f(
+	int			argc,
+	char			**argv)
+{
+	unsigned int		flags = 0;
+	bool			cumulative = false;
+	unsigned int		i;
+	int			c, error;
+
+	while ((c = getopt(argc, argv, "cdm")) != EOF) {
+		switch (c) {
+		case 'c':
+			cumulative = true;
+			break;
+		case 'd':
+			flags |= IOLAT_DUMP;
+			break;
+		case 'm':
+			flags |= IOLAT_CSV;
+			break;
+		default:
+			exitcode = 1;
+			return command_usage(&latency_cmd);
+		}
+	}
+
+	if (optind == argc) {
+		printf(_("latency recording is %s\n"),
+				iolat_enabled ? _("on") : _("off"));
+		return 0;
+	}
+	if (optind != argc - 1) {
+		exitcode = 1;
+		return command_usage(&latency_cmd);
+	}
+
+	if (!strcmp(argv[optind], "on")) {
+		if (!iolat_enabled) {
+			for (i = 0; i < IOLAT_NR; i++) {
+				error = iolat_stats_init(&iolat[i]);
+				if (error) {
+					errno = error;
+					perror("histogram");
+					while (i-- > 0)
+						iolat_stats_free(&iolat[i]);
+					exitcode = 1;
+					return 0;
+				}
+			}
+		}
+		iolat_cumulative = cumulative;
+		iolat_flags = flags;
+		iolat_enabled = true;
+	} else if (!strcmp(argv[optind], "report")) {
+		if (iolat_enabled)
+			iolat_print_all();
+	} else if (!strcmp(argv[optind], "off")) {
+		if (!iolat_enabled)
+			return 0;
+		iolat_print_all();
+		for (i = 0; i < IOLAT_NR; i++)
+			iolat_stats_free(&iolat[i]);
+		iolat_enabled = false;
+	} else {
+		exitcode = 1;
+		return command_usage(&latency_cmd);
+	}
+	return 0;
+}
+
+void
+latency_init(void)
+{
+	latency_cmd.name = "latency";
+	latency_cmd.cfunc = latency_f;
+	latency_cmd.argmin = 0;
+	latency_cmd.argmax = -1;
+	latency_cmd.flags = CMD_NOFILE_OK | CMD_NOMAP_OK | CMD_FOREIGN_OK |
+			    CMD_FLAG_ONESHOT;
+	latency_cmd.args = _("[-cdm] [on|off|report]");
+	latency_cmd.oneline = _("record the latency of data command syscalls");
+	latency_cmd.help = latency_help;
+
+	add_command(&latency_cmd);
+}
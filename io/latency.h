@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#ifndef XFS_IO_LATENCY_H_
+#define XFS_IO_LATENCY_H_
+
+#include <time.h>
+#include "libfrog/histogram.h"
+
+/* Latency distribution of one kind of operation, in nanoseconds. */
+struct iolat_stats {
+	struct histogram	hist;
+	long long		min_ns;
+	long long		max_ns;
+};
+
+int iolat_stats_init(struct iolat_stats *st);
+void iolat_stats_add(struct iolat_stats *st, long long ns);
+void iolat_stats_import(struct iolat_stats *dest,
+		const struct iolat_stats *src);
+void iolat_stats_reset(struct iolat_stats *st);
+void iolat_stats_free(struct iolat_stats *st);
+
+#define IOLAT_CSV	(1U << 0)	/* comma separated summary */
+#define IOLAT_DUMP	(1U << 1)	/* comma separated histogram buckets */
+
+void iolat_stats_print(const char *name, const struct iolat_stats *st,
+		unsigned int flags);
+
+static inline long long
+iolat_nsec(
+	const struct timespec	*start,
+	const struct timespec	*end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+/* Syscalls timed by the data commands while the latency command is on. */
+enum iolat_op {
+	IOLAT_PREAD,
+	IOLAT_PWRITE,
+	IOLAT_MREAD,
+	IOLAT_MWRITE,
+	IOLAT_SENDFILE,
+	IOLAT_COPY_RANGE,
+	IOLAT_FSYNC,
+	IOLAT_FDATASYNC,
+	IOLAT_FALLOCATE,
+	IOLAT_NR,
+};
+
+extern bool	iolat_enabled;
+
+void __iolat_record(enum iolat_op op, const struct timespec *start);
+void iolat_report(void);
+
+static inline void
+iolat_start(
+	struct timespec		*start)
+{
+	if (iolat_enabled)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static inline void
+iolat_stop(
+	enum iolat_op		op,
+	const struct timespec	*start)
+{
+	if (iolat_enabled)
+		__iolat_record(op, start);
+}
+
+#endif /* XFS_IO_LATENCY_H_ */
@@ -10,6 +10,7 @@
 #include <signal.h>
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t mmap_cmd;
 static cmdinfo_t mread_cmd;
@@ -405,6 +406,7 @@ mread_f(
 	size_t		dumplen, cnt = 0;
 	char		*bp;
 	void		*start;
+	struct timespec	lat;
 	int		dump = 0, rflag = 0, c;
 	size_t		blocksize, sectsize;
 
@@ -470,30 +472,37 @@ mread_f(
 	if (!dumplen)
 		dumplen = pagesize;
 
+	/* each page-sized chunk counts as one operation for latency */
+	iolat_start(&lat);
 	if (rflag) {
 		for (tmp = length - 1; tmp >= 0; tmp--) {
 			bp[cnt++] = ((char *)mapping->addr)[dumpoffset + tmp];
 			if (cnt == dumplen) {
+				iolat_stop(IOLAT_MREAD, &lat);
 				if (dump) {
 					dump_buffer(printoffset, dumplen);
 					printoffset += dumplen;
 				}
 				dumplen = pagesize;
 				cnt = 0;
+				iolat_start(&lat);
 			}
 		}
 	} else {
 		for (tmp = 0; tmp < length; tmp++) {
 			bp[cnt++] = ((char *)mapping->addr)[dumpoffset + tmp];
 			if (cnt == dumplen) {
+				iolat_stop(IOLAT_MREAD, &lat);
 				if (dump)
 					dump_buffer(printoffset + tmp -
 						(dumplen - 1), dumplen);
 				dumplen = pagesize;
 				cnt = 0;
+				iolat_start(&lat);
 			}
 		}
 	}
+	iolat_report();
 	return 0;
 }
 
@@ -560,6 +569,7 @@ mwrite_f(
 	off_t		offset, tmp;
 	ssize_t		length;
 	void		*start;
+	struct timespec	lat;
 	char		*sp;
 	int		seed = 'X';
 	int		rflag = 0;
@@ -615,14 +625,29 @@ mwrite_f(
 		return 0;
 	}
 
+	/* each page touched counts as one operation for latency */
 	offset -= mapping->offset;
+	iolat_start(&lat);
 	if (rflag) {
-		for (tmp = offset + length -1; tmp >= offset; tmp--)
+		for (tmp = offset + length -1; tmp >= offset; tmp--) {
 			((char *)mapping->addr)[tmp] = seed;
+			if (tmp > offset && !(tmp % pagesize)) {
+				iolat_stop(IOLAT_MWRITE, &lat);
+				iolat_start(&lat);
+			}
+		}
 	} else {
-		for (tmp = offset; tmp < offset + length; tmp++)
+		for (tmp = offset; tmp < offset + length; tmp++) {
+			if (tmp > offset && !(tmp % pagesize)) {
+				iolat_stop(IOLAT_MWRITE, &lat);
+				iolat_start(&lat);
+			}
 			((char *)mapping->addr)[tmp] = seed;
+		}
 	}
+	if (length)
+		iolat_stop(IOLAT_MWRITE, &lat);
+	iolat_report();
 
 	return 0;
 }
@@ -12,6 +12,7 @@
 #include <ctype.h>
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t pread_cmd;
 
@@ -197,10 +198,16 @@ do_pread(
 	long long	count,
 	size_t		buffer_size)
 {
-	if (!vectors)
-		return pread(fd, io_buffer, min(count, buffer_size), offset);
+	struct timespec	start;
+	ssize_t		bytes;
 
-	return do_preadv(fd, offset, count);
+	iolat_start(&start);
+	if (!vectors)
+		bytes = pread(fd, io_buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_preadv(fd, offset, count);
+	iolat_stop(IOLAT_PREAD, &start);
+	return bytes;
 }
 
 static int
@@ -478,15 +485,17 @@ pread_f(
 	}
 	if (c < 0) {
 		exitcode = 1;
-		return 0;
+		goto out_latency;
 	}
 
 	if (qflag)
-		return 0;
+		goto out_latency;
 	gettimeofday(&t2, NULL);
 	t2 = tsub(t2, t1);
 
 	report_io_times("read", &t2, (long long)offset, count, total, c, Cflag);
+out_latency:
+	iolat_report();
 	return 0;
 }
 
@@ -9,6 +9,7 @@
 #include "input.h"
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 #ifndef FALLOC_FL_PUNCH_HOLE
 #define FALLOC_FL_PUNCH_HOLE	0x02
@@ -66,6 +67,22 @@ offset_length(
 	return 1;
 }
 
+/* Call fallocate on the current file, timing it if asked. */
+static int
+do_fallocate(
+	int		mode,
+	xfs_flock64_t	*segment)
+{
+	struct timespec	start;
+	int		ret;
+
+	iolat_start(&start);
+	ret = fallocate(file->fd, mode, segment->l_start, segment->l_len);
+	iolat_stop(IOLAT_FALLOCATE, &start);
+	iolat_report();
+	return ret;
+}
+
 /*
  * These ioctls were withdrawn in Linux 5.17, but we'll keep them around for
  * a few releases.
@@ -240,8 +257,7 @@ fallocate_f(
 		return 0;
 	}
 
-	if (fallocate(file->fd, mode,
-			segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		exitcode = 1;
 		return 0;
@@ -262,8 +278,7 @@ fpunch_f(
 		return 0;
 	}
 
-	if (fallocate(file->fd, mode,
-			segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		exitcode = 1;
 		return 0;
@@ -284,8 +299,7 @@ fcollapse_f(
 		return 0;
 	}
 
-	if (fallocate(file->fd, mode,
-			segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		exitcode = 1;
 		return 0;
@@ -306,8 +320,7 @@ finsert_f(
 		return 0;
 	}
 
-	if (fallocate(file->fd, mode,
-			segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		exitcode = 1;
 		return 0;
@@ -339,7 +352,7 @@ fzero_f(
 	if (!offset_length(argv[optind], argv[optind + 1], &segment))
 		return 0;
 
-	if (fallocate(file->fd, mode, segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		return 0;
 	}
@@ -369,7 +382,7 @@ funshare_f(
 		return 0;
 	}
 
-	if (fallocate(file->fd, mode, segment.l_start, segment.l_len)) {
+	if (do_fallocate(mode, &segment)) {
 		perror("fallocate");
 		exitcode = 1;
 		return 0;
@@ -9,6 +9,7 @@
 #include "input.h"
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t pwrite_cmd;
 
@@ -97,10 +98,16 @@ do_pwrite(
 	size_t		buffer_size,
 	int		pwritev2_flags)
 {
-	if (!vectors)
-		return pwrite(fd, io_buffer, min(count, buffer_size), offset);
+	struct timespec	start;
+	ssize_t		bytes;
 
-	return do_pwritev(fd, offset, count, pwritev2_flags);
+	iolat_start(&start);
+	if (!vectors)
+		bytes = pwrite(fd, io_buffer, min(count, buffer_size), offset);
+	else
+		bytes = do_pwritev(fd, offset, count, pwritev2_flags);
+	iolat_stop(IOLAT_PWRITE, &start);
+	return bytes;
 }
 
 static int
@@ -275,10 +282,11 @@ pwrite_f(
 	unsigned int	zeed = 0, seed = 0xcdcdcdcd;
 	size_t		fsblocksize, fssectsize;
 	struct timeval	t1, t2;
+	struct timespec	start;
 	char		*sp, *infile = NULL;
 	int		Cflag, qflag, uflag, dflag, wflag, Wflag;
 	int		direction = IO_FORWARD;
-	int		c, fd = -1;
+	int		c, ret, fd = -1;
 	int		pwritev2_flags = 0;
 
 	Cflag = qflag = uflag = dflag = wflag = Wflag = 0;
@@ -443,14 +451,20 @@ pwrite_f(
 		goto done;
 	}
 	if (Wflag) {
-		if (fsync(file->fd) < 0) {
+		iolat_start(&start);
+		ret = fsync(file->fd);
+		iolat_stop(IOLAT_FSYNC, &start);
+		if (ret < 0) {
 			perror("fsync");
 			exitcode = 1;
 			goto done;
 		}
 	}
 	if (wflag) {
-		if (fdatasync(file->fd) < 0) {
+		iolat_start(&start);
+		ret = fdatasync(file->fd);
+		iolat_stop(IOLAT_FDATASYNC, &start);
+		if (ret < 0) {
 			perror("fdatasync");
 			exitcode = 1;
 			goto done;
@@ -465,6 +479,7 @@ pwrite_f(
 	report_io_times("wrote", &t2, (long long)offset, count, total, c,
 			Cflag);
 done:
+	iolat_report();
 	if (infile)
 		close(fd);
 	return 0;
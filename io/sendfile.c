@@ -9,6 +9,7 @@
 #include <sys/sendfile.h>
 #include "init.h"
 #include "io.h"
+#include "latency.h"
 
 static cmdinfo_t sendfile_cmd;
 
@@ -41,11 +42,14 @@ send_buffer(
 {
 	off_t		off = offset;
 	ssize_t		bytes, bytes_remaining = count;
+	struct timespec	start;
 	int		ops = 0;
 
 	*total = 0;
 	while (count > 0) {
+		iolat_start(&start);
 		bytes = sendfile(file->fd, fd, &off, bytes_remaining);
+		iolat_stop(IOLAT_SENDFILE, &start);
 		if (bytes == 0)
 			break;
 		if (bytes < 0) {
@@ -154,6 +158,7 @@ sendfile_f(
 
 	report_io_times("sent", &t2, (long long)offset, count, total, c, Cflag);
 done:
+	iolat_report();
 	if (infile)
 		close(fd);
 	return 0;
@@ -102,6 +102,31 @@ hist_free(
 	memset(hs, 0, sizeof(struct histogram));
 }
 
+/*
+ * Return the upper bound of the bucket containing the observation at the given
+ * percentile, or -1 if nothing has been recorded.  The answer is only as
+ * precise as the bucket boundaries.
+ */
+long long
+hist_percentile(
+	const struct histogram	*hs,
+	double			pct)
+{
+	double			want = pct * hs->tot_obs / 100.0;
+	long long		seen = 0;
+	unsigned int		i;
+
+	if (hs->tot_obs == 0 || hs->nr_buckets == 0)
+		return -1;
+
+	for (i = 0; i < hs->nr_buckets; i++) {
+		seen += hs->buckets[i].nr_obs;
+		if (seen > 0 && seen >= want)
+			return hs->buckets[i].high;
+	}
+	return hs->buckets[hs->nr_buckets - 1].high;
+}
+
 /*
  * Compute the CDF of the histogram in decreasing order of value.
  *
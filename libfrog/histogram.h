@@ -68,6 +68,8 @@ static inline unsigned int hist_buckets(const struct histogram *hs)
 	return hs->nr_buckets;
 }
 
+long long hist_percentile(const struct histogram *hs, double pct);
+
 struct histogram_cdf *hist_cdf(const struct histogram *hs);
 void histcdf_free(struct histogram_cdf *cdf);
 
@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ *
+ * The per-ID lookups were moved here from quota/util.c,
+ * Copyright (c) 2005 Silicon Graphics, Inc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pwd.h>
+#include <grp.h>
+#include "projects.h"
+#include "idnames.h"
+
+/*
+ * Cache of user, group and project names by ID.
+ *
+ * Names are looked up one ID at a time through NSS and the answer is cached,
+ * whether or not there is a name for the ID.  That is the cheapest way to
+ * name a handful of IDs, but a report covering millions of IDs would make
+ * millions of NSS queries, so callers that are about to name every ID in a
+ * quota file can have the whole passwd, group or projid database read into
+ * the cache first with idnames_preload().
+ */
+
+struct idname {
+	uint32_t		id;
+	bool			used;
+	char			*name;		/* NULL if the ID has no name */
+};
+
+struct idname_table {
+	struct idname		*slots;
+	unsigned long		size;		/* always a power of two */
+	unsigned long		count;
+	bool			loaded;
+};
+
+static struct idname_table	tables[IDNAMES_NR_TYPES];
+
+static inline unsigned long
+idname_hash(
+	uint32_t		id)
+{
+	return ((uint64_t)id * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static struct idname *
+idname_slot(
+	struct idname_table	*t,
+	uint32_t		id)
+{
+	unsigned long		i = idname_hash(id) & (t->size - 1);
+
+	while (t->slots[i].used && t->slots[i].id != id)
+		i = (i + 1) & (t->size - 1);
+	return &t->slots[i];
+}
+
+static int
+idname_grow(
+	struct idname_table	*t)
+{
+	struct idname_table	new = {
+		.size		= t->size ? t->size * 2 : 1024,
+		.count		= t->count,
+		.loaded		= t->loaded,
+	};
+	unsigned long		i;
+
+	new.slots = calloc(new.size, sizeof(struct idname));
+	if (!new.slots)
+		return -1;
+	for (i = 0; i < t->size; i++)
+		if (t->slots[i].used)
+			*idname_slot(&new, t->slots[i].id) = t->slots[i];
+	free(t->slots);
+	*t = new;
+	return 0;
+}
+
+/* Add an ID; the first name found for an ID wins, as with getpwuid. */
+static struct idname *
+idname_add(
+	struct idname_table	*t,
+	uint32_t		id,
+	const char		*name)
+{
+	struct idname		*in;
+
+	if (t->count * 2 >= t->size && idname_grow(t))
+		return NULL;
+	in = idname_slot(t, id);
+	if (in->used)
+		return in;
+	in->used = true;
+	in->id = id;
+	in->name = name ? strndup(name, IDNAMES_NMAX) : NULL;
+	t->count++;
+	return in;
+}
+
+/* Read the whole database for a type into the cache, once. */
+void
+idnames_preload(
+	enum idnames_type	type)
+{
+	struct idname_table	*t = &tables[type];
+
+	if (t->loaded)
+		return;
+	t->loaded = true;
+
+	switch (type) {
+	case IDNAMES_USER: {
+		struct passwd	*pw;
+
+		setpwent();
+		while ((pw = getpwent()) != NULL)
+			if (!idname_add(t, pw->pw_uid, pw->pw_name))
+				break;
+		endpwent();
+		break;
+	}
+	case IDNAMES_GROUP: {
+		struct group	*gr;
+
+		setgrent();
+		while ((gr = getgrent()) != NULL)
+			if (!idname_add(t, gr->gr_gid, gr->gr_name))
+				break;
+		endgrent();
+		break;
+	}
+	case IDNAMES_PROJ: {
+		fs_project_t	*pr;
+
+		setprent();
+		while ((pr = getprent()) != NULL)
+			if (!idname_add(t, pr->pr_prid, pr->pr_name))
+				break;
+		endprent();
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/* Look up one ID the slow way. */
+static const char *
+idname_getbyid(
+	enum idnames_type	type,
+	uint32_t		id)
+{
+	struct passwd		*pw;
+	struct group		*gr;
+	fs_project_t		*pr;
+
+	switch (type) {
+	case IDNAMES_USER:
+		pw = getpwuid(id);
+		return pw ? pw->pw_name : NULL;
+	case IDNAMES_GROUP:
+		gr = getgrgid(id);
+		return gr ? gr->gr_name : NULL;
+	case IDNAMES_PROJ:
+		pr = getprprid(id);
+		return pr ? pr->pr_name : NULL;
+	default:
+		return NULL;
+	}
+}
+
+/* Return the name for an ID, or NULL if it doesn't have one. */
+const char *
+idnames_lookup(
+	enum idnames_type	type,
+	uint32_t		id)
+{
+	struct idname_table	*t = &tables[type];
+	struct idname		*in;
+
+	if (t->size) {
+		in = idname_slot(t, id);
+		if (in->used)
+			return in->name;
+	}
+
+	in = idname_add(t, id, idname_getbyid(type, id));
+	if (!in)
+		return idname_getbyid(type, id);
+	return in->name;
+}
+
+void
+idnames_free(void)
+{
+	unsigned long		i;
+	int			type;
+
+	for (type = 0; type < IDNAMES_NR_TYPES; type++) {
+		struct idname_table *t = &tables[type];
+
+		for (i = 0; i < t->size; i++)
+			free(t->slots[i].name);
+		free(t->slots);
+		memset(t, 0, sizeof(*t));
+	}
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#ifndef __LIBFROG_IDNAMES_H__
+#define __LIBFROG_IDNAMES_H__
+
+/* longer names are truncated, as xfs_quota has always done */
+#define IDNAMES_NMAX	32
+
+enum idnames_type {
+	IDNAMES_USER = 0,
+	IDNAMES_GROUP,
+	IDNAMES_PROJ,
+	IDNAMES_NR_TYPES,
+};
+
+const char *idnames_lookup(enum idnames_type type, uint32_t id);
+void idnames_preload(enum idnames_type type);
+void idnames_free(void);
+
+#endif	/* __LIBFROG_IDNAMES_H__ */
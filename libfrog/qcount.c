@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "qcount.h"
+
+/*
+ * Quota usage accumulators for offline quotacheck.
+ *
+ * Counting usage into one shared table needs a lock around every update,
+ * and all the threads walking inodes fight over it.  Instead, each thread
+ * (or each AG, if an AG is only ever scanned by one thread at a time) gets
+ * its own partial table, which it updates without any locking at all.  Once
+ * the scan is done, the partial tables are merged into one array sorted by
+ * quota id, which can then be searched while walking the dquots on disk.
+ *
+ * The partial tables are open addressing hash tables.  Every record in use
+ * has charged at least one inode, so a zero icount marks a free slot.
+ */
+
+#define QCOUNT_INIT_SIZE	256
+
+static inline uint32_t
+qcount_hash(
+	uint32_t		id,
+	uint32_t		size)
+{
+	return ((uint64_t)id * 0x9e3779b97f4a7c15ULL) >> 32 & (size - 1);
+}
+
+static struct qcount_rec *
+qcount_slot(
+	struct qcount_rec	*recs,
+	uint32_t		size,
+	uint32_t		id)
+{
+	uint32_t		i = qcount_hash(id, size);
+
+	while (recs[i].icount && recs[i].id != id)
+		i = (i + 1) & (size - 1);
+	return &recs[i];
+}
+
+static int
+qcount_part_grow(
+	struct qcount_part	*part)
+{
+	struct qcount_rec	*recs;
+	uint32_t		size;
+	uint32_t		i;
+
+	size = part->size ? part->size * 2 : QCOUNT_INIT_SIZE;
+	if (size < part->size)
+		return -ENOMEM;
+	recs = calloc(size, sizeof(struct qcount_rec));
+	if (!recs)
+		return -ENOMEM;
+
+	for (i = 0; i < part->size; i++) {
+		if (part->recs[i].icount)
+			*qcount_slot(recs, size, part->recs[i].id) =
+					part->recs[i];
+	}
+	free(part->recs);
+	part->recs = recs;
+	part->size = size;
+	return 0;
+}
+
+/* Set up @nr_parts empty partial tables. */
+int
+qcount_init(
+	struct qcount		*qc,
+	unsigned int		nr_parts)
+{
+	memset(qc, 0, sizeof(*qc));
+	qc->parts = calloc(nr_parts, sizeof(struct qcount_part));
+	if (!qc->parts)
+		return -ENOMEM;
+	qc->nr_parts = nr_parts;
+	return 0;
+}
+
+/*
+ * Charge one inode and its blocks to @id in partial table @part.  The caller
+ * must make sure that nobody else is updating the same partial table.
+ */
+int
+qcount_add(
+	struct qcount		*qc,
+	unsigned int		part,
+	uint32_t		id,
+	uint64_t		bcount,
+	uint64_t		rtbcount)
+{
+	struct qcount_part	*p = &qc->parts[part];
+	struct qcount_rec	*rec;
+	int			error;
+
+	if (p->nr >= p->size / 2) {
+		error = qcount_part_grow(p);
+		if (error)
+			return error;
+	}
+
+	rec = qcount_slot(p->recs, p->size, id);
+	if (!rec->icount) {
+		rec->id = id;
+		p->nr++;
+	}
+	rec->bcount += bcount;
+	rec->rtbcount += rtbcount;
+	rec->icount++;
+	return 0;
+}
+
+static int
+qcount_rec_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct qcount_rec	*ra = a;
+	const struct qcount_rec	*rb = b;
+
+	if (ra->id < rb->id)
+		return -1;
+	return ra->id > rb->id;
+}
+
+/*
+ * Merge the partial tables into one array sorted by id, and free them.  This
+ * must not run until every thread has finished with its partial table.
+ */
+int
+qcount_merge(
+	struct qcount		*qc)
+{
+	struct qcount_rec	*recs;
+	uint64_t		nr = 0;
+	uint64_t		i, j;
+	unsigned int		p;
+
+	for (p = 0; p < qc->nr_parts; p++)
+		nr += qc->parts[p].nr;
+
+	recs = calloc(nr ? nr : 1, sizeof(struct qcount_rec));
+	if (!recs)
+		return -ENOMEM;
+
+	nr = 0;
+	for (p = 0; p < qc->nr_parts; p++) {
+		struct qcount_part	*part = &qc->parts[p];
+
+		for (i = 0; i < part->size; i++) {
+			if (part->recs[i].icount)
+				recs[nr++] = part->recs[i];
+		}
+		free(part->recs);
+		part->recs = NULL;
+		part->size = part->nr = 0;
+	}
+
+	qsort(recs, nr, sizeof(struct qcount_rec), qcount_rec_cmp);
+
+	/* fold together the counts for ids seen by more than one thread */
+	for (i = 0, j = 0; i < nr; i++) {
+		if (j > 0 && recs[j - 1].id == recs[i].id) {
+			recs[j - 1].bcount += recs[i].bcount;
+			recs[j - 1].rtbcount += recs[i].rtbcount;
+			recs[j - 1].icount += recs[i].icount;
+		} else {
+			recs[j++] = recs[i];
+		}
+	}
+
+	free(qc->recs);
+	qc->recs = recs;
+	qc->nr_recs = j;
+	return 0;
+}
+
+/* Find the merged usage record for @id, if anything was charged to it. */
+struct qcount_rec *
+qcount_lookup(
+	struct qcount		*qc,
+	uint32_t		id)
+{
+	struct qcount_rec	key = { .id = id };
+
+	if (!qc->nr_recs)
+		return NULL;
+	return bsearch(&key, qc->recs, qc->nr_recs, sizeof(struct qcount_rec),
+			qcount_rec_cmp);
+}
+
+void
+qcount_free(
+	struct qcount		*qc)
+{
+	unsigned int		p;
+
+	for (p = 0; p < qc->nr_parts; p++)
+		free(qc->parts[p].recs);
+	free(qc->parts);
+	free(qc->recs);
+	memset(qc, 0, sizeof(*qc));
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#ifndef __LIBFROG_QCOUNT_H__
+#define __LIBFROG_QCOUNT_H__
+
+/* Resource usage charged to one quota id. */
+struct qcount_rec {
+	uint32_t		id;
+	uint32_t		flags;		/* for the caller */
+	uint64_t		bcount;
+	uint64_t		rtbcount;
+	uint64_t		icount;
+};
+
+/* Usage counted by one thread; only that thread may touch it. */
+struct qcount_part {
+	struct qcount_rec	*recs;
+	uint32_t		size;
+	uint32_t		nr;
+};
+
+struct qcount {
+	unsigned int		nr_parts;
+	struct qcount_part	*parts;
+
+	/* merged usage, sorted by id */
+	struct qcount_rec	*recs;
+	uint64_t		nr_recs;
+};
+
+int qcount_init(struct qcount *qc, unsigned int nr_parts);
+int qcount_add(struct qcount *qc, unsigned int part, uint32_t id,
+		uint64_t bcount, uint64_t rtbcount);
+int qcount_merge(struct qcount *qc);
+struct qcount_rec *qcount_lookup(struct qcount *qc, uint32_t id);
+void qcount_free(struct qcount *qc);
+
+#endif /* __LIBFROG_QCOUNT_H__ */
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs_priv.h"
+#include "libxfs_io.h"
+#include "libxfs/buf_stats.h"
+
+/*
+ * Buffer Cache Statistics
+ * =======================
+ *
+ * Counters are kept per buffer type in a small open addressed table keyed
+ * by the verifier ops.  Slot zero collects buffers that have no ops, such
+ * as raw reads and blocks that were prefetched but not yet verified.  Slots
+ * are claimed under a lock and then never change, so lookups don't lock.
+ * The name is copied when the slot is claimed because some callers write
+ * buffers with ops that live on the stack.
+ * Every counter is atomic, since repair hits the cache from many threads.
+ *
+ * I/O latencies go into power of two histograms of nanoseconds, which is
+ * plenty to tell a cache from a disk from a network.
+ */
+#define BSTAT_TYPES		64
+#define BSTAT_LAT_BUCKETS	40
+
+struct bstat_io {
+	atomic64_t		ops;
+	atomic64_t		bytes;
+	atomic64_t		ns;
+	atomic64_t		lat[BSTAT_LAT_BUCKETS];
+};
+
+struct bstat_type {
+	const struct xfs_buf_ops *ops;
+	char			name[32];
+	atomic64_t		hits;
+	atomic64_t		misses;
+	atomic64_t		verifies;
+	atomic64_t		verify_ns;
+	struct bstat_io		io[XFS_BSTAT_NR_IO];
+};
+
+bool				libxfs_buf_stats_on;
+
+static struct bstat_type	bstat_types[BSTAT_TYPES];
+static pthread_mutex_t		bstat_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic64_t		bstat_shakes;
+static atomic64_t		bstat_shaken;
+static struct timespec		bstat_start;
+
+/* periodic JSON emitter */
+static pthread_t		bstat_thread;
+static pthread_cond_t		bstat_wakeup = PTHREAD_COND_INITIALIZER;
+static bool			bstat_thread_running;
+static bool			bstat_thread_stop;
+static unsigned int		bstat_interval;
+static FILE			*bstat_fp;
+
+static inline long long
+bstat_nsec(
+	const struct timespec	*start,
+	const struct timespec	*end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+static struct bstat_type *
+bstat_lookup(
+	const struct xfs_buf_ops *ops)
+{
+	struct bstat_type	*bt;
+	unsigned int		slot, i;
+
+	if (!ops)
+		return &bstat_types[0];
+
+	slot = ((uintptr_t)ops >> 4) % (BSTAT_TYPES - 1);
+	for (i = 0; i < BSTAT_TYPES - 1; i++) {
+		bt = &bstat_types[1 + (slot + i) % (BSTAT_TYPES - 1)];
+		if (smp_load_acquire(&bt->ops) == ops)
+			return bt;
+		if (smp_load_acquire(&bt->ops) != NULL)
+			continue;
+
+		pthread_mutex_lock(&bstat_lock);
+		if (bt->ops == NULL) {
+			snprintf(bt->name, sizeof(bt->name), "%s",
+					ops->name ? ops->name : "(unnamed)");
+			smp_store_release(&bt->ops, ops);
+		}
+		pthread_mutex_unlock(&bstat_lock);
+		if (bt->ops == ops)
+			return bt;
+	}
+
+	/* Table full?  Lump it in with the unknowns. */
+	return &bstat_types[0];
+}
+
+void
+__libxfs_buf_stats_lookup(
+	const struct xfs_buf_ops *ops,
+	bool			hit)
+{
+	struct bstat_type	*bt = bstat_lookup(ops);
+
+	if (hit)
+		atomic64_inc(&bt->hits);
+	else
+		atomic64_inc(&bt->misses);
+}
+
+void
+__libxfs_buf_stats_io(
+	const struct xfs_buf_ops *ops,
+	enum xfs_bstat_io	io,
+	unsigned int		bytes,
+	const struct timespec	*start)
+{
+	struct bstat_io		*bi = &bstat_lookup(ops)->io[io];
+	struct timespec		now;
+	long long		ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = max(bstat_nsec(start, &now), 1LL);
+
+	atomic64_inc(&bi->ops);
+	atomic64_add(bytes, &bi->bytes);
+	atomic64_add(ns, &bi->ns);
+	atomic64_inc(&bi->lat[min(fls64(ns) - 1, BSTAT_LAT_BUCKETS - 1)]);
+}
+
+void
+__libxfs_buf_stats_verify(
+	const struct xfs_buf_ops *ops,
+	const struct timespec	*start)
+{
+	struct bstat_type	*bt = bstat_lookup(ops);
+	struct timespec		now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	atomic64_inc(&bt->verifies);
+	atomic64_add(bstat_nsec(start, &now), &bt->verify_ns);
+}
+
+void
+__libxfs_buf_stats_shake(
+	unsigned int		nodes)
+{
+	atomic64_inc(&bstat_shakes);
+	atomic64_add(nodes, &bstat_shaken);
+}
+
+static inline const char *
+bstat_name(
+	const struct bstat_type	*bt)
+{
+	return bt->ops ? bt->name : "(unknown)";
+}
+
+static inline bool
+bstat_used(
+	const struct bstat_type	*bt)
+{
+	return atomic64_read(&bt->hits) || atomic64_read(&bt->misses) ||
+	       atomic64_read(&bt->io[XFS_BSTAT_READ].ops) ||
+	       atomic64_read(&bt->io[XFS_BSTAT_WRITE].ops) ||
+	       atomic64_read(&bt->verifies);
+}
+
+/* Upper bound of the bucket containing the given percentile, in usec. */
+static double
+bstat_percentile(
+	const struct bstat_io	*bi,
+	double			pct)
+{
+	long long		total = atomic64_read(&bi->ops);
+	long long		seen = 0;
+	unsigned int		i;
+
+	if (!total)
+		return 0;
+	for (i = 0; i < BSTAT_LAT_BUCKETS - 1; i++) {
+		seen += atomic64_read(&bi->lat[i]);
+		if (seen * 100.0 >= total * pct)
+			break;
+	}
+	return (2ULL << i) / 1000.0;
+}
+
+static inline double
+bstat_avg_usec(
+	const struct bstat_io	*bi)
+{
+	long long		ops = atomic64_read(&bi->ops);
+
+	return ops ? atomic64_read(&bi->ns) / 1000.0 / ops : 0;
+}
+
+/* Print a table of everything we've seen so far. */
+void
+libxfs_buf_stats_report(
+	FILE			*fp)
+{
+	const struct bstat_type	*bt;
+	const struct bstat_io	*rd, *wr;
+	long long		hits, misses;
+	unsigned int		i;
+
+	fprintf(fp, _("Buffer cache statistics by buffer type:\n"));
+	fprintf(fp,
+_("%-24s %10s %10s %6s %10s %10s %9s %9s %10s %10s %9s %9s %10s\n"),
+		_("type"), _("hits"), _("misses"), _("hit%"),
+		_("reads"), _("read MiB"), _("rd p50us"), _("rd p99us"),
+		_("writes"), _("write MiB"), _("wr p50us"), _("wr p99us"),
+		_("verify ms"));
+	for (i = 0; i < BSTAT_TYPES; i++) {
+		bt = &bstat_types[i];
+		if (!bstat_used(bt))
+			continue;
+
+		rd = &bt->io[XFS_BSTAT_READ];
+		wr = &bt->io[XFS_BSTAT_WRITE];
+		hits = atomic64_read(&bt->hits);
+		misses = atomic64_read(&bt->misses);
+		fprintf(fp,
+"%-24s %10lld %10lld %6.1f %10lld %10.1f %9.1f %9.1f %10lld %10.1f %9.1f %9.1f %10.1f\n",
+			bstat_name(bt), hits, misses,
+			hits + misses ? hits * 100.0 / (hits + misses) : 0.0,
+			(long long)atomic64_read(&rd->ops),
+			atomic64_read(&rd->bytes) / 1048576.0,
+			bstat_percentile(rd, 50), bstat_percentile(rd, 99),
+			(long long)atomic64_read(&wr->ops),
+			atomic64_read(&wr->bytes) / 1048576.0,
+			bstat_percentile(wr, 50), bstat_percentile(wr, 99),
+			atomic64_read(&bt->verify_ns) / 1000000.0);
+	}
+	fprintf(fp, _("Cache shakes: %lld, buffers reclaimed: %lld\n"),
+		(long long)atomic64_read(&bstat_shakes),
+		(long long)atomic64_read(&bstat_shaken));
+}
+
+void
+libxfs_buf_stats_totals(
+	struct xfs_buf_stats_totals	*tot)
+{
+	const struct bstat_type	*bt;
+	unsigned int		i, io;
+
+	memset(tot, 0, sizeof(*tot));
+	for (i = 0; i < BSTAT_TYPES; i++) {
+		bt = &bstat_types[i];
+		tot->hits += atomic64_read(&bt->hits);
+		tot->misses += atomic64_read(&bt->misses);
+		tot->verify_ns += atomic64_read(&bt->verify_ns);
+		for (io = 0; io < XFS_BSTAT_NR_IO; io++) {
+			tot->ios[io] += atomic64_read(&bt->io[io].ops);
+			tot->io_bytes[io] += atomic64_read(&bt->io[io].bytes);
+			tot->io_ns[io] += atomic64_read(&bt->io[io].ns);
+		}
+	}
+	tot->shakes = atomic64_read(&bstat_shakes);
+	tot->reclaimed = atomic64_read(&bstat_shaken);
+}
+
+static void
+bstat_json_io(
+	FILE			*fp,
+	const char		*name,
+	const struct bstat_io	*bi)
+{
+	fprintf(fp,
+", \"%ss\": %lld, \"%s_bytes\": %lld, \"%s_avg_usec\": %.1f, \"%s_p50_usec\": %.1f, \"%s_p99_usec\": %.1f",
+		name, (long long)atomic64_read(&bi->ops),
+		name, (long long)atomic64_read(&bi->bytes),
+		name, bstat_avg_usec(bi),
+		name, bstat_percentile(bi, 50),
+		name, bstat_percentile(bi, 99));
+}
+
+/* Emit everything we've seen so far as one line of JSON. */
+void
+libxfs_buf_stats_json(
+	FILE			*fp)
+{
+	const struct bstat_type	*bt;
+	struct timespec		now;
+	unsigned int		i;
+	bool			first = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(fp, "{\"program\": \"%s\", \"elapsed\": %.3f, ", progname,
+			bstat_nsec(&bstat_start, &now) / 1e9);
+	fprintf(fp, "\"shakes\": %lld, \"reclaimed\": %lld, \"types\": [",
+			(long long)atomic64_read(&bstat_shakes),
+			(long long)atomic64_read(&bstat_shaken));
+	for (i = 0; i < BSTAT_TYPES; i++) {
+		bt = &bstat_types[i];
+		if (!bstat_used(bt))
+			continue;
+
+		fprintf(fp, "%s{\"type\": \"%s\", \"hits\": %lld, \"misses\": %lld",
+				first ? "" : ", ", bstat_name(bt),
+				(long long)atomic64_read(&bt->hits),
+				(long long)atomic64_read(&bt->misses));
+		bstat_json_io(fp, "read", &bt->io[XFS_BSTAT_READ]);
+		bstat_json_io(fp, "write", &bt->io[XFS_BSTAT_WRITE]);
+		fprintf(fp, ", \"verifies\": %lld, \"verify_usec\": %.1f}",
+				(long long)atomic64_read(&bt->verifies),
+				atomic64_read(&bt->verify_ns) / 1000.0);
+		first = false;
+	}
+	fprintf(fp, "]}\n");
+	fflush(fp);
+}
+
+static void *
+bstat_emitter(
+	void			*arg)
+{
+	struct timespec		deadline;
+
+	pthread_mutex_lock(&bstat_lock);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	while (!bstat_thread_stop) {
+		deadline.tv_sec += bstat_interval;
+		if (pthread_cond_timedwait(&bstat_wakeup, &bstat_lock,
+					&deadline) == ETIMEDOUT)
+			libxfs_buf_stats_json(bstat_fp);
+	}
+	pthread_mutex_unlock(&bstat_lock);
+	return NULL;
+}
+
+/*
+ * Start collecting statistics.  If @interval is nonzero, also write them to
+ * @fp as JSON every @interval seconds, and once more when we're turned off.
+ */
+int
+libxfs_buf_stats_enable(
+	unsigned int		interval,
+	FILE			*fp)
+{
+	int			error;
+
+	clock_gettime(CLOCK_MONOTONIC, &bstat_start);
+	libxfs_buf_stats_on = true;
+	if (!interval)
+		return 0;
+
+	bstat_interval = interval;
+	bstat_fp = fp;
+	bstat_thread_stop = false;
+	error = pthread_create(&bstat_thread, NULL, bstat_emitter, NULL);
+	if (error)
+		return error;
+	bstat_thread_running = true;
+	return 0;
+}
+
+void
+libxfs_buf_stats_disable(void)
+{
+	if (bstat_thread_running) {
+		pthread_mutex_lock(&bstat_lock);
+		bstat_thread_stop = true;
+		pthread_cond_signal(&bstat_wakeup);
+		pthread_mutex_unlock(&bstat_lock);
+		pthread_join(bstat_thread, NULL);
+		bstat_thread_running = false;
+		libxfs_buf_stats_json(bstat_fp);
+	}
+	libxfs_buf_stats_on = false;
+}
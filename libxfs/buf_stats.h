@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#ifndef __LIBXFS_BUF_STATS_H__
+#define __LIBXFS_BUF_STATS_H__
+
+/*
+ * Buffer cache instrumentation.  The hooks are always compiled in, but cost
+ * only a branch on a global flag until a tool turns collection on.
+ * Everything is counted per buffer type, which is the name of the buffer's
+ * verifier ops.
+ */
+extern bool libxfs_buf_stats_on;
+
+enum xfs_bstat_io {
+	XFS_BSTAT_READ,
+	XFS_BSTAT_WRITE,
+	XFS_BSTAT_NR_IO,
+};
+
+void __libxfs_buf_stats_lookup(const struct xfs_buf_ops *ops, bool hit);
+void __libxfs_buf_stats_io(const struct xfs_buf_ops *ops,
+		enum xfs_bstat_io io, unsigned int bytes,
+		const struct timespec *start);
+void __libxfs_buf_stats_verify(const struct xfs_buf_ops *ops,
+		const struct timespec *start);
+void __libxfs_buf_stats_shake(unsigned int nodes);
+
+/* Record a cache hit or miss on a read. */
+static inline void
+libxfs_buf_stats_lookup(
+	const struct xfs_buf_ops	*ops,
+	bool				hit)
+{
+	if (libxfs_buf_stats_on)
+		__libxfs_buf_stats_lookup(ops, hit);
+}
+
+/* Start timing an I/O. */
+static inline void
+libxfs_buf_stats_io_start(
+	struct timespec		*start)
+{
+	if (libxfs_buf_stats_on)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* Record an I/O of @bytes that started at @start. */
+static inline void
+libxfs_buf_stats_io(
+	const struct xfs_buf_ops	*ops,
+	enum xfs_bstat_io		io,
+	unsigned int			bytes,
+	const struct timespec		*start)
+{
+	if (libxfs_buf_stats_on)
+		__libxfs_buf_stats_io(ops, io, bytes, start);
+}
+
+/* Start timing a verifier, in CPU time. */
+static inline void
+libxfs_buf_stats_verify_start(
+	struct timespec		*start)
+{
+	if (libxfs_buf_stats_on)
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+static inline void
+libxfs_buf_stats_verify(
+	const struct xfs_buf_ops	*ops,
+	const struct timespec		*start)
+{
+	if (libxfs_buf_stats_on)
+		__libxfs_buf_stats_verify(ops, start);
+}
+
+/* Record the cache reclaiming @nodes buffers under memory pressure. */
+static inline void
+libxfs_buf_stats_shake(
+	unsigned int		nodes)
+{
+	if (libxfs_buf_stats_on)
+		__libxfs_buf_stats_shake(nodes);
+}
+
+/* Everything added up over all buffer types. */
+struct xfs_buf_stats_totals {
+	long long		hits;
+	long long		misses;
+	long long		ios[XFS_BSTAT_NR_IO];
+	long long		io_bytes[XFS_BSTAT_NR_IO];
+	long long		io_ns[XFS_BSTAT_NR_IO];
+	long long		verify_ns;
+	long long		shakes;
+	long long		reclaimed;
+};
+
+int libxfs_buf_stats_enable(unsigned int interval, FILE *fp);
+void libxfs_buf_stats_disable(void);
+void libxfs_buf_stats_report(FILE *fp);
+void libxfs_buf_stats_json(FILE *fp);
+void libxfs_buf_stats_totals(struct xfs_buf_stats_totals *tot);
+
+#endif /* __LIBXFS_BUF_STATS_H__ */
@@ -17,6 +17,7 @@
 #include "xfs_trans_resv.h"
 #include "xfs_mount.h"
 #include "xfs_bit.h"
+#include "libxfs/buf_stats.h"
 
 #define CACHE_DEBUG 1
 #undef CACHE_DEBUG
@@ -274,6 +275,9 @@ cache_shake(
 		pthread_mutex_lock(&cache->c_mutex);
 		cache->c_count -= count;
 		pthread_mutex_unlock(&cache->c_mutex);
+
+		if (!purge)
+			libxfs_buf_stats_shake(count);
 	}
 
 	return (count == CACHE_SHAKE_COUNT) ? priority : ++priority;
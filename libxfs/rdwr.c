@@ -586,20 +586,33 @@ __read_buf(int fd, void *buf, int len, off_t offset, int flags)
 	return 0;
 }
 
-int
-libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, struct xfs_buf *bp,
-		int len, int flags)
+/*
+ * The readbufr variants take the ops that the caller is about to verify the
+ * buffer with, so that the I/O is accounted to the right buffer type even
+ * though the ops aren't attached until after the read.
+ */
+static int
+__libxfs_readbufr(
+	struct xfs_buftarg	*btp,
+	xfs_daddr_t		blkno,
+	struct xfs_buf		*bp,
+	int			len,
+	int			flags,
+	const struct xfs_buf_ops *ops)
 {
-	int	fd = btp->bt_bdev_fd;
-	int	bytes = BBTOB(len);
-	int	error;
+	int			fd = btp->bt_bdev_fd;
+	int			bytes = BBTOB(len);
+	struct timespec		start;
+	int			error;
 
 	ASSERT(len <= bp->b_length);
 
 	if (xfs_buftarg_is_mem(btp))
 		return 0;
 
+	libxfs_buf_stats_io_start(&start);
 	error = __read_buf(fd, bp->b_addr, bytes, LIBXFS_BBTOOFF64(blkno), flags);
+	libxfs_buf_stats_io(ops, XFS_BSTAT_READ, bytes, &start);
 	if (!error &&
 	    bp->b_target == btp &&
 	    bp->b_cache_key == blkno &&
@@ -609,27 +622,43 @@ libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, struct xfs_buf *bp,
 	return error;
 }
 
+int
+libxfs_readbufr(struct xfs_buftarg *btp, xfs_daddr_t blkno, struct xfs_buf *bp,
+		int len, int flags)
+{
+	return __libxfs_readbufr(btp, blkno, bp, len, flags, bp->b_ops);
+}
+
 int
 libxfs_readbuf_verify(
 	struct xfs_buf		*bp,
 	const struct xfs_buf_ops *ops)
 {
+	struct timespec		start;
+
 	if (!ops)
 		return bp->b_error;
 
 	bp->b_ops = ops;
+	libxfs_buf_stats_verify_start(&start);
 	bp->b_ops->verify_read(bp);
+	libxfs_buf_stats_verify(ops, &start);
 	bp->b_flags &= ~LIBXFS_B_UNCHECKED;
 	return bp->b_error;
 }
 
-int
-libxfs_readbufr_map(struct xfs_buftarg *btp, struct xfs_buf *bp, int flags)
+static int
+__libxfs_readbufr_map(
+	struct xfs_buftarg	*btp,
+	struct xfs_buf		*bp,
+	int			flags,
+	const struct xfs_buf_ops *ops)
 {
-	int	fd = btp->bt_bdev_fd;
-	int	error = 0;
-	void	*buf;
-	int	i;
+	int			fd = btp->bt_bdev_fd;
+	struct timespec		start;
+	int			error = 0;
+	void			*buf;
+	int			i;
 
 	if (xfs_buftarg_is_mem(btp))
 		return 0;
@@ -639,7 +668,9 @@ libxfs_readbufr_map(struct xfs_buftarg *btp, struct xfs_buf *bp, int flags)
 		off_t	offset = LIBXFS_BBTOOFF64(bp->b_maps[i].bm_bn);
 		int len = BBTOB(bp->b_maps[i].bm_len);
 
+		libxfs_buf_stats_io_start(&start);
 		error = __read_buf(fd, buf, len, offset, flags);
+		libxfs_buf_stats_io(ops, XFS_BSTAT_READ, len, &start);
 		if (error) {
 			bp->b_error = error;
 			break;
@@ -652,6 +683,12 @@ libxfs_readbufr_map(struct xfs_buftarg *btp, struct xfs_buf *bp, int flags)
 	return error;
 }
 
+int
+libxfs_readbufr_map(struct xfs_buftarg *btp, struct xfs_buf *bp, int flags)
+{
+	return __libxfs_readbufr_map(btp, bp, flags, bp->b_ops);
+}
+
 int
 libxfs_buf_read_map(
 	struct xfs_buftarg	*btp,
@@ -691,6 +728,7 @@ libxfs_buf_read_map(
 	 */
 	bp->b_error = 0;
 	if (bp->b_flags & (LIBXFS_B_UPTODATE | LIBXFS_B_DIRTY)) {
+		libxfs_buf_stats_lookup(ops ? ops : bp->b_ops, true);
 		if (bp->b_flags & LIBXFS_B_UNCHECKED)
 			error = libxfs_readbuf_verify(bp, ops);
 		if (error && !salvage)
@@ -705,11 +743,12 @@ libxfs_buf_read_map(
 	 * it again, but it won't get called again and set to match the buffer
 	 * contents. *cough* xfs_da_node_buf_ops *cough*.
 	 */
+	libxfs_buf_stats_lookup(ops, false);
 	if (nmaps == 1)
-		error = libxfs_readbufr(btp, map[0].bm_bn, bp, map[0].bm_len,
-				flags);
+		error = __libxfs_readbufr(btp, map[0].bm_bn, bp, map[0].bm_len,
+				flags, ops);
 	else
-		error = libxfs_readbufr_map(btp, bp, flags);
+		error = __libxfs_readbufr_map(btp, bp, flags, ops);
 	if (error)
 		goto err;
 
@@ -779,7 +818,7 @@ libxfs_buf_read_uncached(
 	if (!bp)
 		return -ENOMEM;
 
-	error = libxfs_readbufr(targ, daddr, bp, bblen, flags);
+	error = __libxfs_readbufr(targ, daddr, bp, bblen, flags, ops);
 	if (error)
 		goto err;
 
@@ -818,6 +857,7 @@ libxfs_bwrite(
 	struct xfs_buf	*bp)
 {
 	int		fd = bp->b_target->bt_bdev_fd;
+	struct timespec	start;
 
 	/*
 	 * we never write buffers that are marked stale. This indicates they
@@ -841,7 +881,9 @@ libxfs_bwrite(
 	 */
 	bp->b_error = 0;
 	if (bp->b_ops) {
+		libxfs_buf_stats_verify_start(&start);
 		bp->b_ops->verify_write(bp);
+		libxfs_buf_stats_verify(bp->b_ops, &start);
 		if (bp->b_error) {
 			fprintf(stderr,
 	_("%s: write verifier failed on %s bno 0x%llx/0x%x\n"),
@@ -855,9 +897,12 @@ libxfs_bwrite(
 	if (xfs_buftarg_is_mem(bp->b_target)) {
 		bp->b_error = 0;
 	} else if (!(bp->b_flags & LIBXFS_B_DISCONTIG)) {
+		libxfs_buf_stats_io_start(&start);
 		bp->b_error = __write_buf(fd, bp->b_addr, BBTOB(bp->b_length),
 				    LIBXFS_BBTOOFF64(xfs_buf_daddr(bp)),
 				    bp->b_flags);
+		libxfs_buf_stats_io(bp->b_ops, XFS_BSTAT_WRITE,
+				BBTOB(bp->b_length), &start);
 	} else {
 		int	i;
 		void	*buf = bp->b_addr;
@@ -866,8 +911,11 @@ libxfs_bwrite(
 			off_t	offset = LIBXFS_BBTOOFF64(bp->b_maps[i].bm_bn);
 			int len = BBTOB(bp->b_maps[i].bm_len);
 
+			libxfs_buf_stats_io_start(&start);
 			bp->b_error = __write_buf(fd, buf, len, offset,
 						  bp->b_flags);
+			libxfs_buf_stats_io(bp->b_ops, XFS_BSTAT_WRITE, len,
+					&start);
 			if (bp->b_error)
 				break;
 			buf += len;
@@ -10,6 +10,7 @@
 int print_exit;
 int print_skip_uuid;
 int print_record_header;
+int print_crc_warn;
 
 void
 xlog_init(
@@ -651,6 +651,185 @@ validate_head:
 	return error;
 }
 
+/* Calculate the CRC of a log record the same way the kernel does. */
+static __le32
+xlog_cksum(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead,
+	char			*dp,
+	int			size)
+{
+	uint32_t		crc;
+
+	/* first generate the crc for the record header ... */
+	crc = xfs_start_cksum_safe((char *)rhead,
+			      sizeof(struct xlog_rec_header),
+			      offsetof(struct xlog_rec_header, h_crc));
+
+	/* ... then for additional cycle data for v2 logs ... */
+	if (xfs_has_logv2(log->l_mp)) {
+		xlog_in_core_2_t	*xhdr = (xlog_in_core_2_t *)rhead;
+		int			i;
+		int			xheads;
+
+		xheads = (size + XLOG_HEADER_CYCLE_SIZE - 1) /
+				XLOG_HEADER_CYCLE_SIZE;
+		for (i = 1; i < xheads; i++) {
+			crc = crc32c(crc, &xhdr[i].hic_xheader,
+				     sizeof(struct xlog_rec_ext_header));
+		}
+	}
+
+	/* ... and finally for the payload */
+	crc = crc32c(crc, dp, size);
+
+	return xfs_end_cksum(crc);
+}
+
+/* Number of basic blocks taken up by the header of a log record. */
+static int
+xlog_logrec_hblks(
+	struct xlog		*log,
+	struct xlog_rec_header	*rhead)
+{
+	int			h_size = be32_to_cpu(rhead->h_size);
+
+	if (xfs_has_logv2(log->l_mp) &&
+	    (be32_to_cpu(rhead->h_version) & XLOG_VERSION_2) &&
+	    h_size > XLOG_HEADER_CYCLE_SIZE)
+		return howmany(h_size, XLOG_HEADER_CYCLE_SIZE);
+	return 1;
+}
+
+/*
+ * Read nbblks basic blocks starting at blk_no into buf, carrying on from
+ * the start of the log if the range crosses the physical end of the log.
+ */
+static int
+xlog_bread_wrapped(
+	struct xlog		*log,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	char			*buf)
+{
+	struct xfs_buf		*bp;
+	char			*offset;
+	int			split;
+	int			error;
+
+	bp = xlog_get_bp(log, nbblks);
+	if (!bp)
+		return ENOMEM;
+
+	split = min(nbblks, log->l_logBBsize - (int)blk_no);
+	error = xlog_bread(log, blk_no, split, bp, &offset);
+	if (error)
+		goto out;
+	memcpy(buf, offset, BBTOB(split));
+
+	if (split < nbblks) {
+		error = xlog_bread(log, 0, nbblks - split, bp, &offset);
+		if (error)
+			goto out;
+		memcpy(buf + BBTOB(split), offset, BBTOB(nbblks - split));
+	}
+out:
+	libxfs_buf_relse(bp);
+	return error;
+}
+
+/*
+ * The log writes up to XLOG_MAX_ICLOGS records at once and they can reach
+ * the disk in any order, so a crash can leave any of the last few records in
+ * front of the head torn.  Check the CRCs of those records and move the head
+ * back to the first one that fails, as the kernel does before it recovers
+ * the log.  A bad record further back is real corruption, and is left for
+ * the recovery pass to trip over.
+ */
+static int
+xlog_verify_head(
+	struct xlog		*log,
+	xfs_daddr_t		*head_blk,
+	xfs_daddr_t		tail_blk)
+{
+	struct xlog_rec_header	*rhead;
+	struct xfs_buf		*bp;
+	char			*offset;
+	char			*buf = NULL;
+	xfs_daddr_t		blk = *head_blk;
+	xfs_daddr_t		first = -1;
+	int			count = 0;
+	int			hblks;
+	int			bblks;
+	int			dist;
+	int			error = 0;
+
+	if (!xfs_has_crc(log->l_mp) || *head_blk == tail_blk)
+		return 0;
+
+	bp = xlog_get_bp(log, 1);
+	if (!bp)
+		return ENOMEM;
+
+	/* find the oldest record that could be torn, but stop at the tail */
+	while (count < XLOG_MAX_ICLOGS && blk != tail_blk) {
+		blk = (blk ? blk : log->l_logBBsize) - 1;
+		error = xlog_bread(log, blk, 1, bp, &offset);
+		if (error)
+			goto out;
+		if (*(__be32 *)offset == cpu_to_be32(XLOG_HEADER_MAGIC_NUM)) {
+			first = blk;
+			count++;
+		}
+	}
+	if (first < 0)
+		goto out;
+
+	for (blk = first; blk != *head_blk;
+	     blk = (blk + hblks + bblks) % log->l_logBBsize) {
+		error = xlog_bread(log, blk, 1, bp, &offset);
+		if (error)
+			goto out;
+		rhead = (struct xlog_rec_header *)offset;
+		if (xlog_valid_rec_header(log, rhead, blk))
+			goto torn;
+
+		hblks = xlog_logrec_hblks(log, rhead);
+		bblks = BTOBB(be32_to_cpu(rhead->h_len));
+		dist = (*head_blk - blk + log->l_logBBsize) % log->l_logBBsize;
+		if (hblks + bblks > dist)
+			goto torn;
+
+		buf = malloc(BBTOB(hblks + bblks));
+		if (!buf) {
+			error = ENOMEM;
+			goto out;
+		}
+		error = xlog_bread_wrapped(log, blk, hblks + bblks, buf);
+		if (error)
+			goto out;
+		/* mkfs writes its unmount record with a zero CRC */
+		rhead = (struct xlog_rec_header *)buf;
+		if (rhead->h_crc &&
+		    xlog_cksum(log, rhead, buf + BBTOB(hblks),
+				be32_to_cpu(rhead->h_len)) != rhead->h_crc)
+			goto torn;
+		free(buf);
+		buf = NULL;
+	}
+	goto out;
+
+torn:
+	xfs_warn(log->l_mp,
+"Torn write (CRC failure) detected at log block 0x%llx. Truncating head block from 0x%llx.",
+		(unsigned long long)blk, (unsigned long long)*head_blk);
+	*head_blk = blk;
+out:
+	free(buf);
+	libxfs_buf_relse(bp);
+	return error;
+}
+
 /*
  * Find the sync block number or the tail of the log.
  *
@@ -681,6 +860,8 @@ xlog_find_tail(
 	xfs_daddr_t		umount_data_blk;
 	xfs_daddr_t		after_umount_blk;
 	xfs_lsn_t		tail_lsn;
+	xfs_daddr_t		orig_head;
+	bool			verified = false;
 	int			hblks;
 
 	found = 0;
@@ -709,6 +890,7 @@ xlog_find_tail(
 	/*
 	 * Search backwards looking for log record header block
 	 */
+again:
 	ASSERT(*head_blk < INT_MAX);
 	for (i = (int)(*head_blk) - 1; i >= 0; i--) {
 		error = xlog_bread(log, i, 1, bp, &offset);
@@ -750,6 +932,22 @@ xlog_find_tail(
 	rhead = (xlog_rec_header_t *)offset;
 	*tail_blk = BLOCK_LSN(be64_to_cpu(rhead->h_tail_lsn));
 
+	/*
+	 * Trim any torn records off the head, and if that moved the head,
+	 * find the header of the record in front of the new head.
+	 */
+	if (!verified) {
+		verified = true;
+		orig_head = *head_blk;
+		error = xlog_verify_head(log, head_blk, *tail_blk);
+		if (error)
+			goto done;
+		if (*head_blk != orig_head) {
+			found = 0;
+			goto again;
+		}
+	}
+
 	/*
 	 * Reset log values according to the state of the log when we
 	 * crashed.  In the case where head_blk == 0, we bump curr_cycle
@@ -783,21 +981,7 @@ xlog_find_tail(
 	 * unmount record if there is one, so we pass the lsn of the
 	 * unmount record rather than the block after it.
 	 */
-	if (xfs_has_logv2(log->l_mp)) {
-		int	h_size = be32_to_cpu(rhead->h_size);
-		int	h_version = be32_to_cpu(rhead->h_version);
-
-		if ((h_version & XLOG_VERSION_2) &&
-		    (h_size > XLOG_HEADER_CYCLE_SIZE)) {
-			hblks = h_size / XLOG_HEADER_CYCLE_SIZE;
-			if (h_size % XLOG_HEADER_CYCLE_SIZE)
-				hblks++;
-		} else {
-			hblks = 1;
-		}
-	} else {
-		hblks = 1;
-	}
+	hblks = xlog_logrec_hblks(log, rhead);
 	after_umount_blk = (i + hblks + (int)
 		BTOBB(be32_to_cpu(rhead->h_len))) % log->l_logBBsize;
 	tail_lsn = atomic64_read(&log->l_tail_lsn);
@@ -1189,7 +1373,7 @@ xlog_recover_unmount_trans(
  *
  * NOTE: skip LRs with 0 data length.
  */
-STATIC int
+int
 xlog_recover_process_data(
 	struct xlog		*log,
 	struct hlist_head	rhash[],
@@ -1289,11 +1473,7 @@ xlog_recover_process_data(
  *
  * When filesystems are CRC enabled, this CRC mismatch becomes a fatal log
  * corruption failure
- *
- * XXX: we do not calculate the CRC here yet. It's not clear what we should do
- * with CRC errors here in userspace, so we'll address that problem later on.
  */
-#define xlog_cksum(l,r,dp,len)	((r)->h_crc)
 STATIC int
 xlog_unpack_data_crc(
 	struct xlog_rec_header	*rhead,
@@ -1317,14 +1497,14 @@ xlog_unpack_data_crc(
 		 * recover past this point. Abort recovery if we are enforcing
 		 * CRC protection by punting an error back up the stack.
 		 */
-		if (xfs_has_crc(log->l_mp))
+		if (xfs_has_crc(log->l_mp) && !print_crc_warn)
 			return EFSCORRUPTED;
 	}
 
 	return 0;
 }
 
-STATIC int
+int
 xlog_unpack_data(
 	struct xlog_rec_header	*rhead,
 	char			*dp,
@@ -1356,7 +1536,7 @@ xlog_unpack_data(
 	return 0;
 }
 
-STATIC int
+int
 xlog_valid_rec_header(
 	struct xlog		*log,
 	struct xlog_rec_header	*rhead,
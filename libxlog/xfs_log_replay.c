@@ -0,0 +1,1204 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs.h"
+#include "libxlog.h"
+
+/*
+ * Userspace log replay.
+ *
+ * This follows the kernel's two pass recovery.  Pass 1, run by
+ * xlog_replay_scan(), builds the table of cancelled buffers, notes quotaoff
+ * records and pairs intent items (EFI, RUI, CUI, BUI, XMI, ATTRI) with their
+ * done items.  Nothing is written until then, so the caller can look at the
+ * intents left over and back out.  Pass 2, run by xlog_replay(), replays
+ * buffer, inode, dquot and inode create items into the buffer cache.
+ * Replayed buffers are only marked dirty; they are written back in one go
+ * when the cache is flushed at the end of the replay.
+ *
+ * Intents are never finished here.  Unfinished frees and reverse mapping
+ * updates leave nothing behind that repair does not rebuild anyway, but
+ * the other intents carry work that only log recovery in the kernel can
+ * complete.
+ */
+
+#define XLOG_REPLAY_HASH_SIZE	1024
+
+struct xlog_replay_ent {
+	struct xlog_replay_ent	*next;
+	uint64_t		key;		/* daddr or intent id */
+	uint32_t		len;		/* buffer length or intent type */
+	uint32_t		refcount;
+};
+
+struct xlog_replay {
+	struct xlog_replay_ent	*cancelled[XLOG_REPLAY_HASH_SIZE];
+	struct xlog_replay_ent	*intents[XLOG_REPLAY_HASH_SIZE];
+	unsigned int		quotaoffs;
+	struct xlog_replay_stats *stats;
+};
+
+/* xlog_recover_do_trans has no private argument, so keep the state here */
+static struct xlog_replay	*replay;
+
+/*
+ * Find the entry matching key and len.  Returns the link pointing at it, or
+ * the empty link at the end of the chain if there is no such entry.
+ */
+static struct xlog_replay_ent **
+xlog_replay_find(
+	struct xlog_replay_ent	**table,
+	uint64_t		key,
+	uint32_t		len)
+{
+	struct xlog_replay_ent	**pp;
+
+	pp = &table[key % XLOG_REPLAY_HASH_SIZE];
+	for (; *pp; pp = &(*pp)->next) {
+		if ((*pp)->key == key && (*pp)->len == len)
+			break;
+	}
+	return pp;
+}
+
+static int
+xlog_replay_insert(
+	struct xlog_replay_ent	**table,
+	uint64_t		key,
+	uint32_t		len)
+{
+	struct xlog_replay_ent	**pp = xlog_replay_find(table, key, len);
+
+	if (*pp) {
+		(*pp)->refcount++;
+		return 0;
+	}
+
+	*pp = calloc(1, sizeof(struct xlog_replay_ent));
+	if (!*pp)
+		return ENOMEM;
+	(*pp)->key = key;
+	(*pp)->len = len;
+	(*pp)->refcount = 1;
+	return 0;
+}
+
+/* Drop a reference to an entry; returns true if the entry existed. */
+static bool
+xlog_replay_put(
+	struct xlog_replay_ent	**table,
+	uint64_t		key,
+	uint32_t		len)
+{
+	struct xlog_replay_ent	**pp = xlog_replay_find(table, key, len);
+	struct xlog_replay_ent	*ent = *pp;
+
+	if (!ent)
+		return false;
+	if (--ent->refcount == 0) {
+		*pp = ent->next;
+		free(ent);
+	}
+	return true;
+}
+
+static uint64_t
+xlog_replay_free_table(
+	struct xlog_replay_ent	**table)
+{
+	struct xlog_replay_ent	*ent;
+	uint64_t		count = 0;
+	int			i;
+
+	for (i = 0; i < XLOG_REPLAY_HASH_SIZE; i++) {
+		while ((ent = table[i]) != NULL) {
+			table[i] = ent->next;
+			count += ent->refcount;
+			free(ent);
+		}
+	}
+	return count;
+}
+
+static bool
+xlog_replay_is_cancelled(
+	xfs_daddr_t		blkno,
+	uint			len)
+{
+	return *xlog_replay_find(replay->cancelled, blkno, len) != NULL;
+}
+
+static struct xfs_inode_log_format *
+xlog_replay_inode_format(
+	struct xlog_recover_item	*item,
+	struct xfs_inode_log_format	*in_f)
+{
+	struct xfs_inode_log_format_32	*in_f32;
+
+	if (item->ri_buf[0].i_len == sizeof(struct xfs_inode_log_format))
+		return item->ri_buf[0].i_addr;
+	if (item->ri_buf[0].i_len != sizeof(struct xfs_inode_log_format_32))
+		return NULL;
+
+	in_f32 = item->ri_buf[0].i_addr;
+	in_f->ilf_type = in_f32->ilf_type;
+	in_f->ilf_size = in_f32->ilf_size;
+	in_f->ilf_fields = in_f32->ilf_fields;
+	in_f->ilf_asize = in_f32->ilf_asize;
+	in_f->ilf_dsize = in_f32->ilf_dsize;
+	in_f->ilf_ino = in_f32->ilf_ino;
+	memcpy(&in_f->ilf_u, &in_f32->ilf_u, sizeof(in_f->ilf_u));
+	in_f->ilf_blkno = in_f32->ilf_blkno;
+	in_f->ilf_len = in_f32->ilf_len;
+	in_f->ilf_boffset = in_f32->ilf_boffset;
+	return in_f;
+}
+
+/* Track intents until their done item turns up. */
+static int
+xlog_replay_intent(
+	struct xlog_recover_item *item)
+{
+	void			*p = item->ri_buf[0].i_addr;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_EFI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_efi_log_format *)p)->efi_id,
+				XFS_LI_EFI);
+	case XFS_LI_EFD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_efd_log_format *)p)->efd_efi_id,
+				XFS_LI_EFI);
+		return 0;
+	case XFS_LI_RUI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_rui_log_format *)p)->rui_id,
+				XFS_LI_RUI);
+	case XFS_LI_RUD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_rud_log_format *)p)->rud_rui_id,
+				XFS_LI_RUI);
+		return 0;
+	case XFS_LI_CUI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_cui_log_format *)p)->cui_id,
+				XFS_LI_CUI);
+	case XFS_LI_CUD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_cud_log_format *)p)->cud_cui_id,
+				XFS_LI_CUI);
+		return 0;
+	case XFS_LI_BUI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_bui_log_format *)p)->bui_id,
+				XFS_LI_BUI);
+	case XFS_LI_BUD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_bud_log_format *)p)->bud_bui_id,
+				XFS_LI_BUI);
+		return 0;
+	case XFS_LI_XMI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_xmi_log_format *)p)->xmi_id,
+				XFS_LI_XMI);
+	case XFS_LI_XMD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_xmd_log_format *)p)->xmd_xmi_id,
+				XFS_LI_XMI);
+		return 0;
+	case XFS_LI_ATTRI:
+		return xlog_replay_insert(replay->intents,
+				((struct xfs_attri_log_format *)p)->alfi_id,
+				XFS_LI_ATTRI);
+	case XFS_LI_ATTRD:
+		xlog_replay_put(replay->intents,
+				((struct xfs_attrd_log_format *)p)->alfd_alf_id,
+				XFS_LI_ATTRI);
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * Pass 1: record buffer cancellations, quotaoff items and intents, and
+ * refuse to go
+ * any further if the log contains something we cannot replay.  Nothing has
+ * been written at this point, so failing here leaves the filesystem as it
+ * was.
+ */
+static int
+xlog_replay_pass1(
+	struct xlog		*log,
+	struct xlog_recover	*trans)
+{
+	struct xlog_recover_item *item;
+	struct xfs_buf_log_format *buf_f;
+	struct xfs_qoff_logformat *qoff_f;
+	struct xfs_inode_log_format in_buf, *in_f;
+	int			error;
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list) {
+		switch (ITEM_TYPE(item)) {
+		case XFS_LI_BUF:
+			buf_f = item->ri_buf[0].i_addr;
+			if (!(buf_f->blf_flags & XFS_BLF_CANCEL))
+				break;
+			error = xlog_replay_insert(replay->cancelled,
+					buf_f->blf_blkno, buf_f->blf_len);
+			if (error)
+				return error;
+			break;
+		case XFS_LI_QUOTAOFF:
+			qoff_f = item->ri_buf[0].i_addr;
+			if (qoff_f->qf_flags & XFS_UQUOTA_ACCT)
+				replay->quotaoffs |= XFS_DQTYPE_USER;
+			if (qoff_f->qf_flags & XFS_PQUOTA_ACCT)
+				replay->quotaoffs |= XFS_DQTYPE_PROJ;
+			if (qoff_f->qf_flags & XFS_GQUOTA_ACCT)
+				replay->quotaoffs |= XFS_DQTYPE_GROUP;
+			break;
+		case XFS_LI_INODE:
+			in_f = xlog_replay_inode_format(item, &in_buf);
+			if (!in_f)
+				return EFSCORRUPTED;
+			/*
+			 * Changing the owner of every bmbt block needs the
+			 * whole btree walked; leave that to the kernel.
+			 */
+			if (in_f->ilf_fields & (XFS_ILOG_DOWNER |
+						XFS_ILOG_AOWNER)) {
+				xlog_warn(
+_("%s: log contains a fork owner change for inode %llu, cannot replay\n"),
+					progname,
+					(unsigned long long)in_f->ilf_ino);
+				return EOPNOTSUPP;
+			}
+			break;
+		case XFS_LI_EFI:
+		case XFS_LI_EFD:
+		case XFS_LI_RUI:
+		case XFS_LI_RUD:
+		case XFS_LI_CUI:
+		case XFS_LI_CUD:
+		case XFS_LI_BUI:
+		case XFS_LI_BUD:
+		case XFS_LI_ATTRI:
+		case XFS_LI_ATTRD:
+		case XFS_LI_XMI:
+		case XFS_LI_XMD:
+			error = xlog_replay_intent(item);
+			if (error)
+				return error;
+			break;
+		case XFS_LI_DQUOT:
+		case XFS_LI_ICREATE:
+			break;
+		default:
+			xlog_warn(_("%s: unrecognised log item type 0x%x\n"),
+				progname, ITEM_TYPE(item));
+			return EFSCORRUPTED;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Return the LSN stamped in a v5 metadata block header, or -1 if the block
+ * has no LSN we can trust and must be replayed unconditionally.
+ */
+static xfs_lsn_t
+xlog_replay_buf_lsn(
+	struct xfs_mount	*mp,
+	struct xfs_buf		*bp,
+	struct xfs_buf_log_format *buf_f)
+{
+	void			*blk = bp->b_addr;
+	uuid_t			*uuid = NULL;
+	xfs_lsn_t		lsn = -1;
+	uint16_t		blft;
+
+	if (!xfs_has_crc(mp))
+		return -1;
+
+	blft = xfs_blft_from_flags(buf_f);
+	if (blft == XFS_BLFT_RTBITMAP_BUF || blft == XFS_BLFT_RTSUMMARY_BUF)
+		return -1;
+
+	switch (be32_to_cpu(*(__be32 *)blk)) {
+	case XFS_ABTB_CRC_MAGIC:
+	case XFS_ABTC_CRC_MAGIC:
+	case XFS_RMAP_CRC_MAGIC:
+	case XFS_REFC_CRC_MAGIC:
+	case XFS_FIBT_CRC_MAGIC:
+	case XFS_IBT_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsn = be64_to_cpu(btb->bb_u.s.bb_lsn);
+		uuid = &btb->bb_u.s.bb_uuid;
+		break;
+	}
+	case XFS_BMAP_CRC_MAGIC: {
+		struct xfs_btree_block *btb = blk;
+
+		lsn = be64_to_cpu(btb->bb_u.l.bb_lsn);
+		uuid = &btb->bb_u.l.bb_uuid;
+		break;
+	}
+	case XFS_AGF_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agf *)blk)->agf_lsn);
+		uuid = &((struct xfs_agf *)blk)->agf_uuid;
+		break;
+	case XFS_AGFL_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agfl *)blk)->agfl_lsn);
+		uuid = &((struct xfs_agfl *)blk)->agfl_uuid;
+		break;
+	case XFS_AGI_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_agi *)blk)->agi_lsn);
+		uuid = &((struct xfs_agi *)blk)->agi_uuid;
+		break;
+	case XFS_SYMLINK_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_dsymlink_hdr *)blk)->sl_lsn);
+		uuid = &((struct xfs_dsymlink_hdr *)blk)->sl_uuid;
+		break;
+	case XFS_DIR3_BLOCK_MAGIC:
+	case XFS_DIR3_DATA_MAGIC:
+	case XFS_DIR3_FREE_MAGIC:
+		lsn = be64_to_cpu(((struct xfs_dir3_blk_hdr *)blk)->lsn);
+		uuid = &((struct xfs_dir3_blk_hdr *)blk)->uuid;
+		break;
+	case XFS_SB_MAGIC: {
+		struct xfs_dsb	*dsb = blk;
+
+		lsn = be64_to_cpu(dsb->sb_lsn);
+		if (xfs_has_metauuid(mp))
+			uuid = &dsb->sb_meta_uuid;
+		else
+			uuid = &dsb->sb_uuid;
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (!uuid) {
+		struct xfs_da3_blkinfo *info = blk;
+
+		switch (be16_to_cpu(info->hdr.magic)) {
+		case XFS_DIR3_LEAF1_MAGIC:
+		case XFS_DIR3_LEAFN_MAGIC:
+		case XFS_ATTR3_LEAF_MAGIC:
+		case XFS_DA3_NODE_MAGIC:
+			lsn = be64_to_cpu(info->lsn);
+			uuid = &info->uuid;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	/* a block left over from another filesystem is always overwritten */
+	if (platform_uuid_compare(&mp->m_sb.sb_meta_uuid, uuid))
+		return -1;
+	return lsn;
+}
+
+/* Attach the verifier matching the logged buffer type. */
+static void
+xlog_replay_buf_ops(
+	struct xfs_buf		*bp,
+	struct xfs_buf_log_format *buf_f)
+{
+	switch (xfs_blft_from_flags(buf_f)) {
+	case XFS_BLFT_BTREE_BUF:
+		switch (be32_to_cpu(*(__be32 *)bp->b_addr)) {
+		case XFS_ABTB_CRC_MAGIC:
+		case XFS_ABTB_MAGIC:
+			bp->b_ops = &xfs_bnobt_buf_ops;
+			break;
+		case XFS_ABTC_CRC_MAGIC:
+		case XFS_ABTC_MAGIC:
+			bp->b_ops = &xfs_cntbt_buf_ops;
+			break;
+		case XFS_IBT_CRC_MAGIC:
+		case XFS_IBT_MAGIC:
+			bp->b_ops = &xfs_inobt_buf_ops;
+			break;
+		case XFS_FIBT_CRC_MAGIC:
+		case XFS_FIBT_MAGIC:
+			bp->b_ops = &xfs_finobt_buf_ops;
+			break;
+		case XFS_BMAP_CRC_MAGIC:
+		case XFS_BMAP_MAGIC:
+			bp->b_ops = &xfs_bmbt_buf_ops;
+			break;
+		case XFS_RMAP_CRC_MAGIC:
+			bp->b_ops = &xfs_rmapbt_buf_ops;
+			break;
+		case XFS_REFC_CRC_MAGIC:
+			bp->b_ops = &xfs_refcountbt_buf_ops;
+			break;
+		}
+		break;
+	case XFS_BLFT_AGF_BUF:
+		bp->b_ops = &xfs_agf_buf_ops;
+		break;
+	case XFS_BLFT_AGFL_BUF:
+		bp->b_ops = &xfs_agfl_buf_ops;
+		break;
+	case XFS_BLFT_AGI_BUF:
+		bp->b_ops = &xfs_agi_buf_ops;
+		break;
+	case XFS_BLFT_UDQUOT_BUF:
+	case XFS_BLFT_PDQUOT_BUF:
+	case XFS_BLFT_GDQUOT_BUF:
+		bp->b_ops = &xfs_dquot_buf_ops;
+		break;
+	case XFS_BLFT_DINO_BUF:
+		bp->b_ops = &xfs_inode_buf_ops;
+		break;
+	case XFS_BLFT_SYMLINK_BUF:
+		bp->b_ops = &xfs_symlink_buf_ops;
+		break;
+	case XFS_BLFT_DIR_BLOCK_BUF:
+		bp->b_ops = &xfs_dir3_block_buf_ops;
+		break;
+	case XFS_BLFT_DIR_DATA_BUF:
+		bp->b_ops = &xfs_dir3_data_buf_ops;
+		break;
+	case XFS_BLFT_DIR_FREE_BUF:
+		bp->b_ops = &xfs_dir3_free_buf_ops;
+		break;
+	case XFS_BLFT_DIR_LEAF1_BUF:
+		bp->b_ops = &xfs_dir3_leaf1_buf_ops;
+		break;
+	case XFS_BLFT_DIR_LEAFN_BUF:
+		bp->b_ops = &xfs_dir3_leafn_buf_ops;
+		break;
+	case XFS_BLFT_DA_NODE_BUF:
+		bp->b_ops = &xfs_da3_node_buf_ops;
+		break;
+	case XFS_BLFT_ATTR_LEAF_BUF:
+		bp->b_ops = &xfs_attr3_leaf_buf_ops;
+		break;
+	case XFS_BLFT_ATTR_RMT_BUF:
+		bp->b_ops = &xfs_attr3_rmt_buf_ops;
+		break;
+	case XFS_BLFT_SB_BUF:
+		bp->b_ops = &xfs_sb_buf_ops;
+		break;
+	case XFS_BLFT_RTBITMAP_BUF:
+	case XFS_BLFT_RTSUMMARY_BUF:
+		bp->b_ops = &xfs_rtbuf_ops;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Copy the logged regions of a buffer item over the buffer contents. */
+static int
+xlog_replay_reg_buffer(
+	struct xlog_recover_item *item,
+	struct xfs_buf		*bp,
+	struct xfs_buf_log_format *buf_f)
+{
+	int			i = 1;	/* 0 is the buf format structure */
+	int			bit = 0;
+	int			nbits;
+
+	while ((bit = libxfs_next_bit(buf_f->blf_data_map,
+					buf_f->blf_map_size, bit)) != -1) {
+		nbits = libxfs_contig_bits(buf_f->blf_data_map,
+				buf_f->blf_map_size, bit);
+		if (i >= item->ri_cnt ||
+		    BBTOB(bp->b_length) < (bit + nbits) << XFS_BLF_SHIFT)
+			return EFSCORRUPTED;
+
+		/* a contiguous dirty range may have been logged in pieces */
+		if (item->ri_buf[i].i_len < (nbits << XFS_BLF_SHIFT))
+			nbits = item->ri_buf[i].i_len >> XFS_BLF_SHIFT;
+
+		memcpy(xfs_buf_offset(bp, bit << XFS_BLF_SHIFT),
+				item->ri_buf[i].i_addr, nbits << XFS_BLF_SHIFT);
+		i++;
+		bit += nbits;
+	}
+	return 0;
+}
+
+/*
+ * Inode buffers logged with XFS_BLF_INODE_BUF only carry the unlinked list
+ * pointers; everything else in them is logged through the inode items.
+ */
+static int
+xlog_replay_inode_buffer(
+	struct xfs_mount	*mp,
+	struct xlog_recover_item *item,
+	struct xfs_buf		*bp,
+	struct xfs_buf_log_format *buf_f)
+{
+	int			inodes_per_buf;
+	int			item_index = 0;
+	int			bit = 0;
+	int			nbits = 0;
+	int			reg_buf_offset = 0;
+	int			reg_buf_bytes = 0;
+	int			next_unlinked_offset;
+	xfs_agino_t		*logged_nextp;
+	int			i;
+
+	inodes_per_buf = BBTOB(bp->b_length) >> mp->m_sb.sb_inodelog;
+	for (i = 0; i < inodes_per_buf; i++) {
+		next_unlinked_offset = (i * mp->m_sb.sb_inodesize) +
+			offsetof(struct xfs_dinode, di_next_unlinked);
+
+		while (next_unlinked_offset >= reg_buf_offset + reg_buf_bytes) {
+			bit += nbits;
+			bit = libxfs_next_bit(buf_f->blf_data_map,
+					buf_f->blf_map_size, bit);
+			if (bit == -1)
+				return 0;
+			nbits = libxfs_contig_bits(buf_f->blf_data_map,
+					buf_f->blf_map_size, bit);
+			reg_buf_offset = bit << XFS_BLF_SHIFT;
+			reg_buf_bytes = nbits << XFS_BLF_SHIFT;
+			item_index++;
+		}
+
+		if (next_unlinked_offset < reg_buf_offset)
+			continue;
+		if (item_index >= item->ri_cnt ||
+		    reg_buf_offset + reg_buf_bytes > BBTOB(bp->b_length))
+			return EFSCORRUPTED;
+
+		logged_nextp = item->ri_buf[item_index].i_addr +
+				next_unlinked_offset - reg_buf_offset;
+		if (*logged_nextp == 0) {
+			xlog_warn(
+_("%s: bad inode buffer log record (ptr = %p, bp = %p), zero next unlinked\n"),
+				progname, item, bp);
+			return EFSCORRUPTED;
+		}
+
+		*(xfs_agino_t *)xfs_buf_offset(bp, next_unlinked_offset) =
+				*logged_nextp;
+		libxfs_dinode_calc_crc(mp,
+				xfs_buf_offset(bp, i * mp->m_sb.sb_inodesize));
+	}
+	return 0;
+}
+
+/* Dquot buffers are only replayed while that quota type is accounted. */
+static bool
+xlog_replay_want_dquot_buffer(
+	struct xfs_mount	*mp,
+	struct xfs_buf_log_format *buf_f)
+{
+	unsigned int		type = 0;
+
+	if (!(mp->m_sb.sb_qflags & XFS_ALL_QUOTA_ACCT))
+		return false;
+
+	if (buf_f->blf_flags & XFS_BLF_UDQUOT_BUF)
+		type |= XFS_DQTYPE_USER;
+	if (buf_f->blf_flags & XFS_BLF_PDQUOT_BUF)
+		type |= XFS_DQTYPE_PROJ;
+	if (buf_f->blf_flags & XFS_BLF_GDQUOT_BUF)
+		type |= XFS_DQTYPE_GROUP;
+	return !(replay->quotaoffs & type);
+}
+
+static int
+xlog_replay_buffer(
+	struct xlog		*log,
+	struct xlog_recover_item *item,
+	xfs_lsn_t		current_lsn)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_buf_log_format *buf_f = item->ri_buf[0].i_addr;
+	struct xfs_buf		*bp;
+	xfs_lsn_t		lsn;
+	int			error;
+
+	/*
+	 * Cancel items consume a reference to the cancellation so that a
+	 * reused buffer logged after the last cancel is replayed again.
+	 */
+	if (buf_f->blf_flags & XFS_BLF_CANCEL) {
+		if (xlog_replay_put(replay->cancelled, buf_f->blf_blkno,
+					buf_f->blf_len))
+			replay->stats->nr_cancelled++;
+		return 0;
+	}
+	if (xlog_replay_is_cancelled(buf_f->blf_blkno, buf_f->blf_len)) {
+		replay->stats->nr_cancelled++;
+		return 0;
+	}
+
+	if ((buf_f->blf_flags & (XFS_BLF_UDQUOT_BUF | XFS_BLF_PDQUOT_BUF |
+				 XFS_BLF_GDQUOT_BUF)) &&
+	    !xlog_replay_want_dquot_buffer(mp, buf_f)) {
+		replay->stats->nr_skipped++;
+		return 0;
+	}
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, buf_f->blf_blkno,
+			buf_f->blf_len, 0, &bp, NULL);
+	if (error)
+		return error;
+
+	/* skip buffers that were written back after this transaction */
+	lsn = xlog_replay_buf_lsn(mp, bp, buf_f);
+	if (lsn && lsn != -1 && XFS_LSN_CMP(lsn, current_lsn) >= 0) {
+		replay->stats->nr_skipped++;
+		goto out_release;
+	}
+
+	if (buf_f->blf_flags & XFS_BLF_INODE_BUF)
+		error = xlog_replay_inode_buffer(mp, item, bp, buf_f);
+	else
+		error = xlog_replay_reg_buffer(item, bp, buf_f);
+	if (error)
+		goto out_release;
+	xlog_replay_buf_ops(bp, buf_f);
+	replay->stats->nr_buffers++;
+
+	/*
+	 * Inode buffers that do not match our inode cluster size would
+	 * overlap later cluster reads, so write them out now and make sure
+	 * the cached copy is never used again.
+	 */
+	if (be16_to_cpu(*(__be16 *)bp->b_addr) == XFS_DINODE_MAGIC &&
+	    BBTOB(bp->b_length) != M_IGEO(mp)->inode_cluster_size) {
+		error = -libxfs_bwrite(bp);
+		bp->b_flags &= ~LIBXFS_B_UPTODATE;
+	} else
+		libxfs_buf_mark_dirty(bp);
+out_release:
+	libxfs_buf_relse(bp);
+	return error;
+}
+
+static inline xfs_timestamp_t
+xlog_replay_dinode_ts(
+	struct xfs_log_dinode	*from,
+	xfs_log_timestamp_t	its)
+{
+	struct xfs_legacy_timestamp	*lts;
+	struct xfs_log_legacy_timestamp	*lits;
+	xfs_timestamp_t			ts;
+
+	if (from->di_version >= 3 && (from->di_flags2 & XFS_DIFLAG2_BIGTIME))
+		return cpu_to_be64(its);
+
+	lts = (struct xfs_legacy_timestamp *)&ts;
+	lits = (struct xfs_log_legacy_timestamp *)&its;
+	lts->t_sec = cpu_to_be32(lits->t_sec);
+	lts->t_nsec = cpu_to_be32(lits->t_nsec);
+	return ts;
+}
+
+/*
+ * Convert a logged inode core to its ondisk form.  The unlinked pointer is
+ * deliberately left alone; it is logged through the inode buffer.
+ */
+static void
+xlog_replay_dinode(
+	struct xfs_log_dinode	*from,
+	struct xfs_dinode	*to,
+	xfs_lsn_t		lsn)
+{
+	to->di_magic = cpu_to_be16(from->di_magic);
+	to->di_mode = cpu_to_be16(from->di_mode);
+	to->di_version = from->di_version;
+	to->di_format = from->di_format;
+	to->di_onlink = 0;
+	to->di_uid = cpu_to_be32(from->di_uid);
+	to->di_gid = cpu_to_be32(from->di_gid);
+	to->di_nlink = cpu_to_be32(from->di_nlink);
+	to->di_projid_lo = cpu_to_be16(from->di_projid_lo);
+	to->di_projid_hi = cpu_to_be16(from->di_projid_hi);
+
+	to->di_atime = xlog_replay_dinode_ts(from, from->di_atime);
+	to->di_mtime = xlog_replay_dinode_ts(from, from->di_mtime);
+	to->di_ctime = xlog_replay_dinode_ts(from, from->di_ctime);
+
+	to->di_size = cpu_to_be64(from->di_size);
+	to->di_nblocks = cpu_to_be64(from->di_nblocks);
+	to->di_extsize = cpu_to_be32(from->di_extsize);
+	to->di_forkoff = from->di_forkoff;
+	to->di_aformat = from->di_aformat;
+	to->di_dmevmask = cpu_to_be32(from->di_dmevmask);
+	to->di_dmstate = cpu_to_be16(from->di_dmstate);
+	to->di_flags = cpu_to_be16(from->di_flags);
+	to->di_gen = cpu_to_be32(from->di_gen);
+
+	if (from->di_version == 3) {
+		to->di_changecount = cpu_to_be64(from->di_changecount);
+		to->di_crtime = xlog_replay_dinode_ts(from, from->di_crtime);
+		to->di_flags2 = cpu_to_be64(from->di_flags2);
+		to->di_cowextsize = cpu_to_be32(from->di_cowextsize);
+		to->di_ino = cpu_to_be64(from->di_ino);
+		to->di_lsn = cpu_to_be64(lsn);
+		memcpy(to->di_pad2, from->di_pad2, sizeof(to->di_pad2));
+		platform_uuid_copy(&to->di_uuid, &from->di_uuid);
+		to->di_v3_pad = 0;
+	} else {
+		to->di_flushiter = cpu_to_be16(from->di_flushiter);
+		memset(to->di_v2_pad, 0, sizeof(to->di_v2_pad));
+	}
+
+	if (from->di_version >= 3 && (from->di_flags2 & XFS_DIFLAG2_NREXT64)) {
+		to->di_big_nextents = cpu_to_be64(from->di_big_nextents);
+		to->di_big_anextents = cpu_to_be32(from->di_big_anextents);
+		to->di_nrext64_pad = cpu_to_be16(from->di_nrext64_pad);
+	} else {
+		to->di_nextents = cpu_to_be32(from->di_nextents);
+		to->di_anextents = cpu_to_be16(from->di_anextents);
+	}
+}
+
+/* Copy a logged data or attr fork into the ondisk inode. */
+static int
+xlog_replay_fork(
+	struct xfs_mount	*mp,
+	struct xfs_dinode	*dip,
+	int			whichfork,
+	unsigned int		fields,
+	struct xfs_log_iovec	*reg)
+{
+	char			*dest;
+	int			size;
+
+	if (whichfork == XFS_DATA_FORK) {
+		dest = XFS_DFORK_DPTR(dip);
+		size = XFS_DFORK_DSIZE(dip, mp);
+	} else {
+		dest = XFS_DFORK_APTR(dip);
+		size = XFS_DFORK_ASIZE(dip, mp);
+	}
+
+	if (fields & xfs_ilog_fbroot(whichfork)) {
+		libxfs_bmbt_to_bmdr(mp, reg->i_addr, reg->i_len,
+				(struct xfs_bmdr_block *)dest, size);
+		return 0;
+	}
+
+	if (reg->i_len > size)
+		return EFSCORRUPTED;
+	memcpy(dest, reg->i_addr, reg->i_len);
+	return 0;
+}
+
+static int
+xlog_replay_inode(
+	struct xlog		*log,
+	struct xlog_recover_item *item,
+	xfs_lsn_t		current_lsn)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_inode_log_format in_buf, *in_f;
+	struct xfs_log_dinode	*ldip;
+	struct xfs_dinode	*dip;
+	struct xfs_buf		*bp;
+	unsigned int		fields;
+	int			next_reg = 2;
+	int			error;
+
+	in_f = xlog_replay_inode_format(item, &in_buf);
+	if (!in_f || item->ri_cnt < 2 || in_f->ilf_size > 4 ||
+	    item->ri_cnt < in_f->ilf_size)
+		return EFSCORRUPTED;
+
+	if (xlog_replay_is_cancelled(in_f->ilf_blkno, in_f->ilf_len)) {
+		replay->stats->nr_cancelled++;
+		return 0;
+	}
+
+	ldip = item->ri_buf[1].i_addr;
+	if (ldip->di_magic != XFS_DINODE_MAGIC ||
+	    item->ri_buf[1].i_len > xfs_log_dinode_size(mp) ||
+	    item->ri_buf[1].i_len <
+			offsetof(struct xfs_log_dinode, di_next_unlinked) ||
+	    ldip->di_forkoff > mp->m_sb.sb_inodesize) {
+		xlog_warn(_("%s: bad inode log record for inode %llu\n"),
+			progname, (unsigned long long)in_f->ilf_ino);
+		return EFSCORRUPTED;
+	}
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, in_f->ilf_blkno,
+			in_f->ilf_len, 0, &bp, NULL);
+	if (error)
+		return error;
+
+	if (in_f->ilf_boffset + mp->m_sb.sb_inodesize >
+						BBTOB(bp->b_length)) {
+		error = EFSCORRUPTED;
+		goto out_release;
+	}
+	dip = xfs_buf_offset(bp, in_f->ilf_boffset);
+	if (be16_to_cpu(dip->di_magic) != XFS_DINODE_MAGIC) {
+		xlog_warn(_("%s: bad inode magic for inode %llu at 0x%llx\n"),
+			progname, (unsigned long long)in_f->ilf_ino,
+			(unsigned long long)in_f->ilf_blkno);
+		error = EFSCORRUPTED;
+		goto out_release;
+	}
+
+	/* skip inodes that were written back after this transaction */
+	if (dip->di_version >= 3) {
+		xfs_lsn_t	lsn = be64_to_cpu(dip->di_lsn);
+
+		if (lsn && lsn != -1 && XFS_LSN_CMP(lsn, current_lsn) > 0) {
+			replay->stats->nr_skipped++;
+			goto out_release;
+		}
+	}
+
+	/*
+	 * v4 filesystems order inode updates with the flush counter, which
+	 * may have wrapped.
+	 */
+	if (!xfs_has_v3inodes(mp) &&
+	    ldip->di_flushiter < be16_to_cpu(dip->di_flushiter) &&
+	    !(be16_to_cpu(dip->di_flushiter) == DI_MAX_FLUSH &&
+	      ldip->di_flushiter < (DI_MAX_FLUSH >> 1))) {
+		replay->stats->nr_skipped++;
+		goto out_release;
+	}
+	ldip->di_flushiter = 0;
+
+	xlog_replay_dinode(ldip, dip, current_lsn);
+
+	fields = in_f->ilf_fields;
+	if (fields & XFS_ILOG_DEV)
+		xfs_dinode_put_rdev(dip, in_f->ilf_u.ilfu_rdev);
+
+	if ((fields & XFS_ILOG_DFORK) && next_reg < in_f->ilf_size) {
+		error = xlog_replay_fork(mp, dip, XFS_DATA_FORK, fields,
+				&item->ri_buf[next_reg++]);
+		if (error)
+			goto out_release;
+	}
+	if ((fields & XFS_ILOG_AFORK) && next_reg < in_f->ilf_size) {
+		error = xlog_replay_fork(mp, dip, XFS_ATTR_FORK, fields,
+				&item->ri_buf[next_reg++]);
+		if (error)
+			goto out_release;
+	}
+
+	libxfs_dinode_calc_crc(mp, dip);
+	if (libxfs_dinode_verify(mp, in_f->ilf_ino, dip)) {
+		xlog_warn(_("%s: replayed inode %llu failed verification\n"),
+			progname, (unsigned long long)in_f->ilf_ino);
+		error = EFSCORRUPTED;
+		goto out_release;
+	}
+
+	bp->b_ops = &xfs_inode_buf_ops;
+	libxfs_buf_mark_dirty(bp);
+	replay->stats->nr_inodes++;
+out_release:
+	libxfs_buf_relse(bp);
+	return error;
+}
+
+static int
+xlog_replay_dquot(
+	struct xlog		*log,
+	struct xlog_recover_item *item,
+	xfs_lsn_t		current_lsn)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_dq_logformat	*dq_f = item->ri_buf[0].i_addr;
+	struct xfs_disk_dquot	*recddq;
+	struct xfs_disk_dquot	*ddq;
+	struct xfs_buf		*bp;
+	int			error;
+
+	if (!(mp->m_sb.sb_qflags & XFS_ALL_QUOTA_ACCT))
+		return 0;
+
+	if (item->ri_cnt < 2 ||
+	    item->ri_buf[1].i_len < sizeof(struct xfs_disk_dquot))
+		return EFSCORRUPTED;
+	recddq = item->ri_buf[1].i_addr;
+	if (replay->quotaoffs & (recddq->d_type & XFS_DQTYPE_REC_MASK)) {
+		replay->stats->nr_skipped++;
+		return 0;
+	}
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, dq_f->qlf_blkno,
+			XFS_FSB_TO_BB(mp, dq_f->qlf_len), 0, &bp, NULL);
+	if (error)
+		return error;
+
+	if (dq_f->qlf_boffset + item->ri_buf[1].i_len > BBTOB(bp->b_length)) {
+		error = EFSCORRUPTED;
+		goto out_release;
+	}
+	ddq = xfs_buf_offset(bp, dq_f->qlf_boffset);
+
+	if (xfs_has_crc(mp)) {
+		xfs_lsn_t	lsn;
+
+		lsn = be64_to_cpu(((struct xfs_dqblk *)ddq)->dd_lsn);
+		if (lsn && lsn != -1 && XFS_LSN_CMP(lsn, current_lsn) >= 0) {
+			replay->stats->nr_skipped++;
+			goto out_release;
+		}
+	}
+
+	memcpy(ddq, recddq, item->ri_buf[1].i_len);
+	if (xfs_has_crc(mp))
+		xfs_update_cksum((char *)ddq, sizeof(struct xfs_dqblk),
+				XFS_DQUOT_CRC_OFF);
+
+	bp->b_ops = &xfs_dquot_buf_ops;
+	libxfs_buf_mark_dirty(bp);
+	replay->stats->nr_dquots++;
+out_release:
+	libxfs_buf_relse(bp);
+	return error;
+}
+
+/*
+ * Inode chunk allocations on v5 filesystems log the initialisation rather
+ * than the inode buffers, so rebuild the clusters from the icreate item.
+ */
+static int
+xlog_replay_icreate(
+	struct xlog		*log,
+	struct xlog_recover_item *item)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_ino_geometry	*igeo = M_IGEO(mp);
+	struct xfs_icreate_log	*icl = item->ri_buf[0].i_addr;
+	LIST_HEAD(buffer_list);
+	struct xfs_buf		*bp;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	unsigned int		count;
+	unsigned int		length;
+	unsigned int		bb_per_cluster;
+	int			nbufs;
+	int			cancelled = 0;
+	int			i;
+	int			error;
+
+	agno = be32_to_cpu(icl->icl_ag);
+	agbno = be32_to_cpu(icl->icl_agbno);
+	count = be32_to_cpu(icl->icl_count);
+	length = be32_to_cpu(icl->icl_length);
+	if (icl->icl_size != 1 || agno >= mp->m_sb.sb_agcount ||
+	    !agbno || agbno >= mp->m_sb.sb_agblocks ||
+	    be32_to_cpu(icl->icl_isize) != mp->m_sb.sb_inodesize ||
+	    (length != igeo->ialloc_blks && length != igeo->ialloc_min_blks) ||
+	    !count || (count >> mp->m_sb.sb_inopblog) != length) {
+		xlog_warn(_("%s: bad inode create log record\n"), progname);
+		return EFSCORRUPTED;
+	}
+
+	/* the chunk was freed again later in the log; leave it alone */
+	bb_per_cluster = XFS_FSB_TO_BB(mp, igeo->blocks_per_cluster);
+	nbufs = length / igeo->blocks_per_cluster;
+	for (i = 0; i < nbufs; i++) {
+		if (xlog_replay_is_cancelled(XFS_AGB_TO_DADDR(mp, agno,
+				agbno + i * igeo->blocks_per_cluster),
+				bb_per_cluster))
+			cancelled++;
+	}
+	if (cancelled) {
+		replay->stats->nr_cancelled++;
+		return 0;
+	}
+
+	error = -libxfs_ialloc_inode_init(mp, NULL, &buffer_list, count, agno,
+			agbno, length, be32_to_cpu(icl->icl_gen));
+
+	/* hand the new clusters to the buffer cache instead of writing now */
+	list_for_each_entry(bp, &buffer_list, b_list)
+		libxfs_buf_mark_dirty(bp);
+	libxfs_buf_delwri_cancel(&buffer_list);
+	if (!error)
+		replay->stats->nr_icreates++;
+	return error;
+}
+
+/*
+ * Items are replayed in the order the kernel sorts them: buffers and inode
+ * creates first, then inodes, dquots and intents, then inode buffers, and
+ * buffer cancellations last.
+ */
+enum {
+	XLOG_REPLAY_BUFFERS = 0,
+	XLOG_REPLAY_ITEMS,
+	XLOG_REPLAY_INODE_BUFFERS,
+	XLOG_REPLAY_CANCELS,
+	XLOG_REPLAY_NR_CLASSES,
+};
+
+static int
+xlog_replay_item_class(
+	struct xlog_recover_item *item)
+{
+	struct xfs_buf_log_format *buf_f;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_ICREATE:
+		return XLOG_REPLAY_BUFFERS;
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		if (buf_f->blf_flags & XFS_BLF_CANCEL)
+			return XLOG_REPLAY_CANCELS;
+		if (buf_f->blf_flags & XFS_BLF_INODE_BUF)
+			return XLOG_REPLAY_INODE_BUFFERS;
+		return XLOG_REPLAY_BUFFERS;
+	default:
+		return XLOG_REPLAY_ITEMS;
+	}
+}
+
+static int
+xlog_replay_pass2(
+	struct xlog		*log,
+	struct xlog_recover	*trans)
+{
+	struct xlog_recover_item *item;
+	int			class;
+	int			error = 0;
+
+	for (class = 0; class < XLOG_REPLAY_NR_CLASSES; class++) {
+		list_for_each_entry(item, &trans->r_itemq, ri_list) {
+			if (xlog_replay_item_class(item) != class)
+				continue;
+
+			switch (ITEM_TYPE(item)) {
+			case XFS_LI_BUF:
+				error = xlog_replay_buffer(log, item,
+						trans->r_lsn);
+				break;
+			case XFS_LI_INODE:
+				error = xlog_replay_inode(log, item,
+						trans->r_lsn);
+				break;
+			case XFS_LI_DQUOT:
+				error = xlog_replay_dquot(log, item,
+						trans->r_lsn);
+				break;
+			case XFS_LI_ICREATE:
+				error = xlog_replay_icreate(log, item);
+				break;
+			default:
+				/* quotaoffs and intents were seen in pass 1 */
+				break;
+			}
+			if (error)
+				return error;
+		}
+	}
+
+	replay->stats->nr_trans++;
+	return 0;
+}
+
+/*
+ * Hook for xlog_recover_do_trans.  Does nothing unless xlog_replay() is
+ * running, so tools can keep using the recovery code for other scans.
+ */
+int
+xlog_replay_trans(
+	struct xlog		*log,
+	struct xlog_recover	*trans,
+	int			pass)
+{
+	if (!replay)
+		return 0;
+	if (pass == XLOG_RECOVER_PASS1)
+		return xlog_replay_pass1(log, trans);
+	return xlog_replay_pass2(log, trans);
+}
+
+/* Tear down the replay state, whether or not pass 2 was run. */
+void
+xlog_replay_free(void)
+{
+	if (!replay)
+		return;
+	xlog_replay_free_table(replay->intents);
+	xlog_replay_free_table(replay->cancelled);
+	free(replay);
+	replay = NULL;
+}
+
+/*
+ * Run pass 1 over the dirty region of the log between tail_blk and head_blk
+ * and count the intents that were never finished.  Nothing is written.  If
+ * this succeeds, the caller must either call xlog_replay() to finish the
+ * replay or xlog_replay_free() to abandon it.
+ */
+int
+xlog_replay_scan(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk,
+	struct xlog_replay_stats *stats)
+{
+	struct xlog_replay_ent	*ent;
+	int			error;
+	int			i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (head_blk == tail_blk)
+		return 0;
+
+	replay = calloc(1, sizeof(struct xlog_replay));
+	if (!replay)
+		return ENOMEM;
+	replay->stats = stats;
+
+	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+			XLOG_RECOVER_PASS1);
+	if (error) {
+		xlog_replay_free();
+		return error;
+	}
+
+	for (i = 0; i < XLOG_REPLAY_HASH_SIZE; i++) {
+		for (ent = replay->intents[i]; ent; ent = ent->next) {
+			if (ent->len == XFS_LI_EFI || ent->len == XFS_LI_RUI)
+				stats->nr_intents += ent->refcount;
+			else
+				stats->nr_unfinished += ent->refcount;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Replay the log region given to xlog_replay_scan() into the filesystem.
+ * The caller is responsible for clearing the log afterwards, and must not
+ * get here if the scan found unfinished intents it cannot cope with.
+ */
+int
+xlog_replay(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk)
+{
+	int			error;
+
+	if (!replay)
+		return 0;
+
+	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+			XLOG_RECOVER_PASS2);
+	if (!error)
+		libxfs_bcache_flush(log->l_mp);
+
+	xlog_replay_free();
+	return error;
+}
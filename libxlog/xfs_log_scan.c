@@ -0,0 +1,395 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs.h"
+#include "libxlog.h"
+#include "libfrog/workqueue.h"
+
+/*
+ * Threaded log scanning.
+ *
+ * xlog_do_recovery_pass() reads one record header and one record body at a
+ * time, and checksums and unpacks each record before reading the next one.
+ * On a large log that is a long series of small synchronous reads with all
+ * of the CRC work done on a single thread.
+ *
+ * Here the active part of the log is read in large windows instead, with
+ * the wrap at the physical end of the log taken out so that a record split
+ * across it is contiguous in memory.  Record headers are chained by their
+ * lengths, so the main thread walks the headers of a window and hands
+ * batches of records to a workqueue to be CRC checked and unpacked, then
+ * reads the next window into the other buffer while that happens.  The
+ * unpacked records are fed to xlog_recover_process_data() strictly in log
+ * order, so transactions are reassembled in LSN order exactly as the serial
+ * code does it.
+ */
+
+#define XLOG_SCAN_WINDOW	(32U << 20)	/* bytes read at once */
+#define XLOG_SCAN_BATCH		(1U << 20)	/* bytes unpacked per work item */
+
+struct xlog_scan;
+
+struct xlog_scan_rec {
+	struct xlog_rec_header	*rhead;
+	char			*dp;
+};
+
+struct xlog_scan_batch {
+	struct xlog_scan	*scan;
+	struct xlog_scan_rec	*recs;
+	unsigned int		nr;
+	unsigned int		nr_unpacked;
+	int			error;
+	bool			done;
+};
+
+struct xlog_scan_window {
+	char			*buf;
+	xfs_daddr_t		start;		/* BBs past the tail */
+	int			len;		/* BBs of complete records */
+	struct xlog_scan_rec	*recs;
+	unsigned int		nr_recs;
+	unsigned int		max_recs;
+	struct xlog_scan_batch	*batches;
+	unsigned int		nr_batches;
+	unsigned int		max_batches;
+};
+
+struct xlog_scan {
+	struct xlog		*log;
+	struct workqueue	wq;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wakeup;
+	xfs_daddr_t		tail_blk;
+	xfs_daddr_t		active;		/* BBs from tail to head */
+	int			hblks;		/* BBs in a record header */
+	int			window_bblks;
+	struct xlog_scan_window	windows[2];
+};
+
+/* Read BBs of the active log, starting @start BBs past the tail. */
+static int
+xlog_scan_read(
+	struct xlog_scan	*scan,
+	char			*buf,
+	xfs_daddr_t		start,
+	int			bblks)
+{
+	struct xlog		*log = scan->log;
+	int			fd = log->l_dev->bt_bdev_fd;
+
+	while (bblks > 0) {
+		xfs_daddr_t	blk = (scan->tail_blk + start) % log->l_logBBsize;
+		size_t		count;
+		off_t		off;
+		ssize_t		ret;
+
+		/* don't read past the physical end of the log */
+		count = BBTOB(min(bblks, log->l_logBBsize - blk));
+		off = BBTOB(log->l_logBBstart + blk);
+		start += BTOBB(count);
+		bblks -= BTOBB(count);
+
+		while (count > 0) {
+			ret = pread(fd, buf, count, off);
+			if (ret < 0)
+				return errno;
+			if (ret == 0)
+				return EIO;
+			buf += ret;
+			off += ret;
+			count -= ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the complete log records at the start of a window.  A record that
+ * runs off the end of the window is left for the next window.
+ */
+static int
+xlog_scan_walk(
+	struct xlog_scan	*scan,
+	struct xlog_scan_window	*w,
+	int			bblks)
+{
+	struct xlog		*log = scan->log;
+	struct xlog_rec_header	*rhead;
+	struct xlog_scan_rec	*rec;
+	xfs_daddr_t		blk;
+	int			off = 0;
+	int			rblks;
+	int			error;
+
+	w->nr_recs = 0;
+	while (off + scan->hblks <= bblks) {
+		rhead = (struct xlog_rec_header *)(w->buf + BBTOB(off));
+		blk = (scan->tail_blk + w->start + off) % log->l_logBBsize;
+		error = xlog_valid_rec_header(log, rhead, blk);
+		if (error)
+			return error;
+
+		rblks = BTOBB(be32_to_cpu(rhead->h_len));
+		if (off + scan->hblks + rblks > bblks)
+			break;
+
+		if (w->nr_recs == w->max_recs) {
+			unsigned int	nr = w->max_recs ? w->max_recs * 2 : 256;
+
+			rec = realloc(w->recs, nr * sizeof(*rec));
+			if (!rec)
+				return ENOMEM;
+			w->recs = rec;
+			w->max_recs = nr;
+		}
+		rec = &w->recs[w->nr_recs++];
+		rec->rhead = rhead;
+		rec->dp = (char *)rhead + BBTOB(scan->hblks);
+		off += scan->hblks + rblks;
+	}
+
+	/*
+	 * A window always has room for the largest possible record, so if
+	 * nothing fit the record must run past the head of the log.
+	 */
+	if (off == 0) {
+		xfs_warn(log->l_mp, "%s: log record at block %lld overruns head",
+				__func__,
+				(long long)((scan->tail_blk + w->start) %
+					    log->l_logBBsize));
+		return XFS_ERROR(EFSCORRUPTED);
+	}
+	w->len = off;
+	return 0;
+}
+
+static void
+xlog_scan_unpack(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct xlog_scan_batch	*b = arg;
+	struct xlog_scan	*scan = b->scan;
+	unsigned int		i;
+	int			error = 0;
+
+	for (i = 0; i < b->nr; i++) {
+		error = xlog_unpack_data(b->recs[i].rhead, b->recs[i].dp,
+				scan->log);
+		if (error)
+			break;
+	}
+
+	pthread_mutex_lock(&scan->lock);
+	b->nr_unpacked = i;
+	b->error = error;
+	b->done = true;
+	pthread_cond_broadcast(&scan->wakeup);
+	pthread_mutex_unlock(&scan->lock);
+}
+
+/* Split a window's records into batches and queue them for unpacking. */
+static int
+xlog_scan_queue(
+	struct xlog_scan	*scan,
+	struct xlog_scan_window	*w)
+{
+	struct xlog_scan_batch	*b = NULL;
+	unsigned int		i;
+	unsigned int		bytes = 0;
+
+	w->nr_batches = 0;
+	for (i = 0; i < w->nr_recs; i++) {
+		if (!b || bytes >= XLOG_SCAN_BATCH) {
+			if (w->nr_batches == w->max_batches) {
+				unsigned int	nr = w->max_batches ?
+						     w->max_batches * 2 : 32;
+
+				b = realloc(w->batches, nr * sizeof(*b));
+				if (!b)
+					return ENOMEM;
+				w->batches = b;
+				w->max_batches = nr;
+			}
+			b = &w->batches[w->nr_batches++];
+			memset(b, 0, sizeof(*b));
+			b->scan = scan;
+			b->recs = &w->recs[i];
+			bytes = 0;
+		}
+		b->nr++;
+		bytes += be32_to_cpu(w->recs[i].rhead->h_len);
+	}
+
+	for (i = 0; i < w->nr_batches; i++) {
+		b = &w->batches[i];
+		/* if the work can't be queued, do it here */
+		if (workqueue_add(&scan->wq, xlog_scan_unpack, i, b))
+			xlog_scan_unpack(&scan->wq, i, b);
+	}
+	return 0;
+}
+
+static int
+xlog_scan_fill(
+	struct xlog_scan	*scan,
+	struct xlog_scan_window	*w,
+	xfs_daddr_t		start)
+{
+	int			bblks;
+	int			error;
+
+	w->start = start;
+	w->nr_recs = 0;
+	w->nr_batches = 0;
+	bblks = min(scan->window_bblks, scan->active - start);
+	error = xlog_scan_read(scan, w->buf, start, bblks);
+	if (error)
+		return error;
+	error = xlog_scan_walk(scan, w, bblks);
+	if (error)
+		return error;
+	return xlog_scan_queue(scan, w);
+}
+
+/* Wait for each batch in turn and process its records in log order. */
+static int
+xlog_scan_process(
+	struct xlog_scan	*scan,
+	struct xlog_scan_window	*w,
+	struct hlist_head	*rhash,
+	int			pass)
+{
+	struct xlog_scan_batch	*b;
+	unsigned int		i, j;
+	int			error;
+
+	for (i = 0; i < w->nr_batches; i++) {
+		b = &w->batches[i];
+
+		pthread_mutex_lock(&scan->lock);
+		while (!b->done)
+			pthread_cond_wait(&scan->wakeup, &scan->lock);
+		pthread_mutex_unlock(&scan->lock);
+
+		for (j = 0; j < b->nr_unpacked; j++) {
+			error = xlog_recover_process_data(scan->log, rhash,
+					b->recs[j].rhead, b->recs[j].dp, pass);
+			if (error)
+				return error;
+		}
+		if (b->error)
+			return b->error;
+	}
+	return 0;
+}
+
+/*
+ * Same as xlog_do_recovery_pass(), but with large reads and with records
+ * unpacked by @nr_threads worker threads.
+ */
+int
+xlog_do_recovery_pass_parallel(
+	struct xlog		*log,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk,
+	int			pass,
+	unsigned int		nr_threads)
+{
+	struct xlog_scan	*scan;
+	struct xlog_scan_window	*cur, *next;
+	struct xlog_rec_header	*rhead;
+	struct hlist_head	rhash[XLOG_RHASH_SIZE];
+	int			h_size;
+	int			error, error2;
+	int			i;
+
+	ASSERT(head_blk != tail_blk);
+
+	scan = calloc(1, sizeof(struct xlog_scan));
+	if (!scan)
+		return ENOMEM;
+	scan->log = log;
+	scan->tail_blk = tail_blk;
+	scan->active = head_blk - tail_blk;
+	if (scan->active < 0)
+		scan->active += log->l_logBBsize;
+	scan->window_bblks = min((xfs_daddr_t)BTOBB(XLOG_SCAN_WINDOW),
+				 scan->active);
+	pthread_mutex_init(&scan->lock, NULL);
+	pthread_cond_init(&scan->wakeup, NULL);
+
+	for (i = 0; i < 2; i++) {
+		error = posix_memalign((void **)&scan->windows[i].buf,
+				getpagesize(), BBTOB(scan->window_bblks));
+		if (error)
+			goto out_free;
+	}
+
+	/*
+	 * Size the record headers from the record at the tail, just like
+	 * xlog_do_recovery_pass() does.
+	 */
+	cur = &scan->windows[0];
+	error = xlog_scan_read(scan, cur->buf, 0, 1);
+	if (error)
+		goto out_free;
+	rhead = (struct xlog_rec_header *)cur->buf;
+	error = xlog_valid_rec_header(log, rhead, tail_blk);
+	if (error)
+		goto out_free;
+	scan->hblks = 1;
+	if (xfs_has_logv2(log->l_mp)) {
+		h_size = be32_to_cpu(rhead->h_size);
+		if ((be32_to_cpu(rhead->h_version) & XLOG_VERSION_2) &&
+		    h_size > XLOG_HEADER_CYCLE_SIZE)
+			scan->hblks = (h_size + XLOG_HEADER_CYCLE_SIZE - 1) /
+					XLOG_HEADER_CYCLE_SIZE;
+	}
+
+	error = -workqueue_create(&scan->wq, scan, nr_threads);
+	if (error)
+		goto out_free;
+
+	memset(rhash, 0, sizeof(rhash));
+	error = xlog_scan_fill(scan, cur, 0);
+	while (!error) {
+		xfs_daddr_t	next_start = cur->start + cur->len;
+
+		/* read and walk the next window while this one unpacks */
+		next = NULL;
+		error2 = 0;
+		if (next_start < scan->active) {
+			next = (cur == &scan->windows[0]) ? &scan->windows[1] :
+							    &scan->windows[0];
+			error2 = xlog_scan_fill(scan, next, next_start);
+		}
+
+		error = xlog_scan_process(scan, cur, rhash, pass);
+		if (!error)
+			error = error2;
+		if (!next)
+			break;
+		cur = next;
+	}
+
+	/* wait for anything still being unpacked before freeing buffers */
+	error2 = -workqueue_terminate(&scan->wq);
+	if (!error)
+		error = error2;
+	workqueue_destroy(&scan->wq);
+out_free:
+	for (i = 0; i < 2; i++) {
+		free(scan->windows[i].buf);
+		free(scan->windows[i].recs);
+		free(scan->windows[i].batches);
+	}
+	pthread_cond_destroy(&scan->wakeup);
+	pthread_mutex_destroy(&scan->lock);
+	free(scan);
+	return error;
+}
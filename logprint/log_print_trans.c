@@ -24,14 +24,18 @@ xlog_recover_do_trans(
 	struct xlog_recover	*trans,
 	int			pass)
 {
-	xlog_recover_print_trans(trans, &trans->r_itemq, 3);
+	if (print_json || print_summary)
+		xlog_stats_trans(log, trans);
+	else
+		xlog_recover_print_trans(trans, &trans->r_itemq, 3);
 	return 0;
 }
 
 void
 xfs_log_print_trans(
 	struct xlog	*log,
-	int		print_block_start)
+	int		print_block_start,
+	unsigned int	nr_threads)
 {
 	xfs_daddr_t	head_blk, tail_blk;
 	int		error;
@@ -43,21 +47,26 @@ xfs_log_print_trans(
 		exit(1);
 	}
 
-	printf(_("    log tail: %lld head: %lld state: %s\n"),
-		(long long)tail_blk,
-		(long long)head_blk,
-		(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
-
-	if (print_block_start != -1) {
-		printf(_("    override tail: %d\n"), print_block_start);
-		tail_blk = print_block_start;
+	if (!print_json) {
+		printf(_("    log tail: %lld head: %lld state: %s\n"),
+			(long long)tail_blk,
+			(long long)head_blk,
+			(tail_blk == head_blk)?"<CLEAN>":"<DIRTY>");
+		if (print_block_start != -1)
+			printf(_("    override tail: %d\n"),
+				print_block_start);
+		printf("\n");
 	}
-	printf("\n");
+	if (print_block_start != -1)
+		tail_blk = print_block_start;
 
-	print_record_header = 1;
+	print_record_header = !print_json && !print_summary;
 
-	if (head_blk == tail_blk)
+	if (head_blk == tail_blk) {
+		if (print_summary)
+			xlog_stats_report(log);
 		return;
+	}
 
 	/*
 	 * Version 5 superblock log feature mask validation. We know the
@@ -76,9 +85,18 @@ xfs_log_print_trans(
 				XFS_SB_FEAT_INCOMPAT_LOG_UNKNOWN));
 	}
 
-	if ((error = xlog_do_recovery_pass(log, head_blk, tail_blk, XLOG_RECOVER_PASS1))) {
+	if (nr_threads)
+		error = xlog_do_recovery_pass_parallel(log, head_blk, tail_blk,
+				XLOG_RECOVER_PASS1, nr_threads);
+	else
+		error = xlog_do_recovery_pass(log, head_blk, tail_blk,
+				XLOG_RECOVER_PASS1);
+	if (error) {
 		fprintf(stderr, _("%s: failed in xfs_do_recovery_pass, error: %d\n"),
 			progname, error);
 		exit(1);
 	}
+
+	if (print_summary)
+		xlog_stats_report(log);
 }
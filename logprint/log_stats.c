@@ -0,0 +1,532 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs.h"
+#include "libxlog.h"
+#include "libfrog/histogram.h"
+
+#include "logprint.h"
+
+/*
+ * Machine readable output and log usage statistics for the transactional
+ * view.  With -J every log item of every committed transaction is printed
+ * as a line of JSON; with -S the items are only accounted and a summary by
+ * item type, buffer type, AG and inode is printed when the scan is done.
+ * Both together print the item lines followed by the summary as JSON.
+ */
+
+#define NR_TOP_INODES		20UL
+
+struct stats_count {
+	long long		count;
+	long long		bytes;
+};
+
+struct stats_inode {
+	xfs_ino_t		ino;
+	struct stats_count	c;
+};
+
+static struct {
+	struct stats_count	trans;
+	struct stats_count	items;
+	struct stats_count	types[XFS_LI_XMD - XFS_LI_EFI + 1];
+	struct stats_count	buftypes[XFS_BLFT_MAX_BUF];
+	struct stats_count	*ags;
+	xfs_agnumber_t		agcount;
+
+	/* open addressed by inode number */
+	struct stats_inode	*inodes;
+	unsigned long		nr_inodes;
+	unsigned long		inode_slots;
+
+	struct histogram	trans_bytes;
+	struct histogram	trans_items;
+	bool			setup;
+} stats;
+
+static const char *
+item_type_name(
+	unsigned int		type)
+{
+	switch (type) {
+	case XFS_LI_EFI:	return "efi";
+	case XFS_LI_EFD:	return "efd";
+	case XFS_LI_IUNLINK:	return "iunlink";
+	case XFS_LI_INODE:	return "inode";
+	case XFS_LI_BUF:	return "buf";
+	case XFS_LI_DQUOT:	return "dquot";
+	case XFS_LI_QUOTAOFF:	return "quotaoff";
+	case XFS_LI_ICREATE:	return "icreate";
+	case XFS_LI_RUI:	return "rui";
+	case XFS_LI_RUD:	return "rud";
+	case XFS_LI_CUI:	return "cui";
+	case XFS_LI_CUD:	return "cud";
+	case XFS_LI_BUI:	return "bui";
+	case XFS_LI_BUD:	return "bud";
+	case XFS_LI_ATTRI:	return "attri";
+	case XFS_LI_ATTRD:	return "attrd";
+	case XFS_LI_XMI:	return "xmi";
+	case XFS_LI_XMD:	return "xmd";
+	}
+	return "unknown";
+}
+
+static const char *buf_type_names[XFS_BLFT_MAX_BUF] = {
+	[XFS_BLFT_UNKNOWN_BUF]		= "unknown",
+	[XFS_BLFT_UDQUOT_BUF]		= "udquot",
+	[XFS_BLFT_PDQUOT_BUF]		= "pdquot",
+	[XFS_BLFT_GDQUOT_BUF]		= "gdquot",
+	[XFS_BLFT_BTREE_BUF]		= "btree",
+	[XFS_BLFT_AGF_BUF]		= "agf",
+	[XFS_BLFT_AGFL_BUF]		= "agfl",
+	[XFS_BLFT_AGI_BUF]		= "agi",
+	[XFS_BLFT_DINO_BUF]		= "inode",
+	[XFS_BLFT_SYMLINK_BUF]		= "symlink",
+	[XFS_BLFT_DIR_BLOCK_BUF]	= "dir_block",
+	[XFS_BLFT_DIR_DATA_BUF]		= "dir_data",
+	[XFS_BLFT_DIR_FREE_BUF]		= "dir_free",
+	[XFS_BLFT_DIR_LEAF1_BUF]	= "dir_leaf1",
+	[XFS_BLFT_DIR_LEAFN_BUF]	= "dir_leafn",
+	[XFS_BLFT_DA_NODE_BUF]		= "da_node",
+	[XFS_BLFT_ATTR_LEAF_BUF]	= "attr_leaf",
+	[XFS_BLFT_ATTR_RMT_BUF]		= "attr_rmt",
+	[XFS_BLFT_SB_BUF]		= "sb",
+	[XFS_BLFT_RTBITMAP_BUF]		= "rtbitmap",
+	[XFS_BLFT_RTSUMMARY_BUF]	= "rtsummary",
+};
+
+static inline const char *
+buf_type_name(
+	unsigned int		type)
+{
+	if (type >= XFS_BLFT_MAX_BUF || !buf_type_names[type])
+		return "unknown";
+	return buf_type_names[type];
+}
+
+static inline void
+stats_count_add(
+	struct stats_count	*c,
+	long long		bytes)
+{
+	c->count++;
+	c->bytes += bytes;
+}
+
+/* The AG geometry is only known if we read the superblock. */
+static inline bool
+have_geometry(
+	struct xfs_mount	*mp)
+{
+	return mp->m_sb.sb_agblocks != 0 && mp->m_sb.sb_agcount != 0;
+}
+
+static xfs_agnumber_t
+daddr_to_agno(
+	struct xfs_mount	*mp,
+	int64_t			daddr)
+{
+	return (daddr >> mp->m_blkbb_log) / mp->m_sb.sb_agblocks;
+}
+
+static xfs_agnumber_t
+ino_to_agno(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino)
+{
+	return ino >> (mp->m_sb.sb_agblklog + mp->m_sb.sb_inopblog);
+}
+
+static void
+hist_setup(
+	struct histogram	*hs,
+	int			first_shift,
+	int			last_shift)
+{
+	int			i;
+
+	hist_init(hs);
+	hist_add_bucket(hs, 0);
+	for (i = first_shift; i <= last_shift; i++)
+		hist_add_bucket(hs, 1LL << i);
+	hist_prepare(hs, LLONG_MAX);
+}
+
+static void
+stats_setup(
+	struct xfs_mount	*mp)
+{
+	if (have_geometry(mp)) {
+		stats.agcount = mp->m_sb.sb_agcount;
+		stats.ags = calloc(stats.agcount, sizeof(struct stats_count));
+		if (!stats.ags) {
+			fprintf(stderr, _("%s: cannot allocate AG table\n"),
+				progname);
+			exit(1);
+		}
+	}
+	hist_setup(&stats.trans_bytes, 7, 30);
+	hist_setup(&stats.trans_items, 0, 20);
+	stats.setup = true;
+}
+
+static inline unsigned long
+stats_inode_hash(
+	xfs_ino_t		ino)
+{
+	return (ino * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static void
+stats_inode_insert(
+	struct stats_inode	*table,
+	unsigned long		slots,
+	struct stats_inode	*si)
+{
+	unsigned long		i = stats_inode_hash(si->ino) & (slots - 1);
+
+	while (table[i].c.count)
+		i = (i + 1) & (slots - 1);
+	table[i] = *si;
+}
+
+static void
+stats_inode_add(
+	xfs_ino_t		ino,
+	long long		bytes)
+{
+	unsigned long		i;
+
+	/* keep the table at most half full */
+	if (stats.nr_inodes >= stats.inode_slots / 2) {
+		unsigned long		slots;
+		struct stats_inode	*table;
+
+		slots = stats.inode_slots ? stats.inode_slots * 2 : 1024;
+		table = calloc(slots, sizeof(struct stats_inode));
+		if (!table) {
+			fprintf(stderr, _("%s: cannot allocate inode table\n"),
+				progname);
+			exit(1);
+		}
+		for (i = 0; i < stats.inode_slots; i++)
+			if (stats.inodes[i].c.count)
+				stats_inode_insert(table, slots,
+						&stats.inodes[i]);
+		free(stats.inodes);
+		stats.inodes = table;
+		stats.inode_slots = slots;
+	}
+
+	i = stats_inode_hash(ino) & (stats.inode_slots - 1);
+	while (stats.inodes[i].c.count && stats.inodes[i].ino != ino)
+		i = (i + 1) & (stats.inode_slots - 1);
+	if (!stats.inodes[i].c.count) {
+		stats.inodes[i].ino = ino;
+		stats.nr_inodes++;
+	}
+	stats_count_add(&stats.inodes[i].c, bytes);
+}
+
+static void
+stats_ag_add(
+	xfs_agnumber_t		agno,
+	long long		bytes)
+{
+	if (agno < stats.agcount)
+		stats_count_add(&stats.ags[agno], bytes);
+}
+
+/* Account one log item and print it if asked to. */
+static long long
+xlog_stats_item(
+	struct xfs_mount	*mp,
+	struct xlog_recover	*trans,
+	struct xlog_recover_item *item,
+	int			index)
+{
+	unsigned int		type = ITEM_TYPE(item);
+	long long		bytes = 0;
+	int			i;
+
+	for (i = 0; i < item->ri_cnt; i++)
+		bytes += item->ri_buf[i].i_len;
+
+	if (type >= XFS_LI_EFI && type <= XFS_LI_XMD)
+		stats_count_add(&stats.types[type - XFS_LI_EFI], bytes);
+
+	if (print_json)
+		printf("{\"record\":\"item\",\"cycle\":%d,\"block\":%d,"
+		       "\"tid\":\"0x%x\",\"item\":%d,\"type\":\"%s\","
+		       "\"regions\":%d,\"bytes\":%lld",
+		       CYCLE_LSN(trans->r_lsn), BLOCK_LSN(trans->r_lsn),
+		       trans->r_log_tid, index, item_type_name(type),
+		       item->ri_cnt, bytes);
+
+	switch (type) {
+	case XFS_LI_BUF: {
+		struct xfs_buf_log_format	*blf;
+		unsigned int			blft;
+
+		blf = (struct xfs_buf_log_format *)item->ri_buf[0].i_addr;
+		blft = xfs_blft_from_flags(blf);
+		if (blft < XFS_BLFT_MAX_BUF)
+			stats_count_add(&stats.buftypes[blft], bytes);
+		if (print_json)
+			printf(",\"daddr\":%lld,\"len\":%u,\"buftype\":\"%s\"",
+			       (long long)blf->blf_blkno, blf->blf_len,
+			       buf_type_name(blft));
+		if (blft == XFS_BLFT_RTBITMAP_BUF ||
+		    blft == XFS_BLFT_RTSUMMARY_BUF || !have_geometry(mp))
+			break;
+		stats_ag_add(daddr_to_agno(mp, blf->blf_blkno), bytes);
+		if (print_json)
+			printf(",\"agno\":%u", daddr_to_agno(mp, blf->blf_blkno));
+		break;
+	}
+	case XFS_LI_INODE: {
+		struct xfs_inode_log_format	f_buf;
+		struct xfs_inode_log_format	*f;
+
+		f = xfs_inode_item_format_convert(item->ri_buf[0].i_addr,
+				item->ri_buf[0].i_len, &f_buf);
+		stats_inode_add(f->ilf_ino, bytes);
+		if (print_json)
+			printf(",\"ino\":%llu,\"fields\":\"0x%x\"",
+			       (unsigned long long)f->ilf_ino, f->ilf_fields);
+		if (!have_geometry(mp))
+			break;
+		stats_ag_add(ino_to_agno(mp, f->ilf_ino), bytes);
+		if (print_json)
+			printf(",\"agno\":%u", ino_to_agno(mp, f->ilf_ino));
+		break;
+	}
+	case XFS_LI_ICREATE: {
+		struct xfs_icreate_log		*icl;
+
+		icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
+		stats_ag_add(be32_to_cpu(icl->icl_ag), bytes);
+		if (print_json)
+			printf(",\"agno\":%u,\"agbno\":%u,\"count\":%u",
+			       be32_to_cpu(icl->icl_ag),
+			       be32_to_cpu(icl->icl_agbno),
+			       be32_to_cpu(icl->icl_count));
+		break;
+	}
+	case XFS_LI_DQUOT: {
+		struct xfs_dq_logformat		*f;
+
+		f = (struct xfs_dq_logformat *)item->ri_buf[0].i_addr;
+		if (print_json)
+			printf(",\"id\":%u,\"daddr\":%lld", f->qlf_id,
+			       (long long)f->qlf_blkno);
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (print_json)
+		printf("}\n");
+	return bytes;
+}
+
+void
+xlog_stats_trans(
+	struct xlog		*log,
+	struct xlog_recover	*trans)
+{
+	struct xlog_recover_item *item;
+	long long		bytes = 0;
+	int			nr = 0;
+
+	if (!stats.setup)
+		stats_setup(log->l_mp);
+
+	list_for_each_entry(item, &trans->r_itemq, ri_list)
+		bytes += xlog_stats_item(log->l_mp, trans, item, nr++);
+
+	stats_count_add(&stats.trans, bytes);
+	stats.items.count += nr;
+	stats.items.bytes += bytes;
+	hist_add(&stats.trans_bytes, bytes);
+	hist_add(&stats.trans_items, nr);
+}
+
+static int
+stats_inode_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct stats_inode *ia = a;
+	const struct stats_inode *ib = b;
+
+	if (ia->c.bytes > ib->c.bytes)
+		return -1;
+	if (ia->c.bytes < ib->c.bytes)
+		return 1;
+	if (ia->ino < ib->ino)
+		return -1;
+	return ia->ino > ib->ino;
+}
+
+static void
+report_hist_json(
+	const char		*name,
+	const struct histogram	*hs)
+{
+	unsigned int		i;
+
+	for (i = 0; i < hist_buckets(hs); i++) {
+		if (!hs->buckets[i].nr_obs)
+			continue;
+		printf("{\"record\":\"%s\",\"low\":%lld,\"high\":%lld,"
+		       "\"count\":%lld,\"sum\":%lld}\n", name,
+		       hs->buckets[i].low, hs->buckets[i].high,
+		       hs->buckets[i].nr_obs, hs->buckets[i].sum);
+	}
+}
+
+static void
+report_json(
+	struct stats_inode	*top,
+	unsigned long		nr_top)
+{
+	unsigned long		i;
+
+	printf("{\"record\":\"total\",\"transactions\":%lld,\"items\":%lld,"
+	       "\"bytes\":%lld}\n",
+	       stats.trans.count, stats.items.count, stats.items.bytes);
+	for (i = 0; i < ARRAY_SIZE(stats.types); i++) {
+		if (!stats.types[i].count)
+			continue;
+		printf("{\"record\":\"item_type\",\"type\":\"%s\","
+		       "\"count\":%lld,\"bytes\":%lld}\n",
+		       item_type_name(XFS_LI_EFI + i),
+		       stats.types[i].count, stats.types[i].bytes);
+	}
+	for (i = 0; i < XFS_BLFT_MAX_BUF; i++) {
+		if (!stats.buftypes[i].count)
+			continue;
+		printf("{\"record\":\"buf_type\",\"type\":\"%s\","
+		       "\"count\":%lld,\"bytes\":%lld}\n",
+		       buf_type_name(i),
+		       stats.buftypes[i].count, stats.buftypes[i].bytes);
+	}
+	for (i = 0; i < stats.agcount; i++) {
+		if (!stats.ags[i].count)
+			continue;
+		printf("{\"record\":\"ag\",\"agno\":%lu,"
+		       "\"count\":%lld,\"bytes\":%lld}\n",
+		       i, stats.ags[i].count, stats.ags[i].bytes);
+	}
+	for (i = 0; i < nr_top; i++)
+		printf("{\"record\":\"inode\",\"ino\":%llu,"
+		       "\"count\":%lld,\"bytes\":%lld}\n",
+		       (unsigned long long)top[i].ino,
+		       top[i].c.count, top[i].c.bytes);
+	report_hist_json("trans_bytes", &stats.trans_bytes);
+	report_hist_json("trans_items", &stats.trans_items);
+}
+
+static void
+report_text(
+	struct stats_inode	*top,
+	unsigned long		nr_top)
+{
+	struct histogram_strings hstr = {
+		.observations	= _("transactions"),
+	};
+	unsigned long		i;
+
+	printf(_("transactions: %lld  items: %lld  bytes: %lld\n"),
+	       stats.trans.count, stats.items.count, stats.items.bytes);
+
+	printf(_("\n%-12s %12s %14s\n"), _("item type"), _("items"),
+			_("bytes"));
+	for (i = 0; i < ARRAY_SIZE(stats.types); i++) {
+		if (!stats.types[i].count)
+			continue;
+		printf("%-12s %12lld %14lld\n", item_type_name(XFS_LI_EFI + i),
+		       stats.types[i].count, stats.types[i].bytes);
+	}
+
+	printf(_("\n%-12s %12s %14s\n"), _("buffer type"), _("items"),
+			_("bytes"));
+	for (i = 0; i < XFS_BLFT_MAX_BUF; i++) {
+		if (!stats.buftypes[i].count)
+			continue;
+		printf("%-12s %12lld %14lld\n", buf_type_name(i),
+		       stats.buftypes[i].count, stats.buftypes[i].bytes);
+	}
+
+	if (stats.agcount) {
+		printf(_("\n%-12s %12s %14s\n"), _("AG"), _("items"),
+				_("bytes"));
+		for (i = 0; i < stats.agcount; i++) {
+			if (!stats.ags[i].count)
+				continue;
+			printf("%-12lu %12lld %14lld\n", i,
+			       stats.ags[i].count, stats.ags[i].bytes);
+		}
+	}
+
+	if (nr_top) {
+		printf(_("\n%-20s %12s %14s\n"), _("inode"), _("items"),
+				_("bytes"));
+		for (i = 0; i < nr_top; i++)
+			printf("%-20llu %12lld %14lld\n",
+			       (unsigned long long)top[i].ino,
+			       top[i].c.count, top[i].c.bytes);
+	}
+
+	printf(_("\ntransaction size in bytes:\n"));
+	hstr.sum = _("bytes");
+	hist_print(&stats.trans_bytes, &hstr);
+
+	printf(_("\ntransaction size in items:\n"));
+	hstr.sum = _("items");
+	hist_print(&stats.trans_items, &hstr);
+}
+
+void
+xlog_stats_report(
+	struct xlog		*log)
+{
+	struct stats_inode	*top = NULL;
+	unsigned long		nr_top = 0;
+	unsigned long		i;
+
+	if (!stats.setup)
+		stats_setup(log->l_mp);
+
+	/* pick out the inodes that took up the most log space */
+	if (stats.nr_inodes) {
+		top = malloc(stats.nr_inodes * sizeof(struct stats_inode));
+		if (!top) {
+			fprintf(stderr, _("%s: cannot allocate inode table\n"),
+				progname);
+			exit(1);
+		}
+		for (i = 0; i < stats.inode_slots; i++)
+			if (stats.inodes[i].c.count)
+				top[nr_top++] = stats.inodes[i];
+		qsort(top, nr_top, sizeof(struct stats_inode),
+				stats_inode_cmp);
+		nr_top = min(nr_top, NR_TOP_INODES);
+	}
+
+	if (print_json)
+		report_json(top, nr_top);
+	else
+		report_text(top, nr_top);
+
+	free(top);
+	free(stats.inodes);
+	free(stats.ags);
+	hist_free(&stats.trans_bytes);
+	hist_free(&stats.trans_items);
+}
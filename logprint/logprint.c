@@ -8,6 +8,7 @@
 
 #include "libxfs.h"
 #include "libxlog.h"
+#include "libfrog/convert.h"
 
 #include "logprint.h"
 
@@ -24,7 +25,10 @@ int	print_buffer;
 int	print_overwrite;
 int     print_no_data;
 int     print_no_print;
+int	print_json;
+int	print_summary;
 static int	print_operation = OP_PRINT;
+static unsigned int	print_threads;
 static struct libxfs_init x;
 
 static void
@@ -37,6 +41,7 @@ Options:\n\
     -d	            dump the log in log-record format\n\
     -e	            exit when an error is found in the log\n\
     -f	            specified device is actually a file\n\
+    -j <threads>    in transactional view, decode records on this many threads\n\
     -l <device>     filename of external log\n\
     -n	            don't try and interpret log data\n\
     -o	            print buffer data in hex\n\
@@ -46,6 +51,8 @@ Options:\n\
 	-b          in transactional view, extract buffer info\n\
 	-i          in transactional view, extract inode info\n\
 	-q          in transactional view, extract quota info\n\
+	-J          print one line of JSON per log item\n\
+	-S          print a summary of log usage\n\
     -D              print only data; no decoding\n\
     -V              print version information\n"),
 	progname);
@@ -134,9 +141,10 @@ main(int argc, char **argv)
 	textdomain(PACKAGE);
 	memset(&mount, 0, sizeof(mount));
 	print_exit = 1; /* -e is now default. specify -c to override */
+	print_crc_warn = 1; /* report bad record CRCs but keep going */
 
 	progname = basename(argv[0]);
-	while ((c = getopt(argc, argv, "bC:cdefl:iqnors:tDVv")) != EOF) {
+	while ((c = getopt(argc, argv, "bC:cdefj:Jl:iqnors:StDVv")) != EOF) {
 		switch (c) {
 			case 'D':
 				print_only_data++;
@@ -167,6 +175,15 @@ main(int argc, char **argv)
 				print_skip_uuid++;
 				x.data.isfile = 1;
 				break;
+			case 'j':
+				print_threads = cvt_u32(optarg, 10);
+				if (errno || print_threads == 0)
+					usage();
+				break;
+			case 'J':
+				print_operation = OP_PRINT_TRANS;
+				print_json++;
+				break;
 			case 'l':
 				x.log.name = optarg;
 				x.log.isfile = 1;
@@ -186,6 +203,10 @@ main(int argc, char **argv)
 			case 's':
 				print_start = atoi(optarg);
 				break;
+			case 'S':
+				print_operation = OP_PRINT_TRANS;
+				print_summary++;
+				break;
 			case 't':
 				print_operation = OP_PRINT_TRANS;
 				break;
@@ -209,7 +230,8 @@ main(int argc, char **argv)
 		usage();
 
 	x.flags = LIBXFS_ISINACTIVE;
-	printf(_("xfs_logprint:\n"));
+	if (!print_json)
+		printf(_("xfs_logprint:\n"));
 	if (!libxfs_init(&x))
 		exit(1);
 
@@ -218,16 +240,22 @@ main(int argc, char **argv)
 
 	logfd = (x.log.fd < 0) ? x.data.fd : x.log.fd;
 
-	printf(_("    data device: 0x%llx\n"), (unsigned long long)x.data.dev);
+	/* JSON output has nothing but JSON on stdout */
+	if (!print_json) {
+		printf(_("    data device: 0x%llx\n"),
+			(unsigned long long)x.data.dev);
 
-	if (x.log.name) {
-		printf(_("    log file: \"%s\" "), x.log.name);
-	} else {
-		printf(_("    log device: 0x%llx "), (unsigned long long)x.log.dev);
-	}
+		if (x.log.name) {
+			printf(_("    log file: \"%s\" "), x.log.name);
+		} else {
+			printf(_("    log device: 0x%llx "),
+				(unsigned long long)x.log.dev);
+		}
 
-	printf(_("daddr: %lld length: %lld\n\n"),
-		(long long)log.l_logBBstart, (long long)log.l_logBBsize);
+		printf(_("daddr: %lld length: %lld\n\n"),
+			(long long)log.l_logBBstart,
+			(long long)log.l_logBBsize);
+	}
 
 	ASSERT(x.log.size <= INT_MAX);
 
@@ -236,7 +264,7 @@ main(int argc, char **argv)
 		xfs_log_print(&log, logfd, print_start);
 		break;
 	case OP_PRINT_TRANS:
-		xfs_log_print_trans(&log, print_start);
+		xfs_log_print_trans(&log, print_start, print_threads);
 		break;
 	case OP_DUMP:
 		xfs_log_dump(&log, logfd, print_start);
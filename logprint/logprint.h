@@ -16,6 +16,8 @@ extern int	print_transactions;
 extern int	print_overwrite;
 extern int	print_no_data;
 extern int	print_no_print;
+extern int	print_json;
+extern int	print_summary;
 
 /* exports */
 extern time64_t xlog_extract_dinode_ts(const xfs_log_timestamp_t);
@@ -24,7 +26,9 @@ extern void xlog_print_lseek(struct xlog *, int, xfs_daddr_t, int);
 extern void xfs_log_copy(struct xlog *, int, char *);
 extern void xfs_log_dump(struct xlog *, int, int);
 extern void xfs_log_print(struct xlog *, int, int);
-extern void xfs_log_print_trans(struct xlog *, int);
+extern void xfs_log_print_trans(struct xlog *, int, unsigned int);
+extern void xlog_stats_trans(struct xlog *, struct xlog_recover *);
+extern void xlog_stats_report(struct xlog *);
 
 extern void print_xlog_record_line(void);
 extern void print_xlog_op_line(void);
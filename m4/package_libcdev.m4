@@ -137,6 +137,28 @@ int flags = MAP_SYNC | MAP_SHARED_VALIDATE;
     AC_SUBST(have_map_sync)
   ])
 
+#
+# Check if we have the io_uring system calls and uapi header (Linux)
+#
+AC_DEFUN([AC_HAVE_IO_URING],
+  [ AC_MSG_CHECKING([for io_uring])
+    AC_LINK_IFELSE(
+    [	AC_LANG_PROGRAM([[
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+	]], [[
+struct io_uring_params p = { .flags = IORING_SETUP_CLAMP };
+syscall(__NR_io_uring_setup, 1, &p);
+syscall(__NR_io_uring_enter, 0, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	]])
+    ], have_io_uring=yes
+       AC_MSG_RESULT(yes),
+       AC_MSG_RESULT(no))
+    AC_SUBST(have_io_uring)
+  ])
+
 #
 # Check if we have a mallinfo libc call
 #
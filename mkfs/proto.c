@@ -6,7 +6,10 @@
 
 #include "libxfs.h"
 #include <sys/stat.h>
+#include <sys/xattr.h>
+#include <dirent.h>
 #include "libfrog/convert.h"
+#include "libfrog/workqueue.h"
 #include "proto.h"
 
 /*
@@ -53,17 +56,29 @@ getnum(
 	return i;
 }
 
-char *
+struct proto_source
 setup_proto(
 	char	*fname)
 {
+	struct proto_source	ret = { .type = PROTO_SRC_PROTOFILE };
 	char		*buf = NULL;
 	static char	dflt[] = "d--755 0 0 $";
+	struct stat	st;
 	int		fd;
 	long		size;
 
-	if (!fname)
-		return dflt;
+	if (!fname) {
+		ret.data = dflt;
+		return ret;
+	}
+
+	/* a directory is copied into the new filesystem as the root */
+	if (stat(fname, &st) == 0 && S_ISDIR(st.st_mode)) {
+		ret.type = PROTO_SRC_DIR;
+		ret.data = fname;
+		return ret;
+	}
+
 	if ((fd = open(fname, O_RDONLY)) < 0 || (size = filesize(fd)) < 0) {
 		fprintf(stderr, _("%s: failed to open %s: %s\n"),
 			progname, fname, strerror(errno));
@@ -89,7 +104,8 @@ setup_proto(
 	(void)getnum(getstr(&buf), 0, 0, false);	/* block count */
 	(void)getnum(getstr(&buf), 0, 0, false);	/* inode count */
 	close(fd);
-	return buf;
+	ret.data = buf;
+	return ret;
 
 out_fail:
 	if (fd >= 0)
@@ -98,6 +114,78 @@ out_fail:
 	exit(1);
 }
 
+/*
+ * Parse the shape of a synthetic filesystem.  The spec is a list of
+ * name=value pairs separated by colons, so that it fits in a single mkfs
+ * suboption.
+ */
+struct proto_source
+setup_synth(
+	char			*spec)
+{
+	struct proto_source	ret = { .type = PROTO_SRC_SYNTH };
+	struct proto_synth	*ps = &ret.synth;
+	char			*str = strdup(spec);
+	char			*tok, *save = NULL;
+
+	if (!str) {
+		fprintf(stderr, _("%s: out of memory\n"), progname);
+		exit(1);
+	}
+
+	ps->inodes = 100000;
+	ps->bigdir = -1ULL;
+	ps->frag = -1ULL;
+	ps->depth = 256;
+	ps->fanout = 256;
+	ps->xattrs = 16;
+	ps->reflink = -1;
+	ps->seed = 1;
+
+	for (tok = strtok_r(str, ":", &save); tok;
+	     tok = strtok_r(NULL, ":", &save)) {
+		char		*val = strchr(tok, '=');
+		long long	num;
+
+		if (!val)
+			goto bad;
+		*val++ = '\0';
+		num = cvtnum(0, 0, val);
+		if (num < 0)
+			goto bad;
+
+		if (!strcmp(tok, "inodes"))
+			ps->inodes = num;
+		else if (!strcmp(tok, "bigdir"))
+			ps->bigdir = num;
+		else if (!strcmp(tok, "frag"))
+			ps->frag = num;
+		else if (!strcmp(tok, "depth") && num <= UINT_MAX)
+			ps->depth = num;
+		else if (!strcmp(tok, "fanout") && num >= 2 && num <= UINT_MAX)
+			ps->fanout = num;
+		else if (!strcmp(tok, "xattrs") && num <= UINT_MAX)
+			ps->xattrs = num;
+		else if (!strcmp(tok, "reflink") && num <= INT_MAX)
+			ps->reflink = num;
+		else if (!strcmp(tok, "seed") && num <= UINT_MAX)
+			ps->seed = num;
+		else
+			goto bad;
+	}
+	free(str);
+
+	if (ps->bigdir == -1ULL)
+		ps->bigdir = ps->inodes / 8;
+	if (ps->frag == -1ULL)
+		ps->frag = ps->inodes / 16;
+	return ret;
+bad:
+	fprintf(stderr, _("%s: bad synthetic filesystem spec \"%s\"\n"),
+		progname, spec);
+	exit(1);
+}
+
 static void
 fail(
 	char	*msg,
@@ -739,15 +827,1107 @@ parseproto(
 	libxfs_irele(ip);
 }
 
+/*
+ * Populate the filesystem from a directory tree.
+ *
+ * Inodes, directory entries, symlinks and extended attributes are created
+ * from the host tree by the main thread, one transaction at a time, just as
+ * a prototype file would create them.  The data of each regular file has
+ * all of its blocks allocated up front, skipping any holes in the host file,
+ * and is then handed to a pool of workers that read the host file in chunks
+ * and write it straight to the data device.  No file is ever held in memory
+ * as a whole, and the copying for many files goes on in parallel with the
+ * metadata work.
+ */
+
+#define PROTO_COPY_CHUNK	(4U << 20)	/* bytes copied at once */
+#define PROTO_COPY_QUEUE	16		/* queued files per worker */
+#define PROTO_NMAPS		16
+#define PROTO_LINK_HASH		4096
+
+/* Data copy work for one regular file. */
+struct proto_copy {
+	char			*path;
+	int			fd;
+	unsigned int		nr_maps;
+	unsigned int		max_maps;
+	struct xfs_bmbt_irec	*maps;
+};
+
+/* Host inodes with more than one link that have already been created. */
+struct proto_link {
+	struct proto_link	*next;
+	dev_t			dev;
+	ino_t			ino;
+	xfs_ino_t		xfs_ino;
+};
+
+struct proto_dir_ctx {
+	struct xfs_mount	*mp;
+	struct fsxattr		*fsx;
+	struct workqueue	wq;
+	int			dev_fd;
+
+	/* chunk buffers, one for each worker */
+	pthread_mutex_t		buf_lock;
+	char			**bufs;
+	unsigned int		nr_bufs;
+
+	struct proto_link	*links[PROTO_LINK_HASH];
+};
+
+static void
+proto_set_times(
+	struct xfs_inode	*ip,
+	const struct stat	*st)
+{
+	struct inode		*inode = VFS_I(ip);
+	struct timespec64	ts;
+
+	ts.tv_sec = st->st_atim.tv_sec;
+	ts.tv_nsec = st->st_atim.tv_nsec;
+	inode_set_atime_to_ts(inode, ts);
+	ts.tv_sec = st->st_mtim.tv_sec;
+	ts.tv_nsec = st->st_mtim.tv_nsec;
+	inode_set_mtime_to_ts(inode, ts);
+}
+
+/* Copy the user, trusted and security xattrs of a host file. */
+static void
+proto_copy_xattrs(
+	struct xfs_mount	*mp,
+	struct xfs_inode	*ip,
+	const char		*path)
+{
+	struct xfs_da_args	args = {
+		.geo		= mp->m_attr_geo,
+		.whichfork	= XFS_ATTR_FORK,
+		.op_flags	= XFS_DA_OP_OKNOENT,
+		.dp		= ip,
+		.owner		= ip->i_ino,
+	};
+	char			*names;
+	char			*name;
+	char			*value;
+	ssize_t			len;
+	ssize_t			vlen;
+	int			error;
+
+	len = llistxattr(path, NULL, 0);
+	if (len <= 0)
+		return;
+	names = malloc(len);
+	value = malloc(XATTR_SIZE_MAX);
+	if (!names || !value)
+		fail(_("cannot allocate xattr buffers"), ENOMEM);
+	len = llistxattr(path, names, len);
+
+	for (name = names; len > 0 && name < names + len;
+	     name += strlen(name) + 1) {
+		char		*attrname = name;
+
+		if (!strncmp(name, "user.", 5)) {
+			args.attr_filter = 0;
+			attrname += 5;
+		} else if (!strncmp(name, "trusted.", 8)) {
+			args.attr_filter = LIBXFS_ATTR_ROOT;
+			attrname += 8;
+		} else if (!strncmp(name, "security.", 9)) {
+			args.attr_filter = LIBXFS_ATTR_SECURE;
+			attrname += 9;
+		} else {
+			/* system.* attrs are not stored as plain xattrs */
+			fprintf(stderr,
+	_("%s: %s: not copying extended attribute %s\n"),
+					progname, path, name);
+			continue;
+		}
+
+		vlen = lgetxattr(path, name, value, XATTR_SIZE_MAX);
+		if (vlen < 0) {
+			fprintf(stderr,
+	_("%s: %s: cannot read extended attribute %s: %s\n"),
+					progname, path, name, strerror(errno));
+			exit(1);
+		}
+
+		args.name = (unsigned char *)attrname;
+		args.namelen = strlen(attrname);
+		args.value = value;
+		args.valuelen = vlen;
+		libxfs_attr_sethash(&args);
+		error = -libxfs_attr_set(&args, XFS_ATTRUPDATE_UPSERT, false);
+		if (error)
+			fail(_("error setting extended attribute"), error);
+	}
+
+	free(value);
+	free(names);
+}
+
+/* Remember a host inode with several links, or find where it went. */
+static struct proto_link *
+proto_find_link(
+	struct proto_dir_ctx	*ctx,
+	const struct stat	*st)
+{
+	struct proto_link	*pl;
+
+	pl = ctx->links[(st->st_ino ^ st->st_dev) % PROTO_LINK_HASH];
+	for (; pl; pl = pl->next) {
+		if (pl->ino == st->st_ino && pl->dev == st->st_dev)
+			return pl;
+	}
+	return NULL;
+}
+
+static void
+proto_add_link(
+	struct proto_dir_ctx	*ctx,
+	const struct stat	*st,
+	xfs_ino_t		xfs_ino)
+{
+	struct proto_link	**head;
+	struct proto_link	*pl;
+
+	pl = malloc(sizeof(*pl));
+	if (!pl)
+		fail(_("cannot allocate hard link record"), ENOMEM);
+	pl->dev = st->st_dev;
+	pl->ino = st->st_ino;
+	pl->xfs_ino = xfs_ino;
+	head = &ctx->links[(st->st_ino ^ st->st_dev) % PROTO_LINK_HASH];
+	pl->next = *head;
+	*head = pl;
+}
+
+/* Add another directory entry for an inode we have already created. */
+static void
+proto_link_existing(
+	struct xfs_mount	*mp,
+	struct xfs_inode	*pip,
+	struct xfs_name		*xname,
+	xfs_ino_t		ino)
+{
+	struct xfs_parent_args	*ppargs;
+	struct xfs_inode	*ip;
+	struct xfs_trans	*tp;
+	int			error;
+
+	error = -libxfs_iget(mp, NULL, ino, 0, &ip);
+	if (error)
+		fail(_("cannot find hard link target"), error);
+
+	tp = getres(mp, 0);
+	ppargs = newpptr(mp);
+	libxfs_trans_ijoin(tp, pip, 0);
+	libxfs_trans_ijoin(tp, ip, 0);
+	xname->type = libxfs_mode_to_ftype(VFS_I(ip)->i_mode);
+	newdirent(mp, tp, pip, xname, ip, ppargs);
+	libxfs_bumplink(tp, ip);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Error creating hard link"), error);
+	libxfs_parent_finish(mp, ppargs);
+	libxfs_irele(ip);
+}
+
+/* Allocate the blocks for part of a file and record where they went. */
+static void
+proto_alloc_range(
+	struct xfs_mount	*mp,
+	struct xfs_inode	*ip,
+	struct proto_copy	*pc,
+	xfs_fileoff_t		off,
+	xfs_filblks_t		len)
+{
+	struct xfs_bmbt_irec	maps[PROTO_NMAPS];
+	struct xfs_trans	*tp;
+	int			nmap;
+	int			error;
+	int			i;
+
+	while (len > 0) {
+		xfs_extlen_t	alen = min(len, XFS_MAX_BMBT_EXTLEN);
+
+		tp = getres(mp, alen);
+		libxfs_trans_ijoin(tp, ip, 0);
+		nmap = PROTO_NMAPS;
+		error = -libxfs_bmapi_write(tp, ip, off, alen, 0, alen, maps,
+				&nmap);
+		if (error == ENOSYS && XFS_IS_REALTIME_INODE(ip)) {
+			fprintf(stderr,
+	_("%s: creating realtime files from a directory not supported.\n"),
+					progname);
+			exit(1);
+		}
+		if (error)
+			fail(_("error allocating space for a file"), error);
+		error = -libxfs_trans_commit(tp);
+		if (error)
+			fail(_("committing space for a file failed"), error);
+
+		if (pc->nr_maps + nmap > pc->max_maps) {
+			pc->max_maps = max(pc->max_maps * 2,
+					   pc->nr_maps + nmap);
+			pc->maps = realloc(pc->maps,
+					pc->max_maps * sizeof(*pc->maps));
+			if (!pc->maps)
+				fail(_("cannot allocate file mappings"),
+						ENOMEM);
+		}
+		for (i = 0; i < nmap; i++) {
+			pc->maps[pc->nr_maps++] = maps[i];
+			off += maps[i].br_blockcount;
+			len -= maps[i].br_blockcount;
+		}
+	}
+}
+
+/*
+ * Allocate space for the data in a host file.  Holes are left as holes if
+ * the host filesystem can tell us where they are.
+ */
+static void
+proto_alloc_file(
+	struct xfs_mount	*mp,
+	struct xfs_inode	*ip,
+	struct proto_copy	*pc,
+	off_t			size)
+{
+	xfs_fileoff_t		next = 0;
+	off_t			data, hole;
+
+	for (data = 0; data < size; data = hole) {
+		xfs_fileoff_t	start, end;
+
+		data = lseek(pc->fd, data, SEEK_DATA);
+		if (data < 0 && errno == ENXIO)
+			break;
+		if (data < 0) {
+			data = 0;
+			hole = size;
+		} else {
+			hole = lseek(pc->fd, data, SEEK_HOLE);
+			if (hole < 0 || hole > size)
+				hole = size;
+		}
+
+		start = max(XFS_B_TO_FSBT(mp, data), next);
+		end = XFS_B_TO_FSB(mp, hole);
+		if (end > start)
+			proto_alloc_range(mp, ip, pc, start, end - start);
+		next = end;
+	}
+}
+
+static char *
+proto_get_buf(
+	struct proto_dir_ctx	*ctx)
+{
+	char			*buf;
+
+	pthread_mutex_lock(&ctx->buf_lock);
+	ASSERT(ctx->nr_bufs > 0);
+	buf = ctx->bufs[--ctx->nr_bufs];
+	pthread_mutex_unlock(&ctx->buf_lock);
+	return buf;
+}
+
+static void
+proto_put_buf(
+	struct proto_dir_ctx	*ctx,
+	char			*buf)
+{
+	pthread_mutex_lock(&ctx->buf_lock);
+	ctx->bufs[ctx->nr_bufs++] = buf;
+	pthread_mutex_unlock(&ctx->buf_lock);
+}
+
+/* Copy the data of one file into the blocks allocated for it. */
+static void
+proto_copy_worker(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct proto_dir_ctx	*ctx = wq->wq_ctx;
+	struct xfs_mount	*mp = ctx->mp;
+	struct proto_copy	*pc = arg;
+	char			*buf = proto_get_buf(ctx);
+	unsigned int		i;
+
+	for (i = 0; i < pc->nr_maps; i++) {
+		struct xfs_bmbt_irec *map = &pc->maps[i];
+		off_t		src = XFS_FSB_TO_B(mp, map->br_startoff);
+		off_t		dst = BBTOB(XFS_FSB_TO_DADDR(mp,
+						map->br_startblock));
+		uint64_t	left = XFS_FSB_TO_B(mp, map->br_blockcount);
+
+		while (left > 0) {
+			size_t	count = min(left, PROTO_COPY_CHUNK);
+			ssize_t	ret;
+
+			/* short reads past EOF read back as zeroes */
+			ret = pread(pc->fd, buf, count, src);
+			if (ret < 0) {
+				fprintf(stderr,
+					_("%s: read failed on %s: %s\n"),
+					progname, pc->path, strerror(errno));
+				exit(1);
+			}
+			if ((size_t)ret < count)
+				memset(buf + ret, 0, count - ret);
+
+			ret = pwrite(ctx->dev_fd, buf, count, dst);
+			if ((size_t)ret != count) {
+				fprintf(stderr,
+					_("%s: write failed for %s: %s\n"),
+					progname, pc->path,
+					ret < 0 ? strerror(errno) :
+						  _("short write"));
+				exit(1);
+			}
+			src += count;
+			dst += count;
+			left -= count;
+		}
+	}
+
+	proto_put_buf(ctx, buf);
+	close(pc->fd);
+	free(pc->maps);
+	free(pc->path);
+	free(pc);
+}
+
+static void
+proto_new_file(
+	struct proto_dir_ctx	*ctx,
+	struct xfs_inode	*pip,
+	struct xfs_name		*xname,
+	const char		*path,
+	const struct stat	*st)
+{
+	struct xfs_mount	*mp = ctx->mp;
+	struct xfs_parent_args	*ppargs;
+	struct xfs_inode	*ip;
+	struct xfs_trans	*tp;
+	struct proto_copy	*pc;
+	struct cred		creds = {
+		.cr_uid		= st->st_uid,
+		.cr_gid		= st->st_gid,
+	};
+	char			target[XFS_SYMLINK_MAXLEN + 1];
+	xfs_dev_t		rdev = 0;
+	int			flags = XFS_ILOG_CORE;
+	int			fd = -1;
+	int			len = 0;
+	int			error;
+
+	if (S_ISREG(st->st_mode)) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, _("%s: cannot open %s: %s\n"),
+				progname, path, strerror(errno));
+			exit(1);
+		}
+	} else if (S_ISLNK(st->st_mode)) {
+		len = readlink(path, target, sizeof(target));
+		if (len < 0 || len > XFS_SYMLINK_MAXLEN) {
+			fprintf(stderr, _("%s: cannot read symlink %s: %s\n"),
+				progname, path,
+				len < 0 ? strerror(errno) :
+					  strerror(ENAMETOOLONG));
+			exit(1);
+		}
+	} else if (S_ISBLK(st->st_mode) || S_ISCHR(st->st_mode)) {
+		rdev = IRIX_MKDEV(major(st->st_rdev), minor(st->st_rdev));
+		flags |= XFS_ILOG_DEV;
+	}
+
+	tp = getres(mp, XFS_B_TO_FSB(mp, len));
+	ppargs = newpptr(mp);
+	error = creatproto(&tp, pip, st->st_mode, rdev, &creds, ctx->fsx,
+			&ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	if (S_ISLNK(st->st_mode))
+		writesymlink(tp, ip, target, len);
+	if (S_ISREG(st->st_mode))
+		ip->i_disk_size = st->st_size;
+	proto_set_times(ip, st);
+	libxfs_trans_ijoin(tp, pip, 0);
+	xname->type = libxfs_mode_to_ftype(st->st_mode);
+	newdirent(mp, tp, pip, xname, ip, ppargs);
+	libxfs_trans_log_inode(tp, ip, flags);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Error encountered creating file from directory"),
+				error);
+	libxfs_parent_finish(mp, ppargs);
+
+	proto_copy_xattrs(mp, ip, path);
+	if (st->st_nlink > 1)
+		proto_add_link(ctx, st, ip->i_ino);
+
+	if (fd >= 0) {
+		pc = calloc(1, sizeof(*pc));
+		if (!pc)
+			fail(_("cannot allocate copy work"), ENOMEM);
+		pc->fd = fd;
+		pc->path = strdup(path);
+		proto_alloc_file(mp, ip, pc, st->st_size);
+		if (!pc->path || pc->nr_maps == 0 ||
+		    workqueue_add(&ctx->wq, proto_copy_worker, 0, pc)) {
+			/* nothing to copy, or copy it here */
+			if (pc->path && pc->nr_maps > 0)
+				proto_copy_worker(&ctx->wq, 0, pc);
+			else {
+				close(pc->fd);
+				free(pc->maps);
+				free(pc->path);
+				free(pc);
+			}
+		}
+	}
+	libxfs_irele(ip);
+}
+
+static void
+proto_new_dir(
+	struct proto_dir_ctx	*ctx,
+	struct xfs_inode	*pip,
+	struct xfs_name		*xname,
+	char			*path,
+	const struct stat	*st)
+{
+	struct xfs_mount	*mp = ctx->mp;
+	struct xfs_parent_args	*ppargs = NULL;
+	struct xfs_inode	*ip;
+	struct xfs_trans	*tp;
+	struct dirent		*de;
+	struct stat		cst;
+	struct cred		creds = {
+		.cr_uid		= st->st_uid,
+		.cr_gid		= st->st_gid,
+	};
+	size_t			pathlen = strlen(path);
+	DIR			*dir;
+	int			error;
+
+	tp = getres(mp, 0);
+	error = creatproto(&tp, pip, st->st_mode, 0, &creds, ctx->fsx, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	if (!pip) {
+		pip = ip;
+		mp->m_sb.sb_rootino = ip->i_ino;
+		libxfs_log_sb(tp);
+	} else {
+		ppargs = newpptr(mp);
+		libxfs_trans_ijoin(tp, pip, 0);
+		xname->type = XFS_DIR3_FT_DIR;
+		newdirent(mp, tp, pip, xname, ip, ppargs);
+		libxfs_bumplink(tp, pip);
+		libxfs_trans_log_inode(tp, pip, XFS_ILOG_CORE);
+	}
+	newdirectory(mp, tp, ip, pip);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Directory inode allocation failed."), error);
+	libxfs_parent_finish(mp, ppargs);
+
+	/* Put the RT inodes right after the root inode. */
+	if (ip == pip)
+		rtinit(mp);
+
+	proto_copy_xattrs(mp, ip, path);
+
+	dir = opendir(path);
+	if (!dir) {
+		fprintf(stderr, _("%s: cannot open directory %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	while ((errno = 0, de = readdir(dir)) != NULL) {
+		struct xfs_name	cname;
+		struct proto_link *pl;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (pathlen + strlen(de->d_name) + 2 > PATH_MAX) {
+			fprintf(stderr, _("%s: %s/%s: %s\n"), progname, path,
+				de->d_name, strerror(ENAMETOOLONG));
+			exit(1);
+		}
+		path[pathlen] = '/';
+		strcpy(path + pathlen + 1, de->d_name);
+
+		if (fstatat(dirfd(dir), de->d_name, &cst,
+				AT_SYMLINK_NOFOLLOW) < 0) {
+			fprintf(stderr, _("%s: cannot stat %s: %s\n"),
+				progname, path, strerror(errno));
+			exit(1);
+		}
+
+		cname.name = (unsigned char *)de->d_name;
+		cname.len = strlen(de->d_name);
+		cname.type = 0;
+		if (S_ISDIR(cst.st_mode))
+			proto_new_dir(ctx, ip, &cname, path, &cst);
+		else if (cst.st_nlink > 1 && (pl = proto_find_link(ctx, &cst)))
+			proto_link_existing(mp, ip, &cname, pl->xfs_ino);
+		else
+			proto_new_file(ctx, ip, &cname, path, &cst);
+		path[pathlen] = '\0';
+	}
+	if (errno) {
+		fprintf(stderr, _("%s: cannot read directory %s: %s\n"),
+			progname, path, strerror(errno));
+		exit(1);
+	}
+	closedir(dir);
+
+	/* adding the entries has moved the timestamps on, so set them last */
+	tp = getres(mp, 0);
+	libxfs_trans_ijoin(tp, ip, 0);
+	proto_set_times(ip, st);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Error setting directory timestamps"), error);
+	libxfs_irele(ip);
+}
+
+static void
+populate_from_dir(
+	struct xfs_mount	*mp,
+	struct fsxattr		*fsx,
+	const char		*source,
+	unsigned int		nr_threads)
+{
+	struct proto_dir_ctx	*ctx;
+	struct stat		st;
+	char			path[PATH_MAX];
+	unsigned int		i;
+	int			error;
+
+	if (lstat(source, &st) < 0 || !S_ISDIR(st.st_mode)) {
+		fprintf(stderr, _("%s: %s is not a directory\n"),
+			progname, source);
+		exit(1);
+	}
+	if (strlen(source) >= sizeof(path)) {
+		fprintf(stderr, _("%s: %s: %s\n"), progname, source,
+			strerror(ENAMETOOLONG));
+		exit(1);
+	}
+	strcpy(path, source);
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		fail(_("cannot allocate populate context"), ENOMEM);
+	ctx->mp = mp;
+	ctx->fsx = fsx;
+	ctx->dev_fd = mp->m_ddev_targp->bt_bdev_fd;
+	pthread_mutex_init(&ctx->buf_lock, NULL);
+
+	/* one buffer for each worker, and one for copying here */
+	ctx->bufs = calloc(nr_threads + 1, sizeof(char *));
+	if (!ctx->bufs)
+		fail(_("cannot allocate copy buffers"), ENOMEM);
+	for (i = 0; i < nr_threads + 1; i++) {
+		error = posix_memalign((void **)&ctx->bufs[i], getpagesize(),
+				PROTO_COPY_CHUNK);
+		if (error)
+			fail(_("cannot allocate copy buffers"), error);
+		ctx->nr_bufs++;
+	}
+
+	/*
+	 * Bound the queue so that we don't run out of file descriptors
+	 * while the workers catch up.
+	 */
+	error = -workqueue_create_bound(&ctx->wq, ctx, nr_threads,
+			nr_threads * PROTO_COPY_QUEUE);
+	if (error)
+		fail(_("cannot create copy workers"), error);
+
+	proto_new_dir(ctx, NULL, NULL, path, &st);
+
+	error = -workqueue_terminate(&ctx->wq);
+	if (error)
+		fail(_("copying file data failed"), error);
+	workqueue_destroy(&ctx->wq);
+
+	for (i = 0; i < PROTO_LINK_HASH; i++) {
+		struct proto_link	*pl, *next;
+
+		for (pl = ctx->links[i]; pl; pl = next) {
+			next = pl->next;
+			free(pl);
+		}
+	}
+	for (i = 0; i < ctx->nr_bufs; i++)
+		free(ctx->bufs[i]);
+	free(ctx->bufs);
+	pthread_mutex_destroy(&ctx->buf_lock);
+	free(ctx);
+}
+
+/*
+ * Synthetic filesystems.  Instead of copying anything in, generate a large
+ * tree shaped to stress the metadata that repair, scrub, metadump and the
+ * debugger have to walk: a broad tree of small files and symlinks, one huge
+ * directory, one very deep directory chain, files carrying many xattrs,
+ * extents shared by many files, and a file whose blocks alternate with free
+ * space.  Only metadata is written; file blocks are allocated but their
+ * contents are whatever the device already held.
+ */
+
+struct synth_ctx {
+	struct xfs_mount	*mp;
+	struct fsxattr		*fsx;
+	struct proto_synth	*ps;
+	uint64_t		rand;
+	unsigned long long	nr;	/* inodes created so far */
+	char			*value;	/* xattr value buffer */
+};
+
+static const char synth_pad[] =
+	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+/* xorshift64*, so that the same seed always builds the same filesystem */
+static unsigned int
+synth_rand(
+	struct synth_ctx	*sc)
+{
+	sc->rand ^= sc->rand >> 12;
+	sc->rand ^= sc->rand << 25;
+	sc->rand ^= sc->rand >> 27;
+	return (sc->rand * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/* Create an inode and link it into @pip, or make it the root directory. */
+static struct xfs_inode *
+synth_create(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*pip,
+	const char		*name,
+	mode_t			mode,
+	char			*target)
+{
+	struct xfs_mount	*mp = sc->mp;
+	struct xfs_parent_args	*ppargs = NULL;
+	struct xfs_inode	*ip;
+	struct xfs_trans	*tp;
+	struct xfs_name		xname = {
+		.name		= (unsigned char *)name,
+		.len		= strlen(name),
+		.type		= libxfs_mode_to_ftype(mode),
+	};
+	struct cred		creds = { 0 };
+	int			len = target ? strlen(target) : 0;
+	int			error;
+
+	tp = getres(mp, XFS_B_TO_FSB(mp, len));
+	error = creatproto(&tp, pip, mode, 0, &creds, sc->fsx, &ip);
+	if (error)
+		fail(_("Inode allocation failed"), error);
+	if (target)
+		writesymlink(tp, ip, target, len);
+	if (!pip) {
+		pip = ip;
+		mp->m_sb.sb_rootino = ip->i_ino;
+		libxfs_log_sb(tp);
+	} else {
+		ppargs = newpptr(mp);
+		libxfs_trans_ijoin(tp, pip, 0);
+		newdirent(mp, tp, pip, &xname, ip, ppargs);
+		if (S_ISDIR(mode)) {
+			libxfs_bumplink(tp, pip);
+			libxfs_trans_log_inode(tp, pip, XFS_ILOG_CORE);
+		}
+	}
+	if (S_ISDIR(mode))
+		newdirectory(mp, tp, ip, pip);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Error creating synthetic file"), error);
+	libxfs_parent_finish(mp, ppargs);
+	sc->nr++;
+	return ip;
+}
+
+/* Give a file @len blocks, and return the first mapping if asked. */
+static void
+synth_alloc(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*ip,
+	xfs_filblks_t		len,
+	struct xfs_bmbt_irec	*first)
+{
+	struct proto_copy	pc = { };
+
+	/* allocating the blocks logs the inode core, size and all */
+	ip->i_disk_size = XFS_FSB_TO_B(sc->mp, len);
+	proto_alloc_range(sc->mp, ip, &pc, 0, len);
+	if (first)
+		*first = pc.maps[0];
+	free(pc.maps);
+}
+
+/*
+ * Hang xattrs of all three namespaces off a file.  Most values are small,
+ * but every eighth one is big enough to need remote value blocks.
+ */
+static void
+synth_xattrs(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*ip)
+{
+	static const unsigned int filters[] = {
+		0, LIBXFS_ATTR_ROOT, LIBXFS_ATTR_SECURE,
+	};
+	struct xfs_mount	*mp = sc->mp;
+	char			name[MAXNAMELEN];
+	unsigned int		i;
+	int			error;
+
+	for (i = 0; i < sc->ps->xattrs; i++) {
+		/* setting an xattr leaves remote value state behind in args */
+		struct xfs_da_args	args = {
+			.geo		= mp->m_attr_geo,
+			.whichfork	= XFS_ATTR_FORK,
+			.op_flags	= XFS_DA_OP_OKNOENT,
+			.dp		= ip,
+			.owner		= ip->i_ino,
+			.attr_filter	= filters[i % 3],
+		};
+
+		args.namelen = snprintf(name, sizeof(name), "synth.%u.%.*s",
+				i, (int)(synth_rand(sc) % 48), synth_pad);
+		args.name = (unsigned char *)name;
+		args.value = sc->value;
+		if (i % 8 == 7)
+			args.valuelen = min(2 * mp->m_sb.sb_blocksize,
+					    XATTR_SIZE_MAX);
+		else
+			args.valuelen = 16 + synth_rand(sc) % 240;
+		libxfs_attr_sethash(&args);
+		error = -libxfs_attr_set(&args, XFS_ATTRUPDATE_UPSERT, false);
+		if (error)
+			fail(_("error setting extended attribute"), error);
+	}
+}
+
+/*
+ * One entry in the bulk tree: every 32nd is a symlink, half of the files
+ * are empty, most of the rest have a few blocks, and every eighth carries
+ * xattrs.
+ */
+static void
+synth_file(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*dp,
+	const char		*name)
+{
+	char			target[XFS_SYMLINK_MAXLEN + 1];
+	struct xfs_inode	*ip;
+	unsigned int		r;
+	int			len, i;
+
+	if (sc->nr % 32 == 0) {
+		/* targets must be shorter than XFS_SYMLINK_MAXLEN */
+		len = 1 + synth_rand(sc) % (XFS_SYMLINK_MAXLEN - 1);
+		for (i = 0; i < len; i++)
+			target[i] = (i % 16 == 15) ? '/' : synth_pad[i % 62];
+		target[len] = '\0';
+		ip = synth_create(sc, dp, name, S_IFLNK | 0777, target);
+		libxfs_irele(ip);
+		return;
+	}
+
+	ip = synth_create(sc, dp, name, S_IFREG | 0644, NULL);
+	r = synth_rand(sc) % 100;
+	if (r >= 90)
+		synth_alloc(sc, ip, 5 + synth_rand(sc) % 60, NULL);
+	else if (r >= 50)
+		synth_alloc(sc, ip, 1 + synth_rand(sc) % 4, NULL);
+	if (sc->ps->xattrs && sc->nr % 8 == 0)
+		synth_xattrs(sc, ip);
+	libxfs_irele(ip);
+}
+
+/* Fill a directory with @nr inodes, nesting subdirectories as needed. */
+static void
+synth_tree(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*dp,
+	unsigned long long	nr)
+{
+	unsigned long long	fanout = sc->ps->fanout;
+	unsigned long long	nr_dirs, each, extra, i;
+	struct xfs_inode	*ip;
+	char			name[32];
+
+	if (nr <= fanout) {
+		for (i = 0; i < nr; i++) {
+			snprintf(name, sizeof(name), "f%llu", i);
+			synth_file(sc, dp, name);
+		}
+		return;
+	}
+
+	nr_dirs = min(fanout, (nr + fanout - 1) / fanout);
+	nr -= nr_dirs;
+	each = nr / nr_dirs;
+	extra = nr % nr_dirs;
+	for (i = 0; i < nr_dirs; i++) {
+		snprintf(name, sizeof(name), "d%llu", i);
+		ip = synth_create(sc, dp, name, S_IFDIR | 0755, NULL);
+		synth_tree(sc, ip, each + (i < extra));
+		libxfs_irele(ip);
+	}
+}
+
+/* One directory with a great many entries of assorted name lengths. */
+static void
+synth_bigdir(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*root)
+{
+	struct xfs_inode	*dp, *ip;
+	unsigned long long	i;
+	char			name[MAXNAMELEN];
+
+	dp = synth_create(sc, root, "bigdir", S_IFDIR | 0755, NULL);
+	for (i = 0; i < sc->ps->bigdir; i++) {
+		snprintf(name, sizeof(name), "e%llu.%.*s", i,
+				(int)(synth_rand(sc) % 40), synth_pad);
+		ip = synth_create(sc, dp, name, S_IFREG | 0644, NULL);
+		libxfs_irele(ip);
+	}
+	libxfs_irele(dp);
+}
+
+/* A chain of directories nested @depth levels deep. */
+static void
+synth_deep(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*root)
+{
+	struct xfs_inode	*dp, *ip;
+	unsigned int		i;
+	char			name[32];
+
+	dp = synth_create(sc, root, "deep", S_IFDIR | 0755, NULL);
+	for (i = 0; i < sc->ps->depth; i++) {
+		snprintf(name, sizeof(name), "level%u", i);
+		ip = synth_create(sc, dp, name, S_IFDIR | 0755, NULL);
+		libxfs_irele(dp);
+		dp = ip;
+	}
+	libxfs_irele(dp);
+}
+
+/* Map part of an existing extent into another file, as a reflink would. */
+static void
+synth_share(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*ip,
+	struct xfs_bmbt_irec	*irec)
+{
+	struct xfs_mount	*mp = sc->mp;
+	struct xfs_trans	*tp;
+	int			error;
+
+	tp = getres(mp, XFS_EXTENTADD_SPACE_RES(mp, XFS_DATA_FORK));
+	libxfs_trans_ijoin(tp, ip, 0);
+	libxfs_refcount_increase_extent(tp, irec);
+	libxfs_bmap_map_extent(tp, ip, XFS_DATA_FORK, irec);
+	ip->i_diflags2 |= XFS_DIFLAG2_REFLINK;
+	ip->i_disk_size = XFS_FSB_TO_B(mp, irec->br_blockcount);
+	libxfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = -libxfs_trans_commit(tp);
+	if (error)
+		fail(_("Error sharing file blocks"), error);
+}
+
+/*
+ * Groups of @owners files sharing one extent.  Each clone maps a different
+ * tail of the extent, so the reference counts vary along it.
+ */
+static void
+synth_reflink(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*root,
+	unsigned int		owners,
+	unsigned long long	nr_groups)
+{
+	struct xfs_bmbt_irec	map;
+	struct xfs_inode	*dp, *src, *ip;
+	unsigned long long	g;
+	unsigned int		k;
+	char			name[48];
+
+	dp = synth_create(sc, root, "reflink", S_IFDIR | 0755, NULL);
+	for (g = 0; g < nr_groups; g++) {
+		xfs_filblks_t	len = 1 + synth_rand(sc) % 16;
+
+		if (g % 16 == 15)
+			len += 64 + synth_rand(sc) % 960;
+
+		snprintf(name, sizeof(name), "g%llu.0", g);
+		src = synth_create(sc, dp, name, S_IFREG | 0644, NULL);
+		src->i_diflags2 |= XFS_DIFLAG2_REFLINK;
+		synth_alloc(sc, src, len, &map);
+
+		for (k = 1; k < owners; k++) {
+			xfs_filblks_t	off = (k - 1) % map.br_blockcount;
+			struct xfs_bmbt_irec irec = {
+				.br_startoff	= 0,
+				.br_startblock	= map.br_startblock + off,
+				.br_blockcount	= map.br_blockcount - off,
+				.br_state	= XFS_EXT_NORM,
+			};
+
+			snprintf(name, sizeof(name), "g%llu.%u", g, k);
+			ip = synth_create(sc, dp, name, S_IFREG | 0644, NULL);
+			synth_share(sc, ip, &irec);
+			libxfs_irele(ip);
+		}
+		libxfs_irele(src);
+	}
+	libxfs_irele(dp);
+}
+
+/*
+ * Allocate twice @frag blocks to one file.  synth_frag_punch() frees every
+ * other block once everything else has been allocated, leaving @frag single
+ * block free extents and a file with as many mappings.  Punching any earlier
+ * would let the small allocations that follow fill the holes straight back
+ * in.
+ */
+static struct xfs_inode *
+synth_frag(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*root)
+{
+	struct xfs_inode	*ip;
+
+	ip = synth_create(sc, root, "fragmented", S_IFREG | 0644, NULL);
+	synth_alloc(sc, ip, sc->ps->frag * 2, NULL);
+	return ip;
+}
+
+static void
+synth_frag_punch(
+	struct synth_ctx	*sc,
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = sc->mp;
+	struct xfs_trans	*tp;
+	xfs_fileoff_t		off;
+	int			done;
+	int			error;
+
+	for (off = 1; off < sc->ps->frag * 2; off += 2) {
+		tp = getres(mp, 0);
+		libxfs_trans_ijoin(tp, ip, 0);
+		error = -libxfs_bunmapi(tp, ip, off, 1, 0, 1, &done);
+		if (error)
+			fail(_("error punching a synthetic file"), error);
+		error = -libxfs_trans_commit(tp);
+		if (error)
+			fail(_("committing a punched file failed"), error);
+	}
+	libxfs_irele(ip);
+}
+
+static void
+populate_synth(
+	struct xfs_mount	*mp,
+	struct fsxattr		*fsx,
+	struct proto_synth	*ps)
+{
+	struct synth_ctx	sc = {
+		.mp		= mp,
+		.fsx		= fsx,
+		.ps		= ps,
+		.rand		= ps->seed ? ps->seed : 1,
+	};
+	struct xfs_inode	*root, *ip;
+	struct xfs_inode	*frag = NULL;
+	unsigned long long	nr_groups = 0;
+	unsigned long long	used;
+	int			owners = ps->reflink;
+
+	if (owners < 0)
+		owners = xfs_has_reflink(mp) ? 8 : 0;
+	if (owners > 1 && !xfs_has_reflink(mp)) {
+		fprintf(stderr,
+	_("%s: sharing synthetic file blocks needs the reflink feature\n"),
+			progname);
+		exit(1);
+	}
+	if (owners > 1)
+		nr_groups = max(1ULL, ps->inodes / 16 / owners);
+
+	sc.value = malloc(XATTR_SIZE_MAX);
+	if (!sc.value)
+		fail(_("cannot allocate xattr buffers"), ENOMEM);
+	memset(sc.value, 'v', XATTR_SIZE_MAX);
+
+	root = synth_create(&sc, NULL, "", S_IFDIR | 0755, NULL);
+
+	/* Put the RT inodes right after the root inode. */
+	rtinit(mp);
+
+	/* set aside the blocks to punch holes in once everything is in */
+	if (ps->frag)
+		frag = synth_frag(&sc, root);
+	synth_deep(&sc, root);
+	synth_bigdir(&sc, root);
+	if (nr_groups)
+		synth_reflink(&sc, root, owners, nr_groups);
+
+	/* whatever is left of the inode count goes into the bulk tree */
+	used = sc.nr + 1;
+	ip = synth_create(&sc, root, "tree", S_IFDIR | 0755, NULL);
+	if (ps->inodes > used)
+		synth_tree(&sc, ip, ps->inodes - used);
+	libxfs_irele(ip);
+
+	if (frag)
+		synth_frag_punch(&sc, frag);
+
+	libxfs_irele(root);
+	free(sc.value);
+}
+
 void
 parse_proto(
-	xfs_mount_t	*mp,
-	struct fsxattr	*fsx,
-	char		**pp,
-	int		proto_slashes_are_spaces)
+	xfs_mount_t		*mp,
+	struct fsxattr		*fsx,
+	struct proto_source	*source,
+	int			proto_slashes_are_spaces,
+	unsigned int		nr_threads)
 {
+	if (source->type == PROTO_SRC_DIR) {
+		populate_from_dir(mp, fsx, source->data, nr_threads);
+		return;
+	}
+	if (source->type == PROTO_SRC_SYNTH) {
+		populate_synth(mp, fsx, &source->synth);
+		return;
+	}
+
 	slashes_are_spaces = proto_slashes_are_spaces;
-	parseproto(mp, NULL, fsx, pp, NULL);
+	parseproto(mp, NULL, fsx, &source->data, NULL);
 }
 
 /* Create a sb-rooted metadata file. */
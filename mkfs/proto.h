@@ -6,9 +6,35 @@
 #ifndef MKFS_PROTO_H_
 #define MKFS_PROTO_H_
 
-char *setup_proto(char *fname);
-void parse_proto(struct xfs_mount *mp, struct fsxattr *fsx, char **pp,
-		int proto_slashes_are_spaces);
+enum proto_source_type {
+	PROTO_SRC_PROTOFILE,
+	PROTO_SRC_DIR,
+	PROTO_SRC_SYNTH,
+};
+
+/* Shape of a generated filesystem; see -p synth= in mkfs.xfs(8). */
+struct proto_synth {
+	unsigned long long	inodes;	/* total inodes to create */
+	unsigned long long	bigdir;	/* entries in the huge directory */
+	unsigned long long	frag;	/* free space fragments to create */
+	unsigned int		depth;	/* levels in the deep directory chain */
+	unsigned int		fanout;	/* entries per directory in the tree */
+	unsigned int		xattrs;	/* xattrs on each xattr-heavy file */
+	int			reflink; /* owners per shared extent */
+	unsigned int		seed;
+};
+
+struct proto_source {
+	enum proto_source_type	type;
+	char			*data;	/* protofile contents or directory */
+	struct proto_synth	synth;
+};
+
+struct proto_source setup_proto(char *fname);
+struct proto_source setup_synth(char *spec);
+void parse_proto(struct xfs_mount *mp, struct fsxattr *fsx,
+		struct proto_source *source, int proto_slashes_are_spaces,
+		unsigned int nr_threads);
 void res_failed(int err);
 
 #endif /* MKFS_PROTO_H_ */
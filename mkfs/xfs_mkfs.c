@@ -13,6 +13,7 @@
 #include "libfrog/crc32cselftest.h"
 #include "libfrog/dahashselftest.h"
 #include "libfrog/fsproperties.h"
+#include "libfrog/workqueue.h"
 #include "proto.h"
 #include <ini.h>
 
@@ -79,6 +80,8 @@ enum {
 	D_COWEXTSIZE,
 	D_DAXINHERIT,
 	D_CONCURRENCY,
+	D_DISCARD_CONCURRENCY,
+	D_DISCARD_RATE,
 	D_MAX_OPTS,
 };
 
@@ -122,6 +125,7 @@ enum {
 enum {
 	P_FILE = 0,
 	P_SLASHES,
+	P_SYNTH,
 	P_MAX_OPTS,
 };
 
@@ -153,6 +157,12 @@ enum {
 	M_MAX_OPTS,
 };
 
+enum {
+	O_STATS = 0,
+	O_STATS_INTERVAL,
+	O_MAX_OPTS,
+};
+
 /*
  * Just define the max options array size manually to the largest
  * enum right now, leaving room for a NULL terminator at the end
@@ -325,6 +335,8 @@ static struct opt_params dopts = {
 		[D_COWEXTSIZE] = "cowextsize",
 		[D_DAXINHERIT] = "daxinherit",
 		[D_CONCURRENCY] = "concurrency",
+		[D_DISCARD_CONCURRENCY] = "discard_concurrency",
+		[D_DISCARD_RATE] = "discard_rate",
 		[D_MAX_OPTS] = NULL,
 	},
 	.subopt_params = {
@@ -457,6 +469,19 @@ static struct opt_params dopts = {
 		  .maxval = INT_MAX,
 		  .defaultval = 1,
 		},
+		{ .index = D_DISCARD_CONCURRENCY,
+		  .conflicts = { { NULL, LAST_CONFLICT } },
+		  .minval = 0,
+		  .maxval = INT_MAX,
+		  .defaultval = SUBOPT_NEEDS_VAL,
+		},
+		{ .index = D_DISCARD_RATE,
+		  .conflicts = { { NULL, LAST_CONFLICT } },
+		  .convert = true,
+		  .minval = 0,
+		  .maxval = LLONG_MAX,
+		  .defaultval = SUBOPT_NEEDS_VAL,
+		},
 	},
 };
 
@@ -700,6 +725,7 @@ static struct opt_params popts = {
 	.subopts = {
 		[P_FILE] = "file",
 		[P_SLASHES] = "slashes_are_spaces",
+		[P_SYNTH] = "synth",
 		[P_MAX_OPTS] = NULL,
 	},
 	.subopt_params = {
@@ -713,6 +739,10 @@ static struct opt_params popts = {
 		  .maxval = 1,
 		  .defaultval = 1,
 		},
+		{ .index = P_SYNTH,
+		  .conflicts = { { NULL, LAST_CONFLICT } },
+		  .defaultval = SUBOPT_NEEDS_VAL,
+		},
 	},
 };
 
@@ -864,6 +894,33 @@ static struct opt_params mopts = {
 	},
 };
 
+/*
+ * Options that change how mkfs runs rather than what it makes, so they have
+ * no config file section.
+ */
+static struct opt_params oopts = {
+	.name = 'o',
+	.subopts = {
+		[O_STATS] = "stats",
+		[O_STATS_INTERVAL] = "stats_interval",
+		[O_MAX_OPTS] = NULL,
+	},
+	.subopt_params = {
+		{ .index = O_STATS,
+		  .conflicts = { { NULL, LAST_CONFLICT } },
+		  .minval = 0,
+		  .maxval = 1,
+		  .defaultval = 1,
+		},
+		{ .index = O_STATS_INTERVAL,
+		  .conflicts = { { NULL, LAST_CONFLICT } },
+		  .minval = 1,
+		  .maxval = INT_MAX,
+		  .defaultval = SUBOPT_NEEDS_VAL,
+		},
+	},
+};
+
 /* quick way of checking if a parameter was set on the CLI */
 static bool
 cli_opt_set(
@@ -925,6 +982,7 @@ struct cli_params {
 
 	char	*cfgfile;
 	char	*protofile;
+	char	*protosynth;
 
 	enum fsprop_autofsck autofsck;
 
@@ -949,6 +1007,10 @@ struct cli_params {
 	int	proto_slashes_are_spaces;
 	int	data_concurrency;
 	int	log_concurrency;
+	int	discard_concurrency;
+	uint64_t discard_rate;
+	int	buf_stats;
+	int	buf_stats_interval;
 
 	/* parameters where 0 is not a valid value */
 	int64_t	agcount;
@@ -1051,7 +1113,8 @@ usage( void )
 			    inobtcount=0|1,bigtime=0|1,autofsck=xxx]\n\
 /* data subvol */	[-d agcount=n,agsize=n,file,name=xxx,size=num,\n\
 			    (sunit=value,swidth=value|su=num,sw=num|noalign),\n\
-			    sectsize=num,concurrency=num]\n\
+			    sectsize=num,concurrency=num,\n\
+			    discard_concurrency=num,discard_rate=num]\n\
 /* force overwrite */	[-f]\n\
 /* inode size */	[-i perblock=n|size=num,maxpct=n,attr=0|1|2,\n\
 			    projid32bit=0|1,sparse=0|1,nrext64=0|1,\n\
@@ -1063,7 +1126,8 @@ usage( void )
 /* label */		[-L label (maximum 12 characters)]\n\
 /* naming */		[-n size=num,version=2|ci,ftype=0|1,parent=0|1]]\n\
 /* no-op info only */	[-N]\n\
-/* prototype file */	[-p fname]\n\
+/* statistics */	[-o stats,stats_interval=n]\n\
+/* prototype file */	[-p fname|synth=spec]\n\
 /* quiet */		[-q]\n\
 /* realtime subvol */	[-r extsize=num,size=num,rtdev=xxx]\n\
 /* sectorsize */	[-s size=num]\n\
@@ -1395,41 +1459,244 @@ done:
 	free(buf);
 }
 
+/*
+ * Discard the device in 2G pieces by default, so that it can be interrupted
+ * prematurely, and with a few pieces in flight at once so that devices that
+ * process discards in parallel aren't left idle.
+ */
+#define DISCARD_STEP		(2ULL << 30)
+#define DISCARD_CONCURRENCY	4
+
+struct discard_ctx {
+	int			fd;
+	int			quiet;
+	bool			zero;		/* write zeroes instead */
+	bool			started;
+	bool			failed;
+	uint64_t		count;		/* bytes to discard */
+	uint64_t		step;		/* bytes per request */
+	uint64_t		offset;		/* next byte to hand out */
+	uint64_t		rate;		/* bytes per second, 0 = unlimited */
+	uint64_t		throttle_next;	/* ns, CLOCK_MONOTONIC */
+	pthread_mutex_t		lock;
+};
+
+/*
+ * Read a block queue limit for the device open on @fd from sysfs.  Partitions
+ * don't have a queue directory of their own, so look in the parent device if
+ * there isn't one.  Returns -1 if the limit can't be found.
+ */
+static int64_t
+discard_queue_limit(
+	int			fd,
+	const char		*name)
+{
+	char			path[PATH_MAX];
+	struct stat		st;
+	unsigned long long	val;
+	FILE			*fp;
+	int			ret;
+
+	if (fstat(fd, &st) < 0 || !S_ISBLK(st.st_mode))
+		return -1;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/%s",
+			major(st.st_rdev), minor(st.st_rdev), name);
+	fp = fopen(path, "r");
+	if (!fp) {
+		snprintf(path, sizeof(path),
+				"/sys/dev/block/%u:%u/../queue/%s",
+				major(st.st_rdev), minor(st.st_rdev), name);
+		fp = fopen(path, "r");
+	}
+	if (!fp)
+		return -1;
+	ret = fscanf(fp, "%llu", &val);
+	fclose(fp);
+	if (ret != 1)
+		return -1;
+	return val;
+}
+
+/* Wait until there is enough rate budget left to issue @len bytes. */
 static void
-discard_blocks(int fd, uint64_t nsectors, int quiet)
+discard_throttle(
+	struct discard_ctx	*dc,
+	uint64_t		len)
 {
-	uint64_t	offset = 0;
-	/* Discard the device 2G at a time */
-	const uint64_t	step = 2ULL << 30;
-	const uint64_t	count = BBTOB(nsectors);
+	struct timespec		now;
+	uint64_t		now_ns;
+	uint64_t		wait = 0;
 
-	/*
-	 * The block discarding happens in smaller batches so it can be
-	 * interrupted prematurely
-	 */
-	while (offset < count) {
-		uint64_t	tmp_step = min(step, count - offset);
+	if (!dc->rate)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+	pthread_mutex_lock(&dc->lock);
+	if (dc->throttle_next < now_ns)
+		dc->throttle_next = now_ns;
+	wait = dc->throttle_next - now_ns;
+	dc->throttle_next += len * 1000000000ULL / dc->rate;
+	pthread_mutex_unlock(&dc->lock);
+
+	if (wait) {
+		struct timespec	ts = {
+			.tv_sec = wait / 1000000000ULL,
+			.tv_nsec = wait % 1000000000ULL,
+		};
+
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Discard worker.  Each worker keeps taking the next piece of the device
+ * until there is nothing left or a request has failed.
+ */
+static void
+discard_worker(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct discard_ctx	*dc = arg;
+	uint64_t		offset;
+	uint64_t		len;
+	bool			zero;
+	int			error;
+
+	for (;;) {
+		pthread_mutex_lock(&dc->lock);
+		if (dc->failed || dc->offset >= dc->count) {
+			pthread_mutex_unlock(&dc->lock);
+			return;
+		}
+		offset = dc->offset;
+		len = min(dc->step, dc->count - offset);
+		dc->offset += len;
+		zero = dc->zero;
+		pthread_mutex_unlock(&dc->lock);
+
+		discard_throttle(dc, len);
+
+		/*
+		 * Zeroing with FALLOC_FL_PUNCH_HOLE never falls back to
+		 * writing zeroes by hand, so if the device can't unmap the
+		 * range quickly it fails and we discard it instead.
+		 */
+		error = -1;
+		if (zero) {
+			error = fallocate(dc->fd,
+					FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+					offset, len);
+			if (error) {
+				pthread_mutex_lock(&dc->lock);
+				dc->zero = false;
+				pthread_mutex_unlock(&dc->lock);
+			}
+		}
+		if (error)
+			error = platform_discard_blocks(dc->fd, offset, len);
 
 		/*
 		 * We intentionally ignore errors from the discard ioctl. It is
 		 * not necessary for the mkfs functionality but just an
 		 * optimization. However we should stop on error.
 		 */
-		if (platform_discard_blocks(fd, offset, tmp_step) == 0) {
-			if (offset == 0 && !quiet) {
+		pthread_mutex_lock(&dc->lock);
+		if (error) {
+			dc->failed = true;
+		} else if (!dc->started) {
+			dc->started = true;
+			if (!dc->quiet) {
 				printf("Discarding blocks...");
 				fflush(stdout);
 			}
-		} else {
-			if (offset > 0 && !quiet)
-				printf("\n");
-			return;
 		}
+		pthread_mutex_unlock(&dc->lock);
+	}
+}
 
-		offset += tmp_step;
+static void
+discard_blocks(
+	struct cli_params	*cli,
+	int			fd,
+	uint64_t		nsectors,
+	int			quiet)
+{
+	struct discard_ctx	dc = {
+		.fd		= fd,
+		.quiet		= quiet,
+		.count		= BBTOB(nsectors),
+		.step		= DISCARD_STEP,
+		.rate		= cli->discard_rate,
+	};
+	struct workqueue	wq;
+	int64_t			granularity;
+	int64_t			max_bytes;
+	unsigned int		nr_threads;
+	unsigned int		i;
+
+	/*
+	 * Devices that can unmap a range and guarantee that it reads back as
+	 * zeroes get zeroed rather than discarded, so that the stale contents
+	 * are really gone.  Otherwise skip devices that say they don't support
+	 * discard at all.
+	 */
+	max_bytes = discard_queue_limit(fd, "write_zeroes_unmap_max_bytes");
+	if (max_bytes > 0) {
+		dc.zero = true;
+	} else {
+		max_bytes = discard_queue_limit(fd, "discard_max_bytes");
+		if (max_bytes == 0)
+			return;
 	}
-	if (offset > 0 && !quiet)
-		printf("Done.\n");
+	granularity = discard_queue_limit(fd, "discard_granularity");
+
+	/*
+	 * With a rate limit, keep each request to about a tenth of a second
+	 * worth of the budget so that the device sees a steady stream rather
+	 * than long bursts.
+	 */
+	if (dc.rate)
+		dc.step = min(dc.step, max(dc.rate / 10, 1ULL << 20));
+
+	/*
+	 * Issue requests that the kernel can split into full sized pieces,
+	 * and that start on a discard granule so none of them is wasted.
+	 */
+	if (max_bytes > 0 && max_bytes < dc.step)
+		dc.step -= dc.step % max_bytes;
+	if (granularity > 0 && granularity < dc.step)
+		dc.step -= dc.step % granularity;
+
+	nr_threads = DISCARD_CONCURRENCY;
+	if (cli->discard_concurrency >= 0)
+		nr_threads = cli->discard_concurrency;
+	if (nr_threads > howmany(dc.count, dc.step))
+		nr_threads = howmany(dc.count, dc.step);
+
+	pthread_mutex_init(&dc.lock, NULL);
+	if (nr_threads <= 1 ||
+	    workqueue_create(&wq, NULL, nr_threads) != 0) {
+		discard_worker(NULL, 0, &dc);
+	} else {
+		for (i = 0; i < nr_threads; i++) {
+			if (workqueue_add(&wq, discard_worker, i, &dc))
+				break;
+		}
+		/* if nothing could be queued, do it all here */
+		if (i == 0)
+			discard_worker(NULL, 0, &dc);
+		workqueue_terminate(&wq);
+		workqueue_destroy(&wq);
+	}
+	pthread_mutex_destroy(&dc.lock);
+
+	if (dc.started && !quiet)
+		printf(dc.failed ? "\n" : "Done.\n");
 }
 
 static __attribute__((noreturn)) void
@@ -1715,6 +1982,12 @@ data_opts_parser(
 	case D_CONCURRENCY:
 		set_data_concurrency(opts, subopt, cli, value);
 		break;
+	case D_DISCARD_CONCURRENCY:
+		cli->discard_concurrency = getnum(value, opts, subopt);
+		break;
+	case D_DISCARD_RATE:
+		cli->discard_rate = getnum(value, opts, subopt);
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -1933,9 +2206,16 @@ proto_opts_parser(
 	case P_SLASHES:
 		cli->proto_slashes_are_spaces = getnum(value, opts, subopt);
 		break;
+	case P_SYNTH:
+		if (cli->protofile)
+			conflict(opts, P_SYNTH, opts, P_FILE);
+		cli->protosynth = getstr(value, opts, subopt);
+		break;
 	case P_FILE:
 		fallthrough;
 	default:
+		if (cli->protosynth)
+			conflict(opts, P_FILE, opts, P_SYNTH);
 		if (cli->protofile) {
 			if (subopt < 0)
 				subopt = P_FILE;
@@ -1952,6 +2232,26 @@ proto_opts_parser(
 	return 0;
 }
 
+static int
+other_opts_parser(
+	struct opt_params	*opts,
+	int			subopt,
+	const char		*value,
+	struct cli_params	*cli)
+{
+	switch (subopt) {
+	case O_STATS:
+		cli->buf_stats = getnum(value, opts, subopt);
+		break;
+	case O_STATS_INTERVAL:
+		cli->buf_stats_interval = getnum(value, opts, subopt);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
 static int
 rtdev_opts_parser(
 	struct opt_params	*opts,
@@ -2015,6 +2315,7 @@ static struct subopts {
 	{ &lopts, log_opts_parser },
 	{ &mopts, meta_opts_parser },
 	{ &nopts, naming_opts_parser },
+	{ &oopts, other_opts_parser },
 	{ &popts, proto_opts_parser },
 	{ &ropts, rtdev_opts_parser },
 	{ &sopts, sector_opts_parser },
@@ -3057,6 +3358,7 @@ open_devices(
 
 static void
 discard_devices(
+	struct cli_params	*cli,
 	struct libxfs_init	*xi,
 	int			quiet)
 {
@@ -3065,11 +3367,11 @@ discard_devices(
 	 */
 
 	if (!xi->data.isfile)
-		discard_blocks(xi->data.fd, xi->data.size, quiet);
+		discard_blocks(cli, xi->data.fd, xi->data.size, quiet);
 	if (xi->rt.dev && !xi->rt.isfile)
-		discard_blocks(xi->rt.fd, xi->rt.size, quiet);
+		discard_blocks(cli, xi->rt.fd, xi->rt.size, quiet);
 	if (xi->log.dev && xi->log.dev != xi->data.dev && !xi->log.isfile)
-		discard_blocks(xi->log.fd, xi->log.size, quiet);
+		discard_blocks(cli, xi->log.fd, xi->log.size, quiet);
 }
 
 static void
@@ -4254,6 +4556,145 @@ initialise_ag_freespace(
 	}
 }
 
+/* AGs whose headers are written out with a single delwri submission */
+#define AG_INIT_BATCH		16
+
+struct ag_init_ctx {
+	struct mkfs_params	*cfg;
+	struct xfs_mount	*mp;
+	pthread_mutex_t		lock;
+	int			worst_freelist;
+	unsigned int		nr_threads;
+};
+
+static void
+initialise_ag_headers_batch(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct ag_init_ctx	*ctx = arg;
+	struct list_head	buffer_list;
+	xfs_agnumber_t		agno = index * AG_INIT_BATCH;
+	xfs_agnumber_t		end_agno;
+	int			worst_freelist = 0;
+	int			error;
+
+	end_agno = min(agno + AG_INIT_BATCH, ctx->cfg->agcount);
+
+	INIT_LIST_HEAD(&buffer_list);
+	for (; agno < end_agno; agno++)
+		initialise_ag_headers(ctx->cfg, ctx->mp, agno, &worst_freelist,
+				&buffer_list);
+
+	error = -libxfs_buf_delwri_submit(&buffer_list);
+	if (error) {
+		fprintf(stderr, _("%s: writing AG headers failed, err=%d\n"),
+				progname, error);
+		exit(1);
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->worst_freelist = max(ctx->worst_freelist, worst_freelist);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void
+initialise_ag_freespace_batch(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct ag_init_ctx	*ctx = arg;
+	xfs_agnumber_t		agno = index * AG_INIT_BATCH;
+	xfs_agnumber_t		end_agno;
+
+	end_agno = min(agno + AG_INIT_BATCH, ctx->cfg->agcount);
+	for (; agno < end_agno; agno++)
+		initialise_ag_freespace(ctx->mp, agno, ctx->worst_freelist);
+}
+
+/* Run @func over every batch of AGs and wait for all of them to finish. */
+static void
+run_ag_batches(
+	struct ag_init_ctx	*ctx,
+	workqueue_func_t	func)
+{
+	struct workqueue	wq;
+	unsigned int		nr_batches;
+	unsigned int		i;
+	int			error;
+
+	nr_batches = howmany(ctx->cfg->agcount, AG_INIT_BATCH);
+
+	error = -workqueue_create(&wq, ctx, ctx->nr_threads);
+	if (error) {
+		fprintf(stderr, _("%s: could not start AG init threads, err=%d\n"),
+				progname, error);
+		exit(1);
+	}
+
+	for (i = 0; i < nr_batches; i++) {
+		error = -workqueue_add(&wq, func, i, ctx);
+		if (error) {
+			fprintf(stderr,
+	_("%s: could not queue AG init work, err=%d\n"),
+					progname, error);
+			exit(1);
+		}
+	}
+
+	error = -workqueue_terminate(&wq);
+	if (error) {
+		fprintf(stderr, _("%s: AG init threads failed, err=%d\n"),
+				progname, error);
+		exit(1);
+	}
+	workqueue_destroy(&wq);
+}
+
+/*
+ * Number of threads for the parts of mkfs that write in parallel.  These are
+ * bound by I/O latency rather than CPU, so keep a few writes in flight even
+ * on small machines.
+ */
+static unsigned int
+mkfs_nr_threads(
+	struct cli_params	*cli)
+{
+	if (cli->data_concurrency > 0)
+		return cli->data_concurrency;
+	return max(nr_cpus(), 4);
+}
+
+/*
+ * Write the AG headers and then fill the AGFLs.  Every AG only touches its
+ * own buffers, so both steps are spread over a pool of threads without any
+ * buffer locking.
+ */
+static void
+initialise_ags(
+	struct mkfs_params	*cfg,
+	struct cli_params	*cli,
+	struct xfs_mount	*mp)
+{
+	struct ag_init_ctx	ctx = {
+		.cfg		= cfg,
+		.mp		= mp,
+	};
+	unsigned int		nr_batches = howmany(cfg->agcount, AG_INIT_BATCH);
+
+	ctx.nr_threads = min(mkfs_nr_threads(cli), nr_batches);
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	run_ag_batches(&ctx, initialise_ag_headers_batch);
+
+	/* the AGFLs are all sized for the AG that needs the most blocks */
+	run_ag_batches(&ctx, initialise_ag_freespace_batch);
+
+	pthread_mutex_destroy(&ctx.lock);
+}
+
 /*
  * rewrite several secondary superblocks with the root inode number filled out.
  * This can help repair recovery from a trashed primary superblock without
@@ -4453,15 +4894,13 @@ main(
 	int			argc,
 	char			**argv)
 {
-	xfs_agnumber_t		agno;
 	struct xfs_buf		*buf;
 	int			c;
 	int			dry_run = 0;
 	int			discard = 1;
 	int			force_overwrite = 0;
 	int			quiet = 0;
-	char			*protostring = NULL;
-	int			worst_freelist = 0;
+	struct proto_source	protosource;
 
 	struct libxfs_init	xi = {
 		.flags = LIBXFS_EXCLUSIVELY | LIBXFS_DIRECT,
@@ -4477,6 +4916,7 @@ main(
 		.is_supported	= 1,
 		.data_concurrency = -1, /* auto detect non-mechanical storage */
 		.log_concurrency = -1, /* auto detect non-mechanical ddev */
+		.discard_concurrency = -1, /* use DISCARD_CONCURRENCY */
 		.autofsck = FSPROP_AUTOFSCK_UNSET,
 	};
 	struct mkfs_params	cfg = {};
@@ -4524,7 +4964,6 @@ main(
 		},
 	};
 
-	struct list_head	buffer_list;
 	int			error;
 
 	platform_uuid_generate(&cli.uuid);
@@ -4551,7 +4990,7 @@ main(
 	memcpy(&cli.sb_feat, &dft.sb_feat, sizeof(cli.sb_feat));
 	memcpy(&cli.fsx, &dft.fsx, sizeof(cli.fsx));
 
-	while ((c = getopt_long(argc, argv, "b:c:d:i:l:L:m:n:KNp:qr:s:CfV",
+	while ((c = getopt_long(argc, argv, "b:c:d:i:l:L:m:n:Ko:Np:qr:s:CfV",
 					long_options, &option_index)) != EOF) {
 		switch (c) {
 		case 0:
@@ -4567,6 +5006,7 @@ main(
 		case 'l':
 		case 'm':
 		case 'n':
+		case 'o':
 		case 'p':
 		case 'r':
 		case 's':
@@ -4608,7 +5048,20 @@ main(
 	 */
 	cfgfile_parse(&cli);
 
-	protostring = setup_proto(cli.protofile);
+	if (cli.buf_stats || cli.buf_stats_interval) {
+		error = libxfs_buf_stats_enable(cli.buf_stats_interval, stderr);
+		if (error) {
+			fprintf(stderr,
+	_("%s: cannot start buffer cache statistics: %s\n"),
+				progname, strerror(error));
+			exit(1);
+		}
+	}
+
+	if (cli.protosynth)
+		protosource = setup_synth(cli.protosynth);
+	else
+		protosource = setup_proto(cli.protofile);
 
 	/*
 	 * Extract as much of the valid config as we can from the CLI input
@@ -4717,7 +5170,7 @@ main(
 	 * All values have been validated, discard the old device layout.
 	 */
 	if (discard && !dry_run)
-		discard_devices(&xi, quiet);
+		discard_devices(&cli, &xi, quiet);
 
 	/*
 	 * we need the libxfs buffer cache from here on in.
@@ -4738,42 +5191,16 @@ main(
 	}
 
 	/*
-	 * Initialise all the static on disk metadata.
-	 */
-	INIT_LIST_HEAD(&buffer_list);
-	for (agno = 0; agno < cfg.agcount; agno++) {
-		initialise_ag_headers(&cfg, mp, agno, &worst_freelist,
-				&buffer_list);
-
-		if (agno % 16)
-			continue;
-
-		error = -libxfs_buf_delwri_submit(&buffer_list);
-		if (error) {
-			fprintf(stderr,
-	_("%s: writing AG headers failed, err=%d\n"),
-					progname, error);
-			exit(1);
-		}
-	}
-
-	error = -libxfs_buf_delwri_submit(&buffer_list);
-	if (error) {
-		fprintf(stderr, _("%s: writing AG headers failed, err=%d\n"),
-				progname, error);
-		exit(1);
-	}
-
-	/*
-	 * Initialise the freespace freelists (i.e. AGFLs) in each AG.
+	 * Initialise all the static on disk metadata and the freespace
+	 * freelists (i.e. AGFLs) in each AG.
 	 */
-	for (agno = 0; agno < cfg.agcount; agno++)
-		initialise_ag_freespace(mp, agno, worst_freelist);
+	initialise_ags(&cfg, &cli, mp);
 
 	/*
 	 * Allocate the root inode and anything else in the proto file.
 	 */
-	parse_proto(mp, &cli.fsx, &protostring, cli.proto_slashes_are_spaces);
+	parse_proto(mp, &cli.fsx, &protosource, cli.proto_slashes_are_spaces,
+			mkfs_nr_threads(&cli));
 
 	/*
 	 * Protect ourselves against possible stupidity
@@ -4813,5 +5240,11 @@ main(
 		exit(1);
 
 	libxfs_destroy(&xi);
+
+	if (cli.buf_stats || cli.buf_stats_interval) {
+		libxfs_buf_stats_disable();
+		if (cli.buf_stats)
+			libxfs_buf_stats_report(stdout);
+	}
 	return 0;
 }
@@ -14,9 +14,10 @@
 #include "libfrog/logging.h"
 #include "libfrog/fsgeom.h"
 #include "libfrog/bulkstat.h"
+#include "libfrog/util.h"
+#include "libfrog/workqueue.h"
 
 typedef struct du {
-	struct du	*next;
 	uint64_t	blocks;
 	uint64_t	blocks30;
 	uint64_t	blocks60;
@@ -25,15 +26,36 @@ typedef struct du {
 	uint32_t	id;
 } du_t;
 
+/*
+ * Open addressing hash table of usage by ID.  Every ID in the table owns at
+ * least one inode, so a slot with no files in it is free.
+ */
+struct du_table {
+	du_t		*slots;
+	uint64_t	size;		/* always a power of two */
+	uint64_t	count;
+};
+
 #define	TSIZE		500
-static uint64_t	sizes[TSIZE];
-static uint64_t	overflow;
 
-#define	NDU		60000
-#define	DUHASH		8209
-static du_t		du[3][NDU];
-static du_t		*duhash[3][DUHASH];
-static int		ndu[3];	/* #usr/grp/prj */
+/* Usage counted by one bulkstat worker, or the whole filesystem. */
+struct quot_acct {
+	struct du_table	du[3];		/* usr/grp/prj */
+	uint64_t	sizes[TSIZE];
+	uint64_t	overflow;
+};
+
+/* Per-AG bulkstat walk of one filesystem. */
+struct quot_scan {
+	struct xfs_fd		*fsxfd;
+	unsigned int		flags;
+	pthread_mutex_t		lock;
+	struct quot_acct	**free_accts;	/* one for each worker */
+	unsigned int		nr_free;
+	int			error;
+};
+
+static struct quot_acct	total;
 
 #define NBSTAT 		4069
 
@@ -68,50 +90,105 @@ quot_help(void)
 "\n"));
 }
 
+static inline uint64_t
+du_hash(
+	uint32_t	id)
+{
+	return ((uint64_t)id * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static du_t *
+du_insert_slot(
+	struct du_table	*t,
+	uint32_t	id)
+{
+	uint64_t	i = du_hash(id) & (t->size - 1);
+
+	while (t->slots[i].nfiles && t->slots[i].id != id)
+		i = (i + 1) & (t->size - 1);
+	return &t->slots[i];
+}
+
+static int
+du_table_grow(
+	struct du_table	*t)
+{
+	struct du_table	new = {
+		.size	= t->size ? t->size * 2 : 1024,
+		.count	= t->count,
+	};
+	uint64_t	i;
+
+	new.slots = calloc(new.size, sizeof(du_t));
+	if (!new.slots)
+		return ENOMEM;
+	for (i = 0; i < t->size; i++)
+		if (t->slots[i].nfiles)
+			*du_insert_slot(&new, t->slots[i].id) = t->slots[i];
+	free(t->slots);
+	*t = new;
+	return 0;
+}
+
+/* Find the usage record for an ID, adding an empty one if there isn't one. */
+static du_t *
+du_lookup(
+	struct du_table	*t,
+	uint32_t	id)
+{
+	du_t		*dp;
+
+	if (t->count * 2 >= t->size && du_table_grow(t))
+		return NULL;
+	dp = du_insert_slot(t, id);
+	if (!dp->nfiles) {
+		dp->id = id;
+		t->count++;
+	}
+	return dp;
+}
+
 static void
+quot_acct_free(
+	struct quot_acct	*acct)
+{
+	int			i;
+
+	for (i = 0; i < 3; i++)
+		free(acct->du[i].slots);
+	memset(acct, 0, sizeof(*acct));
+}
+
+static int
 quot_bulkstat_add(
+	struct quot_acct	*acct,
 	struct xfs_bulkstat	*p,
-	uint		flags)
+	uint			flags)
 {
-	du_t		*dp;
-	du_t		**hp;
-	uint64_t	size;
-	uint32_t	i, id;
+	du_t			*dp;
+	uint64_t		size;
+	uint32_t		i, id;
 
 	if ((p->bs_mode & S_IFMT) == 0)
-		return;
+		return 0;
 	size = howmany((p->bs_blocks * p->bs_blksize), 0x400ULL);
 
 	if (flags & HISTOGRAM_FLAG) {
 		if (!(S_ISDIR(p->bs_mode) || S_ISREG(p->bs_mode)))
-			return;
+			return 0;
 		if (size >= TSIZE) {
-			overflow += size;
+			acct->overflow += size;
 			size = TSIZE - 1;
 		}
-		sizes[(int)size]++;
-		return;
+		acct->sizes[(int)size]++;
+		return 0;
 	}
 	for (i = 0; i < 3; i++) {
 		id = (i == 0) ? p->bs_uid : ((i == 1) ?
 			p->bs_gid : p->bs_projectid);
-		hp = &duhash[i][id % DUHASH];
-		for (dp = *hp; dp; dp = dp->next)
-			if (dp->id == id)
-				break;
-		if (dp == NULL) {
-			if (ndu[i] >= NDU)
-				return;
-			dp = &du[i][(ndu[i]++)];
-			dp->next = *hp;
-			*hp = dp;
-			dp->id = id;
-			dp->nfiles = 0;
-			dp->blocks = 0;
-			dp->blocks30 = 0;
-			dp->blocks60 = 0;
-			dp->blocks90 = 0;
-		}
+		dp = du_lookup(&acct->du[i], id);
+		if (!dp)
+			return ENOMEM;
 		dp->blocks += size;
 
 		if (now - p->bs_atime > 30 * (60*60*24))
@@ -122,29 +199,107 @@ quot_bulkstat_add(
 			dp->blocks90 += size;
 		dp->nfiles++;
 	}
+	return 0;
+}
+
+/* Add one worker's counts into another set of counts. */
+static int
+quot_acct_merge(
+	struct quot_acct	*dst,
+	struct quot_acct	*src)
+{
+	du_t			*sp, *dp;
+	uint64_t		j;
+	int			i;
+
+	for (i = 0; i < TSIZE; i++)
+		dst->sizes[i] += src->sizes[i];
+	dst->overflow += src->overflow;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < src->du[i].size; j++) {
+			sp = &src->du[i].slots[j];
+			if (!sp->nfiles)
+				continue;
+			dp = du_lookup(&dst->du[i], sp->id);
+			if (!dp)
+				return ENOMEM;
+			dp->blocks += sp->blocks;
+			dp->blocks30 += sp->blocks30;
+			dp->blocks60 += sp->blocks60;
+			dp->blocks90 += sp->blocks90;
+			dp->nfiles += sp->nfiles;
+		}
+	}
+	return 0;
+}
+
+/* Walk the inodes of one AG into the counts of whichever worker runs it. */
+static void
+quot_bulkstat_ag(
+	struct workqueue	*wq,
+	uint32_t		agno,
+	void			*arg)
+{
+	struct quot_scan	*scan = arg;
+	struct quot_acct	*acct;
+	struct xfs_bulkstat_req	*breq;
+	int			i, ret;
+
+	pthread_mutex_lock(&scan->lock);
+	acct = scan->free_accts[--scan->nr_free];
+	pthread_mutex_unlock(&scan->lock);
+
+	ret = -xfrog_bulkstat_alloc_req(NBSTAT, 0, &breq);
+	if (ret)
+		goto out;
+	xfrog_bulkstat_set_ag(breq, agno);
+
+	while ((ret = -xfrog_bulkstat(scan->fsxfd, breq)) == 0) {
+		if (breq->hdr.ocount == 0)
+			break;
+		for (i = 0; i < breq->hdr.ocount; i++) {
+			ret = quot_bulkstat_add(acct, &breq->bulkstat[i],
+					scan->flags);
+			if (ret)
+				break;
+		}
+		if (ret)
+			break;
+	}
+	free(breq);
+out:
+	pthread_mutex_lock(&scan->lock);
+	if (ret && !scan->error)
+		scan->error = ret;
+	scan->free_accts[scan->nr_free++] = acct;
+	pthread_mutex_unlock(&scan->lock);
 }
 
+/*
+ * Count the usage of a filesystem with one bulkstat cursor per AG.  Each
+ * worker thread counts into a table of its own, and the tables are merged
+ * once all the AGs are done.
+ */
 static void
 quot_bulkstat_mount(
 	char			*fsdir,
 	unsigned int		flags)
 {
 	struct xfs_fd		fsxfd = XFS_FD_INIT_EMPTY;
-	struct xfs_bulkstat_req	*breq;
-	int			i, sts, ret;
-	du_t			**dp;
-
-	/*
-	 * Initialize tables between checks; because of the qsort
-	 * in report() the hash tables must be rebuilt each time.
-	 */
-	for (sts = 0; sts < TSIZE; sts++)
-		sizes[sts] = 0;
-	overflow = 0;
-	for (i = 0; i < 3; i++)
-		for (dp = duhash[i]; dp < &duhash[i][DUHASH]; dp++)
-			*dp = NULL;
-	ndu[0] = ndu[1] = ndu[2] = 0;
+	struct quot_scan	scan = {
+		.fsxfd		= &fsxfd,
+		.flags		= flags,
+	};
+	struct quot_acct	*accts;
+	struct workqueue	wq;
+	xfs_agnumber_t		agno;
+	unsigned int		nr_threads;
+	unsigned int		i;
+	int			ret;
+
+	/* Start from scratch for each filesystem. */
+	quot_acct_free(&total);
 
 	ret = -xfd_open(&fsxfd, fsdir, O_RDONLY);
 	if (ret) {
@@ -152,22 +307,49 @@ quot_bulkstat_mount(
 		return;
 	}
 
-	ret = -xfrog_bulkstat_alloc_req(NBSTAT, 0, &breq);
-	if (ret) {
-		xfrog_perror(ret, "calloc");
-		xfd_close(&fsxfd);
-		return;
+	nr_threads = min_t(unsigned int, platform_nproc(),
+			fsxfd.fsgeom.agcount);
+
+	/* one set of counts per thread, and one if we have to work here */
+	accts = calloc(nr_threads + 1, sizeof(struct quot_acct));
+	scan.free_accts = calloc(nr_threads + 1, sizeof(struct quot_acct *));
+	if (!accts || !scan.free_accts) {
+		xfrog_perror(ENOMEM, "calloc");
+		goto out_free;
 	}
+	for (i = 0; i < nr_threads + 1; i++)
+		scan.free_accts[scan.nr_free++] = &accts[i];
+	pthread_mutex_init(&scan.lock, NULL);
 
-	while ((sts = -xfrog_bulkstat(&fsxfd, breq)) == 0) {
-		if (breq->hdr.ocount == 0)
-			break;
-		for (i = 0; i < breq->hdr.ocount; i++)
-			quot_bulkstat_add(&breq->bulkstat[i], flags);
+	ret = -workqueue_create(&wq, NULL, nr_threads);
+	if (ret) {
+		xfrog_perror(ret, "workqueue_create");
+		goto out_lock;
 	}
-	if (sts < 0)
-		xfrog_perror(sts, "XFS_IOC_FSBULKSTAT");
-	free(breq);
+	for (agno = 0; agno < fsxfd.fsgeom.agcount; agno++) {
+		if (workqueue_add(&wq, quot_bulkstat_ag, agno, &scan))
+			quot_bulkstat_ag(&wq, agno, &scan);
+	}
+	ret = -workqueue_terminate(&wq);
+	if (ret)
+		xfrog_perror(ret, "workqueue_terminate");
+	workqueue_destroy(&wq);
+
+	if (scan.error)
+		xfrog_perror(scan.error, "XFS_IOC_BULKSTAT");
+
+	for (i = 0; i < nr_threads + 1; i++) {
+		if (!ret)
+			ret = quot_acct_merge(&total, &accts[i]);
+		quot_acct_free(&accts[i]);
+	}
+	if (ret)
+		xfrog_perror(ret, _("merging counts"));
+out_lock:
+	pthread_mutex_destroy(&scan.lock);
+out_free:
+	free(scan.free_accts);
+	free(accts);
 	xfd_close(&fsxfd);
 }
 
@@ -192,23 +374,42 @@ qcompare(
 
 typedef char *(*idtoname_t)(uint32_t);
 
+/*
+ * Pack the used slots of a table at the front of the slot array so that
+ * they can be sorted; the table can't be used for lookups after this.
+ */
+static uint64_t
+du_table_pack(
+	struct du_table	*t)
+{
+	uint64_t	i, n = 0;
+
+	for (i = 0; i < t->size; i++)
+		if (t->slots[i].nfiles)
+			t->slots[n++] = t->slots[i];
+	return n;
+}
+
 static void
 quot_report_mount_any_type(
 	FILE		*fp,
-	du_t		*dp,
-	int		count,
+	struct du_table	*t,
 	idtoname_t	names,
 	uint		form,
 	uint		type,
 	fs_path_t	*mount,
 	uint		flags)
 {
+	du_t		*dp;
+	uint64_t	count = du_table_pack(t);
+	uint64_t	i;
 	char		*cp;
 
 	fprintf(fp, _("%s (%s) %s:\n"),
 		mount->fs_name, mount->fs_dir, type_to_string(type));
-	qsort(dp, count, sizeof(dp[0]), qcompare);
-	for (; dp < &dp[count]; dp++) {
+	qsort(t->slots, count, sizeof(du_t), qcompare);
+	for (i = 0; i < count; i++) {
+		dp = &t->slots[i];
 		if (dp->blocks == 0)
 			return;
 		fprintf(fp, "%8llu    ", (unsigned long long) dp->blocks);
@@ -239,15 +440,15 @@ quot_report_mount(
 {
 	switch (type) {
 	case XFS_GROUP_QUOTA:
-		quot_report_mount_any_type(fp, du[1], ndu[1], gid_to_name,
+		quot_report_mount_any_type(fp, &total.du[1], gid_to_name,
 						form, type, mount, flags);
 		break;
 	case XFS_PROJ_QUOTA:
-		quot_report_mount_any_type(fp, du[2], ndu[2], prid_to_name,
+		quot_report_mount_any_type(fp, &total.du[2], prid_to_name,
 						form, type, mount, flags);
 		break;
 	case XFS_USER_QUOTA:
-		quot_report_mount_any_type(fp, du[0], ndu[0], uid_to_name,
+		quot_report_mount_any_type(fp, &total.du[0], uid_to_name,
 						form, type, mount, flags);
 	}
 }
@@ -283,15 +484,15 @@ quot_histogram_mount(
 	fprintf(fp, _("%s (%s):\n"), mount->fs_name, mount->fs_dir);
 
 	for (i = 0; i < TSIZE - 1; i++)
-		if (sizes[i] > 0) {
-			t += sizes[i] * i;
+		if (total.sizes[i] > 0) {
+			t += total.sizes[i] * i;
 			fprintf(fp, _("%d\t%llu\t%llu\n"), i,
-			       (unsigned long long) sizes[i],
+			       (unsigned long long) total.sizes[i],
 			       (unsigned long long) t);
 		}
 	fprintf(fp, _("%d\t%llu\t%llu\n"), TSIZE - 1,
-		(unsigned long long) sizes[TSIZE - 1],
-		(unsigned long long) (overflow + t));
+		(unsigned long long) total.sizes[TSIZE - 1],
+		(unsigned long long) (total.overflow + t));
 }
 
 static void
@@ -11,6 +11,7 @@
 #include <utmp.h>
 #include "init.h"
 #include "quota.h"
+#include "libfrog/idnames.h"
 
 static cmdinfo_t dump_cmd;
 static cmdinfo_t report_cmd;
@@ -362,19 +363,12 @@ report_mount(
 		fprintf(fp, "#%-10u", d->d_id);
 	} else {
 		if (name == NULL) {
-			if (type == XFS_USER_QUOTA) {
-				struct passwd	*u = getpwuid(d->d_id);
-				if (u)
-					name = u->pw_name;
-			} else if (type == XFS_GROUP_QUOTA) {
-				struct group	*g = getgrgid(d->d_id);
-				if (g)
-					name = g->gr_name;
-			} else if (type == XFS_PROJ_QUOTA) {
-				fs_project_t	*p = getprprid(d->d_id);
-				if (p)
-					name = p->pr_name;
-			}
+			if (type == XFS_USER_QUOTA)
+				name = uid_to_name(d->d_id);
+			else if (type == XFS_GROUP_QUOTA)
+				name = gid_to_name(d->d_id);
+			else if (type == XFS_PROJ_QUOTA)
+				name = prid_to_name(d->d_id);
 		}
 		/* If no name is found, print the id #num instead of (null) */
 		if (name != NULL)
@@ -605,8 +599,14 @@ report_any_type(
 {
 	fs_cursor_t	cursor;
 	fs_path_t	*mount;
+	bool		preload;
+
+	/* naming every ID is cheaper with the whole database in memory */
+	preload = !(flags & NO_LOOKUP_FLAG) && !lower && !upper;
 
 	if (type & XFS_USER_QUOTA) {
+		if (preload)
+			idnames_preload(IDNAMES_USER);
 		fs_cursor_initialise(dir, FS_MOUNT_POINT, &cursor);
 		while ((mount = fs_cursor_next_entry(&cursor))) {
 			if (!foreign_allowed && (mount->fs_flags & FS_FOREIGN))
@@ -620,6 +620,8 @@ report_any_type(
 		}
 	}
 	if (type & XFS_GROUP_QUOTA) {
+		if (preload)
+			idnames_preload(IDNAMES_GROUP);
 		fs_cursor_initialise(dir, FS_MOUNT_POINT, &cursor);
 		while ((mount = fs_cursor_next_entry(&cursor))) {
 			if (!foreign_allowed && (mount->fs_flags & FS_FOREIGN))
@@ -633,6 +635,8 @@ report_any_type(
 		}
 	}
 	if (type & XFS_PROJ_QUOTA) {
+		if (preload)
+			idnames_preload(IDNAMES_PROJ);
 		fs_cursor_initialise(dir, FS_MOUNT_POINT, &cursor);
 		while ((mount = fs_cursor_next_entry(&cursor))) {
 			if (!foreign_allowed && (mount->fs_flags & FS_FOREIGN))
@@ -11,6 +11,7 @@
 #include <utmp.h>
 #include "init.h"
 #include "quota.h"
+#include "libfrog/idnames.h"
 
 #define SECONDS_IN_A_DAY	(24 * 60 * 60)
 #define SECONDS_IN_A_HOUR	(60 * 60)
@@ -222,179 +223,27 @@ type_to_string(
  * Identifier caches - user/group/project names/IDs
  */
 
-#define NID		4096
-#define IDMASK		(NID-1)
-
-typedef struct {
-	uint32_t	id;
-	char		name[NMAX+1];
-} idcache_t;
-
-static idcache_t	uidnc[NID];
-static idcache_t	gidnc[NID];
-static idcache_t	pidnc[NID];
-static int		uentriesleft = NID;
-static int		gentriesleft = NID;
-static int		pentriesleft = NID;
-
-static idcache_t *
-getnextpwent(
-	uint32_t	id,
-	int		byid)
-{
-	struct passwd	*pw;
-	static idcache_t idc;
-
-	/* /etc/passwd */
-	if ((pw = byid? getpwuid(id) : getpwent()) == NULL)
-		return NULL;
-	idc.id = pw->pw_uid;
-	strncpy(idc.name, pw->pw_name, NMAX);
-	return &idc;
-}
-
-static idcache_t *
-getnextgrent(
-	uint32_t	id,
-	int		byid)
-{
-	struct group	*gr;
-	static idcache_t idc;
-
-	if ((gr = byid? getgrgid(id) : getgrent()) == NULL)
-		return NULL;
-	idc.id = gr->gr_gid;
-	strncpy(idc.name, gr->gr_name, NMAX);
-	return &idc;
-}
-
-static idcache_t *
-getnextprent(
-	uint32_t	id,
-	int		byid)
-{
-	fs_project_t	*pr;
-	static idcache_t idc;
-
-	if ((pr = byid? getprprid(id) : getprent()) == NULL)
-		return NULL;
-	idc.id = pr->pr_prid;
-	strncpy(idc.name, pr->pr_name, NMAX);
-	return &idc;
-}
-
 char *
 uid_to_name(
 	uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &uidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (uentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (uentriesleft == NID)
-			setpwent();
-		while (((idp = getnextpwent(id, 0)) != NULL) && uentriesleft) {
-			uentriesleft--;
-			ncp = &uidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
-		}
-		endpwent();
-		uentriesleft = 0;
-		ncp = &uidnc[id & IDMASK];
-	}
-
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextpwent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+	return (char *)idnames_lookup(IDNAMES_USER, id);
 }
 
 char *
 gid_to_name(
 	uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &gidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (gentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (gentriesleft == NID)
-			setgrent();
-		while (((idp = getnextgrent(id, 0)) != NULL) && gentriesleft) {
-			gentriesleft--;
-			ncp = &gidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
-		}
-		endgrent();
-		gentriesleft = 0;
-		ncp = &gidnc[id & IDMASK];
-	}
-
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextgrent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+	return (char *)idnames_lookup(IDNAMES_GROUP, id);
 }
 
 char *
 prid_to_name(
 	uint32_t	id)
 {
-	idcache_t	*ncp, *idp;
-
-	/* Check cache for name first */
-	ncp = &pidnc[id & IDMASK];
-	if (ncp->id == id && ncp->name[0])
-		return ncp->name;
-	if (pentriesleft) {
-		/*
-		 * Fill this cache while seaching for a name.
-		 * This lets us run through the file serially.
-		 */
-		if (pentriesleft == NID)
-			setprent();
-		while (((idp = getnextprent(id, 0)) != NULL) && pentriesleft) {
-			pentriesleft--;
-			ncp = &pidnc[idp->id & IDMASK];
-			if (ncp->name[0] == '\0' || idp->id == id)
-				memcpy(ncp, idp, sizeof(idcache_t));
-			if (idp->id == id)
-				return ncp->name;
-		}
-		endprent();
-		pentriesleft = 0;
-		ncp = &pidnc[id & IDMASK];
-	}
-
-	/* Not cached - do it the slow way & insert into cache */
-	if ((idp = getnextprent(id, 1)) == NULL)
-		return NULL;
-	memcpy(ncp, idp, sizeof(idcache_t));
-	return ncp->name;
+	return (char *)idnames_lookup(IDNAMES_PROJ, id);
 }
 
-
 /*
  * Utility routine for opening an output file so that it can
  * be "securely" written to (i.e. without vulnerability to a
@@ -39,6 +39,7 @@ int	no_modify;
 int	dangerously;		/* live dangerously ... fix ro mount */
 int	isa_file;
 int	zap_log;
+int	replay_log;		/* replay a dirty log ourselves */
 int	dumpcore;		/* abort, not exit on fatal errs */
 int	force_geo;		/* can set geo on low confidence info */
 int	assume_xfs;		/* assume we have an xfs fs */
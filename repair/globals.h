@@ -80,6 +80,7 @@ extern int	no_modify;
 extern int	dangerously;		/* live dangerously ... fix ro mount */
 extern int	isa_file;
 extern int	zap_log;
+extern int	replay_log;		/* replay a dirty log ourselves */
 extern int	dumpcore;		/* abort, not exit on fatal errs */
 extern int	force_geo;		/* can set geo on low confidence info */
 extern int	assume_xfs;		/* assume we have an xfs fs */
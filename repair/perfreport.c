@@ -0,0 +1,476 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#include "libxfs.h"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "globals.h"
+#include "err_protos.h"
+#include "perfreport.h"
+
+/*
+ * Phases are numbered as they are everywhere else in repair.  Slot zero is
+ * everything before phase 1 starts, and the last slot is the flush and
+ * unmount after phase 7.
+ */
+#define PERF_NR_PHASES		9
+#define PERF_WRAPUP		(PERF_NR_PHASES - 1)
+#define PERF_MAX_STAGES		32
+
+/* Counters sampled at each phase boundary. */
+struct perf_snap {
+	bool			taken;
+	uint64_t		ns;
+	uint64_t		user_ns;
+	uint64_t		sys_ns;
+	struct xfs_buf_stats_totals bufs;
+};
+
+/* Per-AG work of one kind in one phase, added up over all the AGs. */
+struct perf_stage {
+	const char		*what;
+	int			phase;
+	unsigned int		nr;
+	uint64_t		busy_ns;
+	uint64_t		min_ns;
+	uint64_t		max_ns;
+	xfs_agnumber_t		slowest;
+};
+
+enum perf_event_type {
+	PERF_EV_SPAN,
+	PERF_EV_WAIT,
+};
+
+/* Something for the timeline. */
+struct perf_event {
+	enum perf_event_type	type;
+	const char		*what;
+	int			phase;
+	xfs_agnumber_t		agno;
+	pid_t			tid;
+	uint64_t		start;
+	uint64_t		dur;
+};
+
+bool				perf_enabled;
+static bool			perf_print_report;
+static char			*perf_timeline;
+static int			perf_phase = 1;
+static uint64_t			perf_start;
+static pthread_mutex_t		perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct perf_snap		snaps[PERF_NR_PHASES];
+static struct perf_stage	stages[PERF_MAX_STAGES];
+static unsigned int		nr_stages;
+
+static atomic64_t		wait_nr[PERF_NR_PHASES][PERF_NR_WAITS];
+static atomic64_t		wait_ns[PERF_NR_PHASES][PERF_NR_WAITS];
+static atomic64_t		lock_nr[PERF_NR_PHASES];
+static atomic64_t		lock_ns[PERF_NR_PHASES];
+
+static struct perf_event	*events;
+static size_t			nr_events;
+static size_t			max_events;
+
+static const char		*wait_names[PERF_NR_WAITS] = {
+	[PERF_PF_STALL]		= "prefetch stall",
+	[PERF_PF_THROTTLE]	= "prefetch throttle",
+};
+
+uint64_t
+perf_now(void)
+{
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline double
+ns_to_sec(
+	uint64_t		ns)
+{
+	return ns / 1e9;
+}
+
+static inline uint64_t
+tv_to_ns(
+	const struct timeval	*tv)
+{
+	return tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL;
+}
+
+static void
+perf_snapshot(
+	struct perf_snap	*snap)
+{
+	struct rusage		ru;
+
+	snap->ns = perf_now();
+	if (!getrusage(RUSAGE_SELF, &ru)) {
+		snap->user_ns = tv_to_ns(&ru.ru_utime);
+		snap->sys_ns = tv_to_ns(&ru.ru_stime);
+	}
+	libxfs_buf_stats_totals(&snap->bufs);
+	snap->taken = true;
+}
+
+/* Remember something for the timeline; the caller must hold perf_lock. */
+static void
+perf_add_event(
+	enum perf_event_type	type,
+	const char		*what,
+	xfs_agnumber_t		agno,
+	uint64_t		start,
+	uint64_t		end)
+{
+	struct perf_event	*ev;
+
+	if (!perf_timeline)
+		return;
+
+	if (nr_events == max_events) {
+		size_t		new_max = max(max_events * 2, (size_t)1024);
+
+		ev = realloc(events, new_max * sizeof(struct perf_event));
+		if (!ev)
+			return;
+		events = ev;
+		max_events = new_max;
+	}
+
+	ev = &events[nr_events++];
+	ev->type = type;
+	ev->what = what;
+	ev->phase = perf_phase;
+	ev->agno = agno;
+	ev->tid = syscall(SYS_gettid);
+	ev->start = start;
+	ev->dur = end - start;
+}
+
+void
+__perf_span_end(
+	struct perf_span	*ps)
+{
+	struct perf_stage	*st = NULL;
+	uint64_t		end = perf_now();
+	uint64_t		dur = end - ps->start;
+	unsigned int		i;
+
+	pthread_mutex_lock(&perf_lock);
+	for (i = 0; i < nr_stages; i++) {
+		if (stages[i].what == ps->what &&
+		    stages[i].phase == perf_phase) {
+			st = &stages[i];
+			break;
+		}
+	}
+	if (!st && nr_stages < PERF_MAX_STAGES) {
+		st = &stages[nr_stages++];
+		st->what = ps->what;
+		st->phase = perf_phase;
+		st->min_ns = UINT64_MAX;
+	}
+	if (st) {
+		st->nr++;
+		st->busy_ns += dur;
+		st->min_ns = min(st->min_ns, dur);
+		if (dur >= st->max_ns) {
+			st->max_ns = dur;
+			st->slowest = ps->agno;
+		}
+	}
+	perf_add_event(PERF_EV_SPAN, ps->what, ps->agno, ps->start, end);
+	pthread_mutex_unlock(&perf_lock);
+}
+
+void
+__perf_wait_end(
+	enum perf_wait		wait,
+	xfs_agnumber_t		agno,
+	uint64_t		start)
+{
+	uint64_t		end = perf_now();
+
+	atomic64_inc(&wait_nr[perf_phase][wait]);
+	atomic64_add(end - start, &wait_ns[perf_phase][wait]);
+
+	if (!perf_timeline)
+		return;
+	pthread_mutex_lock(&perf_lock);
+	perf_add_event(PERF_EV_WAIT, wait_names[wait], agno, start, end);
+	pthread_mutex_unlock(&perf_lock);
+}
+
+void
+__perf_lock_wait(
+	uint64_t		start)
+{
+	atomic64_inc(&lock_nr[perf_phase]);
+	atomic64_add(perf_now() - start, &lock_ns[perf_phase]);
+}
+
+/*
+ * Start collecting.  The buffer cache statistics must already be turned on,
+ * since that's where the I/O numbers come from.
+ */
+void
+perf_init(
+	bool			report,
+	const char		*timeline)
+{
+	perf_print_report = report;
+	if (timeline) {
+		perf_timeline = strdup(timeline);
+		if (!perf_timeline)
+			do_error(_("couldn't allocate timeline file name\n"));
+	}
+	perf_start = perf_now();
+	perf_enabled = true;
+}
+
+/* Called from timestamp() whenever a phase finishes. */
+void
+perf_phase_end(
+	int			phase)
+{
+	if (!perf_enabled || phase < 0 || phase >= PERF_WRAPUP)
+		return;
+
+	pthread_mutex_lock(&perf_lock);
+	perf_snapshot(&snaps[phase]);
+	perf_phase = phase + 1;
+	pthread_mutex_unlock(&perf_lock);
+}
+
+/* Find the snapshot taken when the phase before this one ended. */
+static const struct perf_snap *
+perf_prev_snap(
+	int			phase)
+{
+	while (--phase >= 0)
+		if (snaps[phase].taken)
+			return &snaps[phase];
+	return NULL;
+}
+
+static const char *
+perf_phase_name(
+	int			phase,
+	char			*buf,
+	size_t			len)
+{
+	if (phase == PERF_WRAPUP)
+		return _("flush");
+	snprintf(buf, len, _("Phase %d"), phase);
+	return buf;
+}
+
+static void
+perf_print_phases(void)
+{
+	const struct perf_snap	*prev, *snap;
+	char			name[32];
+	uint64_t		wall, cpu, io_ns;
+	long long		hits, misses;
+	int			p;
+
+	do_log(_("\n        XFS_REPAIR Performance Report\n\n"));
+	do_log(
+_("%-8s %9s %9s %9s %6s %9s %9s %9s %6s %7s %9s %9s %9s\n"),
+		_("phase"), _("wall s"), _("user s"), _("sys s"), _("cpu%"),
+		_("io s"), _("read MiB"), _("write MiB"), _("hit%"),
+		_("shakes"), _("pf stall"), _("pf thrtl"), _("lock s"));
+
+	for (p = 1; p < PERF_NR_PHASES; p++) {
+		snap = &snaps[p];
+		prev = perf_prev_snap(p);
+		if (!snap->taken || !prev)
+			continue;
+
+		wall = snap->ns - prev->ns;
+		cpu = (snap->user_ns - prev->user_ns) +
+		      (snap->sys_ns - prev->sys_ns);
+		io_ns = (snap->bufs.io_ns[XFS_BSTAT_READ] -
+			 prev->bufs.io_ns[XFS_BSTAT_READ]) +
+			(snap->bufs.io_ns[XFS_BSTAT_WRITE] -
+			 prev->bufs.io_ns[XFS_BSTAT_WRITE]);
+		hits = snap->bufs.hits - prev->bufs.hits;
+		misses = snap->bufs.misses - prev->bufs.misses;
+
+		do_log(
+"%-8s %9.2f %9.2f %9.2f %6.0f %9.2f %9.1f %9.1f %6.1f %7lld %9.2f %9.2f %9.2f\n",
+			perf_phase_name(p, name, sizeof(name)),
+			ns_to_sec(wall),
+			ns_to_sec(snap->user_ns - prev->user_ns),
+			ns_to_sec(snap->sys_ns - prev->sys_ns),
+			wall ? cpu * 100.0 / wall : 0.0,
+			ns_to_sec(io_ns),
+			(snap->bufs.io_bytes[XFS_BSTAT_READ] -
+			 prev->bufs.io_bytes[XFS_BSTAT_READ]) / 1048576.0,
+			(snap->bufs.io_bytes[XFS_BSTAT_WRITE] -
+			 prev->bufs.io_bytes[XFS_BSTAT_WRITE]) / 1048576.0,
+			hits + misses ? hits * 100.0 / (hits + misses) : 0.0,
+			snap->bufs.shakes - prev->bufs.shakes,
+			ns_to_sec(atomic64_read(&wait_ns[p][PERF_PF_STALL])),
+			ns_to_sec(atomic64_read(&wait_ns[p][PERF_PF_THROTTLE])),
+			ns_to_sec(atomic64_read(&lock_ns[p])));
+	}
+	do_log(
+_("\ncpu%% can exceed 100 and io s can exceed wall s when threads overlap.\n"));
+}
+
+static void
+perf_print_stages(void)
+{
+	const struct perf_snap	*prev;
+	const struct perf_stage	*st;
+	char			name[32];
+	uint64_t		wall;
+	unsigned int		i;
+
+	if (!nr_stages)
+		return;
+
+	do_log(_("\nPer-AG work:\n"));
+	do_log(_("%-8s %-32s %5s %9s %7s %9s %9s %9s %7s\n"),
+		_("phase"), _("work"), _("AGs"), _("busy s"), _("par"),
+		_("min s"), _("avg s"), _("max s"), _("slowest"));
+	for (i = 0; i < nr_stages; i++) {
+		st = &stages[i];
+		prev = perf_prev_snap(st->phase);
+		wall = 0;
+		if (snaps[st->phase].taken && prev)
+			wall = snaps[st->phase].ns - prev->ns;
+
+		do_log("%-8s %-32s %5u %9.2f %7.2f %9.3f %9.3f %9.3f %7u\n",
+			perf_phase_name(st->phase, name, sizeof(name)),
+			_(st->what), st->nr, ns_to_sec(st->busy_ns),
+			wall ? (double)st->busy_ns / wall : 0.0,
+			ns_to_sec(st->min_ns), ns_to_sec(st->busy_ns / st->nr),
+			ns_to_sec(st->max_ns), st->slowest);
+	}
+	do_log(
+_("\npar is busy time over phase wall time; if it is well below the thread\n"
+"count, a few slow AGs are holding the phase up.\n"));
+}
+
+static inline double
+ns_to_usec(
+	uint64_t		ns)
+{
+	return ns / 1000.0;
+}
+
+static void
+perf_write_counters(
+	FILE			*fp,
+	const struct perf_snap	*snap,
+	const struct perf_snap	*prev)
+{
+	long long		hits = snap->bufs.hits - prev->bufs.hits;
+	long long		misses = snap->bufs.misses - prev->bufs.misses;
+
+	fprintf(fp,
+",\n{\"name\": \"buffer cache\", \"ph\": \"C\", \"pid\": %d, \"ts\": %.3f, \"args\": {\"hits\": %lld, \"misses\": %lld}}",
+			getpid(), ns_to_usec(snap->ns - perf_start), hits,
+			misses);
+	fprintf(fp,
+",\n{\"name\": \"I/O MiB\", \"ph\": \"C\", \"pid\": %d, \"ts\": %.3f, \"args\": {\"read\": %.1f, \"write\": %.1f}}",
+			getpid(), ns_to_usec(snap->ns - perf_start),
+			(snap->bufs.io_bytes[XFS_BSTAT_READ] -
+			 prev->bufs.io_bytes[XFS_BSTAT_READ]) / 1048576.0,
+			(snap->bufs.io_bytes[XFS_BSTAT_WRITE] -
+			 prev->bufs.io_bytes[XFS_BSTAT_WRITE]) / 1048576.0);
+}
+
+/*
+ * Write everything out in the Chrome trace event format, which most trace
+ * viewers understand.  Phases appear on their own row; each worker thread
+ * gets a row showing the AGs it worked on and the time it spent waiting for
+ * prefetch.  The counters are sampled once per phase.
+ */
+static void
+perf_write_timeline(void)
+{
+	const struct perf_snap	*prev, *snap;
+	const struct perf_event	*ev;
+	char			name[32];
+	pid_t			pid = getpid();
+	FILE			*fp;
+	size_t			i;
+	int			p;
+
+	fp = fopen(perf_timeline, "w");
+	if (!fp) {
+		do_warn(_("couldn't create timeline file %s: %s\n"),
+				perf_timeline, strerror(errno));
+		return;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(fp,
+"{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+			pid, progname);
+	fprintf(fp,
+",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, \"args\": {\"name\": \"phases\"}}",
+			pid);
+
+	for (p = 1; p < PERF_NR_PHASES; p++) {
+		snap = &snaps[p];
+		prev = perf_prev_snap(p);
+		if (!snap->taken || !prev)
+			continue;
+
+		fprintf(fp,
+",\n{\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": %d, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"user_ms\": %.1f, \"sys_ms\": %.1f}}",
+				perf_phase_name(p, name, sizeof(name)), pid,
+				ns_to_usec(prev->ns - perf_start),
+				ns_to_usec(snap->ns - prev->ns),
+				(snap->user_ns - prev->user_ns) / 1e6,
+				(snap->sys_ns - prev->sys_ns) / 1e6);
+		perf_write_counters(fp, snap, prev);
+	}
+
+	for (i = 0; i < nr_events; i++) {
+		ev = &events[i];
+		fprintf(fp,
+",\n{\"name\": \"%s AG %u\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"phase\": %d, \"agno\": %u}}",
+				ev->what, ev->agno,
+				ev->type == PERF_EV_WAIT ? "wait" : "ag",
+				pid, ev->tid, ns_to_usec(ev->start - perf_start),
+				ns_to_usec(ev->dur), ev->phase, ev->agno);
+	}
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp))
+		do_warn(_("couldn't write timeline file %s: %s\n"),
+				perf_timeline, strerror(errno));
+}
+
+/* Print the report and write the timeline, if anyone asked for them. */
+void
+perf_done(void)
+{
+	if (!perf_enabled)
+		return;
+
+	pthread_mutex_lock(&perf_lock);
+	perf_snapshot(&snaps[PERF_WRAPUP]);
+	perf_enabled = false;
+	pthread_mutex_unlock(&perf_lock);
+
+	if (perf_print_report) {
+		perf_print_phases();
+		perf_print_stages();
+	}
+	if (perf_timeline)
+		perf_write_timeline();
+
+	free(events);
+	free(perf_timeline);
+}
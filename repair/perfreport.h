@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Copyright (C) 2026 agent.  All Rights Reserved.
+ * Author: agent <agent@local>
+ */
+#ifndef	_XFS_REPAIR_PERFREPORT_H_
+#define	_XFS_REPAIR_PERFREPORT_H_
+
+/*
+ * Where did the time go?  When enabled, each phase records its wall clock
+ * time, CPU time, buffer cache activity, prefetch waits and AG lock waits,
+ * and the per-AG workers record how long each AG took.  All of this can be
+ * printed as a table at the end, or written out as a timeline that can be
+ * loaded into a trace viewer.
+ */
+extern bool	perf_enabled;
+
+enum perf_wait {
+	PERF_PF_STALL,		/* processing waited for prefetch to start */
+	PERF_PF_THROTTLE,	/* prefetch waited for processing to catch up */
+	PERF_NR_WAITS,
+};
+
+/* A piece of per-AG work. */
+struct perf_span {
+	const char	*what;
+	xfs_agnumber_t	agno;
+	uint64_t	start;
+};
+
+uint64_t perf_now(void);
+void perf_init(bool report, const char *timeline);
+void perf_phase_end(int phase);
+void perf_done(void);
+void __perf_span_end(struct perf_span *ps);
+void __perf_wait_end(enum perf_wait wait, xfs_agnumber_t agno,
+		uint64_t start);
+void __perf_lock_wait(uint64_t start);
+
+static inline void
+perf_span_begin(
+	struct perf_span	*ps,
+	const char		*what,
+	xfs_agnumber_t		agno)
+{
+	ps->what = what;
+	ps->agno = agno;
+	ps->start = perf_enabled ? perf_now() : 0;
+}
+
+static inline void
+perf_span_end(
+	struct perf_span	*ps)
+{
+	if (ps->start)
+		__perf_span_end(ps);
+}
+
+static inline uint64_t
+perf_wait_begin(void)
+{
+	return perf_enabled ? perf_now() : 0;
+}
+
+static inline void
+perf_wait_end(
+	enum perf_wait		wait,
+	xfs_agnumber_t		agno,
+	uint64_t		start)
+{
+	if (start)
+		__perf_wait_end(wait, agno, start);
+}
+
+/* Take a lock, and account for the time if someone else had it. */
+static inline void
+perf_mutex_lock(
+	pthread_mutex_t		*lock)
+{
+	uint64_t		start;
+
+	if (!perf_enabled) {
+		pthread_mutex_lock(lock);
+		return;
+	}
+	if (pthread_mutex_trylock(lock) == 0)
+		return;
+
+	start = perf_now();
+	pthread_mutex_lock(lock);
+	__perf_lock_wait(start);
+}
+
+#endif	/* _XFS_REPAIR_PERFREPORT_H_ */
@@ -15,10 +15,115 @@
 #include "progress.h"
 #include "scan.h"
 
-/* workaround craziness in the xlog routines */
+/* log replay is driven through the xlog recovery routines */
 int xlog_recover_do_trans(struct xlog *log, struct xlog_recover *t, int p)
 {
-	return 0;
+	return xlog_replay_trans(log, t, p);
+}
+
+/*
+ * Replay the dirty log in userspace instead of making the user mount the
+ * filesystem first.  Replayed metadata goes through the buffer cache, so
+ * the rest of repair sees the recovered filesystem.
+ */
+static void
+replay_log_records(
+	struct xfs_mount	*mp,
+	xfs_daddr_t		head_blk,
+	xfs_daddr_t		tail_blk)
+{
+	struct xlog_replay_stats stats;
+	int			error;
+
+	do_log(_("        - replaying log...\n"));
+	error = xlog_replay_scan(mp->m_log, head_blk, tail_blk, &stats);
+	if (!error && stats.nr_unfinished) {
+		xlog_replay_free();
+		do_warn(_(
+"ERROR: The log holds %llu unfinished block mapping, reference count, file\n"
+"exchange or extended attribute updates, which xfs_repair cannot complete.\n"
+"Nothing has been replayed.  Mount the filesystem to replay the log, and\n"
+"unmount it before re-running xfs_repair.  If you are unable to mount the\n"
+"filesystem, then use the -L option to destroy the log and attempt a repair.\n"),
+			(unsigned long long)stats.nr_unfinished);
+		exit(2);
+	}
+	if (!error) {
+		set_needsrepair_now(mp);
+		error = xlog_replay(mp->m_log, head_blk, tail_blk);
+	}
+	if (error) {
+		do_warn(_(
+"ERROR: Log replay failed (error %d).  Mount the filesystem to replay the log,\n"
+"and unmount it before re-running xfs_repair.  If you are unable to mount the\n"
+"filesystem, then use the -L option to destroy the log and attempt a repair.\n"),
+			error);
+		exit(2);
+	}
+
+	do_log(
+_("        - replayed %llu transactions: %llu buffers, %llu inodes, %llu dquots,\n"
+"          %llu inode chunks, %llu cancelled, %llu already on disk\n"),
+		(unsigned long long)stats.nr_trans,
+		(unsigned long long)stats.nr_buffers,
+		(unsigned long long)stats.nr_inodes,
+		(unsigned long long)stats.nr_dquots,
+		(unsigned long long)stats.nr_icreates,
+		(unsigned long long)stats.nr_cancelled,
+		(unsigned long long)stats.nr_skipped);
+	if (stats.nr_intents)
+		do_warn(
+_("%llu unfinished extent free or reverse mapping intents were not replayed;\n"
+"repair will rebuild the free space and reverse mapping metadata.\n"),
+			(unsigned long long)stats.nr_intents);
+}
+
+/*
+ * Pick up superblock changes made by the replayed log.  Counters, quota
+ * flags and feature bits can simply be refreshed, but everything computed
+ * from the geometry at mount time would be stale if the log grew the
+ * filesystem.
+ */
+static void
+reload_replayed_sb(
+	struct xfs_mount	*mp)
+{
+	struct xfs_sb		sb;
+	struct xfs_buf		*bp;
+	int			error;
+
+	error = -libxfs_buf_read(mp->m_ddev_targp, XFS_SB_DADDR,
+			XFS_FSS_TO_BB(mp, 1), 0, &bp, &xfs_sb_buf_ops);
+	if (error)
+		do_error(_("cannot read superblock after log replay, err=%d\n"),
+			error);
+	libxfs_sb_from_disk(&sb, bp->b_addr);
+
+	/* a replayed superblock buffer drops the flag we set before replay */
+	if (xfs_sb_version_needsrepair(&mp->m_sb) &&
+	    !xfs_sb_version_needsrepair(&sb)) {
+		sb.sb_features_incompat |= XFS_SB_FEAT_INCOMPAT_NEEDSREPAIR;
+		libxfs_sb_to_disk(bp->b_addr, &sb);
+		error = -libxfs_bwrite(bp);
+		if (error)
+			do_error(
+	_("cannot write superblock after log replay, err=%d\n"), error);
+	}
+	libxfs_buf_relse(bp);
+
+	if (sb.sb_dblocks != mp->m_sb.sb_dblocks ||
+	    sb.sb_agcount != mp->m_sb.sb_agcount ||
+	    sb.sb_rblocks != mp->m_sb.sb_rblocks ||
+	    sb.sb_rextents != mp->m_sb.sb_rextents) {
+		do_log(
+_("The log replay changed the filesystem geometry.  The log has been replayed\n"
+"and cleared; please re-run xfs_repair.\n"));
+		exit(2);
+	}
+
+	/* the kernel turns on attr, attr2 and quota features as they are used */
+	mp->m_sb = sb;
+	mp->m_features |= libxfs_sb_version_to_features(&mp->m_sb);
 }
 
 static void
@@ -29,6 +134,7 @@ zero_log(
 	xfs_daddr_t		head_blk;
 	xfs_daddr_t		tail_blk;
 	struct xlog		*log = mp->m_log;
+	bool			replayed = false;
 
 	xlog_init(mp, mp->m_log);
 
@@ -61,6 +167,9 @@ zero_log(
 				do_warn(_(
 "ALERT: The filesystem has valuable metadata changes in a log which is being\n"
 "destroyed because the -L option was used.\n"));
+			} else if (!no_modify && replay_log) {
+				replay_log_records(mp, head_blk, tail_blk);
+				replayed = true;
 			} else if (no_modify) {
 				do_warn(_(
 "ALERT: The filesystem has valuable metadata changes in a log which is being\n"
@@ -70,8 +179,9 @@ zero_log(
 				do_warn(_(
 "ERROR: The filesystem has valuable metadata changes in a log which needs to\n"
 "be replayed.  Mount the filesystem to replay the log, and unmount it before\n"
-"re-running xfs_repair.  If you are unable to mount the filesystem, then use\n"
-"the -L option to destroy the log and attempt a repair.\n"
+"re-running xfs_repair, or use the -o replay_log option to replay it without\n"
+"mounting.  If the log cannot be replayed, then use the -L option to destroy\n"
+"the log and attempt a repair.\n"
 "Note that destroying the log may cause corruption -- please attempt a mount\n"
 "of the filesystem before doing this.\n"));
 				exit(2);
@@ -85,7 +195,7 @@ zero_log(
 	 * the filesystem and creates more work for repair of v5 superblock
 	 * filesystems.
 	 */
-	if (!no_modify && zap_log) {
+	if (!no_modify && (zap_log || replayed)) {
 		libxfs_log_clear(log->l_dev, NULL,
 			XFS_FSB_TO_DADDR(mp, mp->m_sb.sb_logstart),
 			(xfs_extlen_t)XFS_FSB_TO_BB(mp, mp->m_sb.sb_logblocks),
@@ -99,6 +209,9 @@ zero_log(
 			do_error(_("failed to clear log"));
 	}
 
+	if (replayed)
+		reload_replayed_sb(mp);
+
 	/* And we are now magically complete! */
 	PROG_RPT_INC(prog_rpt_done[0], mp->m_sb.sb_logblocks);
 
@@ -17,6 +17,7 @@
 #include "progress.h"
 #include "bmap.h"
 #include "threads.h"
+#include "perfreport.h"
 
 static void
 process_agi_unlinked(
@@ -62,6 +63,10 @@ process_ag_func(
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
+	struct perf_span	ps;
+
+	perf_span_begin(&ps, N_("process inodes"), agno);
+
 	/*
 	 * turn on directory processing (inode discovery) and
 	 * attribute processing (extra_attr_check)
@@ -71,6 +76,7 @@ process_ag_func(
 	process_aginodes(wq->wq_ctx, arg, agno, 1, 0, 1);
 	blkmap_free_final();
 	cleanup_inode_prefetch(arg);
+	perf_span_end(&ps);
 }
 
 static void
@@ -87,8 +93,11 @@ do_uncertain_aginodes(
 	void			*arg)
 {
 	int			*count = arg;
+	struct perf_span	ps;
 
+	perf_span_begin(&ps, N_("check uncertain inodes"), agno);
 	*count = process_uncertain_aginodes(wq->wq_ctx, agno);
+	perf_span_end(&ps);
 
 #ifdef XR_INODE_TRACE
 	fprintf(stderr,
@@ -20,6 +20,7 @@
 #include "progress.h"
 #include "slab.h"
 #include "rmap.h"
+#include "perfreport.h"
 
 bool collect_rmaps;
 
@@ -126,6 +127,9 @@ process_ag_func(
 	xfs_agnumber_t 		agno,
 	void			*arg)
 {
+	struct perf_span	ps;
+
+	perf_span_begin(&ps, N_("check for duplicate blocks"), agno);
 	wait_for_inode_prefetch(arg);
 	do_log(_("        - agno = %d\n"), agno);
 	process_aginodes(wq->wq_ctx, arg, agno, 0, 1, 0);
@@ -136,6 +140,7 @@ process_ag_func(
 	 * now recycle the per-AG duplicate extent records
 	 */
 	release_dup_extent_tree(agno);
+	perf_span_end(&ps);
 }
 
 static void
@@ -151,8 +156,12 @@ check_rmap_btrees(
 	xfs_agnumber_t	agno,
 	void		*arg)
 {
+	struct perf_span ps;
+
+	perf_span_begin(&ps, N_("check rmap btree"), agno);
 	rmap_add_fixed_ag_rec(wq->wq_ctx, agno);
 	rmaps_verify_btree(wq->wq_ctx, agno);
+	perf_span_end(&ps);
 }
 
 static void
@@ -162,12 +171,15 @@ compute_ag_refcounts(
 	void		*arg)
 {
 	int		error;
+	struct perf_span ps;
 
+	perf_span_begin(&ps, N_("compute reference counts"), agno);
 	error = compute_refcounts(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while computing reference count records.\n"),
 			 strerror(error));
+	perf_span_end(&ps);
 }
 
 static void
@@ -177,12 +189,15 @@ process_inode_reflink_flags(
 	void			*arg)
 {
 	int			error;
+	struct perf_span	ps;
 
+	perf_span_begin(&ps, N_("fix reflink flags"), agno);
 	error = fix_inode_reflink_flags(wq->wq_ctx, agno);
 	if (error)
 		do_error(
 _("%s while fixing inode reflink flags.\n"),
 			 strerror(-error));
+	perf_span_end(&ps);
 }
 
 static void
@@ -191,7 +206,11 @@ check_refcount_btrees(
 	xfs_agnumber_t		agno,
 	void			*arg)
 {
+	struct perf_span	ps;
+
+	perf_span_begin(&ps, N_("check refcount btree"), agno);
 	check_refcounts(wq->wq_ctx, agno);
+	perf_span_end(&ps);
 }
 
 static void
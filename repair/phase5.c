@@ -21,6 +21,7 @@
 #include "rmap.h"
 #include "bulkload.h"
 #include "agbtree.h"
+#include "perfreport.h"
 
 static uint64_t	*sb_icount_ag;		/* allocated inodes per ag */
 static uint64_t	*sb_ifree_ag;		/* free inodes per ag */
@@ -679,8 +680,14 @@ phase5(xfs_mount_t *mp)
 	if (error)
 		do_error(_("cannot alloc lost block bitmap\n"));
 
-	for_each_perag(mp, agno, pag)
+	for_each_perag(mp, agno, pag) {
+		struct perf_span	ps;
+
+		perf_span_begin(&ps, N_("rebuild AG headers and btrees"),
+				agno);
 		phase5_func(mp, pag, lost_blocks);
+		perf_span_end(&ps);
+	}
 
 	print_final_rpt();
 
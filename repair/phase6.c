@@ -19,6 +19,7 @@
 #include "progress.h"
 #include "versions.h"
 #include "repair/pptr.h"
+#include "perfreport.h"
 
 static xfs_ino_t		orphanage_ino;
 
@@ -3186,7 +3187,9 @@ traverse_function(
 	prefetch_args_t		*pf_args = arg;
 	struct workqueue	lwq;
 	struct xfs_mount	*mp = wq->wq_ctx;
+	struct perf_span	ps;
 
+	perf_span_begin(&ps, N_("traverse directories"), agno);
 	wait_for_inode_prefetch(pf_args);
 
 	if (verbose)
@@ -3221,6 +3224,7 @@ traverse_function(
 	}
 	destroy_work_queue(&lwq);
 	cleanup_inode_prefetch(pf_args);
+	perf_span_end(&ps);
 }
 
 static void
@@ -16,6 +16,7 @@
 #include "progress.h"
 #include "threads.h"
 #include "quotacheck.h"
+#include "perfreport.h"
 
 static void
 update_inode_nlinks(
@@ -95,7 +96,9 @@ do_link_updates(
 	ino_tree_node_t		*irec;
 	int			j;
 	uint32_t		nrefs;
+	struct perf_span	ps;
 
+	perf_span_begin(&ps, N_("update link counts"), agno);
 	for (irec = findfirst_inode_rec(agno); irec;
 	     irec = next_ino_rec(irec)) {
 		xfs_ino_t	ino;
@@ -115,11 +118,12 @@ do_link_updates(
 
 			if (get_inode_disk_nlinks(irec, j) != nrefs)
 				update_inode_nlinks(wq->wq_ctx, ino + j, nrefs);
-			quotacheck_adjust(mp, ino + j);
+			quotacheck_adjust(mp, agno, ino + j);
 		}
 	}
 
 	PROG_RPT_INC(prog_rpt_done[agno], 1);
+	perf_span_end(&ps);
 }
 
 void
@@ -16,6 +16,7 @@
 #include "repair/incore.h"
 #include "repair/pptr.h"
 #include "repair/strblobs.h"
+#include "repair/perfreport.h"
 
 #undef PPTR_DEBUG
 
@@ -1255,9 +1256,11 @@ check_ag_parent_ptrs(
 	};
 	struct ag_pptrs		*ag_pptrs = &fs_pptrs[agno];
 	struct ino_tree_node	*irec;
+	struct perf_span	ps;
 	char			*descr;
 	int			error;
 
+	perf_span_begin(&ps, N_("check parent pointers"), agno);
 	qsort_slab(ag_pptrs->pptr_recs, cmp_ag_pptr);
 
 	error = -init_slab_cursor(ag_pptrs->pptr_recs, cmp_ag_pptr,
@@ -1314,6 +1317,7 @@ check_ag_parent_ptrs(
 
 	xfblob_destroy(fscan.file_pptr_names);
 	free_slab_cursor(&fscan.ag_pptr_recs_cur);
+	perf_span_end(&ps);
 }
 
 /* Check all the parent pointers of all files in this filesystem. */
@@ -16,6 +16,7 @@
 #include "threads.h"
 #include "prefetch.h"
 #include "progress.h"
+#include "perfreport.h"
 
 int do_prefetch = 1;
 
@@ -482,6 +483,7 @@ pf_batch_read(
 	unsigned long		fsbno = 0;
 	unsigned long		max_fsbno;
 	char			*pbuf;
+	struct timespec		start;
 
 	for (;;) {
 		num = 0;
@@ -575,7 +577,9 @@ pf_batch_read(
 		/*
 		 * now read the data and put into the xfs_but_t's
 		 */
+		libxfs_buf_stats_io_start(&start);
 		len = pread(mp_fd, buf, (int)(last_off - first_off), first_off);
+		libxfs_buf_stats_io(NULL, XFS_BSTAT_READ, max(len, 0), &start);
 
 		/*
 		 * Check the last buffer on the list to see if we need to
@@ -725,6 +729,7 @@ pf_queuing_worker(
 	int			i;
 	int			err;
 	uint64_t		sparse;
+	uint64_t		start;
 	struct xfs_ino_geometry	*igeo = M_IGEO(mp);
 	unsigned long long	cluster_mask;
 
@@ -785,7 +790,9 @@ pf_queuing_worker(
 			 */
 			pf_start_io_workers(args);
 			pf_start_processing(args);
+			start = perf_wait_begin();
 			sem_wait(&args->ra_count);
+			perf_wait_end(PERF_PF_THROTTLE, args->agno, start);
 		}
 
 		num_inos = 0;
@@ -1085,6 +1092,8 @@ void
 wait_for_inode_prefetch(
 	prefetch_args_t		*args)
 {
+	uint64_t		start = 0;
+
 	if (args == NULL)
 		return;
 
@@ -1093,11 +1102,14 @@ wait_for_inode_prefetch(
 	while (!args->can_start_processing) {
 		pftrace("waiting to start processing AG %d", args->agno);
 
+		if (!start)
+			start = perf_wait_begin();
 		pthread_cond_wait(&args->start_processing, &args->lock);
 	}
 	pftrace("can start processing AG %d", args->agno);
 
 	pthread_mutex_unlock(&args->lock);
+	perf_wait_end(PERF_PF_STALL, args->agno, start);
 }
 
 void
@@ -4,6 +4,7 @@
 #include "globals.h"
 #include "progress.h"
 #include "err_protos.h"
+#include "perfreport.h"
 #include <signal.h>
 
 #define ONEMINUTE  60
@@ -411,6 +412,7 @@ timestamp(
 			phase_times[phase+1].start = now;
 			current_phase = phase + 1;
 		}
+		perf_phase_end(phase);
 	}
 	else {
 		phase_times[phase].start = now;
@@ -30,6 +30,7 @@ char	*alloc_ag_buf(int size);
 
 void	print_inode_list(xfs_agnumber_t i);
 char	*err_string(int err_code);
+void	set_needsrepair_now(struct xfs_mount *mp);
 
 void	thread_init(void);
 
@@ -7,7 +7,7 @@
 #include "globals.h"
 #include "versions.h"
 #include "err_protos.h"
-#include "libfrog/avl64.h"
+#include "libfrog/qcount.h"
 #include "quotacheck.h"
 
 /* Allow the xfs_repair caller to skip quotacheck entirely. */
@@ -34,20 +34,18 @@ quotacheck_results(void)
 	return chkd_flags;
 }
 
-/* Global incore dquot tree */
+/*
+ * Incore usage counts.  Phase 7 walks each AG in exactly one work item, so
+ * each AG gets its own partial table that is updated without locking.  The
+ * partial tables are merged when the dquots are checked.
+ */
 struct qc_dquots {
-	pthread_mutex_t		lock;
-	struct avl64tree_desc	tree;
+	struct qcount		counts;
 
 	/* One of XFS_DQTYPE_USER/PROJ/GROUP */
 	xfs_dqtype_t		type;
 };
 
-#define qc_dquots_foreach(dquots, pos, n) \
-	for (pos = (dquots)->tree.avl_firstino, n = pos ? pos->avl_nextino : NULL; \
-			pos != NULL; \
-			pos = n, n = pos ? pos->avl_nextino : NULL)
-
 static struct qc_dquots *user_dquots;
 static struct qc_dquots *group_dquots;
 static struct qc_dquots *proj_dquots;
@@ -55,17 +53,6 @@ static struct qc_dquots *proj_dquots;
 /* This record was found in the on-disk dquot information. */
 #define QC_REC_ONDISK		(1U << 31)
 
-struct qc_rec {
-	struct avl64node	node;
-	pthread_mutex_t		lock;
-
-	xfs_dqid_t		id;
-	uint32_t		flags;
-	uint64_t		bcount;
-	uint64_t		rtbcount;
-	uint64_t		icount;
-};
-
 static const char *
 qflags_typestr(
 	xfs_dqtype_t		type)
@@ -79,79 +66,19 @@ qflags_typestr(
 	return NULL;
 }
 
-/* Operations for the avl64 tree. */
-
-static uint64_t
-qc_avl_start(
-	struct avl64node	*node)
-{
-	struct qc_rec		*qrec;
-
-	qrec = container_of(node, struct qc_rec, node);
-	return qrec->id;
-}
-
-static uint64_t
-qc_avl_end(
-	struct avl64node	*node)
-{
-	return qc_avl_start(node) + 1;
-}
-
-static struct avl64ops qc_cache_ops = {
-	.avl_start		= qc_avl_start,
-	.avl_end		= qc_avl_end,
-};
-
-/* Find a qc_rec in the incore cache, or allocate one if need be. */
-static struct qc_rec *
-qc_rec_get(
-	struct qc_dquots	*dquots,
-	xfs_dqid_t		id,
-	bool			can_alloc)
-{
-	struct qc_rec		*qrec;
-	struct avl64node	*node;
-
-	pthread_mutex_lock(&dquots->lock);
-	node = avl64_find(&dquots->tree, id);
-	if (!node && can_alloc) {
-		qrec = calloc(sizeof(struct qc_rec), 1);
-		if (qrec) {
-			qrec->id = id;
-			node = avl64_insert(&dquots->tree, &qrec->node);
-			if (!node)
-				free(qrec);
-			else
-				pthread_mutex_init(&qrec->lock, NULL);
-		}
-	}
-	pthread_mutex_unlock(&dquots->lock);
-
-	return node ? container_of(node, struct qc_rec, node) : NULL;
-}
-
 /* Bump up an incore dquot's counters. */
 static void
 qc_adjust(
 	struct qc_dquots	*dquots,
+	xfs_agnumber_t		agno,
 	xfs_dqid_t		id,
 	uint64_t		bcount,
 	uint64_t		rtbcount)
 {
-	struct qc_rec		*qrec = qc_rec_get(dquots, id, true);
-
-	if (!qrec) {
+	if (qcount_add(&dquots->counts, agno, id, bcount, rtbcount)) {
 		do_warn(_("Ran out of memory while running quotacheck!\n"));
 		chkd_flags = 0;
-		return;
 	}
-
-	pthread_mutex_lock(&qrec->lock);
-	qrec->bcount += bcount;
-	qrec->rtbcount += rtbcount;
-	qrec->icount++;
-	pthread_mutex_unlock(&qrec->lock);
 }
 
 /* Count the realtime blocks allocated to a file. */
@@ -184,6 +111,7 @@ _("could not read ino %"PRIu64" extents, err=%d\n"),
 void
 quotacheck_adjust(
 	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
 	xfs_ino_t		ino)
 {
 	struct xfs_inode	*ip;
@@ -223,11 +151,13 @@ quotacheck_adjust(
 	blocks = ip->i_nblocks - rtblks;
 
 	if (user_dquots)
-		qc_adjust(user_dquots, i_uid_read(VFS_I(ip)), blocks, rtblks);
+		qc_adjust(user_dquots, agno, i_uid_read(VFS_I(ip)), blocks,
+				rtblks);
 	if (group_dquots)
-		qc_adjust(group_dquots, i_gid_read(VFS_I(ip)), blocks, rtblks);
+		qc_adjust(group_dquots, agno, i_gid_read(VFS_I(ip)), blocks,
+				rtblks);
 	if (proj_dquots)
-		qc_adjust(proj_dquots, ip->i_projid, blocks, rtblks);
+		qc_adjust(proj_dquots, agno, ip->i_projid, blocks, rtblks);
 
 	libxfs_irele(ip);
 }
@@ -275,15 +205,15 @@ qc_check_dquot(
 	struct qc_dquots	*dquots,
 	xfs_dqid_t		dqid)
 {
-	struct qc_rec		*qrec;
-	struct qc_rec		empty = {
+	struct qcount_rec	*qrec;
+	struct qcount_rec	empty = {
 		.bcount		= 0,
 		.rtbcount	= 0,
 		.icount		= 0,
 	};
 	xfs_dqid_t		id = be32_to_cpu(ddq->d_id);
 
-	qrec = qc_rec_get(dquots, id, false);
+	qrec = qcount_lookup(&dquots->counts, id);
 	if (!qrec)
 		qrec = &empty;
 
@@ -335,10 +265,7 @@ qc_check_dquot(
 		chkd_flags = 0;
 	}
 
-	/*
-	 * Mark that we found the record on disk.  Skip locking here because
-	 * we're checking the dquots serially.
-	 */
+	/* Mark that we found the record on disk. */
 	qrec->flags |= QC_REC_ONDISK;
 }
 
@@ -402,7 +329,7 @@ quotacheck_verify(
 	struct xfs_inode	*ip;
 	struct xfs_ifork	*ifp;
 	struct qc_dquots	*dquots = NULL;
-	struct avl64node	*node, *n;
+	uint64_t		i;
 	xfs_ino_t		ino = NULLFSINO;
 	int			error;
 
@@ -429,6 +356,13 @@ quotacheck_verify(
 	if (!dquots || !chkd_flags)
 		return;
 
+	/* All the scanner threads are done, so fold the partial counts. */
+	if (qcount_merge(&dquots->counts)) {
+		do_warn(_("Ran out of memory while running quotacheck!\n"));
+		chkd_flags = 0;
+		return;
+	}
+
 	error = -libxfs_iget(mp, NULL, ino, 0, &ip);
 	if (error) {
 		do_warn(
@@ -463,10 +397,9 @@ quotacheck_verify(
 	 * incore dquots that weren't touched during the comparison, because
 	 * that means something is missing from the dquot file.
 	 */
-	qc_dquots_foreach(dquots, node, n) {
-		struct qc_rec	*qrec;
+	for (i = 0; i < dquots->counts.nr_recs; i++) {
+		struct qcount_rec	*qrec = &dquots->counts.recs[i];
 
-		qrec = container_of(node, struct qc_rec, node);
 		if (!(qrec->flags & QC_REC_ONDISK)) {
 			do_warn(
 _("%s record for id %u not found on disk (bcount %"PRIu64" rtbcount %"PRIu64" icount %"PRIu64")\n"),
@@ -525,6 +458,7 @@ qc_has_quotafile(
 /* Initialize an incore dquot tree. */
 static struct qc_dquots *
 qc_dquots_init(
+	struct xfs_mount	*mp,
 	xfs_dqtype_t		type)
 {
 	struct qc_dquots	*dquots;
@@ -534,8 +468,10 @@ qc_dquots_init(
 		return NULL;
 
 	dquots->type = type;
-	pthread_mutex_init(&dquots->lock, NULL);
-	avl64_init_tree(&dquots->tree, &qc_cache_ops);
+	if (qcount_init(&dquots->counts, mp->m_sb.sb_agcount)) {
+		free(dquots);
+		return NULL;
+	}
 	return dquots;
 }
 
@@ -554,21 +490,21 @@ quotacheck_setup(
 		return 0;
 
 	if (qc_has_quotafile(mp, XFS_DQTYPE_USER)) {
-		user_dquots = qc_dquots_init(XFS_DQTYPE_USER);
+		user_dquots = qc_dquots_init(mp, XFS_DQTYPE_USER);
 		if (!user_dquots)
 			goto err;
 		chkd_flags |= XFS_UQUOTA_CHKD;
 	}
 
 	if (qc_has_quotafile(mp, XFS_DQTYPE_GROUP)) {
-		group_dquots = qc_dquots_init(XFS_DQTYPE_GROUP);
+		group_dquots = qc_dquots_init(mp, XFS_DQTYPE_GROUP);
 		if (!group_dquots)
 			goto err;
 		chkd_flags |= XFS_GQUOTA_CHKD;
 	}
 
 	if (qc_has_quotafile(mp, XFS_DQTYPE_PROJ)) {
-		proj_dquots = qc_dquots_init(XFS_DQTYPE_PROJ);
+		proj_dquots = qc_dquots_init(mp, XFS_DQTYPE_PROJ);
 		if (!proj_dquots)
 			goto err;
 		chkd_flags |= XFS_PQUOTA_CHKD;
@@ -587,17 +523,11 @@ qc_purge(
 	struct qc_dquots	**dquotsp)
 {
 	struct qc_dquots	*dquots = *dquotsp;
-	struct qc_rec		*qrec;
-	struct avl64node	*node;
-	struct avl64node	*n;
 
 	if (!dquots)
 		return;
 
-	qc_dquots_foreach(dquots, node, n) {
-		qrec = container_of(node, struct qc_rec, node);
-		free(qrec);
-	}
+	qcount_free(&dquots->counts);
 	free(dquots);
 	*dquotsp = NULL;
 }
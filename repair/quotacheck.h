@@ -7,7 +7,8 @@
 #define __XFS_REPAIR_QUOTACHECK_H__
 
 void quotacheck_skip(void);
-void quotacheck_adjust(struct xfs_mount *mp, xfs_ino_t ino);
+void quotacheck_adjust(struct xfs_mount *mp, xfs_agnumber_t agno,
+		xfs_ino_t ino);
 void quotacheck_verify(struct xfs_mount *mp, xfs_dqtype_t type);
 uint16_t quotacheck_results(void);
 int quotacheck_setup(struct xfs_mount *mp);
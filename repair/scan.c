@@ -19,6 +19,7 @@
 #include "threads.h"
 #include "slab.h"
 #include "rmap.h"
+#include "perfreport.h"
 
 static xfs_mount_t	*mp = NULL;
 
@@ -336,7 +337,7 @@ _("bad back (left) sibling pointer (saw %llu should be NULL (0))\n"
 		agno = XFS_FSB_TO_AGNO(mp, bno);
 		agbno = XFS_FSB_TO_AGBNO(mp, bno);
 
-		pthread_mutex_lock(&ag_locks[agno].lock);
+		perf_mutex_lock(&ag_locks[agno].lock);
 		state = get_bmap(agno, agbno);
 		switch (state) {
 		case XR_E_INUSE1:
@@ -402,7 +403,7 @@ _("bad state %d, inode %" PRIu64 " bmap block 0x%" PRIx64 "\n"),
 	/* Record BMBT blocks in the reverse-mapping data. */
 	if (check_dups && collect_rmaps) {
 		agno = XFS_FSB_TO_AGNO(mp, bno);
-		pthread_mutex_lock(&ag_locks[agno].lock);
+		perf_mutex_lock(&ag_locks[agno].lock);
 		rmap_add_bmbt_rec(mp, ino, whichfork, bno);
 		pthread_mutex_unlock(&ag_locks[agno].lock);
 	}
@@ -2578,7 +2579,9 @@ scan_ag(
 	int		status;
 	char		*objname = NULL;
 	int		error;
+	struct perf_span ps;
 
+	perf_span_begin(&ps, N_("scan AG headers and btrees"), agno);
 	sb = (struct xfs_sb *)calloc(BBTOB(XFS_FSS_TO_BB(mp, 1)), 1);
 	if (!sb) {
 		do_error(_("can't allocate memory for superblock\n"));
@@ -2709,6 +2712,7 @@ scan_ag(
 		libxfs_buf_relse(sbbuf);
 	free(sb);
 	PROG_RPT_INC(prog_rpt_done[agno], 1);
+	perf_span_end(&ps);
 
 #ifdef XR_INODE_TRACE
 	print_inode_list(i);
@@ -27,6 +27,7 @@
 #include "bulkload.h"
 #include "quotacheck.h"
 #include "rcbag_btree.h"
+#include "perfreport.h"
 
 /*
  * option tables for getsubopt calls
@@ -45,6 +46,11 @@ enum o_opt_nums {
 	BLOAD_LEAF_SLACK,
 	BLOAD_NODE_SLACK,
 	NOQUOTA,
+	REPLAY_LOG,
+	BUF_STATS,
+	BUF_STATS_INTERVAL,
+	PERF_REPORT,
+	PERF_TIMELINE,
 	O_MAX_OPTS,
 };
 
@@ -58,6 +64,11 @@ static char *o_opts[] = {
 	[BLOAD_LEAF_SLACK]	= "debug_bload_leaf_slack",
 	[BLOAD_NODE_SLACK]	= "debug_bload_node_slack",
 	[NOQUOTA]		= "noquota",
+	[REPLAY_LOG]		= "replay_log",
+	[BUF_STATS]		= "stats",
+	[BUF_STATS_INTERVAL]	= "stats_interval",
+	[PERF_REPORT]		= "perf_report",
+	[PERF_TIMELINE]		= "timeline",
 	[O_MAX_OPTS]		= NULL,
 };
 
@@ -87,6 +98,10 @@ static int	bhash_option_used;
 static long	max_mem_specified;	/* in megabytes */
 static int	phase2_threads = 32;
 static bool	report_corrected;
+static bool	buf_stats;		/* print buffer cache stats at exit */
+static unsigned int buf_stats_interval;	/* emit them as JSON this often */
+static bool	perf_report;		/* print where the time went */
+static char	*perf_timeline;		/* write a trace of it here */
 
 static void
 usage(void)
@@ -114,6 +129,21 @@ usage(void)
 	exit(1);
 }
 
+/*
+ * Print the performance report and buffer cache statistics if asked, and stop
+ * collecting them.
+ */
+static void
+buf_stats_done(void)
+{
+	perf_done();
+	if (!buf_stats && !buf_stats_interval && !perf_report && !perf_timeline)
+		return;
+	libxfs_buf_stats_disable();
+	if (buf_stats)
+		libxfs_buf_stats_report(stdout);
+}
+
 char *
 err_string(int err_code)
 {
@@ -209,6 +239,7 @@ process_args(int argc, char **argv)
 	dangerously = 0;
 	isa_file = 0;
 	zap_log = 0;
+	replay_log = 0;
 	dumpcore = 0;
 	full_ino_ex_data = 0;
 	force_geo = 0;
@@ -312,6 +343,39 @@ process_args(int argc, char **argv)
 				case NOQUOTA:
 					quotacheck_skip();
 					break;
+				case REPLAY_LOG:
+					if (val)
+						noval('o', o_opts, REPLAY_LOG);
+					replay_log = 1;
+					break;
+				case BUF_STATS:
+					if (val)
+						noval('o', o_opts, BUF_STATS);
+					buf_stats = true;
+					break;
+				case BUF_STATS_INTERVAL:
+					if (!val)
+						do_abort(
+		_("-o stats_interval requires a parameter\n"));
+					errno = 0;
+					buf_stats_interval = strtoul(val, NULL, 0);
+					if (errno || !buf_stats_interval)
+						do_abort(
+		_("-o stats_interval invalid parameter: %s\n"), val);
+					break;
+				case PERF_REPORT:
+					if (val)
+						noval('o', o_opts, PERF_REPORT);
+					perf_report = true;
+					break;
+				case PERF_TIMELINE:
+					if (!val)
+						do_abort(
+		_("-o timeline requires a parameter\n"));
+					if (perf_timeline)
+						respec('o', o_opts, PERF_TIMELINE);
+					perf_timeline = val;
+					break;
 				default:
 					unknown('o', val);
 					break;
@@ -440,6 +504,9 @@ process_args(int argc, char **argv)
 	if (report_corrected && no_modify)
 		usage();
 
+	if (replay_log && zap_log)
+		do_abort(_("-o replay_log cannot be used with -L\n"));
+
 	p = getenv("XFS_REPAIR_FAIL_AFTER_PHASE");
 	if (p) {
 		errno = 0;
@@ -997,6 +1064,22 @@ unlock:
 	pthread_mutex_unlock(&wb_mutex);
 }
 
+/*
+ * Set NEEDSREPAIR before the first metadata write.  Log replay rewrites the
+ * primary super behind the incore copy's back, so it cannot wait for the
+ * writeback hook to write the incore copy out in the middle of the replay.
+ */
+void
+set_needsrepair_now(
+	struct xfs_mount	*mp)
+{
+	if (mp->m_buf_writeback_fn != repair_capture_writeback)
+		return;
+
+	force_needsrepair(mp);
+	mp->m_buf_writeback_fn = NULL;
+}
+
 static inline void
 phase_end(
 	struct xfs_mount	*mp,
@@ -1048,6 +1131,14 @@ main(int argc, char **argv)
 	setbuf(stdout, NULL);
 
 	process_args(argc, argv);
+	if (buf_stats || buf_stats_interval || perf_report || perf_timeline) {
+		error = libxfs_buf_stats_enable(buf_stats_interval, stderr);
+		if (error)
+			do_error(_("cannot start buffer cache statistics: %s\n"),
+					strerror(error));
+	}
+	if (perf_report || perf_timeline)
+		perf_init(perf_report, perf_timeline);
 	xfs_init(&x);
 
 	msgbuf = malloc(DURATION_BUF_SIZE);
@@ -1412,6 +1503,7 @@ _("Warning:  project quota information would be cleared.\n"
 	_("No modify flag set, skipping filesystem flush and exiting.\n"));
 		if (verbose)
 			summary_report();
+		buf_stats_done();
 		if (fs_is_dirty)
 			return(1);
 
@@ -1480,6 +1572,7 @@ _("Note - stripe unit (%d) and width (%d) were copied from a backup superblock.\
 
 	if (verbose)
 		summary_report();
+	buf_stats_done();
 	do_log(_("done\n"));
 
 	if (dangerously && !no_modify)
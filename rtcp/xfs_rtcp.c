@@ -5,38 +5,138 @@
  */
 
 #include "libxfs.h"
+#include <sys/syscall.h>
 #include "libfrog/fsgeom.h"
+#include "libfrog/convert.h"
+#include "libfrog/workqueue.h"
 
 int rtcp(char *, char *, int);
 int xfsrtextsize(char *path);
 
 static int pflag;
+static int cflag;
+static long long iosize;
 char *progname;
 
+/* default copy size, and how many copy buffers may be in flight per file */
+#define RTCP_IOSIZE	(1024 * 1024)
+#define RTCP_NR_BUFS	4
+
+struct rtcp_job {
+	char		*source;
+	char		*target;
+	int		extsize;
+	int		ret;
+};
+
 static void
 usage(void)
 {
-	fprintf(stderr, _("%s [-e extsize] [-p] [-V] source target\n"), progname);
+	fprintf(stderr,
+_("%s [-b iosize] [-c] [-e extsize] [-j jobs] [-p] [-V] source target\n"),
+		progname);
 	exit(2);
 }
 
+static void
+rtcp_worker(
+	struct workqueue	*wq,
+	uint32_t		index,
+	void			*arg)
+{
+	struct rtcp_job		*job = arg;
+
+	job->ret = rtcp(job->source, job->target, job->extsize);
+}
+
+/*
+ * Copy the files on a workqueue, @jobs at a time.
+ */
+static int
+rtcp_parallel(
+	char			**sources,
+	int			nr,
+	char			*target,
+	int			extsize,
+	unsigned int		jobs)
+{
+	struct workqueue	wq;
+	struct rtcp_job		*job;
+	int			i, r = 0;
+	int			error;
+
+	job = calloc(nr, sizeof(struct rtcp_job));
+	if (!job) {
+		perror("rtcp_job");
+		return -1;
+	}
+
+	error = -workqueue_create(&wq, NULL, min(jobs, nr));
+	if (error) {
+		fprintf(stderr, _("%s: could not create workqueue: %s\n"),
+			progname, strerror(error));
+		free(job);
+		return -1;
+	}
+	for (i = 0; i < nr; i++) {
+		job[i].source = sources[i];
+		job[i].target = target;
+		job[i].extsize = extsize;
+		if (workqueue_add(&wq, rtcp_worker, i, &job[i]))
+			rtcp_worker(&wq, i, &job[i]);
+	}
+	error = -workqueue_terminate(&wq);
+	workqueue_destroy(&wq);
+	if (error) {
+		fprintf(stderr, _("%s: workqueue failed: %s\n"),
+			progname, strerror(error));
+		r = -1;
+	}
+
+	for (i = 0; i < nr; i++)
+		r += job[i].ret;
+	free(job);
+	return r;
+}
+
 int
 main(int argc, char **argv)
 {
 	int	c, i, r, errflg = 0;
 	struct stat	s2;
 	int		extsize = - 1;
+	unsigned int	jobs = 1;
+	char		*sp;
 
 	progname = basename(argv[0]);
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
 	textdomain(PACKAGE);
 
-	while ((c = getopt(argc, argv, "pe:V")) != EOF) {
+	while ((c = getopt(argc, argv, "b:ce:j:pV")) != EOF) {
 		switch (c) {
+		case 'b':
+			iosize = cvtnum(0, 0, optarg);
+			if (iosize <= 0 || iosize > INT_MAX) {
+				fprintf(stderr, _("%s: bad I/O size %s\n"),
+					progname, optarg);
+				errflg++;
+			}
+			break;
+		case 'c':
+			cflag = 1;
+			break;
 		case 'e':
 			extsize = atoi(optarg);
 			break;
+		case 'j':
+			jobs = cvt_u32(optarg, 10);
+			if (errno || jobs == 0) {
+				fprintf(stderr, _("%s: bad job count %s\n"),
+					progname, optarg);
+				errflg++;
+			}
+			break;
 		case 'p':
 			pflag = 1;
 			break;
@@ -83,13 +183,24 @@ main(int argc, char **argv)
 		}
 	}
 
+	/*
+	 * Strip the trailing slashes from the target now, so that
+	 * parallel invocations of rtcp() don't all do it at once.
+	 */
+	sp = argv[argc-1] + strlen(argv[argc-1]);
+	while (*--sp == '/' && sp > argv[argc-1])
+		*sp = '\0';
+
 	/*
 	 * Perform a multiple argument rtcp by
 	 * multiple invocations of rtcp().
 	 */
 	r = 0;
-	for (i = 0; i < argc-1; i++)
-		r += rtcp(argv[i], argv[argc-1], extsize);
+	if (jobs > 1 && argc > 2)
+		r = rtcp_parallel(argv, argc-1, argv[argc-1], extsize, jobs);
+	else
+		for (i = 0; i < argc-1; i++)
+			r += rtcp(argv[i], argv[argc-1], extsize);
 
 	/*
 	 * Show errors by nonzero exit code.
@@ -97,14 +208,215 @@ main(int argc, char **argv)
 	exit(r?2:0);
 }
 
+/*
+ * Preallocate the target in whole extents, so that the copy doesn't have
+ * to allocate realtime extents as it goes.  If this fails, the writes will
+ * tell us soon enough.
+ */
+static void
+rtcp_prealloc(
+	int		tofd,
+	off_t		len,
+	int		extsize)
+{
+	if (extsize > 0)
+		len = roundup(len, extsize);
+	if (len > 0)
+		fallocate(tofd, FALLOC_FL_KEEP_SIZE, 0, len);
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+/*
+ * Let the kernel copy the file if both ends are on the same filesystem.
+ * Returns zero if the whole file was copied.
+ */
+static int
+rtcp_copy_range(
+	int		fromfd,
+	int		tofd,
+	off_t		len)
+{
+	loff_t		src_off = 0;
+	loff_t		dst_off = 0;
+	loff_t		ret;
+
+	while (src_off < len) {
+		ret = syscall(__NR_copy_file_range, fromfd, &src_off, tofd,
+				&dst_off, len - src_off, 0);
+		if (ret < 0)
+			return errno;
+		if (ret == 0)
+			return EIO;
+	}
+	return 0;
+}
+#else
+# define rtcp_copy_range(fromfd, tofd, len)	(EOPNOTSUPP)
+#endif
+
+/*
+ * The copy is a pipeline: the caller reads into a ring of buffers while a
+ * writer thread writes out the ones that have been filled, so that reads
+ * and writes overlap.
+ */
+struct rtcp_buf {
+	char		*data;
+	ssize_t		len;
+	off_t		pos;
+};
+
+struct rtcp_pipe {
+	pthread_mutex_t	lock;
+	pthread_cond_t	filled;
+	pthread_cond_t	drained;
+	struct rtcp_buf	bufs[RTCP_NR_BUFS];
+	unsigned int	head;		/* next buffer to read into */
+	unsigned int	tail;		/* next buffer to write out */
+	unsigned int	nr_filled;
+	bool		done;		/* no more reads coming */
+	int		tofd;
+	int		error;		/* write error */
+};
+
+static void *
+rtcp_writer(
+	void		*arg)
+{
+	struct rtcp_pipe *rp = arg;
+	struct rtcp_buf	*b;
+	ssize_t		ret;
+
+	pthread_mutex_lock(&rp->lock);
+	while (true) {
+		while (!rp->nr_filled && !rp->done)
+			pthread_cond_wait(&rp->filled, &rp->lock);
+		if (!rp->nr_filled)
+			break;
+		b = &rp->bufs[rp->tail];
+		pthread_mutex_unlock(&rp->lock);
+
+		ret = pwrite(rp->tofd, b->data, b->len, b->pos);
+
+		pthread_mutex_lock(&rp->lock);
+		if (ret != b->len) {
+			rp->error = ret < 0 ? errno : EIO;
+			pthread_cond_signal(&rp->drained);
+			break;
+		}
+		rp->tail = (rp->tail + 1) % RTCP_NR_BUFS;
+		rp->nr_filled--;
+		pthread_cond_signal(&rp->drained);
+	}
+	pthread_mutex_unlock(&rp->lock);
+	return NULL;
+}
+
+static int
+rtcp_copy_data(
+	int		fromfd,
+	int		tofd,
+	struct dioattr	*dioattr)
+{
+	struct rtcp_pipe rp = { .tofd = tofd };
+	struct rtcp_buf	*b;
+	pthread_t	writer;
+	ssize_t		readct;
+	ssize_t		iosz;
+	off_t		pos = 0;
+	int		rerr = 0;
+	int		i, error;
+
+	/* big aligned I/Os, but no bigger than direct I/O allows */
+	iosz = iosize ? iosize : RTCP_IOSIZE;
+	iosz = min(iosz, dioattr->d_maxiosz);
+	iosz = max(iosz - iosz % dioattr->d_miniosz, dioattr->d_miniosz);
+
+	for (i = 0; i < RTCP_NR_BUFS; i++) {
+		rp.bufs[i].data = memalign(dioattr->d_mem, iosz);
+		if (!rp.bufs[i].data) {
+			error = errno;
+			goto out_free;
+		}
+	}
+	pthread_mutex_init(&rp.lock, NULL);
+	pthread_cond_init(&rp.filled, NULL);
+	pthread_cond_init(&rp.drained, NULL);
+	error = pthread_create(&writer, NULL, rtcp_writer, &rp);
+	if (error)
+		goto out_lock;
+
+	/*
+	 * read the entire source file
+	 */
+	while (true) {
+		pthread_mutex_lock(&rp.lock);
+		while (rp.nr_filled == RTCP_NR_BUFS && !rp.error)
+			pthread_cond_wait(&rp.drained, &rp.lock);
+		if (rp.error) {
+			pthread_mutex_unlock(&rp.lock);
+			break;
+		}
+		b = &rp.bufs[rp.head];
+		pthread_mutex_unlock(&rp.lock);
+
+		readct = read(fromfd, b->data, iosz);
+		if (readct < 0)
+			rerr = errno;
+		if (readct <= 0)
+			break;
+
+		/*
+		 * if there is a short read, pad to a block boundary
+		 */
+		if (readct % dioattr->d_miniosz) {
+			ssize_t	padded = roundup(readct, dioattr->d_miniosz);
+
+			memset(b->data + readct, 0, padded - readct);
+			readct = padded;
+		}
+		b->len = readct;
+		b->pos = pos;
+		pos += readct;
+
+		pthread_mutex_lock(&rp.lock);
+		rp.head = (rp.head + 1) % RTCP_NR_BUFS;
+		rp.nr_filled++;
+		pthread_cond_signal(&rp.filled);
+		pthread_mutex_unlock(&rp.lock);
+	}
+
+	pthread_mutex_lock(&rp.lock);
+	rp.done = true;
+	pthread_cond_signal(&rp.filled);
+	pthread_mutex_unlock(&rp.lock);
+	pthread_join(writer, NULL);
+
+	if (rerr)
+		fprintf(stderr, _("%s: read error: %s\n"),
+			progname, strerror(rerr));
+	else if (rp.error)
+		fprintf(stderr, _("%s: write error: %s\n"),
+			progname, strerror(rp.error));
+	error = rerr ? rerr : rp.error;
+out_lock:
+	pthread_cond_destroy(&rp.drained);
+	pthread_cond_destroy(&rp.filled);
+	pthread_mutex_destroy(&rp.lock);
+out_free:
+	for (i = 0; i < RTCP_NR_BUFS; i++)
+		free(rp.bufs[i].data);
+	return error;
+}
+
 int
 rtcp( char *source, char *target, int fextsize)
 {
-	int		fromfd, tofd, readct, writect, iosz, reopen;
-	int		remove = 0, rtextsize;
-	char		*sp, *fbuf, *ptr;
+	int		fromfd, tofd, reopen;
+	int		remove = 0, rtextsize, textsize;
+	char		*sp, *ptr;
 	char		tbuf[ PATH_MAX ];
 	struct stat	s1, s2;
+	off_t		len;
 	struct fsxattr	fsxattr;
 	struct dioattr	dioattr;
 
@@ -175,11 +487,20 @@ rtcp( char *source, char *target, int fextsize)
 		/*
 		 * mark the file as a realtime file
 		 */
-		fsxattr.fsx_xflags = FS_XFLAG_REALTIME;
+		if ( xfsctl(tbuf, tofd, FS_IOC_FSGETXATTR, &fsxattr) ) {
+			fprintf(stderr,
+				_("%s: get attributes of %s failed: %s\n"),
+				progname, tbuf, strerror(errno));
+			close( tofd );
+			unlink( tbuf );
+			return( -1 );
+		}
+		fsxattr.fsx_xflags |= FS_XFLAG_REALTIME;
 		if (fextsize != -1 )
 			fsxattr.fsx_extsize = fextsize;
 		else
 			fsxattr.fsx_extsize = 0;
+		textsize = fsxattr.fsx_extsize;
 
 		if ( xfsctl(tbuf, tofd, FS_IOC_FSSETXATTR, &fsxattr) ) {
 			fprintf(stderr,
@@ -227,6 +548,7 @@ rtcp( char *source, char *target, int fextsize)
 			close( tofd );
 			return( -1 );
 		}
+		textsize = fsxattr.fsx_extsize;
 	}
 
 	/*
@@ -315,51 +637,25 @@ rtcp( char *source, char *target, int fextsize)
 		}
 	}
 
-	iosz =  dioattr.d_miniosz;
-	fbuf = memalign( dioattr.d_mem, iosz);
-	memset(fbuf, 0, iosz);
+	len = roundup(s1.st_size, dioattr.d_miniosz);
+	rtcp_prealloc(tofd, len, textsize ? textsize : rtextsize);
 
 	/*
-	 * read the entire source file
+	 * let the kernel do the copy if it can, or else copy it ourselves
 	 */
-	while ( ( readct = read( fromfd, fbuf, iosz) ) != 0 ) {
-		/*
-		 * if there is a read error - break
-		 */
-		if (readct < 0 ) {
-			break;
-		}
-
-		/*
-		 * if there is a short read, pad to a block boundary
-		 */
-		if ( readct != iosz ) {
-			if ( (readct % dioattr.d_miniosz)  != 0 )  {
-				readct = ( (readct/dioattr.d_miniosz) + 1 ) *
-					 dioattr.d_miniosz;
-			}
-		}
-
-		/*
-		 * write to target file
-		 */
-		writect = write( tofd, fbuf, readct);
-
-		if ( writect != readct ) {
-			fprintf(stderr, _("%s: write error: %s\n"),
-				progname, strerror(errno));
+	if (!cflag || fstat(tofd, &s2) || s1.st_dev != s2.st_dev ||
+	    rtcp_copy_range(fromfd, tofd, s1.st_size) ||
+	    (len != s1.st_size && ftruncate(tofd, len))) {
+		if (lseek(fromfd, 0, SEEK_SET) < 0 ||
+		    rtcp_copy_data(fromfd, tofd, &dioattr)) {
 			close(fromfd);
 			close(tofd);
-			free( fbuf );
 			return( -1 );
 		}
-
-		memset( fbuf, 0, iosz);
 	}
 
 	close(fromfd);
 	close(tofd);
-	free( fbuf );
 	return( 0 );
 }
 
@@ -766,10 +766,15 @@ _("Filesystem has errors, skipping connectivity checks."));
 		return 0;
 	}
 
-	ret = check_fs_label(ctx);
+	/* One skeleton cache per worker thread, plus one for this thread. */
+	ret = unicrash_init_phase(ctx, scrub_nproc(ctx) * 2 + 1);
 	if (ret)
 		return ret;
 
+	ret = check_fs_label(ctx);
+	if (ret)
+		goto out_unicrash;
+
 	pthread_mutex_init(&ncs.lock, NULL);
 
 	ret = scrub_scan_all_inodes(ctx, check_inode_names, &ncs);
@@ -791,6 +796,8 @@ out_lock:
 		bitmap_free(&ncs.new_deferred);
 	if (ncs.cur_deferred)
 		bitmap_free(&ncs.cur_deferred);
+out_unicrash:
+	unicrash_end_phase();
 	return ret;
 }
 
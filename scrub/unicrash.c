@@ -17,6 +17,7 @@
 #include <unicode/unorm2.h>
 #include <unicode/uspoof.h>
 #include "libfrog/paths.h"
+#include "libfrog/ptvar.h"
 #include "xfs_scrub.h"
 #include "common.h"
 #include "descr.h"
@@ -56,6 +57,15 @@
  * due to invisible control characters.
  *
  * In other words, skel = remove_invisible(nfd(remap_confusables(nfd(name)))).
+ *
+ * Nearly all the names we see are plain printable ASCII, for which NFKC
+ * normalization is the identity function and the skeleton is the
+ * concatenation of each character's skeleton.  We compute those per-character
+ * skeletons once when we load libicu so that ASCII names never have to go
+ * through the normalizer or the spoof checker.  Everything else is run
+ * through libicu, and the results are remembered in a small per-thread cache
+ * so that names which recur across directories (or xattr names, which recur
+ * across files) are only skeletonized once.
  */
 
 typedef uint16_t __bitwise	badname_t;
@@ -164,6 +174,90 @@ is_utf8_locale(void)
 	return answer;
 }
 
+/*
+ * Precomputed skeletons of the printable ASCII characters.  A character is
+ * only usable in the fast path if its skeleton is short and contains only
+ * starter code points, because that guarantees that the skeleton of an ASCII
+ * string is the concatenation of the skeletons of its characters.
+ */
+#define ASCII_FIRST		0x20
+#define ASCII_LAST		0x7E
+#define ASCII_SKEL_MAX		4
+
+struct ascii_skel {
+	UChar			skel[ASCII_SKEL_MAX];
+	uint8_t			len;
+	bool			ok;
+};
+
+static struct ascii_skel	ascii_skels[ASCII_LAST + 1];
+
+/* Per-thread cache of recently skeletonized non-ASCII names. */
+#define SKEL_CACHE_NR		256
+
+struct skel_cache_ent {
+	/* Raw name, or NULL if this slot is empty */
+	char			*name;
+
+	/* NFKC normalized name and skeleton */
+	UChar			*normstr;
+	UChar			*skelstr;
+	int32_t			normstrlen;
+	int32_t			skelstrlen;
+
+	xfs_dahash_t		hash;
+	badname_t		badflags;
+	uint16_t		namelen;
+
+	/* Was the name checked as a directory entry? */
+	bool			is_dirent;
+};
+
+struct skel_cache {
+	struct skel_cache_ent	ents[SKEL_CACHE_NR];
+};
+
+static struct ptvar		*skel_cache_ptvar;
+
+/* Adapt the dirhash function from libxfs, avoid linking with libxfs. */
+
+#define rol32(x, y)		(((x) << (y)) | ((x) >> (32 - (y))))
+
+/*
+ * Implement a simple hash on a character string.
+ * Rotate the hash value by 7 bits, then XOR each character in.
+ * This is implemented with some source-level loop unrolling.
+ */
+static xfs_dahash_t
+unicrash_dahash(
+	const uint8_t		*name,
+	size_t			namelen)
+{
+	xfs_dahash_t		hash;
+
+	/*
+	 * Do four characters at a time as long as we can.
+	 */
+	for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
+		hash = (name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7) ^
+		       (name[3] << 0) ^ rol32(hash, 7 * 4);
+
+	/*
+	 * Now do the rest of the characters.
+	 */
+	switch (namelen) {
+	case 3:
+		return (name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0) ^
+		       rol32(hash, 7 * 3);
+	case 2:
+		return (name[0] << 7) ^ (name[1] << 0) ^ rol32(hash, 7 * 2);
+	case 1:
+		return (name[0] << 0) ^ rol32(hash, 7 * 1);
+	default: /* case 0: */
+		return hash;
+	}
+}
+
 /*
  * Remove control/formatting characters from this string and return its new
  * length.  UChar32 is required for U16_NEXT, despite the name.
@@ -536,6 +630,205 @@ name_entry_examine(
 	return ret;
 }
 
+#define WORD_ONES		(~0UL / 0xFF)
+#define WORD_HIGHS		(WORD_ONES * 0x80)
+
+/*
+ * Decide if every byte of this name is a printable ASCII character.  We do
+ * this a word at a time: a word is rejected if any byte has the high bit set,
+ * is less than 0x20, or is 0x7F (DEL).
+ */
+static bool
+name_is_printable_ascii(
+	const char		*name,
+	size_t			namelen)
+{
+	const uint8_t		*p = (const uint8_t *)name;
+	unsigned long		w, del;
+
+	for (; namelen >= sizeof(w); namelen -= sizeof(w), p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		del = w ^ (WORD_ONES * (ASCII_LAST + 1));
+		if ((w & WORD_HIGHS) ||
+		    ((w - WORD_ONES * ASCII_FIRST) & ~w & WORD_HIGHS) ||
+		    ((del - WORD_ONES) & ~del & WORD_HIGHS))
+			return false;
+	}
+
+	for (; namelen > 0; namelen--, p++) {
+		if (*p < ASCII_FIRST || *p > ASCII_LAST)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Generate the normalized form and skeleton of a printable ASCII name without
+ * calling libicu.  Returns false if the name must go through the slow path.
+ *
+ * NFKC normalization does not change ASCII text, and the skeleton is built
+ * from the precomputed per-character skeletons.  Printable ASCII contains no
+ * invisible characters, control characters, right-to-left characters, or
+ * period lookalikes, so there are no bad flags to set.
+ */
+static bool
+name_entry_compute_ascii(
+	struct name_entry	*entry)
+{
+	const struct ascii_skel	*as;
+	UChar			*normstr;
+	UChar			*skelstr;
+	int32_t			skelstrlen = 0;
+	unsigned int		i;
+
+	if (!name_is_printable_ascii(entry->name, entry->namelen))
+		return false;
+
+	for (i = 0; i < entry->namelen; i++) {
+		as = &ascii_skels[(uint8_t)entry->name[i]];
+		if (!as->ok)
+			return false;
+		skelstrlen += as->len;
+	}
+
+	normstr = calloc(entry->namelen + 1, sizeof(UChar));
+	if (!normstr)
+		return false;
+	skelstr = calloc(skelstrlen + 1, sizeof(UChar));
+	if (!skelstr) {
+		free(normstr);
+		return false;
+	}
+
+	for (i = 0, skelstrlen = 0; i < entry->namelen; i++) {
+		as = &ascii_skels[(uint8_t)entry->name[i]];
+		normstr[i] = (uint8_t)entry->name[i];
+		memcpy(&skelstr[skelstrlen], as->skel, as->len * sizeof(UChar));
+		skelstrlen += as->len;
+	}
+
+	entry->normstr = normstr;
+	entry->normstrlen = entry->namelen;
+	entry->skelstr = skelstr;
+	entry->skelstrlen = skelstrlen;
+	return true;
+}
+
+/* Duplicate a NUL-terminated UChar string of the given length. */
+static UChar *
+ustrdup(
+	const UChar		*ustr,
+	int32_t			ustrlen)
+{
+	UChar			*p;
+
+	p = malloc((ustrlen + 1) * sizeof(UChar));
+	if (!p)
+		return NULL;
+	memcpy(p, ustr, (ustrlen + 1) * sizeof(UChar));
+	return p;
+}
+
+/* Find this thread's cache slot for a name hash, if we have a cache. */
+static struct skel_cache_ent *
+skel_cache_slot(
+	xfs_dahash_t		hash)
+{
+	struct skel_cache	*sc;
+	int			ret;
+
+	if (!skel_cache_ptvar)
+		return NULL;
+
+	sc = ptvar_get(skel_cache_ptvar, &ret);
+	if (ret)
+		return NULL;
+
+	return &sc->ents[hash % SKEL_CACHE_NR];
+}
+
+/* Empty a skeleton cache slot. */
+static void
+skel_cache_ent_free(
+	struct skel_cache_ent	*ce)
+{
+	free(ce->name);
+	free(ce->normstr);
+	free(ce->skelstr);
+	memset(ce, 0, sizeof(*ce));
+}
+
+/*
+ * Try to fill out the normalized form and skeleton of a name from this
+ * thread's cache.  Returns true if we found it.
+ */
+static bool
+name_entry_cache_lookup(
+	struct name_entry	*entry,
+	xfs_dahash_t		hash)
+{
+	struct skel_cache_ent	*ce = skel_cache_slot(hash);
+	UChar			*normstr;
+	UChar			*skelstr;
+
+	if (!ce || !ce->name || ce->hash != hash ||
+	    ce->namelen != entry->namelen ||
+	    ce->is_dirent != (entry->ino != 0) ||
+	    memcmp(ce->name, entry->name, entry->namelen))
+		return false;
+
+	normstr = ustrdup(ce->normstr, ce->normstrlen);
+	if (!normstr)
+		return false;
+	skelstr = ustrdup(ce->skelstr, ce->skelstrlen);
+	if (!skelstr) {
+		free(normstr);
+		return false;
+	}
+
+	entry->normstr = normstr;
+	entry->normstrlen = ce->normstrlen;
+	entry->skelstr = skelstr;
+	entry->skelstrlen = ce->skelstrlen;
+	entry->badflags |= ce->badflags;
+	return true;
+}
+
+/*
+ * Remember the normalized form and skeleton of a name in this thread's cache,
+ * evicting whatever was in the slot before.  This is advisory, so we don't
+ * care if it fails.
+ */
+static void
+name_entry_cache_store(
+	const struct name_entry	*entry,
+	xfs_dahash_t		hash)
+{
+	struct skel_cache_ent	*ce = skel_cache_slot(hash);
+
+	if (!ce)
+		return;
+
+	skel_cache_ent_free(ce);
+
+	ce->name = malloc(entry->namelen);
+	ce->normstr = ustrdup(entry->normstr, entry->normstrlen);
+	ce->skelstr = ustrdup(entry->skelstr, entry->skelstrlen);
+	if (!ce->name || !ce->normstr || !ce->skelstr) {
+		skel_cache_ent_free(ce);
+		return;
+	}
+
+	memcpy(ce->name, entry->name, entry->namelen);
+	ce->namelen = entry->namelen;
+	ce->normstrlen = entry->normstrlen;
+	ce->skelstrlen = entry->skelstrlen;
+	ce->hash = hash;
+	ce->badflags = entry->badflags;
+	ce->is_dirent = entry->ino != 0;
+}
+
 /* Create a new name entry, returns false if we could not succeed. */
 static bool
 name_entry_create(
@@ -546,6 +839,7 @@ name_entry_create(
 {
 	struct name_entry	*new_entry;
 	size_t			namelen = strlen(name);
+	xfs_dahash_t		hash;
 
 	/* should never happen */
 	if (namelen > UINT16_MAX) {
@@ -563,11 +857,22 @@ name_entry_create(
 	new_entry->name[namelen] = 0;
 	new_entry->namelen = namelen;
 
+	/* Plain ASCII names don't need libicu. */
+	if (name_entry_compute_ascii(new_entry))
+		goto done;
+
+	/* Have we seen this name recently? */
+	hash = unicrash_dahash((uint8_t *)new_entry->name, namelen);
+	if (name_entry_cache_lookup(new_entry, hash))
+		goto done;
+
 	/* Normalize/skeletonize name to find collisions. */
 	if (!name_entry_compute_checknames(uc, new_entry))
 		goto out;
 
 	new_entry->badflags |= name_entry_examine(new_entry);
+	name_entry_cache_store(new_entry, hash);
+done:
 	*entry = new_entry;
 	return true;
 
@@ -586,47 +891,13 @@ name_entry_free(
 	free(entry);
 }
 
-/* Adapt the dirhash function from libxfs, avoid linking with libxfs. */
-
-#define rol32(x, y)		(((x) << (y)) | ((x) >> (32 - (y))))
-
-/*
- * Implement a simple hash on a character string.
- * Rotate the hash value by 7 bits, then XOR each character in.
- * This is implemented with some source-level loop unrolling.
- */
-static xfs_dahash_t
+/* Hash the skeleton of a name entry. */
+static inline xfs_dahash_t
 name_entry_hash(
 	struct name_entry	*entry)
 {
-	uint8_t			*name;
-	size_t			namelen;
-	xfs_dahash_t		hash;
-
-	name = (uint8_t *)entry->skelstr;
-	namelen = entry->skelstrlen * sizeof(UChar);
-
-	/*
-	 * Do four characters at a time as long as we can.
-	 */
-	for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
-		hash = (name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7) ^
-		       (name[3] << 0) ^ rol32(hash, 7 * 4);
-
-	/*
-	 * Now do the rest of the characters.
-	 */
-	switch (namelen) {
-	case 3:
-		return (name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0) ^
-		       rol32(hash, 7 * 3);
-	case 2:
-		return (name[0] << 7) ^ (name[1] << 0) ^ rol32(hash, 7 * 2);
-	case 1:
-		return (name[0] << 0) ^ rol32(hash, 7 * 1);
-	default: /* case 0: */
-		return hash;
-	}
+	return unicrash_dahash((uint8_t *)entry->skelstr,
+			entry->skelstrlen * sizeof(UChar));
 }
 
 /* Initialize the collision detector. */
@@ -1048,6 +1319,105 @@ static inline void dump_uchar32(UChar32 c)
 	}
 }
 
+/*
+ * Compute the skeletons of the printable ASCII characters for the fast path.
+ * Characters whose skeletons we can't use are left marked as not ok.
+ */
+static void
+unicrash_load_ascii_skels(void)
+{
+	struct ascii_skel	*as;
+	USpoofChecker		*spoof;
+	UChar			uchr;
+	UChar			skel[ASCII_SKEL_MAX + 1];
+	int32_t			skellen;
+	int32_t			i;
+	unsigned int		c;
+	UErrorCode		uerr = U_ZERO_ERROR;
+
+	spoof = uspoof_open(&uerr);
+	if (U_FAILURE(uerr))
+		return;
+	uspoof_setChecks(spoof, USPOOF_ALL_CHECKS, &uerr);
+	if (U_FAILURE(uerr))
+		goto out_spoof;
+
+	for (c = ASCII_FIRST; c <= ASCII_LAST; c++) {
+		as = &ascii_skels[c];
+		uchr = c;
+		uerr = U_ZERO_ERROR;
+		skellen = uspoof_getSkeleton(spoof, 0, &uchr, 1, skel,
+				ASCII_SKEL_MAX, &uerr);
+		if (U_FAILURE(uerr) || skellen < 0 || skellen > ASCII_SKEL_MAX)
+			continue;
+		skel[skellen] = 0;
+		skellen = remove_ignorable(skel, skellen);
+
+		/*
+		 * Combining characters could reorder or compose across
+		 * character boundaries, so leave them to the slow path.
+		 */
+		for (i = 0; i < skellen; i++) {
+			if (U16_IS_SURROGATE(skel[i]) ||
+			    u_getCombiningClass(skel[i]) != 0)
+				break;
+		}
+		if (i < skellen)
+			continue;
+
+		memcpy(as->skel, skel, skellen * sizeof(UChar));
+		as->len = skellen;
+		as->ok = true;
+	}
+
+out_spoof:
+	uspoof_close(spoof);
+}
+
+/* Empty one thread's skeleton cache. */
+static int
+skel_cache_free(
+	struct ptvar		*ptv,
+	void			*data,
+	void			*foreach_arg)
+{
+	struct skel_cache	*sc = data;
+	unsigned int		i;
+
+	for (i = 0; i < SKEL_CACHE_NR; i++)
+		skel_cache_ent_free(&sc->ents[i]);
+	return 0;
+}
+
+/* Allocate the per-thread skeleton caches. */
+int
+unicrash_init_phase(
+	struct scrub_ctx	*ctx,
+	unsigned int		nr_threads)
+{
+	int			ret;
+
+	ASSERT(skel_cache_ptvar == NULL);
+	ret = -ptvar_alloc(nr_threads, sizeof(struct skel_cache), NULL,
+			&skel_cache_ptvar);
+	if (ret)
+		str_liberror(ctx, ret, _("creating unicode skeleton cache"));
+
+	return ret;
+}
+
+/* Free the per-thread skeleton caches. */
+void
+unicrash_end_phase(void)
+{
+	if (!skel_cache_ptvar)
+		return;
+
+	ptvar_foreach(skel_cache_ptvar, skel_cache_free, NULL);
+	ptvar_free(skel_cache_ptvar);
+	skel_cache_ptvar = NULL;
+}
+
 /* Load libicu and initialize it. */
 bool
 unicrash_load(void)
@@ -1060,6 +1430,8 @@ unicrash_load(void)
 	if (U_FAILURE(uerr))
 		return true;
 
+	unicrash_load_ascii_skels();
+
 	dbgstr = getenv("XFS_SCRUB_DUMP_CHAR");
 	if (dbgstr) {
 		uchr = strtol(dbgstr, NULL, 0);
@@ -27,6 +27,8 @@ int unicrash_check_fs_label(struct unicrash *uc, struct descr *dsc,
 		const char *label);
 bool unicrash_load(void);
 void unicrash_unload(void);
+int unicrash_init_phase(struct scrub_ctx *ctx, unsigned int nr_threads);
+void unicrash_end_phase(void);
 #else
 # define unicrash_dir_init(u, c, b)		(0)
 # define unicrash_xattr_init(u, c, b)		(0)
@@ -37,6 +39,8 @@ void unicrash_unload(void);
 # define unicrash_check_fs_label(u, d, n)	(0)
 # define unicrash_load()			(0)
 # define unicrash_unload()			do { } while (0)
+# define unicrash_init_phase(c, n)		(0)
+# define unicrash_end_phase()			do { } while (0)
 #endif /* HAVE_LIBICU */
 
 #endif /* XFS_SCRUB_UNICRASH_H_ */
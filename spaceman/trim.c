@@ -11,9 +11,483 @@
 #include "libfrog/paths.h"
 #include "space.h"
 #include "input.h"
+#include "libfrog/histogram.h"
+#include "libfrog/workqueue.h"
+#ifdef HAVE_GETFSMAP
+# include <linux/fsmap.h>
+#endif
 
 static cmdinfo_t trim_cmd;
 
+/*
+ * The trim scheduler splits each AG into bounded chunks so that no single
+ * FITRIM call holds an AG's free space btrees locked for long, trims up to
+ * a given number of AGs at once, and throttles the whole run to a target
+ * discard rate.  Given free space histograms from GETFSMAP it can also
+ * raise minlen per AG and skip AGs whose free space hasn't changed since
+ * the last run recorded in a state file.
+ */
+#define TRIM_STATE_MAGIC	"xfs_trim_state"
+#define TRIM_STATE_VERSION	2
+#define TRIM_MIN_EXTENTS	128
+#define TRIM_MAX_EXTENTS	65536
+
+struct trim_ag {
+	/* fingerprint of the AG's free space */
+	unsigned long long	freeblks;
+	unsigned long long	freeexts;
+	unsigned long long	hash;
+	bool			valid;
+
+	/* what we did to it */
+	unsigned long long	minlen;
+	unsigned long long	trimmed;
+	unsigned int		chunks;
+	bool			skipped;
+	bool			done;
+};
+
+struct trim_sched {
+	struct xfs_fd		*xfd;
+	struct trim_ag		*prev;		/* from the state file */
+	struct trim_ag		*ags;
+	unsigned long long	minlen;		/* bytes */
+	unsigned long long	chunklen;	/* bytes, 0 for a whole AG */
+	unsigned long long	rate;		/* bytes/sec, 0 for unlimited */
+	double			auto_pct;	/* 0 to use minlen as given */
+	bool			scan;
+
+	pthread_mutex_t		lock;
+	struct timespec		start;
+	unsigned long long	throttled;	/* bytes charged to the rate */
+	int			error;
+};
+
+static void
+trim_sched_error(
+	struct trim_sched	*ts,
+	xfs_agnumber_t		agno,
+	const char		*what,
+	int			error)
+{
+	fprintf(stderr, _("%s: AG %u: %s [\"%s\"]: %s\n"), progname, agno,
+			what, file->name, strerror(error));
+	pthread_mutex_lock(&ts->lock);
+	if (!ts->error)
+		ts->error = error;
+	pthread_mutex_unlock(&ts->lock);
+}
+
+/*
+ * Charge the bytes we just discarded to the rate limit, and sleep until the
+ * run as a whole is back under the target rate.
+ */
+static void
+trim_throttle(
+	struct trim_sched	*ts,
+	unsigned long long	bytes)
+{
+	struct timespec		now;
+	double			due, elapsed;
+
+	if (!ts->rate)
+		return;
+
+	pthread_mutex_lock(&ts->lock);
+	ts->throttled += bytes;
+	due = (double)ts->throttled / ts->rate;
+	pthread_mutex_unlock(&ts->lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - ts->start.tv_sec) +
+		  (now.tv_nsec - ts->start.tv_nsec) / 1e9;
+	if (due > elapsed)
+		usleep((due - elapsed) * 1000000);
+}
+
+#ifdef HAVE_GETFSMAP
+/*
+ * Work out how many GETFSMAP records to ask for at a time.  Without rmap,
+ * free extents alternate with used space, so twice the number of free
+ * extents covers the whole AG in one call.  We take that from the last
+ * run's fingerprint, or failing that bound it by the AG's free block count,
+ * and cap it to keep the memory used by each worker sane.
+ */
+static unsigned int
+trim_fsmap_count(
+	struct trim_sched	*ts,
+	xfs_agnumber_t		agno)
+{
+	struct xfs_ag_geometry	ageo;
+	unsigned long long	nr;
+
+	if (ts->prev && ts->prev[agno].valid)
+		nr = ts->prev[agno].freeexts;
+	else if (xfrog_ag_geometry(ts->xfd->fd, agno, &ageo) == 0)
+		nr = ageo.ag_freeblks;
+	else
+		return TRIM_MAX_EXTENTS;
+
+	nr = nr * 2 + 2;
+	return max(TRIM_MIN_EXTENTS, min(TRIM_MAX_EXTENTS, nr));
+}
+
+/*
+ * Build a histogram of the AG's free extents, and fingerprint them so that
+ * we can tell whether anything was allocated or freed since the last trim.
+ * If asked, pick the largest power of two minlen that still leaves auto_pct
+ * percent of the free blocks to be trimmed.
+ */
+static int
+trim_scan_ag(
+	struct trim_sched	*ts,
+	xfs_agnumber_t		agno,
+	struct trim_ag		*ta,
+	unsigned long long	*auto_minlen)
+{
+	struct histogram	hs;
+	struct fsmap_head	*fsmap;
+	struct fsmap		*extent;
+	struct fsmap		*l, *h;
+	struct fsmap		*p;
+	struct xfs_fd		*xfd = ts->xfd;
+	long long		cum = 0;
+	long long		i;
+	xfs_agblock_t		agbno;
+	off_t			aglen;
+	unsigned int		nr;
+	int			error = 0;
+
+	hist_init(&hs);
+	for (i = 1; i < xfd->fsgeom.agblocks; i *= 2) {
+		error = hist_add_bucket(&hs, i);
+		if (error)
+			goto out_hist;
+	}
+	hist_prepare(&hs, xfd->fsgeom.agblocks);
+
+	nr = trim_fsmap_count(ts, agno);
+	fsmap = calloc(1, fsmap_sizeof(nr));
+	if (!fsmap) {
+		error = ENOMEM;
+		goto out_hist;
+	}
+	fsmap->fmh_count = nr;
+	l = fsmap->fmh_keys;
+	h = fsmap->fmh_keys + 1;
+	l->fmr_physical = cvt_agbno_to_b(xfd, agno, 0);
+	h->fmr_physical = cvt_agbno_to_b(xfd, agno + 1, 0);
+	l->fmr_device = h->fmr_device = file->fs_path.fs_datadev;
+	h->fmr_owner = ULLONG_MAX;
+	h->fmr_flags = UINT_MAX;
+	h->fmr_offset = ULLONG_MAX;
+
+	ta->freeblks = ta->freeexts = 0;
+	ta->hash = 0;
+	while (true) {
+		if (ioctl(xfd->fd, FS_IOC_GETFSMAP, fsmap) < 0) {
+			error = errno;
+			goto out_fsmap;
+		}
+		if (!fsmap->fmh_entries)
+			break;
+
+		for (i = 0, extent = fsmap->fmh_recs;
+		     i < fsmap->fmh_entries;
+		     i++, extent++) {
+			if (!(extent->fmr_flags & FMR_OF_SPECIAL_OWNER) ||
+			    extent->fmr_owner != XFS_FMR_OWN_FREE)
+				continue;
+			agbno = cvt_b_to_agbno(xfd, extent->fmr_physical);
+			aglen = cvt_b_to_off_fsbt(xfd, extent->fmr_length);
+			ta->freeblks += aglen;
+			ta->freeexts++;
+			ta->hash = (ta->hash ^ agbno) * 0x100000001b3ULL;
+			ta->hash = (ta->hash ^ aglen) * 0x100000001b3ULL;
+			hist_add(&hs, aglen);
+		}
+
+		p = &fsmap->fmh_recs[fsmap->fmh_entries - 1];
+		if (p->fmr_flags & FMR_OF_LAST)
+			break;
+		fsmap_advance(fsmap);
+	}
+	ta->valid = true;
+
+	*auto_minlen = 0;
+	if (ts->auto_pct == 0 || hs.tot_sum == 0)
+		goto out_fsmap;
+	for (i = hs.nr_buckets - 1; i >= 0; i--) {
+		cum += hs.buckets[i].sum;
+		if (cum * 100.0 >= hs.tot_sum * ts->auto_pct) {
+			*auto_minlen = cvt_off_fsb_to_b(xfd,
+					hs.buckets[i].low);
+			break;
+		}
+	}
+out_fsmap:
+	free(fsmap);
+out_hist:
+	hist_free(&hs);
+	return error;
+}
+#else
+# define trim_scan_ag(ts, agno, ta, m)	(ENOTTY)
+#endif /* HAVE_GETFSMAP */
+
+/*
+ * An AG can be skipped if its free space hasn't changed since it was last
+ * trimmed, and that trim didn't leave behind extents this one would discard.
+ */
+static inline bool
+trim_ag_unchanged(
+	const struct trim_ag	*prev,
+	const struct trim_ag	*now,
+	unsigned long long	minlen)
+{
+	return prev->valid && now->valid &&
+	       prev->freeblks == now->freeblks &&
+	       prev->freeexts == now->freeexts &&
+	       prev->hash == now->hash &&
+	       prev->minlen <= minlen;
+}
+
+static void
+trim_ag_worker(
+	struct workqueue	*wq,
+	uint32_t		agno,
+	void			*arg)
+{
+	struct trim_sched	*ts = arg;
+	struct trim_ag		*ta = &ts->ags[agno];
+	struct xfs_fd		*xfd = ts->xfd;
+	struct fstrim_range	trim;
+	unsigned long long	auto_minlen = 0;
+	unsigned long long	pos, end;
+	unsigned long long	agblocks = xfd->fsgeom.agblocks;
+	int			error;
+
+	if (ts->scan) {
+		error = trim_scan_ag(ts, agno, ta, &auto_minlen);
+		if (error) {
+			trim_sched_error(ts, agno, "FS_IOC_GETFSMAP", error);
+			return;
+		}
+	}
+
+	ta->minlen = max(ts->minlen, auto_minlen);
+	if (ts->prev && trim_ag_unchanged(&ts->prev[agno], ta, ta->minlen)) {
+		/* remember what the AG was actually trimmed with */
+		ta->minlen = ts->prev[agno].minlen;
+		ta->skipped = true;
+		return;
+	}
+
+	/* The last AG can be short. */
+	if ((unsigned long long)agno * agblocks + agblocks >
+	    xfd->fsgeom.datablocks)
+		agblocks = xfd->fsgeom.datablocks - agno * agblocks;
+
+	pos = cvt_agbno_to_b(xfd, agno, 0);
+	end = pos + cvt_off_fsb_to_b(xfd, agblocks);
+	while (pos < end) {
+		trim.start = pos;
+		trim.len = end - pos;
+		if (ts->chunklen)
+			trim.len = min(trim.len, ts->chunklen);
+		trim.minlen = ta->minlen;
+		pos += trim.len;
+
+		if (ioctl(xfd->fd, FITRIM, (unsigned long)&trim) < 0) {
+			trim_sched_error(ts, agno, "ioctl(FITRIM)", errno);
+			return;
+		}
+		ta->trimmed += trim.len;
+		ta->chunks++;
+		trim_throttle(ts, trim.len);
+	}
+	ta->done = true;
+}
+
+/*
+ * The state file records the free space fingerprint of each AG that was
+ * trimmed and the minlen it was trimmed with, keyed to the geometry so that
+ * we don't trust it after a grow.
+ */
+static void
+trim_state_load(
+	struct trim_sched	*ts,
+	const char		*path)
+{
+	struct xfs_fsop_geom	*fsgeom = &ts->xfd->fsgeom;
+	struct trim_ag		*ta;
+	unsigned long long	agcount, agblocks, datablocks;
+	unsigned long long	freeblks, freeexts, hash, minlen;
+	unsigned int		version;
+	xfs_agnumber_t		agno;
+	FILE			*fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			perror(path);
+		return;
+	}
+
+	if (fscanf(fp, TRIM_STATE_MAGIC " %u %llu %llu %llu", &version,
+			&agcount, &agblocks, &datablocks) != 4 ||
+	    version != TRIM_STATE_VERSION || agcount != fsgeom->agcount ||
+	    agblocks != fsgeom->agblocks || datablocks != fsgeom->datablocks)
+		goto out;
+
+	ts->prev = calloc(fsgeom->agcount, sizeof(struct trim_ag));
+	if (!ts->prev)
+		goto out;
+	while (fscanf(fp, "%u %llu %llu %llx %llu", &agno, &freeblks,
+			&freeexts, &hash, &minlen) == 5) {
+		if (agno >= fsgeom->agcount)
+			continue;
+		ta = &ts->prev[agno];
+		ta->freeblks = freeblks;
+		ta->freeexts = freeexts;
+		ta->hash = hash;
+		ta->minlen = minlen;
+		ta->valid = true;
+	}
+out:
+	fclose(fp);
+}
+
+static int
+trim_state_save(
+	struct trim_sched	*ts,
+	const char		*path)
+{
+	struct xfs_fsop_geom	*fsgeom = &ts->xfd->fsgeom;
+	const struct trim_ag	*ta;
+	char			*tmp;
+	xfs_agnumber_t		agno;
+	FILE			*fp;
+	int			error = 0;
+
+	if (asprintf(&tmp, "%s.tmp", path) < 0)
+		return ENOMEM;
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		error = errno;
+		goto out;
+	}
+
+	fprintf(fp, TRIM_STATE_MAGIC " %u %u %u %llu\n", TRIM_STATE_VERSION,
+			fsgeom->agcount, fsgeom->agblocks,
+			(unsigned long long)fsgeom->datablocks);
+	for (agno = 0; agno < fsgeom->agcount; agno++) {
+		/* AGs that failed or weren't asked for keep their old state */
+		ta = &ts->ags[agno];
+		if (!ta->done && !ta->skipped)
+			ta = ts->prev ? &ts->prev[agno] : NULL;
+		if (!ta || !ta->valid)
+			continue;
+		fprintf(fp, "%u %llu %llu %llx %llu\n", agno, ta->freeblks,
+				ta->freeexts, ta->hash, ta->minlen);
+	}
+
+	if (fclose(fp)) {
+		error = errno;
+		unlink(tmp);
+		goto out;
+	}
+	if (rename(tmp, path)) {
+		error = errno;
+		unlink(tmp);
+	}
+out:
+	free(tmp);
+	return error;
+}
+
+static void
+trim_sched_report(
+	struct trim_sched	*ts,
+	xfs_agnumber_t		agno)
+{
+	const struct trim_ag	*ta = &ts->ags[agno];
+
+	if (ta->skipped)
+		printf(_("AG %u: free space unchanged, skipped\n"), agno);
+	else if (ta->done)
+		printf(
+_("AG %u: trimmed %llu bytes in %u chunks, minlen %llu\n"),
+				agno, ta->trimmed, ta->chunks, ta->minlen);
+}
+
+static int
+trim_sched_run(
+	struct trim_sched	*ts,
+	xfs_agnumber_t		agno,
+	bool			all_ags,
+	unsigned int		jobs,
+	const char		*statefile,
+	bool			verbose)
+{
+	struct workqueue	wq;
+	xfs_agnumber_t		agcount = ts->xfd->fsgeom.agcount;
+	xfs_agnumber_t		first = all_ags ? 0 : agno;
+	xfs_agnumber_t		last = all_ags ? agcount - 1 : agno;
+	int			error;
+
+	if (agno >= agcount) {
+		fprintf(stderr, _("%s: AG %u does not exist\n"), progname,
+				agno);
+		return EINVAL;
+	}
+
+	ts->ags = calloc(agcount, sizeof(struct trim_ag));
+	if (!ts->ags)
+		return ENOMEM;
+	pthread_mutex_init(&ts->lock, NULL);
+	if (statefile)
+		trim_state_load(ts, statefile);
+	clock_gettime(CLOCK_MONOTONIC, &ts->start);
+
+	error = -workqueue_create(&wq, NULL, min(jobs, last - first + 1));
+	if (error) {
+		errno = error;
+		perror("workqueue_create");
+		goto out;
+	}
+	for (agno = first; agno <= last; agno++) {
+		if (workqueue_add(&wq, trim_ag_worker, agno, ts))
+			trim_ag_worker(&wq, agno, ts);
+	}
+	error = -workqueue_terminate(&wq);
+	workqueue_destroy(&wq);
+	if (error) {
+		errno = error;
+		perror("workqueue_terminate");
+		goto out;
+	}
+
+	if (verbose) {
+		for (agno = first; agno <= last; agno++)
+			trim_sched_report(ts, agno);
+	}
+	if (statefile) {
+		error = trim_state_save(ts, statefile);
+		if (error)
+			fprintf(stderr, "%s: %s: %s\n", progname, statefile,
+					strerror(error));
+	}
+	if (!error)
+		error = ts->error;
+out:
+	pthread_mutex_destroy(&ts->lock);
+	free(ts->prev);
+	free(ts->ags);
+	return error;
+}
+
 /*
  * Trim unused space in xfs filesystem.
  */
@@ -25,16 +499,23 @@ trim_f(
 	struct fstrim_range	trim = {0};
 	struct xfs_fd		*xfd = &file->xfd;
 	struct xfs_fsop_geom	*fsgeom = &xfd->fsgeom;
+	struct trim_sched	ts = { .xfd = xfd };
 	xfs_agnumber_t		agno = 0;
 	off_t			offset = 0;
 	ssize_t			length = 0;
 	ssize_t			minlen = 0;
+	long long		val;
+	char			*statefile = NULL;
+	char			*p;
+	unsigned int		jobs = 1;
+	bool			sched = false;
+	bool			verbose = false;
 	int			aflag = 0;
 	int			fflag = 0;
 	int			ret;
 	int			c;
 
-	while ((c = getopt(argc, argv, "a:fm:")) != EOF) {
+	while ((c = getopt(argc, argv, "a:c:fj:m:M:r:s:v")) != EOF) {
 		switch (c) {
 		case 'a':
 			aflag = 1;
@@ -44,13 +525,56 @@ trim_f(
 				return command_usage(&trim_cmd);
 			}
 			break;
+		case 'c':
+			val = cvtnum(fsgeom->blocksize, fsgeom->sectsize,
+					optarg);
+			if (val <= 0) {
+				printf(_("bad chunk length %s\n"), optarg);
+				return command_usage(&trim_cmd);
+			}
+			ts.chunklen = val;
+			sched = true;
+			break;
 		case 'f':
 			fflag = 1;
 			break;
+		case 'j':
+			jobs = cvt_u32(optarg, 10);
+			if (errno || jobs == 0) {
+				printf(_("bad job count %s\n"), optarg);
+				return command_usage(&trim_cmd);
+			}
+			sched = true;
+			break;
 		case 'm':
 			minlen = cvtnum(fsgeom->blocksize, fsgeom->sectsize,
 					optarg);
 			break;
+		case 'M':
+			ts.auto_pct = strtod(optarg, &p);
+			if (*p || ts.auto_pct <= 0 || ts.auto_pct > 100) {
+				printf(_("bad percentage %s\n"), optarg);
+				return command_usage(&trim_cmd);
+			}
+			ts.scan = sched = true;
+			break;
+		case 'r':
+			val = cvtnum(fsgeom->blocksize, fsgeom->sectsize,
+					optarg);
+			if (val <= 0) {
+				printf(_("bad rate %s\n"), optarg);
+				return command_usage(&trim_cmd);
+			}
+			ts.rate = val;
+			sched = true;
+			break;
+		case 's':
+			statefile = optarg;
+			ts.scan = sched = true;
+			break;
+		case 'v':
+			verbose = sched = true;
+			break;
 		default:
 			return command_usage(&trim_cmd);
 		}
@@ -59,6 +583,23 @@ trim_f(
 	if (aflag && fflag)
 		return command_usage(&trim_cmd);
 
+	if (sched) {
+		if (!(aflag || fflag) || optind != argc)
+			return command_usage(&trim_cmd);
+#ifndef HAVE_GETFSMAP
+		if (ts.scan) {
+			fprintf(stderr,
+_("%s: -M and -s need GETFSMAP support.\n"), progname);
+			exitcode = 1;
+			return 0;
+		}
+#endif
+		ts.minlen = minlen < 0 ? 0 : minlen;
+		if (trim_sched_run(&ts, agno, fflag, jobs, statefile, verbose))
+			exitcode = 1;
+		return 0;
+	}
+
 	if (optind != argc - 2 && !(aflag || fflag))
 		return command_usage(&trim_cmd);
 	if (optind != argc) {
@@ -100,6 +641,16 @@ trim_help(void)
 " -m minlen     -- skip freespace extents smaller than minlen\n"
 "\n"
 "One of -a, -f, or the offset/length pair are required.\n"
+"\n"
+"With -a or -f, these options schedule the trim one AG at a time:\n"
+" -c chunk      -- trim at most chunk bytes of an AG per FITRIM call\n"
+" -j jobs       -- trim this many AGs at once\n"
+" -r rate       -- discard no more than rate bytes per second\n"
+" -M pct        -- raise minlen in each AG to the largest power of two\n"
+"                  that still trims pct percent of its free blocks\n"
+" -s statefile  -- skip AGs whose free space is the same as when the\n"
+"                  statefile was last written, then update it\n"
+" -v            -- report what was done to each AG\n"
 "\n"));
 
 }
@@ -111,8 +662,9 @@ trim_init(void)
 	trim_cmd.altname = "tr";
 	trim_cmd.cfunc = trim_f;
 	trim_cmd.argmin = 1;
-	trim_cmd.argmax = 4;
-	trim_cmd.args = "[-m minlen] ( -a agno | -f | offset length )";
+	trim_cmd.argmax = -1;
+	trim_cmd.args =
+"[-m minlen] ( -a agno | -f | offset length ) [-c chunk] [-j jobs] [-r rate] [-M pct] [-s statefile] [-v]";
 	trim_cmd.flags = CMD_FLAG_ONESHOT;
 	trim_cmd.oneline = _("Discard filesystem free space");
 	trim_cmd.help = trim_help;
@@ -0,0 +1,178 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+
+# Benchmark the metadata tools against a large synthetic filesystem.
+#
+# mkfs.xfs generates the filesystem straight into a sparse image (see the
+# synth= protofile option), then xfs_repair (dry run and for real), xfs_db
+# check, metadump and mdrestore are run against it in turn.  For each step
+# we report the wall time, the peak RSS and the I/O volume, and the
+# per-phase report from xfs_repair is printed at the end.  Run this from a
+# built tree; the tools are taken from there and not from $PATH:
+#
+#	make bench BENCH_OPTS="-c -s 4t inodes=10m"
+#
+# or run tools/metadata-bench.sh directly, with -b if it is not run from
+# the tree it lives in.  python3 is needed to measure each step.  The I/O
+# columns count what reached the storage layer, not page cache hits, so
+# use -c for cold cache numbers.
+
+usage() {
+	cat << ENDL
+Usage: $0 [-b topdir] [-c] [-d scratchdir] [-k] [-m mkfs_opts] [-s size] [synth_spec]
+
+-b topdir	Built xfsprogs tree to take the tools from.
+-c		Drop the page cache before each step (needs root).
+-d scratchdir	Where to put the images (default: \$TMPDIR or /tmp).
+-k		Keep the images and logs afterwards.
+-m mkfs_opts	Extra options for mkfs.xfs.
+-s size		Size of the sparse image (default: 1t).
+synth_spec	Shape of the filesystem (default: inodes=1m).
+ENDL
+	exit 1
+}
+
+topdir="$(dirname "$(readlink -f "$0")")/.."
+scratchdir="${TMPDIR:-/tmp}"
+size=1t
+spec="inodes=1m"
+drop_caches=0
+keep=0
+mkfs_opts=
+
+while getopts "b:cd:km:s:" c; do
+	case "$c" in
+	b)	topdir="$OPTARG";;
+	c)	drop_caches=1;;
+	d)	scratchdir="$OPTARG";;
+	k)	keep=1;;
+	m)	mkfs_opts="$OPTARG";;
+	s)	size="$OPTARG";;
+	*)	usage;;
+	esac
+done
+shift $((OPTIND - 1))
+test $# -gt 1 && usage
+test $# -eq 1 && spec="$1"
+
+MKFS="$topdir/mkfs/mkfs.xfs"
+REPAIR="$topdir/repair/xfs_repair"
+DB="$topdir/db/xfs_db"
+MDRESTORE="$topdir/mdrestore/xfs_mdrestore"
+
+for tool in "$MKFS" "$REPAIR" "$DB" "$MDRESTORE"; do
+	if [ ! -x "$tool" ]; then
+		echo "$tool: not found; build the tree first." 1>&2
+		exit 1
+	fi
+done
+
+work="$(mktemp -d "$scratchdir/metadata-bench.XXXXXX")" || exit 1
+image="$work/fs.img"
+dump="$work/fs.md"
+restored="$work/restored.img"
+results="$work/results"
+
+cleanup() {
+	if [ $keep -eq 1 ]; then
+		echo "Images and logs kept in $work"
+	else
+		rm -rf "$work"
+	fi
+}
+trap cleanup EXIT
+
+# Run a command with its stderr sent to stdout, and print its peak RSS in KiB,
+# the bytes it read from and wrote to the storage layer and its exit status
+# on stderr.  The child is
+# waited for with WNOWAIT so that /proc/<pid>/io can still be read from the
+# zombie (these totals include any children it reaped itself), and the peak
+# RSS comes from getrusage(RUSAGE_CHILDREN) once it has been reaped.
+run_step() {
+	python3 - "$@" << 'ENDPY'
+import os, resource, sys
+
+pid = os.fork()
+if pid == 0:
+	os.dup2(1, 2)
+	try:
+		os.execvp(sys.argv[1], sys.argv[1:])
+	except OSError as e:
+		print("%s: %s" % (sys.argv[1], e.strerror), file=sys.stderr)
+	os._exit(127)
+
+os.waitid(os.P_PID, pid, os.WEXITED | os.WNOWAIT)
+io = {}
+with open("/proc/%d/io" % pid) as f:
+	for line in f:
+		key, val = line.split(":")
+		io[key] = int(val)
+_, status = os.waitpid(pid, 0)
+ru = resource.getrusage(resource.RUSAGE_CHILDREN)
+print(ru.ru_maxrss, io["read_bytes"], io["write_bytes"],
+      os.waitstatus_to_exitcode(status), file=sys.stderr)
+ENDPY
+}
+
+# Run one step of the benchmark and record its wall time, peak RSS, device
+# I/O and exit status in $results.  The command's output goes to its log.
+measure() {
+	local name="$1" log="$work/$1.log" stats="$work/$1.stats"
+	local start end hwm rbytes wbytes status
+	shift
+
+	if [ $drop_caches -eq 1 ]; then
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+	fi
+
+	start=$(date +%s.%N)
+	run_step "$@" > "$log" 2> "$stats"
+	end=$(date +%s.%N)
+	read hwm rbytes wbytes status < "$stats"
+	if [ -z "$status" ]; then
+		echo "$name: could not measure $1" 1>&2
+		cat "$stats" 1>&2
+		return 1
+	fi
+
+	awk -v n="$name" -v s="$start" -v e="$end" -v h="$hwm" \
+	    -v r="$rbytes" -v w="$wbytes" -v rc="$status" \
+		'BEGIN { printf("%-16s %10.2f %10.1f %10.1f %10.1f %4d\n",
+			n, e - s, h / 1024, r / 1048576, w / 1048576, rc) }' \
+		>> "$results"
+	if [ $status -ne 0 ]; then
+		echo "$name failed with status $status:" 1>&2
+		tail -n 20 "$log" 1>&2
+	fi
+	return $status
+}
+
+truncate -s "$size" "$image" || exit 1
+
+echo "Generating a filesystem with synth=$spec in $image..."
+measure mkfs "$MKFS" -f -q -o stats $mkfs_opts -p "synth=$spec" "$image" || \
+	exit 1
+measure repair-n "$REPAIR" -f -n -o perf_report "$image"
+measure repair "$REPAIR" -f -o perf_report "$image"
+measure db-check "$DB" -r -c check "$image"
+measure metadump "$DB" -i -p xfs_metadump -c "metadump -a -o $dump" "$image"
+measure mdrestore "$MDRESTORE" "$dump" "$restored"
+measure repair-restored "$REPAIR" -f -n "$restored"
+
+echo
+"$DB" -r -c "sb 0" -c "print icount ifree fdblocks" "$image"
+echo
+printf "%-16s %10s %10s %10s %10s %4s\n" step "wall s" "peak MiB" \
+	"read MiB" "write MiB" rc
+cat "$results"
+
+echo
+echo "mkfs:"
+cat "$work/mkfs.log"
+
+for step in repair-n repair; do
+	echo
+	echo "$step:"
+	sed -n -e '/Performance Report/,$p' "$work/$step.log"
+done